@@ -18,6 +18,11 @@
 #include <regex.h>
 #include <string.h>
 #include <math.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // qualifier -> filename mapping entry
 typedef struct icc_mapping_entry_s
@@ -1882,6 +1887,638 @@ optionset_equal(int optset1,
 }
 
 
+//
+// Parsed PPD files are cached, as reading a large Foomatic PPD line by
+// line and checking every FoomaticRIP* value against the system hashes
+// is repeated for every job. The cache holds the key/name/text/value
+// entries in the order the parser found them, with continuation lines
+// joined and quotes removed. It is only used when the PPD file and the
+// hash directories are unchanged, so the entries are known to pass the
+// hash checks and are replayed through process_ppd_entry() without
+// hashing them again.
+//
+
+#define PPD_CACHE_MAGIC		"FRIPPPD"
+#define PPD_CACHE_VERSION	1
+
+typedef struct ppd_cache_header_s	// Header of a PPD cache file
+{
+  char		magic[8];		// PPD_CACHE_MAGIC
+  unsigned	version;		// PPD_CACHE_VERSION
+  unsigned	header_size;		// Size of this header
+  long long	ppd_size;		// Size of the PPD file
+  long long	ppd_mtime;		// Modification time of the PPD file
+  long long	ppd_ino;		// Inode of the PPD file
+  char		ppd_hash[65];		// Hash of the PPD file contents
+  char		hashes_state[65];	// Fingerprint of the system hashes
+  char		ppd_path[2048];		// Path of the PPD file
+  unsigned	num_entries;		// Number of entries
+  long long	data_size;		// Size of the entries
+  char		data_hash[65];		// Hash of the entries
+} ppd_cache_header_t;
+
+typedef struct ppd_parser_s		// State of read_ppd_file()
+{
+  cups_array_t	*known_hashes;		// Allowed hashes, NULL if the values
+					// were already checked
+  option_t	*current_opt;		// Option of the current OpenUI
+  char		*icc_qual2,		// cupsICCQualifier2 value
+		*icc_qual3;		// cupsICCQualifier3 value
+  dstr_t	*entries;		// Entries for the cache or NULL
+  unsigned	num_entries;		// Number of entries
+} ppd_parser_t;
+
+
+//
+// 'process_ppd_entry()' - Process a key/value pair of the PPD file.
+//
+
+static void
+process_ppd_entry(ppd_parser_t *parser,	// I - Parser state
+		  char         *key,	// I - Main keyword
+		  char         *name,	// I - Option keyword
+		  char         *text,	// I - Translation string
+		  dstr_t       *value)	// I - Value
+{
+  char *p;
+  double order;
+  value_t *val;
+  option_t *opt;
+  param_t *param;
+  icc_mapping_entry_t *entry;
+
+
+  if (strcmp(key, "NickName") == 0)
+  {
+    unhtmlify(printer_model, 256, value->data);
+  }
+  else if (strcmp(key, "FoomaticIDs") == 0)
+  {
+    // *FoomaticIDs: <printer ID> <driver ID>
+    sscanf(value->data, "%*[ \t]%127[^ \t]%*[ \t]%127[^ \t\n]",
+	   printer_id, driver);
+  }
+  else if (strcmp(key, "FoomaticRIPPostPipe") == 0)
+  {
+    if (!postpipe)
+      postpipe = create_dstr();
+    dstrassure(postpipe, value->len +128);
+    unhtmlify(postpipe->data, postpipe->alloc, value->data);
+  }
+  else if (strcmp(key, "FoomaticRIPCommandLine") == 0)
+  {
+    if (parser->known_hashes &&
+	!is_allowed_value(parser->known_hashes, value->data,
+			  strlen(value->data)))
+    {
+      cupsArrayDelete(parser->known_hashes);
+      rip_die(EXIT_PRNERR_NOTALLOWED, "ERROR: The value of the key %s is not among the allowed values - see foomatic-rip man page for more instructions.\n", key);
+    }
+
+    unhtmlify(cmd, 4096, value->data);
+  }
+  else if (strcmp(key, "FoomaticRIPCommandLinePDF") == 0)
+  {
+    if (parser->known_hashes &&
+	!is_allowed_value(parser->known_hashes, value->data,
+			  strlen(value->data)))
+    {
+      cupsArrayDelete(parser->known_hashes);
+      rip_die(EXIT_PRNERR_NOTALLOWED, "ERROR: The value of the key %s is not among the allowed values - see foomatic-rip man page for more instructions.\n", key);
+    }
+
+    unhtmlify(cmd_pdf, 4096, value->data);
+  }
+  else if (!strcmp(key, "cupsFilter"))
+  {
+    // cupsFilter: <code>
+    // only save the filter for "application/vnd.cups-raster"
+    if (prefixcmp(value->data, "application/vnd.cups-raster") == 0)
+    {
+      p = strrchr(value->data, ' ');
+      if (p)
+	unhtmlify(cupsfilter, 256, p +1);
+    }
+  }
+  else if (startswith(key, "Custom") && !strcasecmp(name, "true"))
+  {
+    // Cups custom option: *CustomFoo True: "command"
+    if (startswith(&key[6], "JCL"))
+    {
+      opt = assure_option(&key[9]);
+      opt->style = 'J';
+    }
+    else
+      opt = assure_option(&key[6]);
+    option_set_custom_command(opt, value->data);
+    if (!strcmp(key, "CustomPageSize"))
+      option_set_custom_command(assure_option("PageRegion"), value->data);
+  }
+  else if (startswith(key, "ParamCustom"))
+  {
+    // Cups custom parameter:
+    // *ParamCustomFoo Name/Text: order type minimum maximum
+    if (startswith(&key[11], "JCL"))
+      opt = assure_option(&key[14]);
+    else
+      opt = assure_option(&key[11]);
+    option_add_custom_param_from_string(opt, name, text, value->data);
+  }
+  else if (!strcmp(key, "OpenUI") || !strcmp(key, "JCLOpenUI"))
+  {
+    // "*[JCL]OpenUI *<option>[/<translation>]: <type>"
+    parser->current_opt = assure_option(&name[1]);
+    if (!isempty(text))
+      strlcpy(parser->current_opt->text, text, 128);
+    if (startswith(key, "JCL"))
+      parser->current_opt->style = 'J';
+    // Set the argument type only if not defined yet,
+    // a definition in "*FoomaticRIPOption" has priority
+    if (parser->current_opt->type == TYPE_NONE)
+      parser->current_opt->type = type_from_string(value->data);
+  }
+  else if (!strcmp(key, "CloseUI") || !strcmp(key, "JCLCloseUI"))
+  {
+    // *[JCL]CloseUI: *<option>
+    if (!parser->current_opt ||
+	!option_has_name(parser->current_opt, value->data +1))
+      _log("CloseUI found without corresponding OpenUI (%s).\n",
+	   value->data +1);
+    parser->current_opt = NULL;
+  }
+  else if (!strcmp(key, "FoomaticRIPOption"))
+  {
+    // "*FoomaticRIPOption <option>: <type> <style> <spot> [<order>]"
+    // <order> only used for 1-choice enum options
+    option_set_from_string(assure_option(name), value->data);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionPrototype"))
+  {
+    // "*FoomaticRIPOptionPrototype <option>: <code>"
+    // Used for numerical and string options only
+    opt = assure_option(name);
+    opt->proto = malloc(65536);
+    unhtmlify(opt->proto, 65536, value->data);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionRange"))
+  {
+    // *FoomaticRIPOptionRange <option>: <min> <max>
+    // Used for numerical options only
+    param = option_assure_foomatic_param(assure_option(name));
+    sscanf(value->data, "%19s %19s", param->min, param->max);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionMaxLength"))
+  {
+    // "*FoomaticRIPOptionMaxLength <option>: <length>"
+    // Used for string options only
+    param = option_assure_foomatic_param(assure_option(name));
+    sscanf(value->data, "%19s", param->max);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionAllowedChars"))
+  {
+    // *FoomaticRIPOptionAllowedChars <option>: <code>
+    // Used for string options only
+    param = option_assure_foomatic_param(assure_option(name));
+    param_set_allowed_chars(param, value->data);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionAllowedRegExp"))
+  {
+    // "*FoomaticRIPOptionAllowedRegExp <option>: <code>"
+    // Used for string options only
+    param = option_assure_foomatic_param(assure_option(name));
+    param_set_allowed_regexp(param, value->data);
+  }
+  else if (!strcmp(key, "OrderDependency"))
+  {
+    // OrderDependency: <order> <section> *<option>
+    // use 'text' to read <section>
+    sscanf(value->data, "%lf %63s *%63s", &order, text, name);
+    opt = assure_option(name);
+    opt->section = section_from_string(text);
+    option_set_order(opt, order);
+  }
+
+  // Default options are not yet validated (not all options/choices
+  // have been read yet)
+  else if (!prefixcmp(key, "Default"))
+  {
+    // Default<option>: <value>
+    opt = assure_option(&key[7]);
+    val = option_assure_value(opt, optionset("default"));
+    free(val->value);
+    val->value = strdup(value->data);
+  }
+  else if (!prefixcmp(key, "FoomaticRIPDefault"))
+  {
+    // FoomaticRIPDefault<option>: <value>
+    // Used for numerical options only
+    opt = assure_option(&key[18]);
+    val = option_assure_value(opt, optionset("default"));
+    free(val->value);
+    val->value = strdup(value->data);
+  }
+
+  // Current argument
+  else if (parser->current_opt && !strcmp(key, parser->current_opt->name))
+  {
+    // *<option> <choice>[/translation]: <code>
+    option_set_choice(parser->current_opt, name, text, value->data);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionSetting"))
+  {
+    if (parser->known_hashes &&
+	!is_allowed_value(parser->known_hashes, value->data,
+			  strlen(value->data)))
+    {
+      cupsArrayDelete(parser->known_hashes);
+      rip_die(EXIT_PRNERR_NOTALLOWED, "ERROR: The value of the key %s is not among the allowed values - see foomatic-rip man page for more instructions.\n", key);
+    }
+
+    // "*FoomaticRIPOptionSetting <option>[=<choice>]: <code>
+    // For boolean options <choice> is not given
+    option_set_choice(assure_option(name),
+		      isempty(text) ? "true" : text, NULL, value->data);
+  }
+
+  // "*(Foomatic|)JCL(Begin|ToPSInterpreter|End|Prefix): <code>"
+  // The printer supports PJL/JCL when there is such a line
+  else if (!prefixcmp(key, "JCLBegin") ||
+	   !prefixcmp(key, "FoomaticJCLBegin"))
+  {
+    unhexify(jclbegin, 256, value->data);
+    if (!jclprefixset && strstr(jclbegin, "PJL") == NULL)
+      jclprefix[0] = '\0';
+  }
+  else if (!prefixcmp(key, "JCLToPSInterpreter") ||
+	   !prefixcmp(key, "FoomaticJCLToPSInterpreter"))
+  {
+    unhexify(jcltointerpreter, 256, value->data);
+  }
+  else if (!prefixcmp(key, "JCLEnd") ||
+	   !prefixcmp(key, "FoomaticJCLEnd"))
+  {
+    unhexify(jclend, 256, value->data);
+  }
+  else if (!prefixcmp(key, "JCLPrefix") ||
+	   !prefixcmp(key, "FoomaticJCLPrefix"))
+  {
+    unhexify(jclprefix, 256, value->data);
+    jclprefixset = 1;
+  }
+  else if (!prefixcmp(key, "% COMDATA #"))
+  {
+    // old foomtic 2.0.x PPD file
+    _log("You are using an old Foomatic 2.0 PPD file, which is no "
+	 "longer supported by Foomatic >4.0. Exiting.\n");
+    exit(1); // TODO exit more gracefully
+  }
+  else if (!strcmp(key, "FoomaticRIPJobEntityMaxLength"))
+  {
+    //  "*FoomaticRIPJobEntityMaxLength: <length>"
+    sscanf(value->data, "%d", &jobentitymaxlen);
+  }
+  else if (!strcmp(key, "FoomaticRIPUserEntityMaxLength"))
+  {
+    //  "*FoomaticRIPUserEntityMaxLength: <length>"
+    sscanf(value->data, "%d", &userentitymaxlen);
+  }
+  else if (!strcmp(key, "FoomaticRIPHostEntityMaxLength"))
+  {
+    //  "*FoomaticRIPHostEntityMaxLength: <length>"
+    sscanf(value->data, "%d", &hostentitymaxlen);
+  }
+  else if (!strcmp(key, "FoomaticRIPTitleEntityMaxLength"))
+  {
+    //  "*FoomaticRIPTitleEntityMaxLength: <length>"
+    sscanf(value->data, "%d", &titleentitymaxlen);
+  }
+  else if (!strcmp(key, "FoomaticRIPOptionsEntityMaxLength"))
+  {
+    //  "*FoomaticRIPOptionsEntityMaxLength: <length>"
+    sscanf(value->data, "%d", &optionsentitymaxlen);
+  }
+  else if (!strcmp(key, "cupsICCProfile"))
+  {
+    //  "*cupsICCProfile: <qualifier/Title> <filename>"
+    entry = calloc(1, sizeof(icc_mapping_entry_t));
+    entry->qualifier = strdup(name);
+    entry->filename = strdup(value->data);
+    list_append (qualifier_data, entry);
+  }
+  else if (!strcmp(key, "cupsICCQualifier2"))
+  {
+    //  "*cupsICCQualifier2: <value>"
+    parser->icc_qual2 = strdup(value->data);
+  }
+  else if (!strcmp(key, "cupsICCQualifier3"))
+  {
+    //  "*cupsICCQualifier3: <value>"
+    parser->icc_qual3 = strdup(value->data);
+  }
+}
+
+
+//
+// 'ppd_cache_key()' - Fill in the header identifying a PPD file.
+//
+
+static int				// O - 0 on success, -1 on error
+ppd_cache_key(const char         *filename,
+					// I - PPD file
+	      ppd_cache_header_t *header)
+					// O - Header to compare with
+{
+  int		fd;			// PPD file descriptor
+  struct stat	fileinfo;		// PPD file information
+  void		*data;			// PPD file contents
+  int		ret;			// Return value
+
+
+  memset(header, 0, sizeof(ppd_cache_header_t));
+  memcpy(header->magic, PPD_CACHE_MAGIC, sizeof(header->magic));
+  header->version = PPD_CACHE_VERSION;
+  header->header_size = sizeof(ppd_cache_header_t);
+
+  if (strlcpy(header->ppd_path, filename, sizeof(header->ppd_path)) >=
+      sizeof(header->ppd_path))
+    return (-1);
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (-1);
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode) ||
+      fileinfo.st_size == 0 ||
+      (data = mmap(NULL, fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd,
+		   0)) == MAP_FAILED)
+  {
+    close(fd);
+    return (-1);
+  }
+
+  header->ppd_size = fileinfo.st_size;
+  header->ppd_mtime = fileinfo.st_mtime;
+  header->ppd_ino = fileinfo.st_ino;
+
+  ret = hash_data(data, fileinfo.st_size, header->ppd_hash,
+		  sizeof(header->ppd_hash));
+
+  munmap(data, fileinfo.st_size);
+  close(fd);
+
+  if (ret || get_system_hashes_state(header->hashes_state,
+				     sizeof(header->hashes_state)))
+    return (-1);
+
+  return (0);
+}
+
+
+//
+// 'ppd_cache_file()' - Get the name of the cache file for a PPD file.
+//
+
+static int				// O - 0 on success, -1 on error
+ppd_cache_file(const char *filename,	// I - PPD file
+	       char       *cachefile,	// O - Cache file
+	       size_t     cachefile_len)
+					// I - Size of cache file buffer
+{
+  const char	*dir;			// Cache directory
+  char		hash[65];		// Hash of the PPD file name
+
+
+  if ((dir = getenv("CUPS_CACHEDIR")) == NULL || access(dir, W_OK))
+    dir = temp_dir();
+
+  if (hash_data((unsigned char *)filename, strlen(filename), hash,
+		sizeof(hash)))
+    return (-1);
+
+  if (snprintf(cachefile, cachefile_len, "%s/foomatic-rip-%.16s.ppdcache",
+	       dir, hash) >= (int)cachefile_len)
+    return (-1);
+
+  return (0);
+}
+
+
+//
+// 'ppd_cache_add()' - Add an entry to the PPD cache data.
+//
+
+static void
+ppd_cache_add(ppd_parser_t *parser,
+	      const char   *key,
+	      const char   *name,
+	      const char   *text,
+	      const char   *value)
+{
+  const char	*strings[4];		// Strings of the entry
+  unsigned	lengths[4];		// Lengths of the strings
+  int		i;
+
+
+  strings[0] = key;
+  strings[1] = name;
+  strings[2] = text;
+  strings[3] = value;
+
+  for (i = 0; i < 4; i ++)
+    lengths[i] = strlen(strings[i]);
+
+  dstrcatbin(parser->entries, (const char *)lengths, sizeof(lengths));
+  for (i = 0; i < 4; i ++)
+    dstrcatbin(parser->entries, strings[i], lengths[i] + 1);
+
+  parser->num_entries ++;
+}
+
+
+//
+// 'ppd_cache_check()' - Check the entries of a PPD cache file.
+//
+
+static int				// O - 1 if valid, 0 otherwise
+ppd_cache_check(const char *data,	// I - Entries
+		size_t     len,		// I - Size of entries
+		unsigned   num_entries)	// I - Number of entries
+{
+  static const size_t	maxlen[4] = { 128, 64, 64, (size_t)-1 };
+					// Buffer sizes of the parser
+  unsigned	lengths[4];		// Lengths of the strings
+  size_t	pos = 0;		// Position in the entries
+  unsigned	n;
+  int		i;
+
+
+  for (n = 0; n < num_entries; n ++)
+  {
+    if (len - pos < sizeof(lengths))
+      return (0);
+    memcpy(lengths, data + pos, sizeof(lengths));
+    pos += sizeof(lengths);
+
+    for (i = 0; i < 4; i ++)
+    {
+      if (lengths[i] >= maxlen[i] || lengths[i] >= len - pos ||
+	  data[pos + lengths[i]] != '\0')
+	return (0);
+      pos += lengths[i] + 1;
+    }
+  }
+
+  return (pos == len);
+}
+
+
+//
+// 'ppd_cache_load()' - Replay the entries of a PPD cache file.
+//
+
+static int				// O - 1 if loaded, 0 otherwise
+ppd_cache_load(const char               *cachefile,
+					// I - Cache file
+	       const ppd_cache_header_t *expected,
+					// I - Expected header
+	       ppd_parser_t             *parser,
+					// I - Parser state
+	       dstr_t                   *value)
+					// I - Value buffer
+{
+  int			fd;		// Cache file descriptor
+  struct stat		fileinfo;	// Cache file information
+  const char		*data;		// Cache file contents
+  ppd_cache_header_t	header;		// Header of the cache file
+  char			hash[65];	// Hash of the entries
+  char			key_str[128],	// Entry key
+			name[64],	// Entry name
+			text[64];	// Entry text
+  unsigned		lengths[4];	// Lengths of the strings
+  size_t		pos;		// Position in the entries
+  unsigned		n;
+
+
+  //
+  // Only use cache files which nobody else could have written, the
+  // entries in there are not checked against the system hashes again...
+  //
+
+  if ((fd = open(cachefile, O_RDONLY | O_NOFOLLOW)) < 0)
+    return (0);
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode) ||
+      fileinfo.st_uid != geteuid() ||
+      (fileinfo.st_mode & (S_IWGRP | S_IWOTH)) ||
+      fileinfo.st_size < sizeof(header) ||
+      (data = mmap(NULL, fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd,
+		   0)) == MAP_FAILED)
+  {
+    close(fd);
+    return (0);
+  }
+
+  close(fd);
+
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(&header, expected, offsetof(ppd_cache_header_t, num_entries)) ||
+      header.data_size != fileinfo.st_size - (long long)sizeof(header) ||
+      hash_data((unsigned char *)data + sizeof(header), header.data_size,
+		hash, sizeof(hash)) ||
+      strcmp(hash, header.data_hash) ||
+      !ppd_cache_check(data + sizeof(header), header.data_size,
+		       header.num_entries))
+  {
+    _log("Cache file %s is outdated, parsing PPD file...\n", cachefile);
+    munmap((void *)data, fileinfo.st_size);
+    return (0);
+  }
+
+  _log("Using parsed PPD data from %s\n", cachefile);
+
+  for (n = 0, pos = sizeof(header); n < header.num_entries; n ++)
+  {
+    memcpy(lengths, data + pos, sizeof(lengths));
+    pos += sizeof(lengths);
+
+    memcpy(key_str, data + pos, lengths[0] + 1);
+    pos += lengths[0] + 1;
+    memcpy(name, data + pos, lengths[1] + 1);
+    pos += lengths[1] + 1;
+    memcpy(text, data + pos, lengths[2] + 1);
+    pos += lengths[2] + 1;
+    dstrcpybin(value, data + pos, lengths[3]);
+    pos += lengths[3] + 1;
+
+    process_ppd_entry(parser, key_str, name, text, value);
+  }
+
+  munmap((void *)data, fileinfo.st_size);
+
+  return (1);
+}
+
+
+//
+// 'ppd_cache_save()' - Write the entries of a parsed PPD file to a cache file.
+//
+
+static void
+ppd_cache_save(const char         *cachefile,
+					// I - Cache file
+	       ppd_cache_header_t *header,
+					// I - Header identifying the PPD
+	       ppd_parser_t       *parser)
+					// I - Parser state with the entries
+{
+  char		tmpfile[PATH_MAX];	// Temporary cache file
+  int		fd;			// Temporary file descriptor
+  FILE		*fp;			// Temporary file
+
+
+  header->num_entries = parser->num_entries;
+  header->data_size = parser->entries->len;
+  if (hash_data((unsigned char *)parser->entries->data,
+		parser->entries->len, header->data_hash,
+		sizeof(header->data_hash)))
+    return;
+
+  //
+  // Write to a temporary file and rename it, so that concurrent jobs
+  // never see a partially written cache file...
+  //
+
+  if (snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX", cachefile) >=
+      (int)sizeof(tmpfile) ||
+      (fd = mkstemp(tmpfile)) < 0)
+    return;
+
+  if ((fp = fdopen(fd, "w")) == NULL)
+  {
+    close(fd);
+    unlink(tmpfile);
+    return;
+  }
+
+  if (fwrite(header, sizeof(ppd_cache_header_t), 1, fp) != 1 ||
+      fwrite(parser->entries->data, 1, parser->entries->len, fp) !=
+      parser->entries->len)
+  {
+    fclose(fp);
+    fp = NULL;
+  }
+
+  if (!fp || fclose(fp) || rename(tmpfile, cachefile))
+  {
+    _log("Unable to write PPD cache file %s\n", cachefile);
+    unlink(tmpfile);
+    return;
+  }
+
+  _log("Stored parsed PPD data in %s\n", cachefile);
+}
+
+
 //
 // read_ppd_file()
 //
@@ -1891,34 +2528,43 @@ read_ppd_file(const char *filename)
 {
   FILE *fh;
   const char *tmp;
-  char *icc_qual2 = NULL;
-  char *icc_qual3 = NULL;
   char line [256];            // PPD line length is max 255 (excl. \0)
   char *p;
   char key[128], name[64], text[64];
   dstr_t *value = create_dstr(); // value can span multiple lines
-  double order;
   value_t *val;
-  option_t *opt, *current_opt = NULL;
-  param_t *param;
-  icc_mapping_entry_t *entry;
-  cups_array_t *known_hashes = NULL;
+  option_t *opt;
+  ppd_parser_t parser;
+  ppd_cache_header_t cachekey;
+  char cachefile[PATH_MAX];
+  int usecache, cached;
 
   fh = fopen(filename, "r");
   if (!fh)
     rip_die(EXIT_PRNERR_NORETRY_BAD_SETTINGS, "Unable to open PPD file %s\n", filename);
   _log("Parsing PPD file ...\n");
 
-  if (load_system_hashes(&known_hashes))
+  memset(&parser, 0, sizeof(parser));
+  dstrassure(value, 256);
+  qualifier_data = list_create();
+
+  usecache = !ppd_cache_key(filename, &cachekey) &&
+	     !ppd_cache_file(filename, cachefile, sizeof(cachefile));
+
+  cached = usecache && ppd_cache_load(cachefile, &cachekey, &parser, value);
+  if (!cached)
   {
-    fclose(fh);
-    rip_die(EXIT_PRNERR_NORETRY, "Not enough memory for array allocation\n.");
-  }
+    if (load_system_hashes(&parser.known_hashes))
+    {
+      fclose(fh);
+      rip_die(EXIT_PRNERR_NORETRY, "Not enough memory for array allocation\n.");
+    }
 
-  dstrassure(value, 256);
+    if (usecache)
+      parser.entries = create_dstr();
+  }
 
-  qualifier_data = list_create();
-  while (!feof(fh))
+  while (!cached && !feof(fh))
   {
     tmp = fgets(line, 256, fh);
 
@@ -1978,278 +2624,21 @@ read_ppd_file(const char *filename)
     // remove last whitespace
     dstrtrim_right(value);
 
-    // process key/value pairs
-    if (strcmp(key, "NickName") == 0)
-    {
-      unhtmlify(printer_model, 256, value->data);
-    }
-    else if (strcmp(key, "FoomaticIDs") == 0)
-    {
-      // *FoomaticIDs: <printer ID> <driver ID>
-      sscanf(value->data, "%*[ \t]%127[^ \t]%*[ \t]%127[^ \t\n]",
-	     printer_id, driver);
-    }
-    else if (strcmp(key, "FoomaticRIPPostPipe") == 0)
-    {
-      if (!postpipe)
-	postpipe = create_dstr();
-      dstrassure(postpipe, value->len +128);
-      unhtmlify(postpipe->data, postpipe->alloc, value->data);
-    }
-    else if (strcmp(key, "FoomaticRIPCommandLine") == 0)
-    {
-      if (!is_allowed_value(known_hashes, value->data, strlen(value->data)))
-      {
-        cupsArrayDelete(known_hashes);
-        fclose(fh);
-
-        rip_die(EXIT_PRNERR_NOTALLOWED, "ERROR: The value of the key %s is not among the allowed values - see foomatic-rip man page for more instructions.\n", key);
-      }
-
-      unhtmlify(cmd, 4096, value->data);
-    }
-    else if (strcmp(key, "FoomaticRIPCommandLinePDF") == 0)
-    {
-      if (!is_allowed_value(known_hashes, value->data, strlen(value->data)))
-      {
-        cupsArrayDelete(known_hashes);
-        fclose(fh);
-
-        rip_die(EXIT_PRNERR_NOTALLOWED, "ERROR: The value of the key %s is not among the allowed values - see foomatic-rip man page for more instructions.\n", key);
-      }
-
-      unhtmlify(cmd_pdf, 4096, value->data);
-    }
-    else if (!strcmp(key, "cupsFilter"))
-    {
-      // cupsFilter: <code>
-      // only save the filter for "application/vnd.cups-raster"
-      if (prefixcmp(value->data, "application/vnd.cups-raster") == 0)
-      {
-	p = strrchr(value->data, ' ');
-	if (p)
-	  unhtmlify(cupsfilter, 256, p +1);
-      }
-    }
-    else if (startswith(key, "Custom") && !strcasecmp(name, "true"))
-    {
-      // Cups custom option: *CustomFoo True: "command"
-      if (startswith(&key[6], "JCL"))
-      {
-	opt = assure_option(&key[9]);
-	opt->style = 'J';
-      }
-      else
-	opt = assure_option(&key[6]);
-      option_set_custom_command(opt, value->data);
-      if (!strcmp(key, "CustomPageSize"))
-	option_set_custom_command(assure_option("PageRegion"), value->data);
-    }
-    else if (startswith(key, "ParamCustom"))
-    {
-      // Cups custom parameter:
-      // *ParamCustomFoo Name/Text: order type minimum maximum
-      if (startswith(&key[11], "JCL"))
-	opt = assure_option(&key[14]);
-      else
-	opt = assure_option(&key[11]);
-      option_add_custom_param_from_string(opt, name, text, value->data);
-    }
-    else if (!strcmp(key, "OpenUI") || !strcmp(key, "JCLOpenUI"))
-    {
-      // "*[JCL]OpenUI *<option>[/<translation>]: <type>"
-      current_opt = assure_option(&name[1]);
-      if (!isempty(text))
-	strlcpy(current_opt->text, text, 128);
-      if (startswith(key, "JCL"))
-	current_opt->style = 'J';
-      // Set the argument type only if not defined yet,
-      // a definition in "*FoomaticRIPOption" has priority
-      if (current_opt->type == TYPE_NONE)
-	current_opt->type = type_from_string(value->data);
-    }
-    else if (!strcmp(key, "CloseUI") || !strcmp(key, "JCLCloseUI"))
-    {
-      // *[JCL]CloseUI: *<option>
-      if (!current_opt || !option_has_name(current_opt, value->data +1))
-	_log("CloseUI found without corresponding OpenUI (%s).\n",
-	     value->data +1);
-      current_opt = NULL;
-    }
-    else if (!strcmp(key, "FoomaticRIPOption"))
-    {
-      // "*FoomaticRIPOption <option>: <type> <style> <spot> [<order>]"
-      // <order> only used for 1-choice enum options
-      option_set_from_string(assure_option(name), value->data);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionPrototype"))
-    {
-      // "*FoomaticRIPOptionPrototype <option>: <code>"
-      // Used for numerical and string options only
-      opt = assure_option(name);
-      opt->proto = malloc(65536);
-      unhtmlify(opt->proto, 65536, value->data);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionRange"))
-    {
-      // *FoomaticRIPOptionRange <option>: <min> <max>
-      // Used for numerical options only
-      param = option_assure_foomatic_param(assure_option(name));
-      sscanf(value->data, "%19s %19s", param->min, param->max);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionMaxLength"))
-    {
-      // "*FoomaticRIPOptionMaxLength <option>: <length>"
-      // Used for string options only
-      param = option_assure_foomatic_param(assure_option(name));
-      sscanf(value->data, "%19s", param->max);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionAllowedChars"))
-    {
-      // *FoomaticRIPOptionAllowedChars <option>: <code>
-      // Used for string options only
-      param = option_assure_foomatic_param(assure_option(name));
-      param_set_allowed_chars(param, value->data);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionAllowedRegExp"))
-    {
-      // "*FoomaticRIPOptionAllowedRegExp <option>: <code>"
-      // Used for string options only
-      param = option_assure_foomatic_param(assure_option(name));
-      param_set_allowed_regexp(param, value->data);
-    }
-    else if (!strcmp(key, "OrderDependency"))
-    {
-      // OrderDependency: <order> <section> *<option>
-      // use 'text' to read <section>
-      sscanf(value->data, "%lf %63s *%63s", &order, text, name);
-      opt = assure_option(name);
-      opt->section = section_from_string(text);
-      option_set_order(opt, order);
-    }
-
-    // Default options are not yet validated (not all options/choices
-    // have been read yet)
-    else if (!prefixcmp(key, "Default"))
-    {
-      // Default<option>: <value>
-      opt = assure_option(&key[7]);
-      val = option_assure_value(opt, optionset("default"));
-      free(val->value);
-      val->value = strdup(value->data);
-    }
-    else if (!prefixcmp(key, "FoomaticRIPDefault"))
-    {
-      // FoomaticRIPDefault<option>: <value>
-      // Used for numerical options only
-      opt = assure_option(&key[18]);
-      val = option_assure_value(opt, optionset("default"));
-      free(val->value);
-      val->value = strdup(value->data);
-    }
-
-    // Current argument
-    else if (current_opt && !strcmp(key, current_opt->name))
-    {
-      // *<option> <choice>[/translation]: <code>
-      option_set_choice(current_opt, name, text, value->data);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionSetting"))
-    {
-      if (!is_allowed_value(known_hashes, value->data, strlen(value->data)))
-      {
-        cupsArrayDelete(known_hashes);
-        fclose(fh);
-
-        rip_die(EXIT_PRNERR_NOTALLOWED, "ERROR: The value of the key %s is not among the allowed values - see foomatic-rip man page for more instructions.\n", key);
-      }
-
-      // "*FoomaticRIPOptionSetting <option>[=<choice>]: <code>
-      // For boolean options <choice> is not given
-      option_set_choice(assure_option(name),
-			isempty(text) ? "true" : text, NULL, value->data);
-    }
-
-    // "*(Foomatic|)JCL(Begin|ToPSInterpreter|End|Prefix): <code>"
-    // The printer supports PJL/JCL when there is such a line
-    else if (!prefixcmp(key, "JCLBegin") ||
-	     !prefixcmp(key, "FoomaticJCLBegin"))
-    {
-      unhexify(jclbegin, 256, value->data);
-      if (!jclprefixset && strstr(jclbegin, "PJL") == NULL)
-	jclprefix[0] = '\0';
-    }
-    else if (!prefixcmp(key, "JCLToPSInterpreter") ||
-	     !prefixcmp(key, "FoomaticJCLToPSInterpreter"))
-    {
-      unhexify(jcltointerpreter, 256, value->data);
-    }
-    else if (!prefixcmp(key, "JCLEnd") ||
-	     !prefixcmp(key, "FoomaticJCLEnd"))
-    {
-      unhexify(jclend, 256, value->data);
-    }
-    else if (!prefixcmp(key, "JCLPrefix") ||
-	     !prefixcmp(key, "FoomaticJCLPrefix"))
-    {
-      unhexify(jclprefix, 256, value->data);
-      jclprefixset = 1;
-    }
-    else if (!prefixcmp(key, "% COMDATA #"))
-    {
-      // old foomtic 2.0.x PPD file
-      _log("You are using an old Foomatic 2.0 PPD file, which is no "
-	   "longer supported by Foomatic >4.0. Exiting.\n");
-      exit(1); // TODO exit more gracefully
-    }
-    else if (!strcmp(key, "FoomaticRIPJobEntityMaxLength"))
-    {
-      //  "*FoomaticRIPJobEntityMaxLength: <length>"
-      sscanf(value->data, "%d", &jobentitymaxlen);
-    }
-    else if (!strcmp(key, "FoomaticRIPUserEntityMaxLength"))
-    {
-      //  "*FoomaticRIPUserEntityMaxLength: <length>"
-      sscanf(value->data, "%d", &userentitymaxlen);
-    }
-    else if (!strcmp(key, "FoomaticRIPHostEntityMaxLength"))
-    {
-      //  "*FoomaticRIPHostEntityMaxLength: <length>"
-      sscanf(value->data, "%d", &hostentitymaxlen);
-    }
-    else if (!strcmp(key, "FoomaticRIPTitleEntityMaxLength"))
-    {
-      //  "*FoomaticRIPTitleEntityMaxLength: <length>"
-      sscanf(value->data, "%d", &titleentitymaxlen);
-    }
-    else if (!strcmp(key, "FoomaticRIPOptionsEntityMaxLength"))
-    {
-      //  "*FoomaticRIPOptionsEntityMaxLength: <length>"
-      sscanf(value->data, "%d", &optionsentitymaxlen);
-    }
-    else if (!strcmp(key, "cupsICCProfile"))
-    {
-      //  "*cupsICCProfile: <qualifier/Title> <filename>"
-      entry = calloc(1, sizeof(icc_mapping_entry_t));
-      entry->qualifier = strdup(name);
-      entry->filename = strdup(value->data);
-      list_append (qualifier_data, entry);
-    }
-    else if (!strcmp(key, "cupsICCQualifier2"))
-    {
-      //  "*cupsICCQualifier2: <value>"
-      icc_qual2 = strdup(value->data);
-    }
-    else if (!strcmp(key, "cupsICCQualifier3"))
-    {
-      //  "*cupsICCQualifier3: <value>"
-      icc_qual3 = strdup(value->data);
-    }
+    if (parser.entries)
+      ppd_cache_add(&parser, key, name, text, value->data);
+    process_ppd_entry(&parser, key, name, text, value);
   }
 
   fclose(fh);
   free_dstr(value);
 
+  if (parser.entries)
+  {
+    ppd_cache_save(cachefile, &cachekey, &parser);
+    free_dstr(parser.entries);
+  }
+  cupsArrayDelete(parser.known_hashes);
+
   // Validate default options by resetting them with option_set_value()
   for (opt = optionlist; opt; opt = opt->next)
   {
@@ -2278,23 +2667,23 @@ read_ppd_file(const char *filename)
   qualifier[0] = strdup(tmp);
 
   // get selector2
-  if (icc_qual2 == NULL)
-    icc_qual2 = strdup("MediaType");
-  tmp = option_get_value(find_option(icc_qual2), optionset("default"));
+  if (parser.icc_qual2 == NULL)
+    parser.icc_qual2 = strdup("MediaType");
+  tmp = option_get_value(find_option(parser.icc_qual2), optionset("default"));
   if (tmp == NULL)
     tmp = "";
   qualifier[1] = strdup(tmp);
 
   // get selectors
-  if (icc_qual3 == NULL)
-    icc_qual3 = strdup("Resolution");
-  tmp = option_get_value(find_option(icc_qual3), optionset("default"));
+  if (parser.icc_qual3 == NULL)
+    parser.icc_qual3 = strdup("Resolution");
+  tmp = option_get_value(find_option(parser.icc_qual3), optionset("default"));
   if (tmp == NULL)
     tmp = "";
   qualifier[2] = strdup(tmp);
 
-  free (icc_qual2);
-  free (icc_qual3);
+  free (parser.icc_qual2);
+  free (parser.icc_qual3);
 }
 
 
@@ -18,9 +18,15 @@
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
 
 #define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
 
@@ -28,6 +34,1374 @@
 static int wait_for_renderer();
 
 
+//
+// Native page counter and page extraction
+//
+// Finding the page count only needs the trailer, the cross-reference
+// sections and the /Count of the root of the page tree, so it is read
+// right out of the file instead of starting Ghostscript for it.  Classic
+// xref tables, xref streams and objects in object streams are
+// understood; anything else, or a damaged file, makes the counter give up
+// and Ghostscript is asked as before.
+//
+// A range of pages is cut out in the same way: the file is copied as it
+// is and an incremental update replaces the page tree with one listing
+// only the wanted pages.  Attributes the pages inherit from the nodes of
+// the old tree are copied into the pages themselves.
+//
+
+#define PDF_MAX_SECTIONS 256		// Maximum xref sections followed
+#define PDF_MAX_STREAM (64 * 1024 * 1024)
+					// Maximum decoded stream size
+#define PDF_MAX_DEPTH 16		// Maximum nesting of lookups
+
+typedef struct pdf_xref_s		// Cross-reference section
+{
+  size_t offset;			// Offset of xref table, if any
+  unsigned char *data;			// Decoded xref stream, if any
+  size_t length;			// Length of decoded stream
+  int w[3];				// Field widths of stream entries
+  long long *index;			// Object ranges of stream entries
+  int num_index;			// Number of index entries
+} pdf_xref_t;
+
+typedef struct pdf_page_s		// Page of the document
+{
+  long long num, gen;			// Object number and generation
+  dstr_t *dict;				// Page dictionary without /Parent
+} pdf_page_t;
+
+typedef struct pdf_file_s		// PDF file being read
+{
+  const unsigned char *data;		// File contents
+  size_t size;				// Size of file
+  pdf_xref_t sections[PDF_MAX_SECTIONS];// Cross-reference sections
+  int num_sections;			// Number of sections
+  long long objects;			// Number of objects (trailer /Size)
+  long long root, root_gen;		// Document catalog
+  const unsigned char *trailer;		// Newest trailer dictionary
+  int encrypted;			// Is the file encrypted?
+  long long objstm;			// Object stream in cache or -1
+  unsigned char *objstm_data;		// Decoded object stream
+  size_t objstm_length;			// Length of object stream
+  long long tree, tree_gen;		// Root of the page tree
+  pdf_page_t *pages;			// Pages, if loaded
+  int num_pages;			// Number of pages
+  long long nodes;			// Page tree nodes visited
+} pdf_file_t;
+
+
+//
+// Skip white space and comments.
+//
+
+static const unsigned char *
+pdf_skip_space(const unsigned char *p,
+	       const unsigned char *end)
+{
+  while (p < end)
+  {
+    if (*p == '%')
+    {
+      while (p < end && *p != '\r' && *p != '\n')
+	p ++;
+    }
+    else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' ||
+	     *p == '\f' || *p == '\0')
+      p ++;
+    else
+      break;
+  }
+
+  return (p);
+}
+
+
+//
+// Is this a delimiter or white space character?
+//
+
+static int
+pdf_is_delim(int c)
+{
+  return (strchr("()<>[]{}/% \t\r\n\f", c) != NULL || c == '\0');
+}
+
+
+//
+// Read a non-negative integer.
+//
+
+static const unsigned char *
+pdf_get_int(const unsigned char *p,
+	    const unsigned char *end,
+	    long long *value)
+{
+  p = pdf_skip_space(p, end);
+
+  if (p >= end || !isdigit(*p))
+    return (NULL);
+
+  for (*value = 0; p < end && isdigit(*p); p ++)
+  {
+    if (*value > LLONG_MAX / 10 - 10)
+      return (NULL);
+    *value = *value * 10 + *p - '0';
+  }
+
+  return (p);
+}
+
+
+//
+// Check for a keyword.
+//
+
+static const unsigned char *
+pdf_get_keyword(const unsigned char *p,
+		const unsigned char *end,
+		const char *keyword)
+{
+  size_t len = strlen(keyword);
+
+  p = pdf_skip_space(p, end);
+
+  if ((size_t)(end - p) < len || memcmp(p, keyword, len) ||
+      (p + len < end && !pdf_is_delim(p[len])))
+    return (NULL);
+
+  return (p + len);
+}
+
+
+//
+// Read an indirect reference ("num gen R"), "gen" may be NULL.
+//
+
+static const unsigned char *
+pdf_get_ref(const unsigned char *p,
+	    const unsigned char *end,
+	    long long *num,
+	    long long *gen)
+{
+  long long temp;
+
+  if ((p = pdf_get_int(p, end, num)) == NULL ||
+      (p = pdf_get_int(p, end, gen ? gen : &temp)) == NULL)
+    return (NULL);
+
+  return (pdf_get_keyword(p, end, "R"));
+}
+
+
+//
+// Skip one object, including the "num gen R" of a reference.
+//
+
+static const unsigned char *
+pdf_skip_object(const unsigned char *p,
+		const unsigned char *end)
+{
+  int depth = 0;
+  int parens;
+  const unsigned char *next;
+  long long num;
+
+  do
+  {
+    if ((p = pdf_skip_space(p, end)) >= end)
+      return (NULL);
+
+    if (*p == '(')
+    {
+      for (p ++, parens = 1; p < end && parens > 0; p ++)
+      {
+	if (*p == '\\')
+	  p ++;
+	else if (*p == '(')
+	  parens ++;
+	else if (*p == ')')
+	  parens --;
+      }
+    }
+    else if (*p == '<' && p + 1 < end && p[1] == '<')
+    {
+      depth ++;
+      p += 2;
+    }
+    else if (*p == '>' && p + 1 < end && p[1] == '>')
+    {
+      depth --;
+      p += 2;
+    }
+    else if (*p == '<')
+    {
+      while (p < end && *p != '>')
+	p ++;
+      p ++;
+    }
+    else if (*p == '[')
+    {
+      depth ++;
+      p ++;
+    }
+    else if (*p == ']')
+    {
+      depth --;
+      p ++;
+    }
+    else if (*p == '/')
+    {
+      for (p ++; p < end && !pdf_is_delim(*p); p ++);
+    }
+    else if (isdigit(*p) &&
+	     (next = pdf_get_ref(p, end, &num, NULL)) != NULL)
+      p = next;
+    else if (pdf_is_delim(*p))
+      return (NULL);
+    else
+    {
+      while (p < end && !pdf_is_delim(*p))
+	p ++;
+    }
+
+    if (depth < 0 || p > end)
+      return (NULL);
+  }
+  while (depth > 0);
+
+  return (p);
+}
+
+
+//
+// Find the value of a key in a dictionary.
+//
+
+static const unsigned char *
+pdf_dict_get(const unsigned char *p,
+	     const unsigned char *end,
+	     const char *key)
+{
+  size_t len = strlen(key);
+
+  p = pdf_skip_space(p, end);
+
+  if (end - p < 2 || p[0] != '<' || p[1] != '<')
+    return (NULL);
+
+  for (p += 2;;)
+  {
+    if ((p = pdf_skip_space(p, end)) >= end)
+      return (NULL);
+
+    if (*p != '/')
+      return (NULL);
+
+    p ++;
+
+    if ((size_t)(end - p) >= len && !memcmp(p, key, len) &&
+	(p + len == end || pdf_is_delim(p[len])))
+      return (p + len);
+
+    for (; p < end && !pdf_is_delim(*p); p ++);
+
+    if ((p = pdf_skip_object(p, end)) == NULL)
+      return (NULL);
+  }
+}
+
+
+//
+// Decode a Flate-compressed stream, undoing PNG predictors.
+//
+
+static unsigned char *
+pdf_inflate(const unsigned char *src,
+	    size_t srclen,
+	    const unsigned char *parms,
+	    const unsigned char *end,
+	    size_t *length)
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  z_stream z;
+  unsigned char *data = NULL, *temp, *row, *prev;
+  size_t alloc = 0;
+  long long predictor = 1, colors = 1, bpc = 8, columns = 1;
+  const unsigned char *value;
+  size_t rowlen, bpp, in, out, i;
+  int status = Z_MEM_ERROR, a, b, c, pa, pb, pc, pred;
+
+  *length = 0;
+
+  if (parms)
+  {
+    if ((value = pdf_dict_get(parms, end, "Predictor")) != NULL)
+      pdf_get_int(value, end, &predictor);
+    if ((value = pdf_dict_get(parms, end, "Colors")) != NULL)
+      pdf_get_int(value, end, &colors);
+    if ((value = pdf_dict_get(parms, end, "BitsPerComponent")) != NULL)
+      pdf_get_int(value, end, &bpc);
+    if ((value = pdf_dict_get(parms, end, "Columns")) != NULL)
+      pdf_get_int(value, end, &columns);
+  }
+
+  if ((predictor != 1 && predictor < 10) || colors < 1 || colors > 32 ||
+      bpc < 1 || bpc > 16 || columns < 1 || columns > 65536)
+    return (NULL);
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit(&z) != Z_OK)
+    return (NULL);
+
+  z.next_in  = (Bytef *)src;
+  z.avail_in = (uInt)srclen;
+
+  do
+  {
+    if (*length == alloc)
+    {
+      if (alloc >= PDF_MAX_STREAM ||
+	  (temp = realloc(data, alloc + 65536)) == NULL)
+	break;
+      data  = temp;
+      alloc += 65536;
+    }
+
+    z.next_out  = data + *length;
+    z.avail_out = (uInt)(alloc - *length);
+
+    status = inflate(&z, Z_NO_FLUSH);
+
+    *length = alloc - z.avail_out;
+  }
+  while (status == Z_OK);
+
+  inflateEnd(&z);
+
+  if (status != Z_STREAM_END && (status != Z_BUF_ERROR || !*length))
+  {
+    free(data);
+    return (NULL);
+  }
+
+  if (predictor == 1)
+    return (data);
+
+  //
+  // Undo the PNG predictor of each row in place; the filter byte in front
+  // of each row is dropped...
+  //
+
+  rowlen = (size_t)((columns * colors * bpc + 7) / 8);
+  bpp    = (size_t)((colors * bpc + 7) / 8);
+  prev   = NULL;
+
+  for (in = 0, out = 0; in + 1 + rowlen <= *length;
+       in += 1 + rowlen, out += rowlen)
+  {
+    pred = data[in];
+    row  = data + out;
+
+    memmove(row, data + in + 1, rowlen);
+
+    for (i = 0; i < rowlen; i ++)
+    {
+      a = i >= bpp ? row[i - bpp] : 0;
+      b = prev ? prev[i] : 0;
+      c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+
+      switch (pred)
+      {
+	case 0 :
+	    break;
+	case 1 :
+	    row[i] += a;
+	    break;
+	case 2 :
+	    row[i] += b;
+	    break;
+	case 3 :
+	    row[i] += (a + b) / 2;
+	    break;
+	case 4 :
+	    pa = abs(b - c);
+	    pb = abs(a - c);
+	    pc = abs(a + b - 2 * c);
+	    row[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+	    break;
+	default :
+	    free(data);
+	    return (NULL);
+      }
+    }
+
+    prev = row;
+  }
+
+  *length = out;
+
+  return (data);
+
+#else
+  (void)src;
+  (void)srclen;
+  (void)parms;
+  (void)end;
+  (void)length;
+
+  return (NULL);
+#endif // HAVE_ZLIB_H && HAVE_LIBZ
+}
+
+
+static int pdf_find_entry(pdf_file_t *pdf, long long num, long long *field2,
+			  long long *field3);
+static const unsigned char *pdf_find_object(pdf_file_t *pdf, long long num,
+					    const unsigned char **end,
+					    int depth);
+
+
+//
+// Get an integer that may be given as an indirect reference.
+//
+
+static int
+pdf_get_number(pdf_file_t *pdf,
+	       const unsigned char *p,
+	       const unsigned char *end,
+	       long long *value,
+	       int depth)
+{
+  long long num;
+
+  if (pdf_get_ref(p, end, &num, NULL))
+  {
+    if ((p = pdf_find_object(pdf, num, &end, depth + 1)) == NULL)
+      return (0);
+  }
+
+  return (pdf_get_int(p, end, value) != NULL);
+}
+
+
+//
+// Read and decode the stream following a stream dictionary.
+//
+
+static unsigned char *
+pdf_read_stream(pdf_file_t *pdf,
+		const unsigned char *dict,
+		const unsigned char *end,
+		size_t *length,
+		int depth)
+{
+  const unsigned char *p, *value, *parms;
+  long long len;
+
+  //
+  // Only Flate-compressed streams are used for xref and object streams;
+  // a single filter may also be given as an array...
+  //
+
+  if ((value = pdf_dict_get(dict, end, "Filter")) == NULL)
+    return (NULL);
+
+  value = pdf_skip_space(value, end);
+  if (value < end && *value == '[')
+    value ++;
+
+  if (!pdf_get_keyword(value, end, "/FlateDecode"))
+    return (NULL);
+
+  if ((parms = pdf_dict_get(dict, end, "DecodeParms")) != NULL)
+  {
+    parms = pdf_skip_space(parms, end);
+    if (parms < end && *parms == '[')
+      parms ++;
+    if (pdf_get_keyword(parms, end, "null"))
+      parms = NULL;
+  }
+
+  if ((value = pdf_dict_get(dict, end, "Length")) == NULL ||
+      !pdf_get_number(pdf, value, end, &len, depth))
+    return (NULL);
+
+  if ((p = pdf_skip_object(dict, end)) == NULL ||
+      (p = pdf_get_keyword(p, end, "stream")) == NULL)
+    return (NULL);
+
+  if (p < end && *p == '\r')
+    p ++;
+  if (p < end && *p == '\n')
+    p ++;
+
+  if (len < 0 || len > end - p)
+    return (NULL);
+
+  return (pdf_inflate(p, (size_t)len, parms, end, length));
+}
+
+
+//
+// Read the cross-reference section at an offset and those before it.
+//
+
+static int
+pdf_read_xref(pdf_file_t *pdf,
+	      long long offset)
+{
+  const unsigned char *p, *end = pdf->data + pdf->size, *value, *dict;
+  pdf_xref_t *xref;
+  long long num, gen, prev = -1, stm = -1, first, count, size, *index;
+  int i, width;
+  size_t remaining;
+
+  if (offset < 0 || (size_t)offset >= pdf->size ||
+      pdf->num_sections >= PDF_MAX_SECTIONS)
+    return (0);
+
+  for (i = 0; i < pdf->num_sections; i ++)
+    if (pdf->sections[i].offset == (size_t)offset)
+      return (1);
+
+  xref = pdf->sections + pdf->num_sections ++;
+  xref->offset = (size_t)offset;
+  p = pdf->data + offset;
+
+  if ((p = pdf_get_keyword(p, end, "xref")) != NULL)
+  {
+    //
+    // Classic xref table; skip the subsections to get to the trailer...
+    //
+
+    while ((value = pdf_get_int(p, end, &first)) != NULL)
+    {
+      if ((value = pdf_get_int(value, end, &count)) == NULL)
+	return (0);
+
+      p = pdf_skip_space(value, end);
+      if (first < 0 || count < 0 || first > LLONG_MAX - count ||
+	  count > (end - p) / 20)
+	return (0);
+      p += count * 20;
+    }
+
+    if ((dict = pdf_get_keyword(p, end, "trailer")) == NULL)
+      return (0);
+  }
+  else
+  {
+    //
+    // Cross-reference stream...
+    //
+
+    p = pdf->data + offset;
+
+    if ((p = pdf_get_int(p, end, &num)) == NULL ||
+	(p = pdf_get_int(p, end, &gen)) == NULL ||
+	(dict = pdf_get_keyword(p, end, "obj")) == NULL ||
+	(value = pdf_dict_get(dict, end, "Type")) == NULL ||
+	!pdf_get_keyword(value, end, "/XRef"))
+      return (0);
+
+    if ((value = pdf_dict_get(dict, end, "W")) == NULL)
+      return (0);
+
+    value = pdf_skip_space(value, end);
+    if (value >= end || *value != '[')
+      return (0);
+
+    for (value ++, i = 0; i < 3; i ++)
+    {
+      if ((value = pdf_get_int(value, end, &num)) == NULL || num > 8)
+	return (0);
+      xref->w[i] = (int)num;
+    }
+
+    if ((value = pdf_dict_get(dict, end, "Size")) == NULL ||
+	!pdf_get_int(value, end, &size))
+      return (0);
+
+    if ((value = pdf_dict_get(dict, end, "Index")) != NULL)
+    {
+      value = pdf_skip_space(value, end);
+      if (value >= end || *value != '[')
+	return (0);
+
+      for (value ++; (p = pdf_get_int(value, end, &num)) != NULL; value = p)
+      {
+	if ((xref->num_index % 64) == 0)
+	{
+	  if ((index = realloc(xref->index, (size_t)(xref->num_index + 64) *
+						sizeof(long long))) == NULL)
+	    return (0);
+	  xref->index = index;
+	}
+
+	xref->index[xref->num_index ++] = num;
+      }
+
+      if (xref->num_index & 1)
+	return (0);
+    }
+    else
+    {
+      if ((xref->index = malloc(2 * sizeof(long long))) == NULL)
+	return (0);
+
+      xref->index[0]   = 0;
+      xref->index[1]   = size;
+      xref->num_index = 2;
+    }
+
+    if ((xref->data = pdf_read_stream(pdf, dict, end, &xref->length,
+				      0)) == NULL)
+      return (0);
+
+    //
+    // Make sure that every range of entries lies within the stream, so
+    // that pdf_find_entry() never gets past its end...
+    //
+
+    width = xref->w[0] + xref->w[1] + xref->w[2];
+    if (width == 0)
+      return (0);
+
+    for (i = 0, remaining = xref->length; i < xref->num_index; i += 2)
+    {
+      first = xref->index[i];
+      count = xref->index[i + 1];
+
+      if (first < 0 || count < 0 || first > LLONG_MAX - count ||
+	  (unsigned long long)count > remaining / (size_t)width)
+	return (0);
+
+      remaining -= (size_t)count * (size_t)width;
+    }
+  }
+
+  //
+  // The first trailer seen is the newest one, which names the catalog;
+  // then follow the older sections...
+  //
+
+  if (!pdf->trailer)
+    pdf->trailer = dict;
+
+  if (pdf->root < 0 && (value = pdf_dict_get(dict, end, "Root")) != NULL &&
+      !pdf_get_ref(value, end, &pdf->root, &pdf->root_gen))
+    return (0);
+
+  if (pdf->objects == 0 && (value = pdf_dict_get(dict, end, "Size")) != NULL &&
+      !pdf_get_int(value, end, &pdf->objects))
+    return (0);
+
+  if (pdf_dict_get(dict, end, "Encrypt"))
+    pdf->encrypted = 1;
+
+  if ((value = pdf_dict_get(dict, end, "XRefStm")) != NULL &&
+      pdf_get_int(value, end, &stm) && !pdf_read_xref(pdf, stm))
+    return (0);
+
+  if ((value = pdf_dict_get(dict, end, "Prev")) != NULL &&
+      pdf_get_int(value, end, &prev) && !pdf_read_xref(pdf, prev))
+    return (0);
+
+  return (1);
+}
+
+
+//
+// Find an object in the cross-reference sections.  Returns the type of
+// the entry (0 = free, 1 = at an offset, 2 = in an object stream) or -1
+// if the object is not there.
+//
+
+static int
+pdf_find_entry(pdf_file_t *pdf,
+	       long long num,
+	       long long *field2,
+	       long long *field3)
+{
+  const unsigned char *p, *end = pdf->data + pdf->size;
+  pdf_xref_t *xref;
+  long long first, count, fields[3];
+  int i, j, k, width;
+  size_t pos;
+
+  for (i = 0, xref = pdf->sections; i < pdf->num_sections; i ++, xref ++)
+  {
+    if (!xref->data)
+    {
+      p = pdf_get_keyword(pdf->data + xref->offset, end, "xref");
+
+      while ((p = pdf_get_int(p, end, &first)) != NULL &&
+	     (p = pdf_get_int(p, end, &count)) != NULL)
+      {
+	p = pdf_skip_space(p, end);
+
+	if (num >= first && num < first + count)
+	{
+	  p += (num - first) * 20;
+
+	  if (end - p < 18)
+	    return (-1);
+
+	  if (!pdf_get_int(p, end, field2))
+	    return (-1);
+	  *field3 = 0;
+
+	  return (p[17] == 'n' ? 1 : 0);
+	}
+
+	p += count * 20;
+      }
+    }
+    else
+    {
+      width = xref->w[0] + xref->w[1] + xref->w[2];
+
+      for (j = 0, pos = 0; j < xref->num_index; j += 2)
+      {
+	first = xref->index[j];
+	count = xref->index[j + 1];
+
+	if (count < 0 || (size_t)count > (xref->length - pos) / (size_t)width)
+	  return (-1);
+
+	if (num >= first && num < first + count)
+	{
+	  pos += (size_t)(num - first) * (size_t)width;
+
+	  for (k = 0; k < 3; k ++)
+	  {
+	    fields[k] = 0;
+	    for (width = xref->w[k]; width > 0; width --)
+	      fields[k] = (fields[k] << 8) | xref->data[pos ++];
+	  }
+
+	  if (xref->w[0] == 0)
+	    fields[0] = 1;
+
+	  *field2 = fields[1];
+	  *field3 = fields[2];
+
+	  return ((int)fields[0]);
+	}
+
+	pos += (size_t)count * (size_t)width;
+      }
+    }
+  }
+
+  return (-1);
+}
+
+
+//
+// Decode an object stream, unless it is the one decoded last; the catalog
+// and the page tree are usually in the same one.
+//
+
+static int
+pdf_load_objstm(pdf_file_t *pdf,
+		long long num,
+		int depth)
+{
+  const unsigned char *dict, *end;
+  long long field2, field3;
+  unsigned char *data;
+  size_t length;
+
+  if (pdf->objstm == num)
+    return (1);
+
+  //
+  // Streams in encrypted files would need decrypting, and an object
+  // stream is never inside another one...
+  //
+
+  if (pdf->encrypted || pdf_find_entry(pdf, num, &field2, &field3) != 1 ||
+      (dict = pdf_find_object(pdf, num, &end, depth + 1)) == NULL ||
+      (data = pdf_read_stream(pdf, dict, end, &length, depth + 1)) == NULL)
+    return (0);
+
+  free(pdf->objstm_data);
+
+  pdf->objstm_data   = data;
+  pdf->objstm_length = length;
+  pdf->objstm        = num;
+
+  return (1);
+}
+
+
+//
+// Find an object and return a pointer to its value.
+//
+
+static const unsigned char *
+pdf_find_object(pdf_file_t *pdf,
+		long long num,
+		const unsigned char **end,
+		int depth)
+{
+  const unsigned char *p, *dict, *value, *objend;
+  long long field2, field3, n, first, objnum, offset;
+  int i;
+
+  if (depth > PDF_MAX_DEPTH)
+    return (NULL);
+
+  *end = pdf->data + pdf->size;
+
+  switch (pdf_find_entry(pdf, num, &field2, &field3))
+  {
+    case 1 :
+	if (field2 < 0 || (size_t)field2 >= pdf->size)
+	  return (NULL);
+
+	p = pdf->data + field2;
+
+	if ((p = pdf_get_int(p, *end, &objnum)) == NULL || objnum != num ||
+	    (p = pdf_get_int(p, *end, &field3)) == NULL)
+	  return (NULL);
+
+	return (pdf_get_keyword(p, *end, "obj"));
+
+    case 2 :
+	//
+	// Object in an object stream; its offset is in the header of the
+	// stream, a list of object number and offset pairs...
+	//
+
+	if (!pdf_load_objstm(pdf, field2, depth) ||
+	    (dict = pdf_find_object(pdf, field2, &objend,
+				    depth + 1)) == NULL ||
+	    (value = pdf_dict_get(dict, objend, "N")) == NULL ||
+	    !pdf_get_int(value, objend, &n) ||
+	    (value = pdf_dict_get(dict, objend, "First")) == NULL ||
+	    !pdf_get_int(value, objend, &first))
+	  return (NULL);
+
+	*end = pdf->objstm_data + pdf->objstm_length;
+	p    = pdf->objstm_data;
+
+	if (first > *end - p || field3 >= n)
+	  return (NULL);
+
+	for (i = 0; i <= field3; i ++)
+	  if ((p = pdf_get_int(p, *end, &objnum)) == NULL ||
+	      (p = pdf_get_int(p, *end, &offset)) == NULL)
+	    return (NULL);
+
+	if (objnum != num || offset >= *end - pdf->objstm_data - first)
+	  return (NULL);
+
+	return (pdf->objstm_data + first + offset);
+
+    default :
+	return (NULL);
+  }
+}
+
+
+//
+// Map a PDF file and read its cross-reference sections, returns 0 if
+// that is not possible.  The file is closed with pdf_close() either way.
+//
+
+static int
+pdf_open(pdf_file_t *pdf,
+	 const char *filename)
+{
+  int fd;
+  struct stat st;
+  void *map;
+  const unsigned char *p, *end;
+  long long offset;
+
+  memset(pdf, 0, sizeof(pdf_file_t));
+  pdf->root   = -1;
+  pdf->objstm = -1;
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (0);
+
+  if (fstat(fd, &st) || st.st_size < 32 ||
+      (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+		  0)) == MAP_FAILED)
+  {
+    close(fd);
+    return (0);
+  }
+
+  close(fd);
+
+  pdf->data = map;
+  pdf->size = (size_t)st.st_size;
+
+  //
+  // Find the last "startxref" and read the cross-reference sections from
+  // there...
+  //
+
+  end = pdf->data + pdf->size;
+
+  for (p = end - 9; p > pdf->data && p > end - 2048; p --)
+    if (!memcmp(p, "startxref", 9))
+      break;
+
+  return (p > pdf->data && p > end - 2048 &&
+	  pdf_get_int(p + 9, end, &offset) && pdf_read_xref(pdf, offset) &&
+	  pdf->root >= 0);
+}
+
+
+//
+// Free everything read from a PDF file and unmap it.
+//
+
+static void
+pdf_close(pdf_file_t *pdf)
+{
+  int i;
+
+  for (i = 0; i < pdf->num_sections; i ++)
+  {
+    free(pdf->sections[i].data);
+    free(pdf->sections[i].index);
+  }
+
+  for (i = 0; i < pdf->num_pages; i ++)
+    free_dstr(pdf->pages[i].dict);
+
+  free(pdf->pages);
+  free(pdf->objstm_data);
+
+  if (pdf->data)
+    munmap((void *)pdf->data, pdf->size);
+
+  memset(pdf, 0, sizeof(pdf_file_t));
+}
+
+
+//
+// Count the pages of a PDF file without Ghostscript, returns -1 if that
+// is not possible.
+//
+
+static int
+pdf_count_pages_native(const char *filename)
+{
+  pdf_file_t pdf;
+  const unsigned char *p, *end, *value;
+  long long pages, count = -1;
+
+  //
+  // Get the /Count of the root of the page tree...
+  //
+
+  if (pdf_open(&pdf, filename) &&
+      (p = pdf_find_object(&pdf, pdf.root, &end, 0)) != NULL &&
+      (value = pdf_dict_get(p, end, "Pages")) != NULL &&
+      pdf_get_ref(value, end, &pages, NULL) &&
+      (p = pdf_find_object(&pdf, pages, &end, 0)) != NULL &&
+      (value = pdf_dict_get(p, end, "Count")) != NULL &&
+      pdf_get_number(&pdf, value, end, &pages, 0) && pages <= INT_MAX)
+    count = pages;
+
+  pdf_close(&pdf);
+
+  return ((int)count);
+}
+
+
+//
+// Attributes which pages inherit from the nodes of the page tree.
+//
+
+static const char * const pdf_inherited[] =
+{
+  "Resources",
+  "MediaBox",
+  "CropBox",
+  "Rotate"
+};
+
+
+//
+// Copy the entries of a dictionary except one, without the "<<" and ">>".
+//
+
+static int
+pdf_copy_dict(dstr_t *dst,
+	      const unsigned char *p,
+	      const unsigned char *end,
+	      const char *except)
+{
+  const unsigned char *key, *next;
+  size_t len = strlen(except);
+
+  p = pdf_skip_space(p, end);
+
+  if (end - p < 2 || p[0] != '<' || p[1] != '<')
+    return (0);
+
+  for (p += 2;;)
+  {
+    if ((p = pdf_skip_space(p, end)) >= end)
+      return (0);
+
+    if (*p == '>')
+      return (p + 1 < end && p[1] == '>');
+
+    if (*p != '/')
+      return (0);
+
+    for (key = p ++; p < end && !pdf_is_delim(*p); p ++);
+
+    //
+    // The text is copied as it is, which would not work across a nul
+    // byte...
+    //
+
+    if ((next = pdf_skip_object(p, end)) == NULL ||
+	memchr(key, '\0', (size_t)(next - key)))
+      return (0);
+
+    if ((size_t)(p - key - 1) != len || memcmp(key + 1, except, len))
+    {
+      dstrputc(dst, ' ');
+      dstrncat(dst, (const char *)key, (size_t)(next - key));
+    }
+
+    p = next;
+  }
+}
+
+
+//
+// Add a page to the list of pages, with the attributes it inherits.
+//
+
+static int
+pdf_add_page(pdf_file_t *pdf,
+	     long long num,
+	     long long gen,
+	     const unsigned char *p,
+	     const unsigned char *end,
+	     char **inherited)
+{
+  pdf_page_t *page;
+  size_t i;
+
+  if ((pdf->num_pages % 64) == 0)
+  {
+    if ((page = realloc(pdf->pages, (size_t)(pdf->num_pages + 64) *
+				    sizeof(pdf_page_t))) == NULL)
+      return (0);
+    pdf->pages = page;
+  }
+
+  page       = pdf->pages + pdf->num_pages ++;
+  page->num  = num;
+  page->gen  = gen;
+  page->dict = create_dstr();
+
+  if (!pdf_copy_dict(page->dict, p, end, "Parent"))
+    return (0);
+
+  for (i = 0; i < ARRAY_LEN(pdf_inherited); i ++)
+    if (inherited[i] && !pdf_dict_get(p, end, pdf_inherited[i]))
+      dstrcatf(page->dict, " /%s %s", pdf_inherited[i], inherited[i]);
+
+  return (1);
+}
+
+
+//
+// Collect the pages below a node of the page tree.
+//
+
+static int
+pdf_load_node(pdf_file_t *pdf,
+	      long long num,
+	      long long gen,
+	      char **inherited,
+	      int depth)
+{
+  const unsigned char *p, *end, *value, *next;
+  char *attrs[ARRAY_LEN(pdf_inherited)];
+  long long *kids = NULL, *temp;
+  int num_kids = 0, i, ret = 0;
+  size_t j;
+
+  //
+  // Every page is an object of its own, which limits the number of pages
+  // and so the number of nodes worth visiting in a broken tree...
+  //
+
+  if (depth > PDF_MAX_DEPTH || pdf->num_pages >= pdf->objects ||
+      ++ pdf->nodes > PDF_MAX_DEPTH * (pdf->objects + 1) ||
+      (p = pdf_find_object(pdf, num, &end, 0)) == NULL)
+    return (0);
+
+  if ((value = pdf_dict_get(p, end, "Type")) != NULL &&
+      pdf_get_keyword(value, end, "/Page"))
+    return (pdf_add_page(pdf, num, gen, p, end, inherited));
+
+  //
+  // Copy the list of kids and the attributes of this node before going
+  // down, the object may be in an object stream which gets replaced...
+  //
+
+  memset(attrs, 0, sizeof(attrs));
+
+  if ((value = pdf_dict_get(p, end, "Kids")) == NULL ||
+      (value = pdf_skip_space(value, end)) >= end || *value != '[')
+    return (0);
+
+  for (value ++;
+       (next = pdf_get_ref(value, end, &num, &gen)) != NULL;
+       value = next)
+  {
+    if ((num_kids % 32) == 0)
+    {
+      if ((temp = realloc(kids, (size_t)(num_kids + 32) * 2 *
+				sizeof(long long))) == NULL)
+	goto done;
+      kids = temp;
+    }
+
+    kids[2 * num_kids]     = num;
+    kids[2 * num_kids + 1] = gen;
+    num_kids ++;
+  }
+
+  if ((value = pdf_skip_space(value, end)) >= end || *value != ']')
+    goto done;
+
+  for (j = 0; j < ARRAY_LEN(pdf_inherited); j ++)
+  {
+    if ((value = pdf_dict_get(p, end, pdf_inherited[j])) == NULL)
+      continue;
+
+    value = pdf_skip_space(value, end);
+
+    if ((next = pdf_skip_object(value, end)) == NULL ||
+	memchr(value, '\0', (size_t)(next - value)) ||
+	(attrs[j] = malloc((size_t)(next - value) + 1)) == NULL)
+      goto done;
+
+    memcpy(attrs[j], value, (size_t)(next - value));
+    attrs[j][next - value] = '\0';
+  }
+
+  for (j = 0; j < ARRAY_LEN(pdf_inherited); j ++)
+    if (!attrs[j] && inherited[j])
+      attrs[j] = strdup(inherited[j]);
+
+  for (i = 0; i < num_kids; i ++)
+    if (!pdf_load_node(pdf, kids[2 * i], kids[2 * i + 1], attrs, depth + 1))
+      goto done;
+
+  ret = 1;
+
+  done:
+
+  for (j = 0; j < ARRAY_LEN(pdf_inherited); j ++)
+    free(attrs[j]);
+
+  free(kids);
+
+  return (ret);
+}
+
+
+//
+// Load the list of pages of a PDF file, returns 0 if that is not
+// possible.
+//
+
+static int
+pdf_load_pages(pdf_file_t *pdf)
+{
+  const unsigned char *p, *end, *value;
+  char *inherited[ARRAY_LEN(pdf_inherited)];
+  long long count;
+
+  //
+  // Strings in encrypted files are encrypted with the number of the
+  // object they are in, so they cannot be moved into other objects...
+  //
+
+  if (pdf->encrypted ||
+      (p = pdf_find_object(pdf, pdf->root, &end, 0)) == NULL ||
+      (value = pdf_dict_get(p, end, "Pages")) == NULL ||
+      !pdf_get_ref(value, end, &pdf->tree, &pdf->tree_gen) ||
+      (p = pdf_find_object(pdf, pdf->tree, &end, 0)) == NULL ||
+      (value = pdf_dict_get(p, end, "Count")) == NULL ||
+      !pdf_get_number(pdf, value, end, &count, 0) || count > INT_MAX ||
+      pdf->objects <= 0)
+    return (0);
+
+  memset(inherited, 0, sizeof(inherited));
+
+  if (!pdf_load_node(pdf, pdf->tree, pdf->tree_gen, inherited, 0) ||
+      pdf->num_pages != count)
+    return (0);
+
+  return (1);
+}
+
+
+//
+// Entries of the newest trailer which are repeated in the trailer of an
+// incremental update, besides /Size and /Root.  Encrypted files are never
+// updated.
+//
+
+static const char * const pdf_trailer_keys[] =
+{
+  "Info",
+  "ID"
+};
+
+
+//
+// Compare two cross-reference entries by object number.
+//
+
+static int
+pdf_compare_entries(const void *a,
+		    const void *b)
+{
+  const long long *ea = (const long long *)a,
+		  *eb = (const long long *)b;
+
+  return (ea[0] < eb[0] ? -1 : ea[0] > eb[0]);
+}
+
+
+//
+// Write a copy of a PDF file showing only pages 'first' through 'last',
+// returns 0 on error.
+//
+
+static int
+pdf_write_pages(pdf_file_t *pdf,
+		FILE *fp,
+		int first,
+		int last)
+{
+  dstr_t *update;
+  const unsigned char *end = pdf->data + pdf->size, *value, *next;
+  long long *entries, base, size;
+  int i, j, count = last - first + 1, ret = 0;
+  size_t k;
+
+  if (!pdf->pages || first < 1 || last > pdf->num_pages || count < 1 ||
+      (entries = calloc((size_t)count + 1, 3 * sizeof(long long))) == NULL)
+    return (0);
+
+  update = create_dstr();
+  base   = (long long)pdf->size;
+
+  if (pdf->data[pdf->size - 1] != '\n' && pdf->data[pdf->size - 1] != '\r')
+    dstrputc(update, '\n');
+
+  //
+  // Replace the root of the page tree and point the pages at it...
+  //
+
+  entries[0] = pdf->tree;
+  entries[1] = pdf->tree_gen;
+  entries[2] = base + (long long)update->len;
+
+  dstrcatf(update, "%lld %lld obj\n<< /Type /Pages /Kids [", pdf->tree,
+	   pdf->tree_gen);
+  for (i = first - 1; i < last; i ++)
+    dstrcatf(update, " %lld %lld R", pdf->pages[i].num, pdf->pages[i].gen);
+  dstrcatf(update, " ] /Count %d >>\nendobj\n", count);
+
+  for (i = first - 1, j = 3; i < last; i ++, j += 3)
+  {
+    entries[j]     = pdf->pages[i].num;
+    entries[j + 1] = pdf->pages[i].gen;
+    entries[j + 2] = base + (long long)update->len;
+
+    dstrcatf(update, "%lld %lld obj\n<<%s /Parent %lld %lld R >>\nendobj\n",
+	     pdf->pages[i].num, pdf->pages[i].gen, pdf->pages[i].dict->data,
+	     pdf->tree, pdf->tree_gen);
+  }
+
+  //
+  // Then the cross-reference table, one subsection per run of object
+  // numbers, and the trailer.  A page listed twice would need two
+  // entries for one object...
+  //
+
+  qsort(entries, (size_t)count + 1, 3 * sizeof(long long),
+	pdf_compare_entries);
+
+  for (i = 1; i <= count; i ++)
+    if (entries[3 * i] == entries[3 * i - 3])
+      goto done;
+
+  size = entries[3 * count] + 1;
+  if (size < pdf->objects)
+    size = pdf->objects;
+
+  base += (long long)update->len;
+  dstrcat(update, "xref\n0 1\n0000000000 65535 f\r\n");
+
+  for (i = 0; i <= count; i = j)
+  {
+    for (j = i + 1; j <= count && entries[3 * j] == entries[3 * j - 3] + 1;
+	 j ++);
+
+    dstrcatf(update, "%lld %d\n", entries[3 * i], j - i);
+    for (; i < j; i ++)
+      dstrcatf(update, "%010lld %05lld n\r\n", entries[3 * i + 2],
+	       entries[3 * i + 1]);
+  }
+
+  dstrcatf(update, "trailer\n<< /Size %lld /Root %lld %lld R", size,
+	   pdf->root, pdf->root_gen);
+
+  for (k = 0; k < ARRAY_LEN(pdf_trailer_keys); k ++)
+  {
+    if ((value = pdf_dict_get(pdf->trailer, end,
+			      pdf_trailer_keys[k])) == NULL)
+      continue;
+
+    value = pdf_skip_space(value, end);
+
+    if ((next = pdf_skip_object(value, end)) == NULL ||
+	memchr(value, '\0', (size_t)(next - value)))
+      goto done;
+
+    dstrcatf(update, " /%s ", pdf_trailer_keys[k]);
+    dstrncat(update, (const char *)value, (size_t)(next - value));
+  }
+
+  dstrcatf(update, " /Prev %lld >>\nstartxref\n%lld\n%%%%EOF\n",
+	   (long long)pdf->sections[0].offset, base);
+
+  ret = fwrite(pdf->data, 1, pdf->size, fp) == pdf->size &&
+	fwrite(update->data, 1, update->len, fp) == update->len;
+
+  done:
+
+  free(entries);
+  free_dstr(update);
+
+  return (ret);
+}
+
+
 int
 pdf_count_pages(const char *filename)
 {
@@ -37,6 +1411,12 @@ pdf_count_pages(const char *filename)
   size_t bytes;
   char *p;
 
+  if ((pagecount = pdf_count_pages_native(filename)) >= 0)
+    return (pagecount);
+
+  _log("Could not read the page count from the PDF file, asking "
+       "Ghostscript\n");
+
   snprintf(gscommand, CMDLINE_MAX, "%s -dNODISPLAY -dNOSAFER -dNOPAUSE -q -c "
 	   "'/pdffile (%s) (r) file runpdfbegin (PageCount: ) print "
 	   "pdfpagecount = quit'",
@@ -67,6 +1447,7 @@ pdf_count_pages(const char *filename)
 }
 
 pid_t kid3 = 0;
+static char kid3_file[PATH_MAX] = "";	// Extracted pages read by kid3
 
 
 static int
@@ -91,6 +1472,13 @@ wait_for_renderer()
 
   waitpid(kid3, &status, 0);
 
+  // The renderer is done with the pages extracted for it
+  if (kid3_file[0])
+  {
+    unlink(kid3_file);
+    kid3_file[0] = '\0';
+  }
+
   if (!WIFEXITED(status))
   {
     _log("Kid3 did not finish normally.\n");
@@ -108,39 +1496,49 @@ wait_for_renderer()
 
 //
 // Extract pages 'first' through 'last' from the pdf and write them into a
-// temporary file.
+// temporary file.  'pdf' is the already loaded file, if any.
 //
 
 static int
 pdf_extract_pages(char filename[PATH_MAX],
 		  const char *pdffilename,
+		  pdf_file_t *pdf,
 		  int first,
 		  int last)
 {
   char gscommand[CMDLINE_MAX];
   char filename_arg[PATH_MAX], first_arg[50], last_arg[50];
-  int fd;
+  int fd, ok;
+  FILE *fp;
 
   _log("Extracting pages %d through %d\n", first, last);
 
   snprintf(filename, PATH_MAX, "%s/foomatic-XXXXXX", temp_dir());
   if ((fd = mkstemp(filename)) == -1)
     rip_die(EXIT_STARVED, "Unable to create temporary file!\n");
-  close (fd);
-
-  snprintf(filename_arg, PATH_MAX, "-sOutputFile=%s", filename);
 
-  first_arg[0] = '\0';
-  last_arg[0] = '\0';
-  if (first > 1)
+  if (pdf)
   {
-    snprintf(first_arg, 50, "-dFirstPage=%d", first);
-    if (last >= first)
-      snprintf(last_arg, 50, "-dLastPage=%d", last);
+    if ((fp = fdopen(fd, "w")) == NULL)
+      rip_die(EXIT_STARVED, "Unable to create temporary file!\n");
+
+    ok = pdf_write_pages(pdf, fp, first, last);
+    if (fclose(fp) == 0 && ok)
+      return (1);
+
+    _log("Could not extract the pages from the PDF file, asking "
+	 "Ghostscript\n");
   }
+  else
+    close(fd);
 
-  snprintf(gscommand, CMDLINE_MAX, "%s -q -dNOPAUSE -dBATCH -dSAFER -dNOINTERPOLATE -dNOMEDIAATTRS"
-	   "-sDEVICE=pdfwrite -dShowAcroForm %s %s %s %s",
+  snprintf(filename_arg, PATH_MAX, "-sOutputFile=%s", filename);
+  snprintf(first_arg, 50, "-dFirstPage=%d", first);
+  snprintf(last_arg, 50, "-dLastPage=%d", last);
+
+  snprintf(gscommand, CMDLINE_MAX, "%s -q -dNOPAUSE -dBATCH -dSAFER "
+	   "-dNOINTERPOLATE -dNOMEDIAATTRS -sDEVICE=pdfwrite -dShowAcroForm "
+	   "%s %s %s %s",
 	   gspath, filename_arg, first_arg, last_arg, pdffilename);
 
   FILE *pd = popen(gscommand, "r");
@@ -155,6 +1553,7 @@ pdf_extract_pages(char filename[PATH_MAX],
 static int
 render_pages_with_generic_command(dstr_t *cmd,
 				  const char *filename,
+				  pdf_file_t *pdf,
 				  int firstpage,
 				  int lastpage)
 {
@@ -169,7 +1568,7 @@ render_pages_with_generic_command(dstr_t *cmd,
     dstrcatf(cmd, " < %s", filename);
   else
   {
-    if (!pdf_extract_pages(tmpfile, filename, firstpage, lastpage))
+    if (!pdf_extract_pages(tmpfile, filename, pdf, firstpage, lastpage))
       rip_die(EXIT_STARVED,
 	      "Could not run ghostscript to extract the pages!\n");
     dstrcatf(cmd, " < %s", tmpfile);
@@ -177,8 +1576,9 @@ render_pages_with_generic_command(dstr_t *cmd,
 
   result = start_renderer(cmd->data);
 
+  // Remove the temporary file only when the renderer has read it
   if (lastpage > 0)
-    unlink(tmpfile);
+    strlcpy(kid3_file, tmpfile, sizeof(kid3_file));
 
   return (result);
 }
@@ -206,16 +1606,10 @@ render_pages_with_ghostscript(dstr_t *cmd,
 
   dstrinsertf(cmd, start_gs_cmd + 2, " -dShowAcroForm ");
 
-  if (firstpage > 1)
-  {
-    if (lastpage >= firstpage)
-      dstrinsertf(cmd, start_gs_cmd +2,
-		  " -dFirstPage=%d -dLastPage=%d ",
-		  firstpage, lastpage);
-    else
-      dstrinsertf(cmd, start_gs_cmd +2,
-		  " -dFirstPage=%d ", firstpage);
-  }
+  if (lastpage > 0)
+    dstrinsertf(cmd, start_gs_cmd +2,
+		" -dFirstPage=%d -dLastPage=%d ",
+		firstpage, lastpage);
 
   return (start_renderer(cmd->data));
 }
@@ -223,6 +1617,7 @@ render_pages_with_ghostscript(dstr_t *cmd,
 
 static int
 render_pages(const char *filename,
+	     pdf_file_t *pdf,
 	     int firstpage,
 	     int lastpage)
 {
@@ -237,6 +1632,7 @@ render_pages(const char *filename,
     // command is not Ghostscript
     result = render_pages_with_generic_command(cmd,
 					       filename,
+					       pdf,
 					       firstpage,
 					       lastpage);
   else
@@ -253,11 +1649,31 @@ render_pages(const char *filename,
 }
 
 
+//
+// Get what the renderer gets for the current page: its command line and
+// the JCL header.
+//
+
+static void
+get_renderer_setup(dstr_t *setup)
+{
+  char **jcl;
+
+  build_commandline(optionset("currentpage"), setup, 1);
+
+  for (jcl = jclprepend; jcl && *jcl; jcl ++)
+    dstrcatf(setup, "\n%s", *jcl);
+}
+
+
 static int
 print_pdf_file(const char *filename)
 {
-  int page_count, i;
-  int firstpage;
+  int page_count, i, j;
+  int *runs = NULL, num_runs = 0;	// First pages of runs of pages
+  int *temp;
+  dstr_t *setup, *prevsetup, *swap;
+  pdf_file_t pdf, *pages = NULL;
 
   page_count = pdf_count_pages(filename);
 
@@ -272,27 +1688,83 @@ print_pdf_file(const char *filename)
     return (1);
   }
 
+  //
+  // Find out up front where the renderer setup changes.  Pages whose
+  // options differ only in ways the renderer does not see go into one
+  // run, and each run of pages is rendered by one renderer...
+  //
+
+  setup     = create_dstr();
+  prevsetup = create_dstr();
+
   optionset_copy_values(optionset("header"), optionset("currentpage"));
   optionset_copy_values(optionset("currentpage"), optionset("previouspage"));
-  firstpage = 1;
   for (i = 1; i <= page_count; i++)
   {
     set_options_for_page(optionset("currentpage"), i);
-    if (!optionset_equal(optionset("currentpage"),
-			 optionset("previouspage"), 1))
+    if (i == 1 || !optionset_equal(optionset("currentpage"),
+				   optionset("previouspage"), 1))
     {
-      render_pages(filename, firstpage, i);
-      firstpage = i;
+      get_renderer_setup(setup);
+      if (i == 1 || strcmp(setup->data, prevsetup->data))
+      {
+	if ((num_runs % 64) == 0)
+	{
+	  if ((temp = realloc(runs, (size_t)(num_runs + 64) *
+				    sizeof(int))) == NULL)
+	    rip_die(EXIT_STARVED, "Out of memory!\n");
+	  runs = temp;
+	}
+
+	runs[num_runs ++] = i;
+      }
+
+      swap      = prevsetup;
+      prevsetup = setup;
+      setup     = swap;
     }
     optionset_copy_values(optionset("currentpage"), optionset("previouspage"));
   }
-  if (firstpage == 1)
-    render_pages(filename, 1, -1); // Render the whole document
-  else
-    render_pages(filename, firstpage, page_count);
+
+  free_dstr(setup);
+  free_dstr(prevsetup);
+
+  //
+  // Then render the runs, getting the options of each run in the same
+  // way as above.  The pages are cut out of the file in-process when the
+  // renderer is not Ghostscript...
+  //
+
+  if (num_runs > 1)
+  {
+    _log("Rendering the pages in %d runs\n", num_runs);
+
+    if (pdf_open(&pdf, filename) && pdf_load_pages(&pdf) &&
+	pdf.num_pages == page_count)
+      pages = &pdf;
+    else
+      pdf_close(&pdf);
+  }
+
+  optionset_copy_values(optionset("header"), optionset("currentpage"));
+  for (i = 1, j = 0; j < num_runs; j ++)
+  {
+    for (; i <= runs[j]; i++)
+      set_options_for_page(optionset("currentpage"), i);
+
+    if (num_runs == 1)
+      render_pages(filename, NULL, 1, -1); // Render the whole document
+    else
+      render_pages(filename, pages, runs[j],
+		   j + 1 < num_runs ? runs[j + 1] - 1 : page_count);
+  }
 
   wait_for_renderer();
 
+  if (pages)
+    pdf_close(pages);
+  free(runs);
+
   return (1);
 }
 
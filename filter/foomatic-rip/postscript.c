@@ -130,43 +130,20 @@ line_type(const char *line)
 #define MAX_NON_DSC_LINES_IN_HEADER 1000
 #define MAX_LINES_FOR_PAGE_OPTIONS 200
 
-typedef struct
-{
-  size_t pos;
-
-  FILE *file;
-  const char *alreadyread;
-  size_t len;
-} stream_t;
-
-
-void _print_ps(stream_t *stream);
+void _print_ps(linereader_t *stream);
 
 
 int
 stream_next_line(dstr_t *line,
-		 stream_t *s)
+		 linereader_t *s)
 {
-  int c;
-  size_t cnt = 0;
+  const char *data;
+  size_t cnt;
 
-  dstrclear(line);
-  while (s->pos < s->len)
-  {
-    c = s->alreadyread[s->pos++];
-    dstrputc(line, c);
-    cnt++;
-    if (c == '\n')
-      return (cnt);
-  }
-
-  while ((c = fgetc(s->file)) != EOF)
-  {
-    dstrputc(line, c);
-    cnt++;
-    if (c == '\n')
-      return (cnt);
-  }
+  if ((cnt = linereader_next(s, &data)) > 0)
+    dstrcpybin(line, data, cnt);
+  else
+    dstrclear(line);
   return (cnt);
 }
 
@@ -177,7 +154,7 @@ print_ps(FILE *file,
 	 size_t len,
 	 const char *filename)
 {
-  stream_t stream;
+  linereader_t *stream;
   int pagefound = 0;
   FILE *in, *out;
   pid_t pid;
@@ -189,16 +166,13 @@ print_ps(FILE *file,
 
 
   // Define input data stream for reading
-  stream.pos = 0;
-  stream.file = file;
-  stream.alreadyread = alreadyread;
-  stream.len = len;
+  stream = create_linereader(file, alreadyread, len);
 
   // If a buffer is supplied but with zero length, we are in streaming
   // mode and do not pre-check for zero-page input, but print right away
   if (alreadyread && len == 0)
     // Simply print the file, without checking whether it has pages
-    _print_ps(&stream);
+    _print_ps(stream);
   else
   {
     //
@@ -226,7 +200,6 @@ print_ps(FILE *file,
     // not
     //
 
-    char buf[4096];
     char gscommand[65536];
     line = create_dstr();
     data_read = create_dstr();
@@ -244,11 +217,11 @@ print_ps(FILE *file,
 
     // Read input as long as we do not find a page ("showpage" action in
     // PostScript, makes the "bbox" device producing output)
-    while ((stream_next_line(line, &stream)) > 0)
+    while ((stream_next_line(line, stream)) > 0)
     {
       // Save what we have already read, we need to re-feed it when actually
       // rendering the job
-      dstrncat(data_read, line->data, line->len);
+      dstrcatbin(data_read, line->data, line->len);
       // Feed read line into Ghostscript
       for (bytes = line->len, pos = line->data, bytes_sent = 0;
 	   bytes_sent >= 0 && bytes_sent < bytes;
@@ -304,15 +277,14 @@ print_ps(FILE *file,
 
       // Redefine stream for what we have read now
       if (data_read->len < len)
-	dstrncat(data_read, buf + data_read->len, len - data_read->len);
+	dstrcatbin(data_read, alreadyread + data_read->len,
+		   len - data_read->len);
 
-      stream.pos = 0;
-      stream.file = file;
-      stream.alreadyread = data_read->data;
-      stream.len = data_read->len;
+      free_linereader(stream);
+      stream = create_linereader(file, data_read->data, data_read->len);
 
       // Print the file
-      _print_ps(&stream);
+      _print_ps(stream);
     }
     else
       _log("No pages left, outputting empty file.\n");
@@ -321,12 +293,14 @@ print_ps(FILE *file,
     free_dstr(line);
   }
 
+  free_linereader(stream);
+
   return (1);
 }
 
 
 void
-_print_ps(stream_t *stream)
+_print_ps(linereader_t *stream)
 {
   char *p;
 
@@ -13,6 +13,8 @@
 #include <config.h>
 #include <signal.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -136,28 +138,17 @@ massage_gs_commandline(dstr_t *cmd)
 
 
 char *
-read_line(FILE *stream,
+read_line(linereader_t *lr,
 	  size_t *readbytes)
 {
+  const char *data;
   char *line;
-  size_t alloc = 64, len = 0;
-  int c;
-
-  line = malloc(alloc);
-
-  while ((c = fgetc(stream)) != EOF)
-  {
-    if (len >= alloc -1)
-    {
-      alloc *= 2;
-      line = realloc(line, alloc);
-    }
-    line[len] = (char)c;
-    len++;
-    if (c == '\n')
-      break;
-  }
+  size_t len;
 
+  len = linereader_next(lr, &data);
+  line = malloc(len + 1);
+  if (len)
+    memcpy(line, data, len);
   line[len] = '\0';
   *readbytes = len;
   return (line);
@@ -169,11 +160,8 @@ write_binary_data(FILE *stream,
 		  const char *data,
 		  size_t bytes)
 {
-  int i;
-  for (i=0; i < bytes; i++)
-  {
-    fputc(data[i], stream);
-  }
+  if (bytes)
+    fwrite_or_die(data, 1, bytes, stream);
 }
 
 
@@ -190,11 +178,14 @@ read_jcl_lines(FILE *stream,
   char *line;
   char **result;
   size_t alloc = 8, cnt = 0;
+  linereader_t *lr;
 
   result = malloc(alloc * sizeof(char *));
 
-  // read from the renderer output until the first non-JCL line appears
-  while ((line = read_line(stream, readbinarybytes)))
+  // read from the renderer output until the first non-JCL line appears,
+  // the rest of the data stays in 'stream'
+  lr = create_linereader(stream, NULL, 0);
+  while ((line = read_line(lr, readbinarybytes)))
   {
     if (cnt >= alloc -1)
     {
@@ -209,6 +200,8 @@ read_jcl_lines(FILE *stream,
     cnt++;
   }
 
+  free_linereader(lr);
+
   cnt++;
   result[cnt] = NULL;
   return (result);
@@ -380,6 +373,69 @@ log_jcl()
 }
 
 
+//
+// Copy the job data from the renderer to the output.  Where the kernel
+// can do so, the data gets moved from the renderer's pipe to the output
+// with splice(), without copying it through our buffers.
+//
+
+#define JOB_DATA_BUFSIZE 65536	// Buffer size of renderer output
+
+static void
+copy_job_data(FILE *out,
+	      FILE *in)
+{
+#ifdef HAVE_SPLICE
+  char buf[JOB_DATA_BUFSIZE];
+  size_t bytes;
+  ssize_t moved;
+  int flags, spliced = 0;
+
+  // What stdio has already read into its buffer, while reading the JCL
+  // header, goes first.  The pipe is non-blocking while doing so, and
+  // stdio only reads from it when its buffer is empty, so a short read
+  // means that we got all of it
+  flags = fcntl(fileno(in), F_GETFL);
+  if (flags != -1 && fcntl(fileno(in), F_SETFL, flags | O_NONBLOCK) == 0)
+  {
+    do
+    {
+      bytes = fread(buf, 1, sizeof(buf), in);
+      fwrite_or_die(buf, 1, bytes, out);
+    }
+    while (bytes == sizeof(buf));
+
+    if (ferror(in) && errno != EAGAIN && errno != EWOULDBLOCK)
+      rip_die(EXIT_PRNERR, "Encountered error %s during fread",
+	      strerror(errno));
+    clearerr(in);
+    fcntl(fileno(in), F_SETFL, flags);
+
+    if (fflush(out))
+      rip_die(EXIT_PRNERR, "Encountered error %s during fwrite",
+	      strerror(errno));
+
+    // Then the rest in the kernel, if the output allows it (it is not a
+    // terminal or a file opened for appending)
+    while ((moved = splice(fileno(in), NULL, fileno(out), NULL,
+			   JOB_DATA_BUFSIZE * 16,
+			   SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+      spliced = 1;
+
+    if (moved == 0)
+      return;
+    else if (errno != EINVAL || spliced)
+      rip_die(EXIT_PRNERR, "Encountered error %s during splice",
+	      strerror(errno));
+
+    _log("Cannot splice job data to the output, copying it\n");
+  }
+#endif // HAVE_SPLICE
+
+  copy_file(out, in, NULL, 0);
+}
+
+
 int
 exec_kid4(FILE *in,
 	  FILE *out,
@@ -423,7 +479,7 @@ exec_kid4(FILE *in,
   }
 
   // The job data
-  copy_file(fileh, in, NULL, 0);
+  copy_job_data(fileh, in);
 
   // A JCL trailer
   if (argv_count(jclprepend) > 0 && !driverjcl)
@@ -0,0 +1,814 @@
+//
+// test-pdf.c
+//
+// Test program for the native PDF reader of foomatic-rip.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./test-pdf
+//
+// Writes small PDF files with classic cross-reference tables and with
+// cross-reference streams, some of them damaged on purpose, and checks
+// the page count pdf_count_pages_native() reads from them.  Damaged
+// files must make the reader give up (-1) instead of reading past the
+// cross-reference data; build with -fsanitize=address to catch that.
+//
+// Then cuts ranges of pages out of more files with pdf_write_pages(),
+// reads the result back and checks its pages and their attributes.
+// Files which cannot be cut in-process must be refused, so that
+// Ghostscript does it instead.
+//
+
+#include "pdf.c"
+
+
+//
+// Symbols of foomatic-rip which pdf.c refers to, but which are not
+// needed for reading PDF files...
+//
+
+char gspath[PATH_MAX] = "gs";
+char **jclprepend = NULL;
+
+int
+build_commandline(int optset,
+		  dstr_t *cmdline,
+		  int pdfcmdline)
+{
+  return (0);
+}
+
+int
+exec_kid3(FILE *in,
+	  FILE *out,
+	  void *user_arg)
+{
+  return (0);
+}
+
+int
+optionset(const char *name)
+{
+  return (0);
+}
+
+void
+optionset_copy_values(int src_optset,
+		      int dest_optset)
+{
+}
+
+int
+optionset_equal(int optset1,
+		int optset2,
+		int exceptPS)
+{
+  return (1);
+}
+
+void
+set_options_for_page(int optset,
+		     int page)
+{
+}
+
+
+//
+// Test files...
+//
+
+typedef struct test_pdf_s
+{
+  const char *name;			// Description
+  int xrefstm;				// Cross-reference stream?
+  int w[3];				// /W of the stream
+  const char *index;			// /Index of the stream or NULL
+  const char *subsection;		// First line of classic table or NULL
+  int pages;				// Expected page count
+} test_pdf_t;
+
+static const test_pdf_t tests[] =
+{
+  { "classic xref table", 0, { 0 }, NULL, NULL, 3 },
+  { "classic xref overflowing first object", 0, { 0 }, NULL,
+    "9223372036854775807 5", -1 },
+  { "xref stream", 1, { 1, 4, 1 }, NULL, NULL, 3 },
+  { "xref stream with /Index", 1, { 1, 4, 1 }, "[0 2 2 5]", NULL, 3 },
+  { "xref stream with short fields", 1, { 0, 2, 0 }, NULL, NULL, 3 },
+  { "xref stream with /Index wrapping before the data", 1, { 1, 2, 0 },
+    "[2 6148914691236517205 1 6]", NULL, -1 },
+  { "xref stream with huge /Index count", 1, { 1, 4, 1 },
+    "[0 3074457345618258603 1 6]", NULL, -1 },
+  { "xref stream with /Index past the data", 1, { 1, 4, 1 }, "[0 8]",
+    NULL, -1 },
+  { "xref stream with overflowing /Index", 1, { 1, 4, 1 },
+    "[9223372036854775807 7]", NULL, -1 }
+};
+
+
+//
+// Page extraction tests...
+//
+
+typedef struct test_attr_s
+{
+  int page;				// Page of the output from 1, or 0
+					// for its trailer
+  const char *key;			// Attribute
+  const char *value;			// Expected value or NULL if absent
+} test_attr_t;
+
+typedef struct test_extract_s
+{
+  const char *name;			// Description
+  int (*write)(dstr_t *pdf);		// Write the source file
+  int first, last;			// Pages to extract
+  int pages;				// Expected page count, 0 if the pages
+					// must not be written and -1 if they
+					// must not be loaded
+  test_attr_t attrs[10];			// Expected attributes
+} test_extract_t;
+
+static int write_nested(dstr_t *pdf);
+static int write_objstm(dstr_t *pdf);
+static int write_update(dstr_t *pdf);
+static int write_duplicate(dstr_t *pdf);
+static int write_encrypted(dstr_t *pdf);
+
+static const test_extract_t extract_tests[] =
+{
+  { "extract from nested page tree", write_nested, 2, 3, 2,
+    { { 1, "MediaBox", "[0 0 595 842]" },
+      { 1, "CropBox", "[10 10 602 782]" },
+      { 1, "Rotate", "180" },
+      { 1, "Resources", "<</ProcSet[/PDF]>>" },
+      { 2, "MediaBox", "[0 0 612 792]" },
+      { 2, "CropBox", NULL },
+      { 2, "Rotate", NULL },
+      { 2, "Resources", "<</ProcSet[/PDF]>>" },
+      { 0, "Info", "7 0 R" },
+      { 0, "ID", "[<00112233><44556677>]" } } },
+  { "extract page from object stream", write_objstm, 2, 2, 1,
+    { { 1, "MediaBox", "[0 0 612 792]" },
+      { 1, "Rotate", "270" } } },
+  { "extract from file updated with xref stream", write_update, 1, 2, 2,
+    { { 1, "MediaBox", "[0 0 612 792]" },
+      { 2, "MediaBox", "[0 0 420 595]" },
+      { 0, "ID", "[<AABB><CCDD>]" },
+      { 0, "W", NULL } } },
+  { "extract duplicate page", write_duplicate, 1, 3, 0, { { 0 } } },
+  { "extract single copy of duplicate page", write_duplicate, 2, 3, 2,
+    { { 1, "MediaBox", "[0 0 200 200]" },
+      { 2, "MediaBox", "[0 0 100 100]" } } },
+  { "extract from encrypted file", write_encrypted, 1, 1, -1, { { 0 } } }
+};
+
+
+//
+// Append objects with consecutive numbers, saving their offsets.
+//
+
+static void
+add_objects(dstr_t *pdf,
+	    long *offsets,
+	    int first,
+	    const char * const *objects,
+	    int count)
+{
+  int i;
+
+  for (i = 0; i < count; i ++)
+  {
+    offsets[first + i] = (long)pdf->len;
+    dstrcatf(pdf, "%d 0 obj\n%s\nendobj\n", first + i, objects[i]);
+  }
+}
+
+
+//
+// Append a classic xref table for objects 1 through 'size' - 1 and the
+// trailer, returns the offset of the table.
+//
+
+static long
+add_xref_table(dstr_t *pdf,
+	       const long *offsets,
+	       int size,
+	       const char *trailer)
+{
+  long startxref = (long)pdf->len;
+  int i;
+
+  dstrcatf(pdf, "xref\n0 %d\n0000000000 65535 f\r\n", size);
+  for (i = 1; i < size; i ++)
+    dstrcatf(pdf, "%010ld 00000 n\r\n", offsets[i]);
+  dstrcatf(pdf, "trailer\n<</Size %d%s>>\nstartxref\n%ld\n%%%%EOF\n", size,
+	   trailer, startxref);
+
+  return (startxref);
+}
+
+
+//
+// Append object 'num' as a Flate-compressed stream.
+//
+
+static int
+add_stream(dstr_t *pdf,
+	   int num,
+	   const char *dict,
+	   const unsigned char *data,
+	   size_t length)
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  unsigned char *packed;
+  uLongf packedlen = compressBound((uLong)length);
+
+  if ((packed = malloc(packedlen)) == NULL ||
+      compress(packed, &packedlen, data, (uLong)length) != Z_OK)
+  {
+    free(packed);
+    return (0);
+  }
+
+  dstrcatf(pdf, "%d 0 obj\n<<%s/Filter/FlateDecode/Length %lu>>\nstream\n",
+	   num, dict, (unsigned long)packedlen);
+  dstrcatbin(pdf, (const char *)packed, packedlen);
+  dstrcat(pdf, "\nendstream\nendobj\n");
+
+  free(packed);
+
+  return (1);
+
+#else
+  (void)pdf;
+  (void)num;
+  (void)dict;
+  (void)data;
+  (void)length;
+
+  return (0);
+#endif // HAVE_ZLIB_H && HAVE_LIBZ
+}
+
+
+//
+// Append objects with consecutive numbers in object stream 'num'.
+//
+
+static int
+add_objstm(dstr_t *pdf,
+	   long *offsets,
+	   int num,
+	   int first,
+	   const char * const *objects,
+	   int count)
+{
+  dstr_t *header = create_dstr(), *body = create_dstr();
+  char dict[64];
+  size_t start;
+  int i, ret;
+
+  for (i = 0; i < count; i ++)
+  {
+    dstrcatf(header, "%d %lu ", first + i, (unsigned long)body->len);
+    dstrcatf(body, "%s\n", objects[i]);
+  }
+
+  start = header->len;
+  dstrcatbin(header, body->data, body->len);
+
+  snprintf(dict, sizeof(dict), "/Type/ObjStm/N %d/First %lu", count,
+	   (unsigned long)start);
+
+  offsets[num] = (long)pdf->len;
+  ret = add_stream(pdf, num, dict, (const unsigned char *)header->data,
+		   header->len);
+
+  free_dstr(header);
+  free_dstr(body);
+
+  return (ret);
+}
+
+
+//
+// Append xref stream 'num' with 'count' entries for the objects from
+// 'first' on; each entry is its type and two fields.
+//
+
+static int
+add_xref_stream(dstr_t *pdf,
+		int num,
+		int first,
+		const long (*entries)[3],
+		int count,
+		const char *trailer)
+{
+  static const int w[3] = { 1, 4, 2 };
+  unsigned char data[16 * 7], *entry = data;
+  char dict[256];
+  long startxref = (long)pdf->len;
+  int i, j, k;
+
+  if (count > 16)
+    return (0);
+
+  for (i = 0; i < count; i ++)
+    for (j = 0; j < 3; j ++)
+      for (k = w[j] - 1; k >= 0; k --)
+	*entry ++ = (unsigned char)(entries[i][j] >> (8 * k));
+
+  snprintf(dict, sizeof(dict), "/Type/XRef/Size %d/W[1 4 2]/Index[%d %d]%s",
+	   num + 1, first, count, trailer);
+
+  if (!add_stream(pdf, num, dict, data, (size_t)(entry - data)))
+    return (0);
+
+  dstrcatf(pdf, "startxref\n%ld\n%%%%EOF\n", startxref);
+
+  return (1);
+}
+
+
+//
+// A page tree with an intermediate node; pages inherit attributes from
+// both levels and override some of them.
+//
+
+static int
+write_nested(dstr_t *pdf)
+{
+  static const char * const objects[] =
+  {
+    "<</Type/Catalog/Pages 2 0 R>>",
+    "<</Type/Pages/Kids[3 0 R 6 0 R]/Count 3/MediaBox[0 0 612 792]"
+    "/Resources<</ProcSet[/PDF]>>>>",
+    "<</Type/Pages/Parent 2 0 R/Kids[4 0 R 5 0 R]/Count 2"
+    "/CropBox[10 10 602 782]/Rotate 90>>",
+    "<</Type/Page/Parent 3 0 R>>",
+    "<</Type/Page/Parent 3 0 R/Rotate 180/MediaBox[0 0 595 842]>>",
+    "<</Type/Page/Parent 2 0 R>>",
+    "<</Title(Nested)>>"
+  };
+  long offsets[ARRAY_LEN(objects) + 1];
+
+  dstrcpy(pdf, "%PDF-1.4\n");
+  add_objects(pdf, offsets, 1, objects, ARRAY_LEN(objects));
+  add_xref_table(pdf, offsets, ARRAY_LEN(objects) + 1,
+		 "/Root 1 0 R/Info 7 0 R/ID[<00112233><44556677>]");
+
+  return (1);
+}
+
+
+//
+// The page tree and the pages in an object stream, found through an xref
+// stream.
+//
+
+static int
+write_objstm(dstr_t *pdf)
+{
+  static const char * const catalog[] =
+  {
+    "<</Type/Catalog/Pages 2 0 R>>"
+  };
+  static const char * const objects[] =
+  {
+    "<</Type/Pages/Kids[3 0 R 4 0 R]/Count 2/MediaBox[0 0 612 792]"
+    "/Rotate 270>>",
+    "<</Type/Page/Parent 2 0 R>>",
+    "<</Type/Page/Parent 2 0 R>>"
+  };
+  long offsets[7], entries[7][3] =
+  {
+    { 0, 0, 65535 },
+    { 1, 0, 0 },
+    { 2, 5, 0 },
+    { 2, 5, 1 },
+    { 2, 5, 2 },
+    { 1, 0, 0 },
+    { 1, 0, 0 }
+  };
+
+  dstrcpy(pdf, "%PDF-1.5\n");
+  add_objects(pdf, offsets, 1, catalog, 1);
+  if (!add_objstm(pdf, offsets, 5, 2, objects, ARRAY_LEN(objects)))
+    return (0);
+
+  entries[1][1] = offsets[1];
+  entries[5][1] = offsets[5];
+  entries[6][1] = (long)pdf->len;
+
+  return (add_xref_stream(pdf, 6, 0, (const long (*)[3])entries, 7,
+			  "/Root 1 0 R"));
+}
+
+
+//
+// A file with a classic xref table and an incremental update, found
+// through an xref stream, which replaces the second page.
+//
+
+static int
+write_update(dstr_t *pdf)
+{
+  static const char * const objects[] =
+  {
+    "<</Type/Catalog/Pages 2 0 R>>",
+    "<</Type/Pages/Kids[3 0 R 4 0 R]/Count 2/MediaBox[0 0 612 792]>>",
+    "<</Type/Page/Parent 2 0 R>>",
+    "<</Type/Page/Parent 2 0 R>>"
+  };
+  static const char * const update[] =
+  {
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 420 595]>>"
+  };
+  long offsets[ARRAY_LEN(objects) + 1], prev, entries[2][3];
+  char trailer[64];
+
+  dstrcpy(pdf, "%PDF-1.5\n");
+  add_objects(pdf, offsets, 1, objects, ARRAY_LEN(objects));
+  prev = add_xref_table(pdf, offsets, ARRAY_LEN(objects) + 1, "/Root 1 0 R");
+
+  add_objects(pdf, offsets, 4, update, 1);
+
+  entries[0][0] = 1;
+  entries[0][1] = offsets[4];
+  entries[0][2] = 0;
+  entries[1][0] = 1;
+  entries[1][1] = (long)pdf->len;
+  entries[1][2] = 0;
+
+  snprintf(trailer, sizeof(trailer), "/Root 1 0 R/Prev %ld/ID[<AABB><CCDD>]",
+	   prev);
+
+  return (add_xref_stream(pdf, 5, 4, (const long (*)[3])entries, 2,
+			  trailer));
+}
+
+
+//
+// A page tree which lists the same page twice.
+//
+
+static int
+write_duplicate(dstr_t *pdf)
+{
+  static const char * const objects[] =
+  {
+    "<</Type/Catalog/Pages 2 0 R>>",
+    "<</Type/Pages/Kids[3 0 R 4 0 R 3 0 R]/Count 3>>",
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 100 100]>>",
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 200 200]>>"
+  };
+  long offsets[ARRAY_LEN(objects) + 1];
+
+  dstrcpy(pdf, "%PDF-1.4\n");
+  add_objects(pdf, offsets, 1, objects, ARRAY_LEN(objects));
+  add_xref_table(pdf, offsets, ARRAY_LEN(objects) + 1, "/Root 1 0 R");
+
+  return (1);
+}
+
+
+//
+// An encrypted file; its strings are encrypted with the numbers of the
+// objects they are in.
+//
+
+static int
+write_encrypted(dstr_t *pdf)
+{
+  static const char * const objects[] =
+  {
+    "<</Type/Catalog/Pages 2 0 R>>",
+    "<</Type/Pages/Kids[3 0 R]/Count 1>>",
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]>>",
+    "<</Filter/Standard/V 1/R 2/O<00>/U<00>/P -4>>"
+  };
+  long offsets[ARRAY_LEN(objects) + 1];
+
+  dstrcpy(pdf, "%PDF-1.4\n");
+  add_objects(pdf, offsets, 1, objects, ARRAY_LEN(objects));
+  add_xref_table(pdf, offsets, ARRAY_LEN(objects) + 1,
+		 "/Root 1 0 R/Encrypt 4 0 R/ID[<00><00>]");
+
+  return (1);
+}
+
+
+//
+// Save a file.
+//
+
+static int
+write_file(const char *filename,
+	   const dstr_t *pdf)
+{
+  FILE *fp;
+
+  if ((fp = fopen(filename, "wb")) == NULL)
+    return (0);
+
+  fwrite(pdf->data, 1, pdf->len, fp);
+
+  return (fclose(fp) == 0);
+}
+
+
+//
+// Check an attribute of a page or the trailer of the output, returns 1 if
+// it has the expected value.
+//
+
+static int
+check_attr(pdf_file_t *pdf,
+	   const test_attr_t *attr)
+{
+  const unsigned char *p, *end, *value, *next;
+
+  if (attr->page == 0)
+  {
+    p   = pdf->trailer;
+    end = pdf->data + pdf->size;
+  }
+  else if (attr->page < 0 || attr->page > pdf->num_pages ||
+	   (p = pdf_find_object(pdf, pdf->pages[attr->page - 1].num, &end,
+				0)) == NULL)
+    return (0);
+
+  if ((value = pdf_dict_get(p, end, attr->key)) == NULL)
+    return (attr->value == NULL);
+
+  value = pdf_skip_space(value, end);
+
+  return (attr->value && (next = pdf_skip_object(value, end)) != NULL &&
+	  (size_t)(next - value) == strlen(attr->value) &&
+	  !memcmp(value, attr->value, (size_t)(next - value)));
+}
+
+
+//
+// Extract pages from a test file and check the result, returns 1 on
+// success.
+//
+
+static int
+test_extract(const char *filename,
+	     const char *outname,
+	     const test_extract_t *test)
+{
+  pdf_file_t pdf, out;
+  const test_attr_t *attr;
+  FILE *fp;
+  int loaded, written, pages, ok = 1;
+
+  loaded = pdf_open(&pdf, filename) && pdf_load_pages(&pdf);
+
+  if (!loaded)
+  {
+    pdf_close(&pdf);
+
+    if (test->pages >= 0)
+      printf("FAIL: %s, cannot load the pages\n", test->name);
+
+    return (test->pages < 0);
+  }
+  else if (test->pages < 0)
+  {
+    pdf_close(&pdf);
+    printf("FAIL: %s, pages loaded\n", test->name);
+    return (0);
+  }
+
+  if ((fp = fopen(outname, "wb")) == NULL)
+  {
+    pdf_close(&pdf);
+    perror(outname);
+    return (0);
+  }
+
+  written = pdf_write_pages(&pdf, fp, test->first, test->last);
+  written = fclose(fp) == 0 && written;
+  pdf_close(&pdf);
+
+  if (!written || test->pages == 0)
+  {
+    if (written)
+      printf("FAIL: %s, pages written\n", test->name);
+    else if (test->pages)
+      printf("FAIL: %s, cannot write the pages\n", test->name);
+
+    return (!written && test->pages == 0);
+  }
+
+  //
+  // Read the output back, both as the page counter and as the page
+  // extraction do...
+  //
+
+  if ((pages = pdf_count_pages_native(outname)) != test->pages)
+  {
+    printf("FAIL: %s, %d pages instead of %d\n", test->name, pages,
+	   test->pages);
+    return (0);
+  }
+
+  if (!pdf_open(&out, outname) || !pdf_load_pages(&out) ||
+      out.num_pages != test->pages)
+  {
+    pdf_close(&out);
+    printf("FAIL: %s, cannot load the output\n", test->name);
+    return (0);
+  }
+
+  for (attr = test->attrs;
+       attr < test->attrs + ARRAY_LEN(test->attrs) && attr->key; attr ++)
+    if (!check_attr(&out, attr))
+    {
+      printf("FAIL: %s, page %d /%s is not %s\n", test->name, attr->page,
+	     attr->key, attr->value ? attr->value : "absent");
+      ok = 0;
+    }
+
+  pdf_close(&out);
+
+  return (ok);
+}
+
+
+//
+// Write a test file with a catalog, a page tree and three pages.
+//
+
+static int
+write_pdf(const char *filename,
+	  const test_pdf_t *test)
+{
+  static const char * const objects[] =
+  {
+    "<</Type/Catalog/Pages 2 0 R>>",
+    "<</Type/Pages/Kids[3 0 R 4 0 R 5 0 R]/Count 3>>",
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]>>",
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]>>",
+    "<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]>>"
+  };
+  dstr_t *pdf = create_dstr();
+  long offsets[ARRAY_LEN(objects) + 1];
+  unsigned char entries[(ARRAY_LEN(objects) + 2) * 24], *entry;
+  long startxref;
+  size_t i;
+  FILE *fp;
+
+  dstrcpy(pdf, "%PDF-1.5\n");
+
+  for (i = 0; i < ARRAY_LEN(objects); i ++)
+  {
+    offsets[i] = (long)pdf->len;
+    dstrcatf(pdf, "%d 0 obj\n%s\nendobj\n", (int)i + 1, objects[i]);
+  }
+
+  startxref = (long)pdf->len;
+
+  if (!test->xrefstm)
+  {
+    dstrcatf(pdf, "xref\n%s\n0000000000 65535 f\r\n",
+	     test->subsection ? test->subsection : "0 6");
+    for (i = 0; i < ARRAY_LEN(objects); i ++)
+      dstrcatf(pdf, "%010ld 00000 n\r\n", offsets[i]);
+    dstrcatf(pdf, "trailer\n<</Size 6/Root 1 0 R>>\n");
+  }
+  else
+  {
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    unsigned char packed[256];
+    uLongf packedlen = sizeof(packed);
+    long fields[3];
+    int j, k;
+
+    //
+    // Entry 0 is the head of the free list, the last one is the stream
+    // itself...
+    //
+
+    offsets[ARRAY_LEN(objects)] = startxref;
+    for (i = 0, entry = entries; i <= ARRAY_LEN(objects) + 1; i ++)
+    {
+      fields[0] = i > 0;
+      fields[1] = i > 0 ? offsets[i - 1] : 0;
+      fields[2] = i > 0 ? 0 : 65535;
+
+      for (j = 0; j < 3; j ++)
+	for (k = test->w[j] - 1; k >= 0; k --)
+	  *entry ++ = (unsigned char)(fields[j] >> (8 * k));
+    }
+
+    if (compress(packed, &packedlen, entries,
+		 (uLong)(entry - entries)) != Z_OK)
+    {
+      free_dstr(pdf);
+      return (0);
+    }
+
+    dstrcatf(pdf, "%d 0 obj\n<</Type/XRef/Size 7/W[%d %d %d]%s%s"
+	     "/Root 1 0 R/Filter/FlateDecode/Length %lu>>\nstream\n",
+	     (int)ARRAY_LEN(objects) + 1, test->w[0], test->w[1], test->w[2],
+	     test->index ? "/Index" : "", test->index ? test->index : "",
+	     (unsigned long)packedlen);
+    dstrcatbin(pdf, (const char *)packed, packedlen);
+    dstrcat(pdf, "\nendstream\nendobj\n");
+#else
+    free_dstr(pdf);
+    return (0);
+#endif // HAVE_ZLIB_H && HAVE_LIBZ
+  }
+
+  dstrcatf(pdf, "startxref\n%ld\n%%%%EOF\n", startxref);
+
+  if ((fp = fopen(filename, "wb")) == NULL)
+  {
+    free_dstr(pdf);
+    return (0);
+  }
+
+  fwrite(pdf->data, 1, pdf->len, fp);
+  fclose(fp);
+  free_dstr(pdf);
+
+  return (1);
+}
+
+
+int
+main(int argc,
+     char **argv)
+{
+  char filename[PATH_MAX], outname[PATH_MAX];
+  dstr_t *pdf;
+  size_t i;
+  int fd, pages, status = 0;
+
+  snprintf(filename, sizeof(filename), "%s/test-pdf-XXXXXX", temp_dir());
+  if ((fd = mkstemp(filename)) < 0)
+  {
+    perror(filename);
+    return (1);
+  }
+  close(fd);
+
+  snprintf(outname, sizeof(outname), "%s/test-pdf-XXXXXX", temp_dir());
+  if ((fd = mkstemp(outname)) < 0)
+  {
+    perror(outname);
+    unlink(filename);
+    return (1);
+  }
+  close(fd);
+
+  for (i = 0; i < ARRAY_LEN(tests); i ++)
+  {
+    if (!write_pdf(filename, tests + i))
+    {
+      printf("SKIP: %s\n", tests[i].name);
+      continue;
+    }
+
+    if ((pages = pdf_count_pages_native(filename)) == tests[i].pages)
+      printf("PASS: %s\n", tests[i].name);
+    else
+    {
+      printf("FAIL: %s, %d pages instead of %d\n", tests[i].name, pages,
+	     tests[i].pages);
+      status = 1;
+    }
+  }
+
+  for (i = 0; i < ARRAY_LEN(extract_tests); i ++)
+  {
+    pdf = create_dstr();
+
+    if (!extract_tests[i].write(pdf))
+      printf("SKIP: %s\n", extract_tests[i].name);
+    else if (!write_file(filename, pdf))
+    {
+      perror(filename);
+      status = 1;
+    }
+    else if (test_extract(filename, outname, extract_tests + i))
+      printf("PASS: %s\n", extract_tests[i].name);
+    else
+      status = 1;
+
+    free_dstr(pdf);
+  }
+
+  unlink(filename);
+  unlink(outname);
+
+  return (status);
+}
@@ -896,6 +896,39 @@ dstrncat(dstr_t *ds,
 }
 
 
+void
+dstrcpybin(dstr_t *ds,
+	   const char *src,
+	   size_t n)
+{
+  ds->len = 0;
+  dstrcatbin(ds, src, n);
+}
+
+
+void
+dstrcatbin(dstr_t *ds,
+	   const char *src,
+	   size_t n)
+{
+  size_t needed = ds->len + n;
+
+  if (needed >= ds->alloc)
+  {
+    do
+    {
+      ds->alloc *= 2;
+    }
+    while (needed >= ds->alloc);
+    ds->data = realloc(ds->data, ds->alloc);
+  }
+
+  memcpy(&ds->data[ds->len], src, n);
+  ds->len = needed;
+  ds->data[ds->len] = '\0';
+}
+
+
 void
 dstrcpyf(dstr_t *ds,
 	 const char *src,
@@ -1245,6 +1278,75 @@ dstrtrim_right(dstr_t *ds)
 }
 
 
+//
+//  LINE READER
+//
+
+linereader_t *
+create_linereader(FILE *file,
+		  const char *alreadyread,
+		  size_t alreadyread_len)
+{
+  linereader_t *lr = calloc(1, sizeof(linereader_t));
+
+  lr->file = file;
+  lr->alreadyread = alreadyread;
+  lr->alreadyread_len = alreadyread ? alreadyread_len : 0;
+  return (lr);
+}
+
+
+void
+free_linereader(linereader_t *lr)
+{
+  free(lr->buffer);
+  free(lr);
+}
+
+
+size_t
+linereader_next(linereader_t *lr,
+		const char **line)
+{
+  const char *start, *p;
+  size_t len = 0;
+  ssize_t bytes;
+
+  // Lines in the data read before are handed out right from there, only
+  // one continuing in the file needs to be put together
+  if (lr->pos < lr->alreadyread_len)
+  {
+    start = lr->alreadyread + lr->pos;
+    p = memchr(start, '\n', lr->alreadyread_len - lr->pos);
+    len = p ? (size_t)(p - start + 1) : lr->alreadyread_len - lr->pos;
+    lr->pos += len;
+    *line = start;
+    if (p || !lr->file)
+      return (len);
+  }
+
+  // The rest comes from the file, stdio finds the end of the line in its
+  // buffer and copies the line as a whole, and does not block on more
+  // input than the line
+  if (!lr->file || (bytes = getline(&lr->buffer, &lr->alloc, lr->file)) < 0)
+    return (len);
+
+  if (len)
+  {
+    if (len + (size_t)bytes >= lr->alloc)
+    {
+      lr->alloc = len + (size_t)bytes + 1;
+      lr->buffer = realloc(lr->buffer, lr->alloc);
+    }
+    memmove(lr->buffer + len, lr->buffer, (size_t)bytes + 1);
+    memcpy(lr->buffer, start, len);
+  }
+
+  *line = lr->buffer;
+  return (len + (size_t)bytes);
+}
+
+
 //
 //  LIST
 //
@@ -1547,6 +1649,20 @@ hash_data(unsigned char *data,	      // I - Data to hash
 }
 
 
+//
+// System directories to load system hashes from (defined in Makefile.am)
+//
+// SYS_HASH_PATH - /usr/share/foomatic/hashes.d by default
+// USR_HASH_PATH - /etc/foomatic/hashes.d by default
+//
+
+static const char *hash_dirs[] = {
+  SYS_HASH_PATH,
+  USR_HASH_PATH,
+  NULL
+};
+
+
 //
 // 'load_system_hashes()' - Load hashes from system.
 //
@@ -1559,19 +1675,6 @@ load_system_hashes(cups_array_t **hashes) // O - Array of existing hashes
   cups_dentry_t *dent = NULL;		  // CUPS struct representing an object in directory
   int		i = 0;			  // Array index
 
-  //
-  // System directories to load system hashes from (defined in Makefile.am)
-  //
-  // SYS_HASH_PATH - /usr/share/foomatic/hashes.d by default
-  // USR_HASH_PATH - /etc/foomatic/hashes.d by default
-  //
-
-  const char *dirs[] = {
-    SYS_HASH_PATH,
-    USR_HASH_PATH,
-    NULL
-  };
-
   if (!hashes)
     return (1);
 
@@ -1585,11 +1688,11 @@ load_system_hashes(cups_array_t **hashes) // O - Array of existing hashes
   // Go through files in directories and load hashes...
   //
 
-  while (dirs[i] != NULL)
+  while (hash_dirs[i] != NULL)
   {
-    if ((dir = cupsDirOpen(dirs[i])) == NULL)
+    if ((dir = cupsDirOpen(hash_dirs[i])) == NULL)
     {
-      fprintf(stderr, "Could not open the directory \"%s\" - ignoring...\n", dirs[i++]);
+      fprintf(stderr, "Could not open the directory \"%s\" - ignoring...\n", hash_dirs[i++]);
       continue;
     }
 
@@ -1604,7 +1707,7 @@ load_system_hashes(cups_array_t **hashes) // O - Array of existing hashes
 	  (dent->fileinfo.st_mode & S_IWOTH))
         continue;
 
-      snprintf(filename, sizeof(filename), "%s/%s", dirs[i], dent->filename);
+      snprintf(filename, sizeof(filename), "%s/%s", hash_dirs[i], dent->filename);
 
       if (!is_valid_path(filename, IS_FILE))
 	continue;
@@ -1622,6 +1725,65 @@ load_system_hashes(cups_array_t **hashes) // O - Array of existing hashes
 }
 
 
+//
+// 'get_system_hashes_state()' - Get a fingerprint of the system hashes.
+//
+// The fingerprint covers the names, sizes, modification times and owners
+// of the files in the hash directories, so it changes whenever a hash is
+// added, removed or edited. It lets callers reuse results which were
+// checked against the hashes without loading them.
+//
+
+int					// O - success 0 / error 1
+get_system_hashes_state(char   *state,	// O - Hexadecimal fingerprint
+			size_t state_len)
+					// I - Length of fingerprint
+{
+  dstr_t	*data;			// Data describing the directories
+  char		entry[1024];		// Description of one entry
+  cups_dir_t	*dir;			// CUPS struct representing dir
+  cups_dentry_t	*dent;			// CUPS struct representing an object in directory
+  struct stat	fileinfo;		// Information about a directory
+  int		i,			// Array index
+		ret;			// Return value
+
+
+  data = create_dstr();
+
+  for (i = 0; hash_dirs[i] != NULL; i ++)
+  {
+    if (stat(hash_dirs[i], &fileinfo) ||
+	(dir = cupsDirOpen(hash_dirs[i])) == NULL)
+    {
+      snprintf(entry, sizeof(entry), "%s -\n", hash_dirs[i]);
+      dstrcat(data, entry);
+      continue;
+    }
+
+    snprintf(entry, sizeof(entry), "%s %ld %ld\n", hash_dirs[i],
+	     (long)fileinfo.st_ino, (long)fileinfo.st_mtime);
+    dstrcat(data, entry);
+
+    while ((dent = cupsDirRead(dir)) != NULL)
+    {
+      snprintf(entry, sizeof(entry), "%s %ld %ld %ld %ld %o\n",
+	       dent->filename, (long)dent->fileinfo.st_ino,
+	       (long)dent->fileinfo.st_size, (long)dent->fileinfo.st_mtime,
+	       (long)dent->fileinfo.st_uid, (unsigned)dent->fileinfo.st_mode);
+      dstrcat(data, entry);
+    }
+
+    cupsDirClose(dir);
+  }
+
+  ret = hash_data((unsigned char *)data->data, data->len, state, state_len);
+
+  free_dstr(data);
+
+  return (ret);
+}
+
+
 //
 // `load_array()` - Loads data from file into CUPS array...
 //
@@ -198,6 +198,7 @@ int is_valid_path(char *path, enum filetype type);
 // Hash functions
 int hash_data(unsigned char* data, size_t datalen, char *hash_string, size_t string_len);
 int load_system_hashes(cups_array_t **hashes);
+int get_system_hashes_state(char *state, size_t state_len);
 
 // Dynamic string
 typedef struct dstr
@@ -214,6 +215,9 @@ void dstrassure(dstr_t *ds, size_t alloc);
 void dstrcpy(dstr_t *ds, const char *src);
 void dstrncpy(dstr_t *ds, const char *src, size_t n);
 void dstrncat(dstr_t *ds, const char *src, size_t n);
+void dstrcpybin(dstr_t *ds, const char *src, size_t n);
+void dstrcatbin(dstr_t *ds, const char *src, size_t n);
+                            // like dstrncpy()/dstrncat(), for binary data
 void dstrcpyf(dstr_t *ds, const char *src, ...);
 void dstrcat(dstr_t *ds, const char *src);
 void dstrcatf(dstr_t *ds, const char *src, ...);
@@ -233,6 +237,24 @@ void dstrremovenewline(dstr_t *ds);
 void dstrtrim(dstr_t *ds);
 void dstrtrim_right(dstr_t *ds);
 
+// Line reader, hands out the lines of data read before and then of a file;
+// lines are only valid until the next one is read
+typedef struct linereader_s
+{
+  FILE *file;
+  const char *alreadyread;
+  size_t alreadyread_len;
+  size_t pos;
+  char *buffer;
+  size_t alloc;
+} linereader_t;
+
+linereader_t * create_linereader(FILE *file, const char *alreadyread,
+				 size_t alreadyread_len);
+void free_linereader(linereader_t *lr);
+size_t linereader_next(linereader_t *lr, const char **line);
+                            // returns length of line (incl. \n), 0 at end
+
 // Doubly linked list of void pointers
 typedef struct listitem_s
 {
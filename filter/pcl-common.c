@@ -9,9 +9,19 @@
 //
 // Contents:
 //
-//   pcl_set_media_size() - Set media size using the page size command.
-//   pjl_write()          - Write a PJL command string, performing
-//                          substitutions as needed.
+//   pcl_compress_delta()     - Compress a line with delta-row encoding
+//                              (mode 3).
+//   pcl_compress_delta_rle() - Compress a line with compressed replacement
+//                              delta-row encoding (mode 9).
+//   pcl_compress_rle()       - Compress a line with run-length encoding
+//                              (mode 1).
+//   pcl_set_media_size()     - Set media size using the page size command.
+//   pjl_compile()            - Compile a PJL command string for a job.
+//   pjl_expand()             - Write a compiled PJL command string.
+//   pjl_free()               - Free a compiled PJL command string.
+//   pjl_add()                - Add a token to a compiled PJL command string.
+//   put_extended()           - Put the extension bytes of a mode 9 offset
+//                              or count.
 //
 
 //
@@ -22,20 +32,395 @@
 #include <ppd/ppd.h>
 #include <ppd/ppd-filter.h>
 #include "pcl-common.h"
+#include "raster-common.h"
 #include <math.h>
 
 
+//
+// Compiled PJL command strings...
+//
+// Everything but the "value" substitutions (%s and %?value:string;) is
+// known once the job starts, so a template is compiled into literal text
+// and those substitutions, and only they are looked at when it is written.
+//
+
+enum
+{
+  PJL_TEXT,				// Literal text
+  PJL_VALUE,				// %s
+  PJL_MATCH				// %?value:string;
+};
+
+typedef struct pjl_token_s		// Template token
+{
+  int		type;			// Type of token
+  size_t	offset,			// Offset of text or string
+		length,			// Length of text or string
+		match,			// Offset of value to match
+		match_length;		// Length of value to match
+} pjl_token_t;
+
+struct pjl_template_s			// Compiled PJL command string
+{
+  int		num_tokens,		// Number of tokens
+		alloc_tokens;		// Allocated tokens
+  pjl_token_t	*tokens;		// Tokens
+  char		*text;			// Text of all tokens
+  size_t	length,			// Length of text
+		alloc_length;		// Allocated text
+};
+
+
+//
+// PCL page sizes, by the length of the long edge in points...
+//
+
+typedef struct pcl_size_s
+{
+  int		length,			// Long edge in points
+		code;			// PCL page size code
+} pcl_size_t;
+
+static const pcl_size_t	pcl_sizes[] =
+{
+  {  419,  71 },			// Postcard
+  {  540,  80 },			// Monarch Envelope
+  {  567,  72 },			// Double Postcard
+  {  595,  25 },			// A5
+  {  612,   5 },			// Statement
+  {  624,  90 },			// DL Envelope
+  {  649,  91 },			// C5 Envelope
+  {  684,  81 },			// COM-10 Envelope
+  {  709, 100 },			// B5 Envelope
+  {  729,  45 },			// B5
+  {  756,   1 },			// Executive
+  {  792,   2 },			// Letter
+  {  842,  26 },			// A4
+  {  936,  23 },			// Foolscap
+  { 1008,   3 },			// Legal
+  { 1032,  46 },			// B4
+  { 1191,  27 },			// A3
+  { 1224,   6 }				// Tabloid
+};
+
+
+//
+// Local functions...
+//
+
+static int		pjl_add(pjl_template_t *t, int type, const char *text,
+			        size_t length, const char *match,
+				size_t match_length);
+static unsigned char	*put_extended(unsigned char *dst, int value);
+
+
+//
+// 'pcl_compress_delta()' - Compress a line with delta-row encoding (mode 3).
+//
+// Each command replaces up to 8 bytes that differ from the seed row.  When
+// the printer's seed row is not known, pass NULL for "seed" and the whole
+// line is sent as replacement bytes.
+//
+
+int					// O - Number of bytes in "dst"
+pcl_compress_delta(
+    unsigned char       *dst,		// O - Compressed data
+    const unsigned char *src,		// I - Line to compress
+    const unsigned char *seed,		// I - Seed row or NULL
+    int                 length)		// I - Number of bytes in line
+{
+  const unsigned char	*src_ptr,	// Current byte
+			*src_end,	// End of line
+			*start;		// Start of replacement bytes
+  unsigned char		*dst_ptr;	// Current output byte
+  int			count,		// Number of replacement bytes
+			offset;		// Offset from last replacement
+
+
+  for (src_ptr = src, src_end = src + length, dst_ptr = dst;
+       src_ptr < src_end;)
+  {
+    //
+    // Find the next non-matching sequence...
+    //
+
+    start = src_ptr;
+
+    if (!seed)
+    {
+      //
+      // The seed row is invalid, so do the next 8 bytes, max...
+      //
+
+      offset = 0;
+
+      if ((count = src_end - src_ptr) > 8)
+        count = 8;
+
+      src_ptr += count;
+    }
+    else
+    {
+      //
+      // The seed row is valid, so compare against it...
+      //
+
+      offset  = (int)raster_count_same(src_ptr, seed,
+                                       (size_t)(src_end - src_ptr));
+      src_ptr += offset;
+      seed    += offset;
+
+      if (src_ptr == src_end)
+        break;
+
+      //
+      // Find up to 8 non-matching bytes...
+      //
+
+      start = src_ptr;
+      count = 0;
+      while (src_ptr < src_end && *src_ptr != *seed && count < 8)
+      {
+        src_ptr ++;
+        seed ++;
+        count ++;
+      }
+    }
+
+    //
+    // Place mode 3 compression data in the buffer; see HP manuals
+    // for details...
+    //
+
+    if (offset >= 31)
+    {
+      //
+      // Output multi-byte offset...
+      //
+
+      *dst_ptr++ = ((count - 1) << 5) | 31;
+
+      offset -= 31;
+      while (offset >= 255)
+      {
+        *dst_ptr++ = 255;
+        offset    -= 255;
+      }
+
+      *dst_ptr++ = offset;
+    }
+    else
+    {
+      //
+      // Output single-byte offset...
+      //
+
+      *dst_ptr++ = ((count - 1) << 5) | offset;
+    }
+
+    memcpy(dst_ptr, start, count);
+    dst_ptr += count;
+  }
+
+  return ((int)(dst_ptr - dst));
+}
+
+
+//
+// 'pcl_compress_delta_rle()' - Compress a line with compressed replacement
+//                              delta-row encoding (mode 9).
+//
+// Like mode 3, only the bytes that differ from the seed row are sent, but
+// each command can replace any number of bytes and runs of 4 or more equal
+// replacement bytes are run-length encoded.  When the printer's seed row is
+// not known, pass NULL for "seed" and the whole line is sent as replacement
+// bytes.  "dst" must hold at least length + length / 8 + 8 bytes.
+//
+
+int					// O - Number of bytes in "dst"
+pcl_compress_delta_rle(
+    unsigned char       *dst,		// O - Compressed data
+    const unsigned char *src,		// I - Line to compress
+    const unsigned char *seed,		// I - Seed row or NULL
+    int                 length)		// I - Number of bytes in line
+{
+  const unsigned char	*src_ptr,	// Current byte
+			*src_end,	// End of line
+			*end,		// End of replacement bytes
+			*run;		// Start of next run of equal bytes
+  unsigned char		*dst_ptr;	// Current output byte
+  int			count,		// Number of bytes for command
+			offset,		// Offset from last replacement
+			temp;		// Count in command byte
+
+
+  for (src_ptr = src, src_end = src + length, dst_ptr = dst;
+       src_ptr < src_end;)
+  {
+    //
+    // Find the next non-matching sequence...
+    //
+
+    if (!seed)
+    {
+      //
+      // The seed row is invalid, so replace the rest of the line...
+      //
+
+      offset = 0;
+      end    = src_end;
+    }
+    else
+    {
+      //
+      // The seed row is valid, so compare against it...
+      //
+
+      offset  = (int)raster_count_same(src_ptr, seed,
+                                       (size_t)(src_end - src_ptr));
+      src_ptr += offset;
+      seed    += offset;
+
+      if (src_ptr == src_end)
+        break;
+
+      count = (int)raster_count_diff(src_ptr, seed,
+                                     (size_t)(src_end - src_ptr));
+      end   = src_ptr + count;
+      seed += count;
+    }
+
+    //
+    // Split the replacement bytes into literal bytes and runs; the offset
+    // only applies to the first command...
+    //
+
+    while (src_ptr < end)
+    {
+      for (run = src_ptr;
+           run + 3 < end &&
+	       (run[0] != run[1] || run[0] != run[2] || run[0] != run[3]);
+	   run ++);
+
+      if (run + 3 >= end)
+        run = end;
+
+      if ((count = (int)(run - src_ptr)) > 0)
+      {
+        //
+	// Output literal bytes; the command byte looks like:
+	//
+	//     0 OFF OFF OFF OFF CNT CNT CNT
+	//
+	// with offset and count - 1 extended by additional bytes when they
+	// are 15 and 7 respectively...
+	//
+
+	temp = count - 1 > 7 ? 7 : count - 1;
+
+	if (offset >= 15)
+	{
+	  *dst_ptr++ = (15 << 3) | temp;
+	  dst_ptr    = put_extended(dst_ptr, offset - 15);
+	}
+	else
+	  *dst_ptr++ = (offset << 3) | temp;
+
+	if (temp == 7)
+	  dst_ptr = put_extended(dst_ptr, count - 8);
+
+	memcpy(dst_ptr, src_ptr, count);
+	dst_ptr += count;
+	src_ptr  = run;
+	offset   = 0;
+      }
+
+      if (run < end)
+      {
+        //
+	// Output a run of equal bytes; the command byte looks like:
+	//
+	//     1 OFF OFF CNT CNT CNT CNT CNT
+	//
+	// followed by the offset extension bytes, the byte to repeat and
+	// the count extension bytes, with offset and count - 2 extended when
+	// they are 3 and 31 respectively...
+	//
+
+	for (src_ptr = run + 4; src_ptr < end && *src_ptr == *run; src_ptr ++);
+
+	count = (int)(src_ptr - run);
+	temp  = count - 2 > 31 ? 31 : count - 2;
+
+	if (offset >= 3)
+	{
+	  *dst_ptr++ = 0x80 | (3 << 5) | temp;
+	  dst_ptr    = put_extended(dst_ptr, offset - 3);
+	}
+	else
+	  *dst_ptr++ = 0x80 | (offset << 5) | temp;
+
+	*dst_ptr++ = *run;
+
+	if (temp == 31)
+	  dst_ptr = put_extended(dst_ptr, count - 33);
+
+	offset = 0;
+      }
+    }
+  }
+
+  return ((int)(dst_ptr - dst));
+}
+
+
+//
+// 'pcl_compress_rle()' - Compress a line with run-length encoding (mode 1).
+//
+
+int					// O - Number of bytes in "dst"
+pcl_compress_rle(
+    unsigned char       *dst,		// O - Compressed data
+    const unsigned char *src,		// I - Line to compress
+    int                 length)		// I - Number of bytes in line
+{
+  const unsigned char	*src_ptr,	// Current byte
+			*src_end;	// End of line
+  unsigned char		*dst_ptr;	// Current output byte
+  int			count;		// Run length
+
+
+  for (src_ptr = src, src_end = src + length, dst_ptr = dst;
+       src_ptr < src_end;
+       dst_ptr += 2, src_ptr += count)
+  {
+    for (count = 1;
+         (src_ptr + count) < src_end &&
+	     src_ptr[0] == src_ptr[count] &&
+	     count < 256;
+         count ++);
+
+    dst_ptr[0] = count - 1;
+    dst_ptr[1] = src_ptr[0];
+  }
+
+  return ((int)(dst_ptr - dst));
+}
+
+
 //
 // 'pcl_set_media_size()' - Set media size using the page size command.
 //
 
 void
-pcl_set_media_size(ppd_file_t *ppd,	// I - PPD file
-                   float      width,	// I - Width of page
-                   float      length)	// I - Length of page
+pcl_set_media_size(raster_out_t *out,	// I - Output buffer
+                   ppd_file_t   *ppd,	// I - PPD file
+                   float        width,	// I - Width of page
+                   float        length)	// I - Length of page
 {
   float l;
   int l_int;
+  const pcl_size_t *size;		// Current page size
 
   if (width < length)
     l = length;
@@ -45,276 +430,339 @@ pcl_set_media_size(ppd_file_t *ppd,	// I - PPD file
   fprintf (stderr, "DEBUG: Width: %f Length: %f Long Edge: %f\n",
 	   width, length, l);
 
-  printf("\033&l0O");			// Set portrait orientation
+  raster_out_printf(out, "\033&l0O");	// Set portrait orientation
 
   if (!ppd || ppd->model_number & PCL_PAPER_SIZE)
   {
-    if (l_int >= 418 && l_int <= 420) // Postcard
-      printf("\033&l71A");		// Set page size
-    else if (l_int >= 539 && l_int <= 541) // Monarch Envelope
-      printf("\033&l80A");		// Set page size
-    else if (l_int >= 566 && l_int <= 568) // Double Postcard
-      printf("\033&l72A");		// Set page size
-    else if (l_int >= 594 && l_int <= 596) // A5
-      printf("\033&l25A");		// Set page size
-    else if (l_int >= 611 && l_int <= 613) // Statement
-      printf("\033&l5A");		// Set page size
-    else if (l_int >= 623 && l_int <= 625) // DL Envelope
-      printf("\033&l90A");		// Set page size
-    else if (l_int >= 648 && l_int <= 650) // C5 Envelope
-      printf("\033&l91A");		// Set page size
-    else if (l_int >= 683 && l_int <= 685) // COM-10 Envelope
-      printf("\033&l81A");		// Set page size
-    else if (l_int >= 708 && l_int <= 710) // B5 Envelope
-      printf("\033&l100A");		// Set page size
-    else if (l_int >= 728 && l_int <= 730) // B5
-      printf("\033&l45A");		// Set page size
-    else if (l_int >= 755 && l_int <= 757) // Executive
-      printf("\033&l1A");		// Set page size
-    else if (l_int >= 791 && l_int <= 793) // Letter
-      printf("\033&l2A");		// Set page size
-    else if (l_int >= 841 && l_int <= 843) // A4
-      printf("\033&l26A");		// Set page size
-    else if (l_int >= 935 && l_int <= 937) // Foolscap
-      printf("\033&l23A");		// Set page size
-    else if (l_int >= 1007 && l_int <= 1009) // Legal
-      printf("\033&l3A");		// Set page size
-    else if (l_int >= 1031 && l_int <= 1033) // B4
-      printf("\033&l46A");		// Set page size
-    else if (l_int >= 1190 && l_int <= 1192) // A3
-      printf("\033&l27A");		// Set page size
-    else if (l_int >= 1223 && l_int <= 1225) // Tabloid
-      printf("\033&l6A");		// Set page size
+    for (size = pcl_sizes;
+         size < pcl_sizes + sizeof(pcl_sizes) / sizeof(pcl_sizes[0]);
+	 size ++)
+      if (l_int >= size->length - 1 && l_int <= size->length + 1)
+        break;
+
+    if (size < pcl_sizes + sizeof(pcl_sizes) / sizeof(pcl_sizes[0]))
+      raster_out_printf(out, "\033&l%dA", size->code);
+					// Set page size
     else
     {
-      printf("\033&l101A");		// Set page size
-      printf("\033&l6D\033&k12H");	// Set 6 LPI, 10 CPI
-      printf("\033&l%.2fP", l / 12.0);	// Set page length
-      printf("\033&l%.0fF", l / 12.0);	// Set text length to page
+      raster_out_printf(out, "\033&l101A");	// Set page size
+      raster_out_printf(out, "\033&l6D\033&k12H");	// Set 6 LPI, 10 CPI
+      raster_out_printf(out, "\033&l%.2fP", l / 12.0);
+					// Set page length
+      raster_out_printf(out, "\033&l%.0fF", l / 12.0);
+					// Set text length to page
     }
-#if 0
-    switch ((int)(l + 0.5f))
-    {
-      case 419 : // Postcard
-          printf("\033&l71A");		// Set page size
-	  break;
+  }
+  else
+  {
+    raster_out_printf(out, "\033&l6D\033&k12H");	// Set 6 LPI, 10 CPI
+    raster_out_printf(out, "\033&l%.2fP", l / 12.0);
+					// Set page length
+    raster_out_printf(out, "\033&l%.0fF", l / 12.0);
+					// Set text length to page
+  }
 
-      case 540 : // Monarch Envelope
-          printf("\033&l80A");		// Set page size
-	  break;
+  raster_out_printf(out, "\033&l0L");	// Turn off perforation skip
+  raster_out_printf(out, "\033&l0E");	// Reset top margin to 0
+}
 
-      case 567 : // Double Postcard
-          printf("\033&l72A");		// Set page size
-	  break;
 
-      case 595 : // A5
-          printf("\033&l25A");		// Set page size
-	  break;
+//
+// 'pjl_compile()' - Compile a PJL command string for a job.
+//
+// The job substitutions (%b, %h, %j, %n, %q, %t, %u and %%) are done
+// here, leaving %s and %?value:string; for pjl_expand().
+//
 
-      case 612 : // Statement
-          printf("\033&l5A");		// Set page size
-	  break;
+pjl_template_t *			// O - Compiled string or NULL
+pjl_compile(const char    *format,	// I - Format string
+            int           job_id,	// I - Job ID
+            const char    *user,	// I - Username
+	    const char    *title,	// I - Title
+	    int           num_options,	// I - Number of options
+            cups_option_t *options)	// I - Options
+{
+  pjl_template_t *t;			// Compiled string
+  const char	*start,			// Start of literal text
+		*optval,		// Option value
+		*match;			// Value to match
+  size_t	match_length;		// Length of value to match
+  char		id[32];			// Job ID string
+  int		ok = 1;			// Tokens added?
 
-      case 624 : // DL Envelope
-          printf("\033&l90A");		// Set page size
-	  break;
 
-      case 649 : // C5 Envelope
-          printf("\033&l91A");		// Set page size
-	  break;
+  if (!format || (t = calloc(1, sizeof(pjl_template_t))) == NULL)
+    return (NULL);
 
-      case 684 : // COM-10 Envelope
-          printf("\033&l81A");		// Set page size
-	  break;
+  while (*format && ok)
+  {
+    //
+    // Copy literal text up to the next substitution...
+    //
+
+    for (start = format; *format && *format != '%'; format ++);
+
+    if (format > start)
+      ok = pjl_add(t, PJL_TEXT, start, (size_t)(format - start), NULL, 0);
 
-      case 709 : // B5 Envelope
-          printf("\033&l100A");		// Set page size
+    if (!*format || !ok)
+      break;
+
+    //
+    // Perform substitution...
+    //
+
+    format ++;
+    optval = NULL;
+
+    switch (*format)
+    {
+      case 'b' :			// job-billing
+	  optval = cupsGetOption("job-billing", num_options, options);
 	  break;
 
-      case 729 : // B5
-          printf("\033&l45A");		// Set page size
+      case 'h' :			// job-originating-host-name
+	  optval = cupsGetOption("job-originating-host-name", num_options,
+	                         options);
 	  break;
 
-      case 756 : // Executive
-          printf("\033&l1A");		// Set page size
+      case 'j' :			// job-id
+	  snprintf(id, sizeof(id), "%d", job_id);
+	  optval = id;
 	  break;
 
-      case 792 : // Letter
-          printf("\033&l2A");		// Set page size
+      case 'n' :			// CR + LF
+	  optval = "\r\n";
 	  break;
 
-      case 842 : // A4
-          printf("\033&l26A");		// Set page size
+      case 'q' :			// double quote (")
+	  optval = "\"";
 	  break;
 
-      case 936 : // Foolscap
-          printf("\033&l23A");		// Set page size
+      case 's' :			// "value"
+	  ok = pjl_add(t, PJL_VALUE, NULL, 0, NULL, 0);
 	  break;
 
-      case 1008 : // Legal
-          printf("\033&l3A");		// Set page size
+      case 't' :			// job-name
+	  optval = title;
 	  break;
 
-      case 1032 : // B4
-          printf("\033&l46A");		// Set page size
+      case 'u' :			// job-originating-user-name
+	  optval = user;
 	  break;
 
-      case 1191 : // A3
-          printf("\033&l27A");		// Set page size
+      case '?' :			// ?value:string;
+	  //
+	  // Get the match value, then the string to copy when it
+	  // matches...
+	  //
+
+	  for (match = ++ format; *format && *format != ':'; format ++);
+
+	  if (!*format)
+	    return (t);
+
+	  if ((match_length = (size_t)(format - match)) > 254)
+	    match_length = 254;
+
+	  for (start = ++ format; *format && *format != ';'; format ++);
+
+	  ok = pjl_add(t, PJL_MATCH, start, (size_t)(format - start), match,
+	               match_length);
+
+	  if (!*format)
+	    return (t);
 	  break;
 
-      case 1224 : // Tabloid
-          printf("\033&l6A");		// Set page size
+      case '\0' :			// Trailing %
+	  ok = pjl_add(t, PJL_TEXT, "%", 1, NULL, 0);
+	  continue;
+
+      default :				// Anything else
+	  ok = pjl_add(t, PJL_TEXT, format - 1, 2, NULL, 0);
 	  break;
 
-      default :
-          printf("\033&l101A");		// Set page size
-	  printf("\033&l6D\033&k12H");	// Set 6 LPI, 10 CPI
-	  printf("\033&l%.2fP", l / 12.0);
-					// Set page length
-	  printf("\033&l%.0fF", l / 12.0);
-					// Set text length to page
+      case '%' :			// %% = single %
+	  ok = pjl_add(t, PJL_TEXT, format, 1, NULL, 0);
 	  break;
     }
-#endif
+
+    if (optval && ok)
+      ok = pjl_add(t, PJL_TEXT, optval, strlen(optval), NULL, 0);
+
+    format ++;
   }
-  else
+
+  if (!ok)
   {
-    printf("\033&l6D\033&k12H");	// Set 6 LPI, 10 CPI
-    printf("\033&l%.2fP", l / 12.0);
-					// Set page length
-    printf("\033&l%.0fF", l / 12.0);
-					// Set text length to page
+    pjl_free(t);
+    return (NULL);
   }
 
-  printf("\033&l0L");			// Turn off perforation skip
-  printf("\033&l0E");			// Reset top margin to 0
+  return (t);
 }
 
 
 //
-// 'pjl_write()' - Write a PJL command string, performing substitutions as
-//                 needed.
+// 'pjl_expand()' - Write a compiled PJL command string.
 //
 
 void
-pjl_write(const char    *format,	// I - Format string
-          const char    *value,		// I - Value for %s
-	  int           job_id,		// I - Job ID
-          const char    *user,		// I - Username
-	  const char    *title,		// I - Title
-	  int           num_options,	// I - Number of options
-          cups_option_t *options)	// I - Options
+pjl_expand(raster_out_t         *out,	// I - Output buffer
+           const pjl_template_t *t,	// I - Compiled string
+           const char           *value)	// I - Value for %s
 {
-  const char	*optval;		// Option value
-  char		match[255],		// Match string
-		*mptr;			// Pointer into match string
+  int			i;		// Looping var
+  const pjl_token_t	*token;		// Current token
+  size_t		value_length;	// Length of value
 
 
-  if (!format)
+  if (!t)
     return;
 
-  while (*format)
+  value_length = value ? strlen(value) : 0;
+
+  for (i = t->num_tokens, token = t->tokens; i > 0; i --, token ++)
   {
-    if (*format == '%')
+    switch (token->type)
     {
-      //
-      // Perform substitution...
-      //
+      case PJL_TEXT :
+          raster_out_write(out, t->text + token->offset, token->length);
+	  break;
 
-      format ++;
-      switch (*format)
-      {
-        case 'b' :			// job-billing
-	    if ((optval = cupsGetOption("job-billing", num_options,
-	                                options)) != NULL)
-	      fputs(optval, stdout);
-	    break;
-
-	case 'h' :			// job-originating-host-name
-	    if ((optval = cupsGetOption("job-originating-host-name",
-	                                num_options, options)) != NULL)
-	      fputs(optval, stdout);
-	    break;
-
-	case 'j' :			// job-id
-	    printf("%d", job_id);
-	    break;
-
-	case 'n' :			// CR + LF
-	    putchar('\r');
-	    putchar('\n');
-	    break;
-
-	case 'q' :			// double quote (")
-	    putchar('\"');
-	    break;
-
-	case 's' :			// "value"
-	    if (value)
-	      fputs(value, stdout);
-	    break;
-
-	case 't' :			// job-name
-            fputs(title, stdout);
-	    break;
-
-	case 'u' :			// job-originating-user-name
-            fputs(user, stdout);
-	    break;
-
-        case '?' :			// ?value:string;
-            //
-	    // Get the match value...
-	    //
-
-	    for (format ++, mptr = match; *format && *format != ':'; format ++)
-	      if (mptr < (match + sizeof(match) - 1))
-	        *mptr++ = *format;
-
-            if (!*format)
-	      return;
-
-	    //
-	    // See if we have a match...
-	    //
-
-            format ++;
-            *mptr = '\0';
-
-	    if (!value || strcmp(match, value))
-	    {
-	      //
-	      // Value doesn't match; skip the string that follows...
-	      //
-
-              while (*format && *format != ';')
-	        format ++;
-	    }
-	    else
-	    {
-	      //
-	      // Value matches; copy the string that follows...
-	      //
-
-              while (*format && *format != ';')
-	        putchar(*format++);
-	    }
-
-	    if (!*format)
-	      return;
-	    break;
-
-	default :			// Anything else
-	    putchar('%');
-	case '%' :			// %% = single %
-	    putchar(*format);
-	    break;
-      }
+      case PJL_VALUE :
+          if (value)
+	    raster_out_write(out, value, value_length);
+	  break;
+
+      case PJL_MATCH :
+          if (value && value_length == token->match_length &&
+	      !memcmp(t->text + token->match, value, value_length))
+            raster_out_write(out, t->text + token->offset, token->length);
+	  break;
     }
-    else
-      putchar(*format);
+  }
+}
 
-    format ++;
+
+//
+// 'pjl_free()' - Free a compiled PJL command string.
+//
+
+void
+pjl_free(pjl_template_t *t)		// I - Compiled string
+{
+  if (!t)
+    return;
+
+  free(t->tokens);
+  free(t->text);
+  free(t);
+}
+
+
+//
+// 'pjl_add()' - Add a token to a compiled PJL command string.
+//
+// Literal text is joined with the text token before it.
+//
+
+static int				// O - 1 on success, 0 on error
+pjl_add(pjl_template_t *t,		// I - Compiled string
+        int            type,		// I - Type of token
+        const char     *text,		// I - Text or string
+        size_t         length,		// I - Length of text or string
+        const char     *match,		// I - Value to match or NULL
+        size_t         match_length)	// I - Length of value to match
+{
+  pjl_token_t	*token;			// New token
+  size_t	needed;			// Text needed
+  void		*temp;			// New allocation
+
+
+  //
+  // Make room for the text...
+  //
+
+  if ((needed = t->length + length + match_length) > t->alloc_length)
+  {
+    if (needed < 2 * t->alloc_length)
+      needed = 2 * t->alloc_length;
+    if (needed < 256)
+      needed = 256;
+
+    if ((temp = realloc(t->text, needed)) == NULL)
+      return (0);
+
+    t->text         = temp;
+    t->alloc_length = needed;
   }
+
+  //
+  // Then for the token, unless the text goes with the previous one...
+  //
+
+  if (type == PJL_TEXT && t->num_tokens > 0 &&
+      t->tokens[t->num_tokens - 1].type == PJL_TEXT)
+    token = t->tokens + t->num_tokens - 1;
+  else
+  {
+    if (t->num_tokens >= t->alloc_tokens)
+    {
+      if ((temp = realloc(t->tokens, (size_t)(t->alloc_tokens + 16) *
+                                     sizeof(pjl_token_t))) == NULL)
+        return (0);
+
+      t->tokens       = temp;
+      t->alloc_tokens += 16;
+    }
+
+    token = t->tokens + t->num_tokens ++;
+
+    memset(token, 0, sizeof(pjl_token_t));
+
+    token->type   = type;
+    token->offset = t->length;
+
+    if (match)
+    {
+      memcpy(t->text + t->length, match, match_length);
+
+      token->match        = t->length;
+      token->match_length = match_length;
+      token->offset       = t->length += match_length;
+    }
+  }
+
+  if (length > 0)
+  {
+    memcpy(t->text + t->length, text, length);
+
+    t->length     += length;
+    token->length += length;
+  }
+
+  return (1);
+}
+
+
+//
+// 'put_extended()' - Put the extension bytes of a mode 9 offset or count.
+//
+// Each extension byte of 255 means that another byte follows.
+//
+
+static unsigned char *			// O - Next output byte
+put_extended(unsigned char *dst,	// I - Output buffer
+             int           value)	// I - Remaining offset or count
+{
+  while (value >= 255)
+  {
+    *dst++ = 255;
+    value -= 255;
+  }
+
+  *dst++ = value;
+
+  return (dst);
 }
@@ -16,50 +16,66 @@
 #include <string.h>
 #include <ctype.h>
 #include "pcl.h"
+#include "raster-common.h"
+
+
+//
+// Types...
+//
+
+typedef struct pjl_template_s pjl_template_t;
+					// Compiled PJL command string
 
 
 //
 // Functions/macros...
 //
 
-#define pcl_reset()\
-	printf("\033E")
-#define pcl_set_copies(copies)\
-	printf("\033&l%dX", (copies))
-#define pcl_set_pcl_mode(m)\
-	printf("\033%%%dA", (m))
-#define pcl_set_hpgl_mode(m)\
-	printf("\033%%%dB", (m))
-#define pcl_set_negative_motion()\
-        printf("\033&a1N")
-#define pcl_set_media_source(source)\
-	printf("\033&l%dH", source)
-#define pcl_set_media_type(type)\
-	printf("\033&l%dM", type)
-#define pcl_set_duplex(duplex,landscape)\
-	if (duplex) printf("\033&l%dS", (duplex) + (landscape))
-#define pcl_set_simple_black()\
-	printf("\033*r-1U")
-#define pcl_set_simple_color()\
-	printf("\033*r3U")
-#define pcl_set_simple_cmy()\
-	printf("\033*r-3U")
-#define pcl_set_simple_kcmy()\
-	printf("\033*r-4U")
-#define pcl_set_simple_resolution(r)\
-	printf("\033*t%dR", (r))
+#define pcl_reset(out)\
+	raster_out_printf((out), "\033E")
+#define pcl_set_copies(out,copies)\
+	raster_out_printf((out), "\033&l%dX", (copies))
+#define pcl_set_pcl_mode(out,m)\
+	raster_out_printf((out), "\033%%%dA", (m))
+#define pcl_set_hpgl_mode(out,m)\
+	raster_out_printf((out), "\033%%%dB", (m))
+#define pcl_set_negative_motion(out)\
+        raster_out_printf((out), "\033&a1N")
+#define pcl_set_media_source(out,source)\
+	raster_out_printf((out), "\033&l%dH", source)
+#define pcl_set_media_type(out,type)\
+	raster_out_printf((out), "\033&l%dM", type)
+#define pcl_set_duplex(out,duplex,landscape)\
+	if (duplex) raster_out_printf((out), "\033&l%dS", \
+	                              (duplex) + (landscape))
+#define pcl_set_simple_black(out)\
+	raster_out_printf((out), "\033*r-1U")
+#define pcl_set_simple_color(out)\
+	raster_out_printf((out), "\033*r3U")
+#define pcl_set_simple_cmy(out)\
+	raster_out_printf((out), "\033*r-3U")
+#define pcl_set_simple_kcmy(out)\
+	raster_out_printf((out), "\033*r-4U")
+#define pcl_set_simple_resolution(out,r)\
+	raster_out_printf((out), "\033*t%dR", (r))
 
-#define pjl_escape()\
-	printf("\033%%-12345X@PJL\r\n")
-#define pjl_set_job(job_id,user,title)\
-	printf("@PJL JOB NAME = \"%s\" DISPLAY = \"%d %s %s\"\r\n", \
-	       (title), (job_id), (user), (title))
-#define pjl_enter_language(lang)\
-	printf("@PJL ENTER LANGUAGE=%s\r\n", (lang))
+#define pjl_escape(out)\
+	raster_out_printf((out), "\033%%-12345X@PJL\r\n")
 
-extern void	pcl_set_media_size(ppd_file_t *ppd, float width, float length);
-extern void	pjl_write(const char *format,
-		          const char *value, int job_id,
-                	  const char *user, const char *title,
-			  int num_options, cups_option_t *options);
+extern int	pcl_compress_delta(unsigned char *dst,
+			           const unsigned char *src,
+				   const unsigned char *seed, int length);
+extern int	pcl_compress_delta_rle(unsigned char *dst,
+			               const unsigned char *src,
+				       const unsigned char *seed, int length);
+extern int	pcl_compress_rle(unsigned char *dst, const unsigned char *src,
+			         int length);
+extern void	pcl_set_media_size(raster_out_t *out, ppd_file_t *ppd,
+			           float width, float length);
+extern pjl_template_t *pjl_compile(const char *format, int job_id,
+			           const char *user, const char *title,
+				   int num_options, cups_option_t *options);
+extern void	pjl_expand(raster_out_t *out, const pjl_template_t *t,
+			   const char *value);
+extern void	pjl_free(pjl_template_t *t);
 
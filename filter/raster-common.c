@@ -0,0 +1,2517 @@
+//
+// Common raster driver functions for cups-filters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Contents:
+//
+//   raster_out_append()      - Move the contents of a memory buffer to the
+//                              end of an output buffer.
+//   raster_out_checkpoint()  - Flush buffered output once enough has been
+//                              collected.
+//   raster_out_delete()      - Flush and free an output buffer.
+//   raster_out_discard()     - Throw away the contents of a memory buffer.
+//   raster_out_dup()         - Copy the contents of a memory buffer.
+//   raster_out_flush()       - Write all buffered output.
+//   raster_out_length()      - Return the number of bytes buffered.
+//   raster_out_new()         - Create an output buffer for a file or
+//                              memory.
+//   raster_out_printf()      - Add formatted text to an output buffer.
+//   raster_out_putc()        - Add a single byte to an output buffer.
+//   raster_out_puts()        - Add a string to an output buffer.
+//   raster_out_write()       - Add data to an output buffer.
+//   out_block()              - Get an empty block for an output buffer.
+//   raster_check_value()     - Check whether every byte of a line has the
+//                              same value.
+//   raster_count_diff()      - Count leading bytes that differ from a seed
+//                              row.
+//   raster_count_diff_rgb()  - Count leading RGB pixels that differ from a
+//                              seed row.
+//   raster_count_same()      - Count leading bytes that match a seed row.
+//   raster_dither_delete()   - Free a threshold dither matrix.
+//   raster_dither_levels()   - Compute the threshold dither levels for a
+//                              lookup table.
+//   raster_dither_line()     - Dither a line of ink values with a threshold
+//                              matrix.
+//   raster_dither_new()      - Create a threshold dither matrix.
+//   dither_bayer()           - Compute the ranks of a Bayer matrix.
+//   dither_bluenoise()       - Compute the ranks of a void-and-cluster
+//                              matrix.
+//   dither_find()            - Find the tightest cluster or largest void of
+//                              a pattern.
+//   dither_toggle()          - Set or clear a cell of a pattern.
+//   raster_hash()            - Add data to a 128-bit hash.
+//   raster_invert_check()    - Invert a line and check whether every byte
+//                              had the same value.
+//   raster_packbits()        - Compress a line using TIFF PackBits encoding.
+//   raster_packbits_impl()   - Return the name of the PackBits kernel in
+//                              use.
+//   raster_packbits_select() - Select a PackBits kernel by name.
+//   packbits_encode()        - Encode a line with the given run scanners.
+//   packbits_init()          - Choose the default PackBits kernel.
+//   raster_prefetch_delete() - Stop reading ahead and free the buffer.
+//   raster_prefetch_new()    - Start reading raster data ahead.
+//   raster_prefetch_read()   - Read raster data that was read ahead.
+//   raster_prefetch_stop()   - Stop reading ahead, reads return the end
+//                              of the file.
+//   prefetch_thread()        - Read raster data into the ring buffer.
+//   same_*()                 - Count leading pairs of equal bytes.
+//   diff_*()                 - Count leading pairs of different bytes.
+//   encode_*()               - Encode a line using a particular kernel.
+//   neon_mask()              - Convert a byte compare result to a 4-bit per
+//                              byte mask.
+//   raster_out_set_stats()   - Record the time spent writing an output
+//                              buffer.
+//   raster_stats_add()       - Add the time and output of a stage.
+//   raster_stats_delete()    - Report the job totals and free statistics.
+//   raster_stats_merge()     - Move the totals of a page slot into the
+//                              page totals.
+//   raster_stats_new()       - Create statistics for a job if enabled.
+//   raster_stats_page()      - Report the totals of a page.
+//   raster_stats_slot()      - Create the totals of a page rendered by
+//                              another thread.
+//   raster_stats_start()     - Get the start time of a stage.
+//   stats_json()             - Write the totals of a page or job as JSON.
+//   stats_log()              - Log the totals of a page or job.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <config.h>
+#include "raster-common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/uio.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif // HAVE_PTHREAD_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define HAVE_X86_KERNELS 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define HAVE_NEON_KERNELS 1
+#endif // __GNUC__ && (__x86_64__ || __i386__)
+
+
+//
+// Output buffer data...
+//
+
+#define RASTER_OUT_BLOCK	65536	// Size of output blocks
+#define RASTER_OUT_IOV		64	// Blocks per writev() call
+
+typedef struct raster_out_block_s	// Block of buffered output
+{
+  struct raster_out_block_s *next;	// Next block
+  size_t	used;			// Bytes used in block
+  unsigned char	data[RASTER_OUT_BLOCK];	// Data
+} raster_out_block_t;
+
+struct raster_out_s			// Buffered printer output
+{
+  int			fd;		// File to write to or -1 for memory
+  size_t		flush_size,	// Bytes to collect before writing
+			bytes;		// Bytes buffered
+  raster_out_block_t	*first,		// First block of data
+			*last,		// Last block of data
+			*spare;		// Unused blocks
+  int			error;		// Non-zero after a write or memory
+					// error
+  raster_stats_t	*stats;		// Statistics, if any
+  cf_logfunc_t		logfunc;	// Log function
+  void			*ld;		// Log function data
+};
+
+
+//
+// Threshold dither data...
+//
+
+#define DITHER_MAX		32	// Largest matrix size
+
+struct raster_dither_s			// Threshold dither matrix
+{
+  int			size;		// Width and height of matrix
+  unsigned short	*rows;		// 255 - threshold, each row twice
+};
+
+
+//
+// Input prefetch data...
+//
+
+struct raster_prefetch_s		// Raster data read ahead
+{
+  int			fd;		// File to read from
+  unsigned char		*buffer;	// Ring buffer
+  size_t		size,		// Size of ring buffer
+			head,		// Next byte to return
+			count;		// Bytes in ring buffer
+  int			eof,		// End of file or error seen?
+			aborted;	// Stop reading?
+#ifdef HAVE_PTHREAD_H
+  pthread_t		thread;		// Reader thread
+  pthread_mutex_t	mutex;		// Mutex for ring buffer
+  pthread_cond_t	cond;		// Ring buffer state changes
+#endif // HAVE_PTHREAD_H
+};
+
+
+//
+// PackBits kernel data...
+//
+
+typedef struct raster_packbits_kernel_s
+{
+  const char	*name;			// Name of kernel
+  int		(*encode)(unsigned char *, const unsigned char *, int, int);
+					// Encoder function
+} raster_packbits_kernel_t;
+
+
+//
+// Stage statistics data...
+//
+
+struct raster_stats_s			// Stage statistics for a job
+{
+  const char	*driver;		// Name of driver or NULL for a
+					// page slot
+  cf_logfunc_t	logfunc;		// Log function
+  void		*ld;			// Log function data
+  FILE		*json;			// JSON file, if any
+  int		pages;			// Number of pages reported
+  long long	page_start,		// Start time of page
+		job_start,		// Start time of job
+		page_ns[RASTER_STAGE_MAX],
+					// Nanoseconds per stage for page
+		page_bytes[RASTER_STAGE_MAX],
+					// Bytes per stage for page
+		job_ns[RASTER_STAGE_MAX],
+					// Nanoseconds per stage for job
+		job_bytes[RASTER_STAGE_MAX];
+					// Bytes per stage for job
+};
+
+static const char * const stage_names[RASTER_STAGE_MAX] =
+{					// Names of stages
+  "read",
+  "separate",
+  "dither",
+  "pack",
+  "compress",
+  "write"
+};
+
+
+//
+// Local functions...
+//
+
+static void	dither_bayer(unsigned short *ranks, int size);
+static int	dither_bluenoise(unsigned short *ranks, int size);
+static int	dither_find(const unsigned char *pattern,
+		            const double *energy, int count, int value);
+static void	dither_toggle(unsigned char *pattern, double *energy,
+		              const double *kernel, int size, int cell);
+static raster_out_block_t	*out_block(raster_out_t *out);
+#ifdef HAVE_NEON_KERNELS
+static inline unsigned long long neon_mask(uint8x16_t eq);
+#endif // HAVE_NEON_KERNELS
+static const raster_packbits_kernel_t	*packbits_init(void);
+#ifdef HAVE_PTHREAD_H
+static void	*prefetch_thread(void *arg);
+#endif // HAVE_PTHREAD_H
+static void	stats_json(raster_stats_t *stats, long long elapsed,
+		           const long long *ns, const long long *bytes);
+static void	stats_log(raster_stats_t *stats, const char *what,
+		          long long elapsed, const long long *ns,
+			  const long long *bytes);
+
+
+//
+// 'raster_out_append()' - Move the contents of a memory buffer to the end
+//                         of an output buffer.
+//
+// The blocks are moved rather than copied, and the spare blocks of "out"
+// are given to "src" so that they can be reused for its next contents.
+//
+
+void
+raster_out_append(raster_out_t *out,	// I - Output buffer
+                  raster_out_t *src)	// I - Memory buffer to empty
+{
+  raster_out_block_t	*block;		// Current block
+
+
+  if (src->error)
+    out->error = 1;
+
+  if (src->first)
+  {
+    if (out->last)
+      out->last->next = src->first;
+    else
+      out->first = src->first;
+
+    out->last  = src->last;
+    out->bytes += src->bytes;
+
+    src->first = NULL;
+    src->last  = NULL;
+    src->bytes = 0;
+  }
+
+  while ((block = out->spare) != NULL)
+  {
+    out->spare  = block->next;
+    block->next = src->spare;
+    src->spare  = block;
+  }
+}
+
+
+//
+// 'raster_out_checkpoint()' - Flush buffered output once enough has been
+//                             collected.
+//
+// Drivers call this at band and line boundaries instead of fflush(), so
+// that the printer sees a few large writes rather than one per line.
+//
+
+int					// O - 0 on success, -1 on error
+raster_out_checkpoint(raster_out_t *out)// I - Output buffer
+{
+  if (out->fd < 0 || out->bytes < out->flush_size)
+    return (0);
+
+  return (raster_out_flush(out));
+}
+
+
+//
+// 'raster_out_delete()' - Flush and free an output buffer.
+//
+
+void
+raster_out_delete(raster_out_t *out)	// I - Output buffer
+{
+  raster_out_block_t	*block,		// Current block
+			*next;		// Next block
+
+
+  if (!out)
+    return;
+
+  raster_out_flush(out);
+
+  for (block = out->first; block; block = next)
+  {
+    next = block->next;
+    free(block);
+  }
+
+  for (block = out->spare; block; block = next)
+  {
+    next = block->next;
+    free(block);
+  }
+
+  free(out);
+}
+
+
+//
+// 'raster_out_discard()' - Throw away the contents of a memory buffer.
+//
+// The blocks are kept for the next contents and any error is cleared.
+//
+
+void
+raster_out_discard(raster_out_t *out)	// I - Memory buffer
+{
+  raster_out_block_t	*block;		// Current block
+
+
+  while ((block = out->first) != NULL)
+  {
+    out->first  = block->next;
+    block->next = out->spare;
+    out->spare  = block;
+  }
+
+  out->last  = NULL;
+  out->bytes = 0;
+  out->error = 0;
+}
+
+
+//
+// 'raster_out_dup()' - Copy the contents of a memory buffer.
+//
+
+unsigned char *				// O - Copy of data or NULL on error
+raster_out_dup(const raster_out_t *out,	// I - Memory buffer
+               size_t             *length)
+					// O - Number of bytes
+{
+  unsigned char		*data,		// Copy of data
+			*ptr;		// Pointer into copy
+  raster_out_block_t	*block;		// Current block
+
+
+  *length = out->bytes;
+
+  if ((data = malloc(out->bytes ? out->bytes : 1)) == NULL)
+    return (NULL);
+
+  for (block = out->first, ptr = data; block; block = block->next)
+  {
+    memcpy(ptr, block->data, block->used);
+    ptr += block->used;
+  }
+
+  return (data);
+}
+
+
+//
+// 'raster_out_flush()' - Write all buffered output.
+//
+
+int					// O - 0 on success, -1 on error
+raster_out_flush(raster_out_t *out)	// I - Output buffer
+{
+  struct iovec		iov[RASTER_OUT_IOV];
+					// Blocks to write
+  int			count;		// Number of blocks to write
+  ssize_t		bytes;		// Bytes written
+  size_t		offset = 0;	// Bytes of first block already written
+  raster_out_block_t	*block;		// Current block
+  long long		start;		// Start time of write
+
+
+  if (out->fd < 0)
+    return (out->error ? -1 : 0);	// Memory buffers keep their data
+
+  while (out->first)
+  {
+    for (count = 0, block = out->first;
+         block && count < RASTER_OUT_IOV;
+	 count ++, block = block->next)
+    {
+      iov[count].iov_base = block->data + (count ? 0 : offset);
+      iov[count].iov_len  = block->used - (count ? 0 : offset);
+    }
+
+    start = raster_stats_start(out->stats);
+
+    if (out->error)
+      bytes = (ssize_t)out->bytes;
+    else if ((bytes = writev(out->fd, iov, count)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (out->logfunc)
+        out->logfunc(out->ld, CF_LOGLEVEL_ERROR,
+	             "Unable to write print data: %s", strerror(errno));
+      out->error = 1;
+      continue;
+    }
+    else
+      raster_stats_add(out->stats, RASTER_STAGE_WRITE, start, (size_t)bytes);
+
+    //
+    // Move the blocks that have been written to the spare list...
+    //
+
+    while (out->first && bytes >= (ssize_t)(out->first->used - offset))
+    {
+      bytes      -= (ssize_t)(out->first->used - offset);
+      out->bytes -= out->first->used - offset;
+      offset     = 0;
+
+      block       = out->first;
+      out->first  = block->next;
+      block->next = out->spare;
+      out->spare  = block;
+    }
+
+    offset     += (size_t)bytes;
+    out->bytes -= (size_t)bytes;
+  }
+
+  out->last  = NULL;
+  out->bytes = 0;
+
+  return (out->error ? -1 : 0);
+}
+
+
+//
+// 'raster_out_length()' - Return the number of bytes buffered.
+//
+
+size_t					// O - Number of bytes
+raster_out_length(
+    const raster_out_t *out)		// I - Output buffer
+{
+  return (out->bytes);
+}
+
+
+//
+// 'raster_out_new()' - Create an output buffer for a file or memory.
+//
+// When "fd" is -1 the output is kept in memory until raster_out_append()
+// moves it to another buffer; flushing such a buffer does nothing.
+//
+// If memory for the data runs out later, the data is dropped and the
+// next raster_out_flush() returns -1.
+//
+
+raster_out_t *				// O - Output buffer or NULL on error
+raster_out_new(int          fd,		// I - File to write to or -1
+               size_t       flush_size,	// I - Bytes to collect before writing
+	       cf_logfunc_t logfunc,	// I - Log function
+	       void         *ld)	// I - Log function data
+{
+  raster_out_t	*out;			// Output buffer
+
+
+  if ((out = calloc(1, sizeof(raster_out_t))) == NULL)
+  {
+    if (logfunc)
+      logfunc(ld, CF_LOGLEVEL_ERROR, "Unable to allocate output buffer: %s",
+              strerror(errno));
+    return (NULL);
+  }
+
+  out->fd         = fd;
+  out->flush_size = flush_size;
+  out->logfunc    = logfunc;
+  out->ld         = ld;
+
+  return (out);
+}
+
+
+//
+// 'raster_out_printf()' - Add formatted text to an output buffer.
+//
+
+void
+raster_out_printf(raster_out_t *out,	// I - Output buffer
+                  const char   *format,	// I - printf-style format string
+		  ...)			// I - Additional arguments
+{
+  va_list	ap;			// Argument pointer
+  int		bytes;			// Length of formatted text
+  size_t	avail;			// Space left in last block
+  char		*buffer;		// Formatted text
+
+
+  avail = out->last ? RASTER_OUT_BLOCK - out->last->used : 0;
+
+  va_start(ap, format);
+  bytes = vsnprintf(avail ? (char *)out->last->data + out->last->used : NULL,
+                    avail, format, ap);
+  va_end(ap);
+
+  if (bytes < 0)
+    return;
+  else if ((size_t)bytes < avail)
+  {
+    //
+    // Formatted text fit in the current block...
+    //
+
+    out->last->used += (size_t)bytes;
+    out->bytes      += (size_t)bytes;
+  }
+  else if ((buffer = malloc((size_t)bytes + 1)) != NULL)
+  {
+    va_start(ap, format);
+    vsnprintf(buffer, (size_t)bytes + 1, format, ap);
+    va_end(ap);
+
+    raster_out_write(out, buffer, (size_t)bytes);
+    free(buffer);
+  }
+  else
+    out->error = 1;
+}
+
+
+//
+// 'raster_out_putc()' - Add a single byte to an output buffer.
+//
+
+void
+raster_out_putc(raster_out_t *out,	// I - Output buffer
+                int          ch)	// I - Byte to add
+{
+  if ((!out->last || out->last->used >= RASTER_OUT_BLOCK) &&
+      !out_block(out))
+    return;
+
+  out->last->data[out->last->used ++] = (unsigned char)ch;
+  out->bytes ++;
+}
+
+
+//
+// 'raster_out_puts()' - Add a string to an output buffer.
+//
+
+void
+raster_out_puts(raster_out_t *out,	// I - Output buffer
+                const char   *s)	// I - String to add
+{
+  raster_out_write(out, s, strlen(s));
+}
+
+
+//
+// 'raster_out_set_stats()' - Record the time spent writing an output
+//                            buffer.
+//
+
+void
+raster_out_set_stats(
+    raster_out_t   *out,		// I - Output buffer
+    raster_stats_t *stats)		// I - Statistics or NULL
+{
+  out->stats = stats;
+}
+
+
+//
+// 'raster_out_write()' - Add data to an output buffer.
+//
+
+void
+raster_out_write(raster_out_t *out,	// I - Output buffer
+                 const void   *data,	// I - Data to add
+		 size_t       length)	// I - Number of bytes
+{
+  const unsigned char	*ptr = data;	// Pointer into data
+  size_t		bytes;		// Bytes to copy to current block
+
+
+  while (length > 0)
+  {
+    if ((!out->last || out->last->used >= RASTER_OUT_BLOCK) &&
+        !out_block(out))
+      return;
+
+    bytes = RASTER_OUT_BLOCK - out->last->used;
+    if (bytes > length)
+      bytes = length;
+
+    memcpy(out->last->data + out->last->used, ptr, bytes);
+
+    out->last->used += bytes;
+    out->bytes      += bytes;
+    ptr             += bytes;
+    length          -= bytes;
+  }
+}
+
+
+//
+// 'out_block()' - Get an empty block for an output buffer.
+//
+
+static raster_out_block_t *		// O - New last block or NULL
+out_block(raster_out_t *out)		// I - Output buffer
+{
+  raster_out_block_t	*block;		// New block
+
+
+  if ((block = out->spare) != NULL)
+    out->spare = block->next;
+  else if ((block = malloc(sizeof(raster_out_block_t))) == NULL)
+  {
+    if (!out->error && out->logfunc)
+      out->logfunc(out->ld, CF_LOGLEVEL_ERROR,
+                   "Unable to allocate output buffer: %s", strerror(errno));
+    out->error = 1;
+    return (NULL);
+  }
+
+  block->next = NULL;
+  block->used = 0;
+
+  if (out->last)
+    out->last->next = block;
+  else
+    out->first = block;
+
+  out->last = block;
+
+  return (block);
+}
+
+
+//
+// 'raster_check_value()' - Check whether every byte of a line has the same
+//                          value.
+//
+// This is cfCheckValue() for whole raster lines, comparing 64 bytes per
+// iteration with SSE2 or NEON where available, so that the drivers can
+// find blank lines before doing any color separation.
+//
+
+int					// O - 1 if all bytes match, 0 otherwise
+raster_check_value(
+    const unsigned char *p,		// I - Data
+    size_t              length,		// I - Number of bytes
+    int                 value)		// I - Value to look for
+{
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+  __m128i	v,			// Value in every byte
+		diff;			// Differing bits of 64 bytes
+
+
+  v = _mm_set1_epi8((char)value);
+
+  for (; length >= 64; p += 64, length -= 64)
+  {
+    diff = _mm_or_si128(
+               _mm_or_si128(
+                   _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), v),
+                   _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 16)),
+                                 v)),
+               _mm_or_si128(
+                   _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 32)),
+                                 v),
+                   _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 48)),
+                                 v)));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) !=
+            0xffff)
+      return (0);
+  }
+
+#elif defined(HAVE_NEON_KERNELS)
+  uint8x16_t	v,			// Value in every byte
+		diff;			// Differing bits of 64 bytes
+
+
+  v = vdupq_n_u8((unsigned char)value);
+
+  for (; length >= 64; p += 64, length -= 64)
+  {
+    diff = vorrq_u8(vorrq_u8(veorq_u8(vld1q_u8(p), v),
+                             veorq_u8(vld1q_u8(p + 16), v)),
+                    vorrq_u8(veorq_u8(vld1q_u8(p + 32), v),
+                             veorq_u8(vld1q_u8(p + 48), v)));
+
+    if (vmaxvq_u8(diff))
+      return (0);
+  }
+#endif // HAVE_X86_KERNELS && __SSE2__
+
+  for (; length > 0; p ++, length --)
+    if (*p != (unsigned char)value)
+      return (0);
+
+  return (1);
+}
+
+
+//
+// 'raster_count_diff()' - Count leading bytes that differ from a seed row.
+//
+// The PCL delta-row encoders use this and raster_count_same() to split a
+// line into changed and unchanged runs, comparing 16 bytes at a time with
+// SSE2 or NEON where available.
+//
+
+size_t					// O - Number of different bytes
+raster_count_diff(
+    const unsigned char *p,		// I - Line
+    const unsigned char *seed,		// I - Seed row
+    size_t              length)		// I - Number of bytes
+{
+  size_t		i = 0;		// Looping var
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+  unsigned		mask;		// Mask of equal bytes
+
+
+  for (; i + 16 <= length; i += 16)
+  {
+    mask = (unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)),
+                              _mm_loadu_si128((const __m128i *)(seed + i))));
+
+    if (mask)
+      return (i + __builtin_ctz(mask));
+  }
+
+#elif defined(HAVE_NEON_KERNELS)
+  unsigned long long	mask;		// Mask of equal bytes
+
+
+  for (; i + 16 <= length; i += 16)
+  {
+    mask = neon_mask(vceqq_u8(vld1q_u8(p + i), vld1q_u8(seed + i)));
+
+    if (mask)
+      return (i + (__builtin_ctzll(mask) >> 2));
+  }
+#endif // HAVE_X86_KERNELS && __SSE2__
+
+  for (; i < length && p[i] != seed[i]; i ++);
+
+  return (i);
+}
+
+
+//
+// 'raster_count_diff_rgb()' - Count leading RGB pixels that differ from a
+//                             seed row.
+//
+// A pixel differs when any of its three bytes differs; 16 pixels are
+// compared at a time with SSE2 or NEON where available.
+//
+
+size_t					// O - Number of different pixels
+raster_count_diff_rgb(
+    const unsigned char *p,		// I - Line
+    const unsigned char *seed,		// I - Seed row
+    size_t              count)		// I - Number of pixels
+{
+  size_t		i = 0;		// Looping var
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+  unsigned long long	mask;		// Mask of equal pixels
+
+
+  for (; i + 16 <= count; i += 16, p += 48, seed += 48)
+  {
+    //
+    // Get a mask of equal bytes and keep the bits of pixels whose three
+    // bytes are equal...
+    //
+
+    mask = (unsigned long long)(unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),
+                              _mm_loadu_si128((const __m128i *)seed))) |
+           (unsigned long long)(unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)),
+                              _mm_loadu_si128((const __m128i *)(seed + 16))))
+               << 16 |
+           (unsigned long long)(unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)),
+                              _mm_loadu_si128((const __m128i *)(seed + 32))))
+               << 32;
+    mask &= (mask >> 1) & (mask >> 2) & 0x249249249249ULL;
+
+    if (mask)
+      return (i + __builtin_ctzll(mask) / 3);
+  }
+
+#elif defined(HAVE_NEON_KERNELS)
+  uint8x16x3_t		a, b;		// Deinterleaved pixels
+  unsigned long long	mask;		// Mask of equal pixels
+
+
+  for (; i + 16 <= count; i += 16, p += 48, seed += 48)
+  {
+    a    = vld3q_u8(p);
+    b    = vld3q_u8(seed);
+    mask = neon_mask(vandq_u8(vandq_u8(vceqq_u8(a.val[0], b.val[0]),
+                                       vceqq_u8(a.val[1], b.val[1])),
+                              vceqq_u8(a.val[2], b.val[2])));
+
+    if (mask)
+      return (i + (__builtin_ctzll(mask) >> 2));
+  }
+#endif // HAVE_X86_KERNELS && __SSE2__
+
+  for (; i < count && (p[0] != seed[0] || p[1] != seed[1] ||
+                       p[2] != seed[2]);
+       i ++, p += 3, seed += 3);
+
+  return (i);
+}
+
+
+//
+// 'raster_count_same()' - Count leading bytes that match a seed row.
+//
+
+size_t					// O - Number of equal bytes
+raster_count_same(
+    const unsigned char *p,		// I - Line
+    const unsigned char *seed,		// I - Seed row
+    size_t              length)		// I - Number of bytes
+{
+  size_t		i = 0;		// Looping var
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+  unsigned		mask;		// Mask of different bytes
+
+
+  for (; i + 16 <= length; i += 16)
+  {
+    mask = (unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)),
+                              _mm_loadu_si128((const __m128i *)(seed + i))))
+           ^ 0xffff;
+
+    if (mask)
+      return (i + __builtin_ctz(mask));
+  }
+
+#elif defined(HAVE_NEON_KERNELS)
+  unsigned long long	mask;		// Mask of different bytes
+
+
+  for (; i + 16 <= length; i += 16)
+  {
+    mask = ~neon_mask(vceqq_u8(vld1q_u8(p + i), vld1q_u8(seed + i)));
+
+    if (mask)
+      return (i + (__builtin_ctzll(mask) >> 2));
+  }
+#endif // HAVE_X86_KERNELS && __SSE2__
+
+  for (; i < length && p[i] == seed[i]; i ++);
+
+  return (i);
+}
+
+
+//
+// 'raster_dither_delete()' - Free a threshold dither matrix.
+//
+
+void
+raster_dither_delete(
+    raster_dither_t *d)			// I - Dither matrix
+{
+  if (!d)
+    return;
+
+  free(d->rows);
+  free(d);
+}
+
+
+//
+// 'raster_dither_levels()' - Compute the threshold dither levels for a
+//                            lookup table.
+//
+// Each ink value maps to the pixel value its adjusted intensity falls on
+// or above, times 256, plus the fraction of the way to the next pixel
+// value.  The intensity of a pixel value is taken from the error the
+// lookup table gives for it, as error diffusion would.
+//
+
+unsigned short *			// O - Levels or NULL on error
+raster_dither_levels(const cf_lut_t *lut)
+					// I - Lookup table
+{
+  int			i,		// Ink value
+			intensity,	// Adjusted intensity
+			pixel,		// Pixel value
+			top,		// Largest pixel value
+			frac,		// Fraction to next pixel value
+			values[256];	// Intensity of each pixel value
+  unsigned short	*levels;	// Levels for ink values
+
+
+  if ((levels = malloc(4096 * sizeof(unsigned short))) == NULL)
+    return (NULL);
+
+  if ((top = lut[4095].pixel) > 255)
+    top = 255;
+
+  for (pixel = 0; pixel <= top; pixel ++)
+    values[pixel] = -1;
+
+  for (i = 0; i < 4096; i ++)
+    if (lut[i].pixel >= 0 && lut[i].pixel <= top)
+      values[lut[i].pixel] = i - lut[i].error;
+
+  for (pixel = 1; pixel <= top; pixel ++)
+    if (values[pixel] <= values[pixel - 1])
+      values[pixel] = values[pixel - 1];
+
+  for (i = 0; i < 4096; i ++)
+  {
+    if ((intensity = lut[i].intensity) < 0)
+      intensity = 0;
+    else if (intensity > 4095)
+      intensity = 4095;
+
+    for (pixel = 0; pixel < top && values[pixel + 1] <= intensity; pixel ++);
+
+    if (pixel < top && values[pixel + 1] > values[pixel])
+    {
+      frac = 256 * (intensity - values[pixel]) /
+             (values[pixel + 1] - values[pixel]);
+
+      if (frac < 0)
+        frac = 0;
+      else if (frac > 255)
+        frac = 255;
+    }
+    else
+      frac = 0;
+
+    levels[i] = (unsigned short)(pixel * 256 + frac);
+  }
+
+  return (levels);
+}
+
+
+//
+// 'raster_dither_line()' - Dither a line of ink values with a threshold
+//                          matrix.
+//
+// "levels" maps each ink value (0 to 4095) to the output pixel value times
+// 256 plus the fraction (0 to 255) of the way to the next pixel value.
+// Every pixel is dithered on its own, so lines and planes can be done in
+// any order and by any number of threads.  Each plane uses the matrix at
+// a different offset, so that the dots of the planes do not line up.
+//
+
+void
+raster_dither_line(
+    const raster_dither_t *d,		// I - Dither matrix
+    const unsigned short  *levels,	// I - Levels for ink values
+    const short           *input,	// I - Ink values
+    int                   step,		// I - Ink values per pixel
+    unsigned char         *pixels,	// O - Dithered pixels
+    int                   width,	// I - Number of pixels
+    int                   y,		// I - Line on the page
+    int                   plane)	// I - Color plane
+{
+  int			i,		// Looping var
+			count,		// Pixels in this pass
+			value;		// Ink value
+  const unsigned short	*row;		// Thresholds for line
+  unsigned short	q[DITHER_MAX];	// Levels for pixels
+
+
+  row = d->rows + ((y + plane * 11) % d->size) * 2 * d->size +
+        (plane * 7) % d->size;
+
+  for (; width > 0; width -= count, pixels += count)
+  {
+    //
+    // Look up the levels for as many pixels as the matrix is wide, so the
+    // same thresholds apply to every pass...
+    //
+
+    count = width < d->size ? width : d->size;
+
+    for (i = 0; i < count; i ++, input += step)
+    {
+      if ((value = *input) < 0)
+        value = 0;
+      else if (value > 4095)
+        value = 4095;
+
+      q[i] = levels[value];
+    }
+
+    //
+    // Then add the thresholds; a pixel goes to the next value when its
+    // fraction is above the threshold...
+    //
+
+    i = 0;
+
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+    for (; i + 8 <= count; i += 8)
+      _mm_storel_epi64((__m128i *)(pixels + i),
+                       _mm_packus_epi16(
+		           _mm_srli_epi16(
+			       _mm_add_epi16(
+			           _mm_loadu_si128((const __m128i *)(q + i)),
+			           _mm_loadu_si128((const __m128i *)(row + i))),
+			       8),
+			   _mm_setzero_si128()));
+
+#elif defined(HAVE_NEON_KERNELS)
+    for (; i + 8 <= count; i += 8)
+      vst1_u8(pixels + i, vshrn_n_u16(vaddq_u16(vld1q_u16(q + i),
+                                                vld1q_u16(row + i)), 8));
+#endif // HAVE_X86_KERNELS && __SSE2__
+
+    for (; i < count; i ++)
+      pixels[i] = (unsigned char)((q[i] + row[i]) >> 8);
+  }
+}
+
+
+//
+// 'raster_dither_new()' - Create a threshold dither matrix.
+//
+// "ordered" is a 16x16 Bayer matrix, which is the fastest to compute and
+// looks regular; "bluenoise" is a 32x32 void-and-cluster matrix without a
+// visible pattern.  Anything else means error diffusion and returns NULL.
+//
+
+raster_dither_t *			// O - Dither matrix or NULL
+raster_dither_new(const char *name)	// I - Name of matrix
+{
+  raster_dither_t	*d;		// Dither matrix
+  int			x, y,		// Looping vars
+			size;		// Size of matrix
+  unsigned short	*ranks;		// Rank of each cell
+  unsigned short	*row;		// Current row
+
+
+  if (!name)
+    return (NULL);
+  else if (!strcmp(name, "ordered"))
+    size = 16;
+  else if (!strcmp(name, "bluenoise"))
+    size = 32;
+  else
+    return (NULL);
+
+  if ((d = calloc(1, sizeof(raster_dither_t))) == NULL)
+    return (NULL);
+
+  d->size = size;
+
+  if ((d->rows = calloc((size_t)(2 * size * size),
+                        sizeof(unsigned short))) == NULL ||
+      (ranks = calloc((size_t)(size * size), sizeof(unsigned short))) == NULL)
+  {
+    raster_dither_delete(d);
+    return (NULL);
+  }
+
+  if (size == 16)
+    dither_bayer(ranks, size);
+  else if (!dither_bluenoise(ranks, size))
+  {
+    free(ranks);
+    raster_dither_delete(d);
+    return (NULL);
+  }
+
+  //
+  // Store 255 minus the threshold of each cell, twice per row so a line
+  // can start anywhere in the row...
+  //
+
+  for (y = 0, row = d->rows; y < size; y ++, row += 2 * size)
+    for (x = 0; x < size; x ++)
+      row[x] = row[x + size] =
+          (unsigned short)(255 - ranks[y * size + x] * 256 / (size * size));
+
+  free(ranks);
+
+  return (d);
+}
+
+
+//
+// 'dither_bayer()' - Compute the ranks of a Bayer matrix.
+//
+
+static void
+dither_bayer(unsigned short *ranks,	// O - Rank of each cell
+             int            size)	// I - Size of matrix (power of 2)
+{
+  int	x, y,				// Current cell
+	bit,				// Current bit
+	rank;				// Rank of cell
+
+
+  for (y = 0; y < size; y ++)
+    for (x = 0; x < size; x ++)
+    {
+      for (bit = 1, rank = 0; bit < size; bit <<= 1)
+        rank = (rank << 2) | (((x ^ y) & bit) ? 2 : 0) | ((y & bit) ? 1 : 0);
+
+      ranks[y * size + x] = (unsigned short)rank;
+    }
+}
+
+
+//
+// 'dither_bluenoise()' - Compute the ranks of a void-and-cluster matrix.
+//
+// Ulichney's method: a sparse random pattern is evened out by moving the
+// dot in the tightest cluster to the largest void, then the dots are
+// ranked by taking them out from the tightest cluster down, and the
+// rest by filling the largest void up.  The random pattern comes from a
+// fixed seed, so every job gets the same matrix.
+//
+
+static int				// O - 1 on success, 0 on error
+dither_bluenoise(
+    unsigned short *ranks,		// O - Rank of each cell
+    int            size)		// I - Size of matrix
+{
+  int		i, j,			// Looping vars
+		count = size * size,	// Number of cells
+		ones,			// Number of dots
+		cluster,		// Tightest cluster
+		voidc,			// Largest void
+		rank;			// Current rank
+  int		dx, dy;			// Distance to cell
+  unsigned	seed = 12345;		// Random number seed
+  unsigned char	*initial,		// Initial pattern
+		*pattern;		// Current pattern
+  double	*kernel,		// Gaussian filter
+		*energy,		// Energy of initial pattern
+		*current,		// Energy of current pattern
+		w;			// Filter weight
+
+
+  initial = calloc((size_t)count, 2);
+  kernel  = calloc((size_t)count, 3 * sizeof(double));
+
+  if (!initial || !kernel)
+  {
+    free(initial);
+    free(kernel);
+    return (0);
+  }
+
+  pattern = initial + count;
+  energy  = kernel + count;
+  current = energy + count;
+
+  //
+  // Gaussian filter with sigma 1.5 over toroidal distances; exp() is
+  // done by squaring to stay clear of libm...
+  //
+
+  for (i = 0; i < count; i ++)
+  {
+    dx = i % size;
+    dy = i / size;
+
+    if (dx > size / 2)
+      dx = size - dx;
+    if (dy > size / 2)
+      dy = size - dy;
+
+    w = 1.0 - (dx * dx + dy * dy) / (2.0 * 1.5 * 1.5) / 1024.0;
+
+    for (j = 0; j < 10; j ++)
+      w *= w;
+
+    kernel[i] = w;
+  }
+
+  //
+  // Start with a tenth of the cells set at random...
+  //
+
+  for (ones = 0; ones < count / 10;)
+  {
+    seed = seed * 1103515245 + 12345;
+    i    = (int)((seed >> 16) % (unsigned)count);
+
+    if (!initial[i])
+    {
+      dither_toggle(initial, energy, kernel, size, i);
+      ones ++;
+    }
+  }
+
+  //
+  // Move dots from the tightest cluster to the largest void until the
+  // dot that is taken out would go back to the same place...
+  //
+
+  for (i = 0; i < count; i ++)
+  {
+    cluster = dither_find(initial, energy, count, 1);
+    dither_toggle(initial, energy, kernel, size, cluster);
+
+    voidc = dither_find(initial, energy, count, 0);
+    dither_toggle(initial, energy, kernel, size, voidc);
+
+    if (voidc == cluster)
+      break;
+  }
+
+  //
+  // Rank the dots of the pattern from the tightest cluster down...
+  //
+
+  memcpy(pattern, initial, (size_t)count);
+  memcpy(current, energy, (size_t)count * sizeof(double));
+
+  for (rank = ones - 1; rank >= 0; rank --)
+  {
+    cluster = dither_find(pattern, current, count, 1);
+    dither_toggle(pattern, current, kernel, size, cluster);
+
+    ranks[cluster] = (unsigned short)rank;
+  }
+
+  //
+  // Then fill the largest voids of the pattern up...
+  //
+
+  for (rank = ones; rank < count; rank ++)
+  {
+    voidc = dither_find(initial, energy, count, 0);
+    dither_toggle(initial, energy, kernel, size, voidc);
+
+    ranks[voidc] = (unsigned short)rank;
+  }
+
+  free(initial);
+  free(kernel);
+
+  return (1);
+}
+
+
+//
+// 'dither_find()' - Find the tightest cluster or largest void of a pattern.
+//
+
+static int				// O - Cell
+dither_find(const unsigned char *pattern,
+					// I - Pattern
+            const double        *energy,// I - Energy of each cell
+	    int                 count,	// I - Number of cells
+	    int                 value)	// I - 1 for cluster, 0 for void
+{
+  int	i,				// Looping var
+	best = -1;			// Best cell
+
+
+  for (i = 0; i < count; i ++)
+    if (pattern[i] == value &&
+        (best < 0 || (value ? energy[i] > energy[best] :
+	                      energy[i] < energy[best])))
+      best = i;
+
+  return (best);
+}
+
+
+//
+// 'dither_toggle()' - Set or clear a cell of a pattern.
+//
+
+static void
+dither_toggle(unsigned char *pattern,	// I - Pattern
+              double        *energy,	// I - Energy of each cell
+              const double  *kernel,	// I - Gaussian filter
+	      int           size,	// I - Size of matrix
+	      int           cell)	// I - Cell to toggle
+{
+  int		x, y,			// Current cell
+		cx = cell % size,	// Column of toggled cell
+		cy = cell / size;	// Row of toggled cell
+  double	sign;			// Add or remove energy
+
+
+  sign = pattern[cell] ? -1.0 : 1.0;
+  pattern[cell] ^= 1;
+
+  for (y = 0; y < size; y ++)
+    for (x = 0; x < size; x ++)
+      energy[y * size + x] += sign * kernel[((y - cy + size) % size) * size +
+                                            (x - cx + size) % size];
+}
+
+
+//
+// 'raster_hash()' - Add data to a 128-bit hash.
+//
+// Two independent multiply-and-mix lanes go over the data a word at a
+// time.  This is no cryptographic hash, but enough to recognize a page
+// raster that was already printed; start with both words set to 0.
+//
+
+void
+raster_hash(unsigned long long  *hash,	// IO - Hash value (2 words)
+            const unsigned char *data,	// I  - Data
+	    size_t              length)	// I  - Number of bytes
+{
+  unsigned long long	h0 = hash[0] ^ length,
+					// First lane
+			h1 = hash[1] + length,
+					// Second lane
+			w;		// Current word
+
+
+  for (; length >= 8; data += 8, length -= 8)
+  {
+    memcpy(&w, data, 8);
+
+    h0 = (h0 ^ w) * 0x9e3779b97f4a7c15ULL;
+    h0 ^= h0 >> 29;
+    h1 = (h1 + w) * 0xc2b2ae3d27d4eb4fULL;
+    h1 = (h1 << 31) | (h1 >> 33);
+  }
+
+  if (length > 0)
+  {
+    w = 0;
+    memcpy(&w, data, length);
+
+    h0 = (h0 ^ w) * 0x9e3779b97f4a7c15ULL;
+    h1 = (h1 + w) * 0xc2b2ae3d27d4eb4fULL;
+  }
+
+  hash[0] = h0 ^ (h0 >> 32);
+  hash[1] = h1 ^ (h1 >> 29);
+}
+
+
+//
+// 'raster_invert_check()' - Invert a line and check whether every byte had
+//                           the same value.
+//
+// Inverting while looking for a blank line reads the line only once, and
+// can copy it out of a page that was read ahead at the same time.  The
+// destination may be the source but must not overlap it otherwise.
+//
+
+int					// O - 1 if all bytes matched, 0 otherwise
+raster_invert_check(
+    unsigned char       *dst,		// O - Inverted line
+    const unsigned char *src,		// I - Line
+    size_t              length,		// I - Number of bytes
+    int                 value)		// I - Value to look for
+{
+  unsigned long long	v,		// Value in every byte
+			w,		// Current word
+			diff = 0;	// Differing bits
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+  __m128i		vv,		// Value in every byte
+			ones,		// All bits set
+			a, b, c, d,	// 64 bytes of the line
+			acc;		// Differing bits
+
+
+  vv   = _mm_set1_epi8((char)value);
+  ones = _mm_set1_epi8(-1);
+  acc  = _mm_setzero_si128();
+
+  for (; length >= 64; src += 64, dst += 64, length -= 64)
+  {
+    a = _mm_loadu_si128((const __m128i *)src);
+    b = _mm_loadu_si128((const __m128i *)(src + 16));
+    c = _mm_loadu_si128((const __m128i *)(src + 32));
+    d = _mm_loadu_si128((const __m128i *)(src + 48));
+
+    acc = _mm_or_si128(acc,
+                       _mm_or_si128(_mm_or_si128(_mm_xor_si128(a, vv),
+                                                 _mm_xor_si128(b, vv)),
+                                    _mm_or_si128(_mm_xor_si128(c, vv),
+                                                 _mm_xor_si128(d, vv))));
+
+    _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(a, ones));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_xor_si128(b, ones));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_xor_si128(c, ones));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_xor_si128(d, ones));
+  }
+
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+    diff = 1;
+
+#elif defined(HAVE_NEON_KERNELS)
+  uint8x16_t		vv,		// Value in every byte
+			a, b, c, d,	// 64 bytes of the line
+			acc;		// Differing bits
+
+
+  vv  = vdupq_n_u8((unsigned char)value);
+  acc = vdupq_n_u8(0);
+
+  for (; length >= 64; src += 64, dst += 64, length -= 64)
+  {
+    a = vld1q_u8(src);
+    b = vld1q_u8(src + 16);
+    c = vld1q_u8(src + 32);
+    d = vld1q_u8(src + 48);
+
+    acc = vorrq_u8(acc, vorrq_u8(vorrq_u8(veorq_u8(a, vv), veorq_u8(b, vv)),
+                                 vorrq_u8(veorq_u8(c, vv), veorq_u8(d, vv))));
+
+    vst1q_u8(dst, vmvnq_u8(a));
+    vst1q_u8(dst + 16, vmvnq_u8(b));
+    vst1q_u8(dst + 32, vmvnq_u8(c));
+    vst1q_u8(dst + 48, vmvnq_u8(d));
+  }
+
+  if (vmaxvq_u8(acc))
+    diff = 1;
+#endif // HAVE_X86_KERNELS && __SSE2__
+
+  //
+  // Do the rest a word and then a byte at a time...
+  //
+
+  v = 0x0101010101010101ULL * (unsigned char)value;
+
+  for (; length >= 8; src += 8, dst += 8, length -= 8)
+  {
+    memcpy(&w, src, 8);
+    diff |= w ^ v;
+    w    = ~w;
+    memcpy(dst, &w, 8);
+  }
+
+  for (; length > 0; src ++, dst ++, length --)
+  {
+    diff |= *src ^ (unsigned char)value;
+    *dst = (unsigned char)~*src;
+  }
+
+  return (!diff);
+}
+
+
+//
+// 'same_scalar()' - Count leading pairs of equal bytes.
+//
+// Returns the first index i < count for which p[i] != p[i + 1], or count.
+//
+
+static inline int			// O - Number of equal pairs
+same_scalar(const unsigned char *p,	// I - Data
+            int                 count)	// I - Maximum number of pairs
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < count && p[i] == p[i + 1]; i ++);
+
+  return (i);
+}
+
+
+//
+// 'diff_scalar()' - Count leading pairs of different bytes.
+//
+// Returns the first index i < count for which p[i] == p[i + 1], or count.
+//
+
+static inline int			// O - Number of different pairs
+diff_scalar(const unsigned char *p,	// I - Data
+            int                 count)	// I - Maximum number of pairs
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < count && p[i] != p[i + 1]; i ++);
+
+  return (i);
+}
+
+
+//
+// 'packbits_encode()' - Encode a line with the given run scanners.
+//
+// This produces exactly the same byte stream as the PackBits loops that
+// used to live in the ESC/P and PCL drivers, including the separate
+// literal for a lone trailing byte.  Runs and literals are limited to 127
+// bytes.
+//
+
+static inline int			// O - Number of bytes written
+packbits_encode(
+    unsigned char       *dst,		// I - Output buffer
+    const unsigned char *src,		// I - Input data
+    int                 length,		// I - Number of input bytes
+    int                 limit,		// I - Stop after this many bytes or 0
+    int                 (*same)(const unsigned char *, int),
+					// I - Equal pair scanner
+    int                 (*diff)(const unsigned char *, int))
+					// I - Different pair scanner
+{
+  const unsigned char	*src_ptr,	// Current input byte
+			*src_end;	// End of input
+  unsigned char		*dst_ptr;	// Current output byte
+  int			count,		// Number of bytes in sequence
+			pairs;		// Number of pairs left to check
+
+
+  src_ptr = src;
+  src_end = src + length;
+  dst_ptr = dst;
+
+  while (src_ptr < src_end && (limit <= 0 || (dst_ptr - dst) < limit))
+  {
+    if ((src_ptr + 1) >= src_end)
+    {
+      //
+      // Single byte on the end...
+      //
+
+      *dst_ptr++ = 0x00;
+      *dst_ptr++ = *src_ptr++;
+    }
+    else if (src_ptr[0] == src_ptr[1])
+    {
+      //
+      // Repeated sequence...
+      //
+
+      src_ptr ++;
+
+      pairs = (int)(src_end - src_ptr) - 1;
+      if (pairs > 125)
+        pairs = 125;
+
+      count    = (*same)(src_ptr, pairs);
+      src_ptr += count;
+      count   += 2;
+
+      *dst_ptr++ = 257 - count;
+      *dst_ptr++ = *src_ptr++;
+    }
+    else
+    {
+      //
+      // Non-repeated sequence...
+      //
+
+      pairs = (int)(src_end - src_ptr) - 2;
+      if (pairs > 126)
+        pairs = 126;
+
+      count = 1 + (*diff)(src_ptr + 1, pairs);
+
+      *dst_ptr++ = count - 1;
+
+      memcpy(dst_ptr, src_ptr, count);
+      dst_ptr += count;
+      src_ptr += count;
+    }
+  }
+
+  return ((int)(dst_ptr - dst));
+}
+
+
+//
+// 'encode_scalar()' - Encode a line one byte at a time.
+//
+
+static int				// O - Number of bytes written
+encode_scalar(unsigned char       *dst,	// I - Output buffer
+              const unsigned char *src,	// I - Input data
+	      int                 length,
+					// I - Number of input bytes
+	      int                 limit)// I - Output limit or 0
+{
+  return (packbits_encode(dst, src, length, limit, same_scalar,
+                          diff_scalar));
+}
+
+
+#ifdef HAVE_X86_KERNELS
+#  ifdef __SSE2__
+//
+// 'same_sse2()' - Count leading pairs of equal bytes, 16 at a time.
+//
+
+static inline int			// O - Number of equal pairs
+same_sse2(const unsigned char *p,	// I - Data
+          int                 count)	// I - Maximum number of pairs
+{
+  int		i;			// Looping var
+  unsigned	mask;			// Mask of different pairs
+
+
+  for (i = 0; i + 16 <= count; i += 16)
+  {
+    mask = (unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)),
+                              _mm_loadu_si128((const __m128i *)(p + i + 1))))
+           ^ 0xffff;
+
+    if (mask)
+      return (i + __builtin_ctz(mask));
+  }
+
+  return (i + same_scalar(p + i, count - i));
+}
+
+
+//
+// 'diff_sse2()' - Count leading pairs of different bytes, 16 at a time.
+//
+
+static inline int			// O - Number of different pairs
+diff_sse2(const unsigned char *p,	// I - Data
+          int                 count)	// I - Maximum number of pairs
+{
+  int		i;			// Looping var
+  unsigned	mask;			// Mask of equal pairs
+
+
+  for (i = 0; i + 16 <= count; i += 16)
+  {
+    mask = (unsigned)_mm_movemask_epi8(
+               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)),
+                              _mm_loadu_si128((const __m128i *)(p + i + 1))));
+
+    if (mask)
+      return (i + __builtin_ctz(mask));
+  }
+
+  return (i + diff_scalar(p + i, count - i));
+}
+
+
+//
+// 'encode_sse2()' - Encode a line using SSE2 run detection.
+//
+
+static int				// O - Number of bytes written
+encode_sse2(unsigned char       *dst,	// I - Output buffer
+            const unsigned char *src,	// I - Input data
+	    int                 length,	// I - Number of input bytes
+	    int                 limit)	// I - Output limit or 0
+{
+  return (packbits_encode(dst, src, length, limit, same_sse2, diff_sse2));
+}
+#  endif // __SSE2__
+
+
+//
+// 'same_avx2()' - Count leading pairs of equal bytes, 32 at a time.
+//
+
+__attribute__((target("avx2")))
+static inline int			// O - Number of equal pairs
+same_avx2(const unsigned char *p,	// I - Data
+          int                 count)	// I - Maximum number of pairs
+{
+  int		i;			// Looping var
+  unsigned	mask;			// Mask of different pairs
+
+
+  for (i = 0; i + 32 <= count; i += 32)
+  {
+    mask = ~(unsigned)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(
+		    _mm256_loadu_si256((const __m256i *)(p + i)),
+		    _mm256_loadu_si256((const __m256i *)(p + i + 1))));
+
+    if (mask)
+      return (i + __builtin_ctz(mask));
+  }
+
+  return (i + same_scalar(p + i, count - i));
+}
+
+
+//
+// 'diff_avx2()' - Count leading pairs of different bytes, 32 at a time.
+//
+
+__attribute__((target("avx2")))
+static inline int			// O - Number of different pairs
+diff_avx2(const unsigned char *p,	// I - Data
+          int                 count)	// I - Maximum number of pairs
+{
+  int		i;			// Looping var
+  unsigned	mask;			// Mask of equal pairs
+
+
+  for (i = 0; i + 32 <= count; i += 32)
+  {
+    mask = (unsigned)_mm256_movemask_epi8(
+               _mm256_cmpeq_epi8(
+		   _mm256_loadu_si256((const __m256i *)(p + i)),
+		   _mm256_loadu_si256((const __m256i *)(p + i + 1))));
+
+    if (mask)
+      return (i + __builtin_ctz(mask));
+  }
+
+  return (i + diff_scalar(p + i, count - i));
+}
+
+
+//
+// 'encode_avx2()' - Encode a line using AVX2 run detection.
+//
+
+__attribute__((target("avx2")))
+static int				// O - Number of bytes written
+encode_avx2(unsigned char       *dst,	// I - Output buffer
+            const unsigned char *src,	// I - Input data
+	    int                 length,	// I - Number of input bytes
+	    int                 limit)	// I - Output limit or 0
+{
+  return (packbits_encode(dst, src, length, limit, same_avx2, diff_avx2));
+}
+#endif // HAVE_X86_KERNELS
+
+
+#ifdef HAVE_NEON_KERNELS
+//
+// 'neon_mask()' - Convert a byte compare result to a 4-bit per byte mask.
+//
+
+static inline unsigned long long	// O - Mask
+neon_mask(uint8x16_t eq)		// I - Compare result
+{
+  return (vget_lane_u64(vreinterpret_u64_u8(
+                            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0));
+}
+
+
+//
+// 'same_neon()' - Count leading pairs of equal bytes, 16 at a time.
+//
+
+static inline int			// O - Number of equal pairs
+same_neon(const unsigned char *p,	// I - Data
+          int                 count)	// I - Maximum number of pairs
+{
+  int			i;		// Looping var
+  unsigned long long	mask;		// Mask of different pairs
+
+
+  for (i = 0; i + 16 <= count; i += 16)
+  {
+    mask = ~neon_mask(vceqq_u8(vld1q_u8(p + i), vld1q_u8(p + i + 1)));
+
+    if (mask)
+      return (i + (__builtin_ctzll(mask) >> 2));
+  }
+
+  return (i + same_scalar(p + i, count - i));
+}
+
+
+//
+// 'diff_neon()' - Count leading pairs of different bytes, 16 at a time.
+//
+
+static inline int			// O - Number of different pairs
+diff_neon(const unsigned char *p,	// I - Data
+          int                 count)	// I - Maximum number of pairs
+{
+  int			i;		// Looping var
+  unsigned long long	mask;		// Mask of equal pairs
+
+
+  for (i = 0; i + 16 <= count; i += 16)
+  {
+    mask = neon_mask(vceqq_u8(vld1q_u8(p + i), vld1q_u8(p + i + 1)));
+
+    if (mask)
+      return (i + (__builtin_ctzll(mask) >> 2));
+  }
+
+  return (i + diff_scalar(p + i, count - i));
+}
+
+
+//
+// 'encode_neon()' - Encode a line using NEON run detection.
+//
+
+static int				// O - Number of bytes written
+encode_neon(unsigned char       *dst,	// I - Output buffer
+            const unsigned char *src,	// I - Input data
+	    int                 length,	// I - Number of input bytes
+	    int                 limit)	// I - Output limit or 0
+{
+  return (packbits_encode(dst, src, length, limit, same_neon, diff_neon));
+}
+#endif // HAVE_NEON_KERNELS
+
+
+//
+// Local globals...
+//
+
+static const raster_packbits_kernel_t packbits_kernels[] =
+{					// Available kernels, default first
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+  { "sse2",   encode_sse2 },
+#endif // HAVE_X86_KERNELS && __SSE2__
+#ifdef HAVE_NEON_KERNELS
+  { "neon",   encode_neon },
+#endif // HAVE_NEON_KERNELS
+  { "scalar", encode_scalar },
+#ifdef HAVE_X86_KERNELS
+  { "avx2",   encode_avx2 }
+#endif // HAVE_X86_KERNELS
+};
+static const raster_packbits_kernel_t *packbits_kernel = NULL;
+					// Selected kernel
+
+
+//
+// 'raster_packbits()' - Compress a line using TIFF PackBits encoding.
+//
+// Encoding stops early once "limit" or more bytes have been written, so
+// callers that fall back to uncompressed data when compression does not
+// help only need to compare the result against their limit.  The output
+// buffer must hold at least 2 * length bytes when limit is 0.
+//
+
+int					// O - Number of bytes written
+raster_packbits(unsigned char       *dst,
+					// I - Output buffer
+                const unsigned char *src,
+					// I - Input data
+		int                 length,
+					// I - Number of input bytes
+		int                 limit)
+					// I - Stop after this many bytes or 0
+{
+  if (!packbits_kernel)
+    packbits_kernel = packbits_init();
+
+  return ((*packbits_kernel->encode)(dst, src, length, limit));
+}
+
+
+//
+// 'raster_packbits_impl()' - Return the name of the PackBits kernel in use.
+//
+
+const char *				// O - Kernel name
+raster_packbits_impl(void)
+{
+  if (!packbits_kernel)
+    packbits_kernel = packbits_init();
+
+  return (packbits_kernel->name);
+}
+
+
+//
+// 'raster_packbits_select()' - Select a PackBits kernel by name.
+//
+// Passing NULL selects the default kernel again.
+//
+
+int					// O - 0 on success, -1 if unsupported
+raster_packbits_select(const char *name)// I - Kernel name or NULL
+{
+  int	i;				// Looping var
+
+
+  if (!name)
+  {
+    packbits_kernel = packbits_init();
+    return (0);
+  }
+
+  for (i = 0;
+       i < (int)(sizeof(packbits_kernels) / sizeof(packbits_kernels[0]));
+       i ++)
+    if (!strcmp(name, packbits_kernels[i].name))
+    {
+#ifdef HAVE_X86_KERNELS
+      __builtin_cpu_init();
+
+      if (packbits_kernels[i].encode == encode_avx2 &&
+          !__builtin_cpu_supports("avx2"))
+        return (-1);
+#endif // HAVE_X86_KERNELS
+
+      packbits_kernel = packbits_kernels + i;
+      return (0);
+    }
+
+  return (-1);
+}
+
+
+//
+// 'packbits_init()' - Choose the default PackBits kernel.
+//
+// The AVX2 kernel is only used when selected by name: on the short runs
+// of typical printer rows it measures slower than the SSE2 kernel, which
+// every x86-64 CPU has.
+//
+
+static const raster_packbits_kernel_t *	// O - Kernel
+packbits_init(void)
+{
+  return (packbits_kernels);
+}
+
+
+//
+// 'raster_prefetch_delete()' - Stop reading ahead and free the buffer.
+//
+
+void
+raster_prefetch_delete(
+    raster_prefetch_t *pf)		// I - Prefetch buffer
+{
+  if (!pf)
+    return;
+
+#ifdef HAVE_PTHREAD_H
+  //
+  // Stop the reader thread; it may be waiting for the upstream filter in
+  // read(), the only place where it can be canceled...
+  //
+
+  pthread_mutex_lock(&pf->mutex);
+  pf->aborted = 1;
+  pthread_cond_broadcast(&pf->cond);
+  pthread_mutex_unlock(&pf->mutex);
+
+  pthread_cancel(pf->thread);
+  pthread_join(pf->thread, NULL);
+
+  pthread_cond_destroy(&pf->cond);
+  pthread_mutex_destroy(&pf->mutex);
+#endif // HAVE_PTHREAD_H
+
+  free(pf->buffer);
+  free(pf);
+}
+
+
+//
+// 'raster_prefetch_new()' - Start reading raster data ahead.
+//
+// A reader thread fills a ring buffer of "size" bytes from the file with
+// large read() calls, so that the upstream filter is not held up while
+// the driver is busy with a line.  Pass raster_prefetch_read() and the
+// buffer to cupsRasterOpenIO() to use it.  Returns NULL when threads are
+// not available or the buffer cannot be allocated.
+//
+
+raster_prefetch_t *			// O - Prefetch buffer or NULL
+raster_prefetch_new(int    fd,		// I - File to read from
+                    size_t size)	// I - Bytes to read ahead
+{
+#ifdef HAVE_PTHREAD_H
+  raster_prefetch_t	*pf;		// Prefetch buffer
+
+
+  if (size == 0 || (pf = calloc(1, sizeof(raster_prefetch_t))) == NULL)
+    return (NULL);
+
+  if ((pf->buffer = malloc(size)) == NULL)
+  {
+    free(pf);
+    return (NULL);
+  }
+
+  pf->fd   = fd;
+  pf->size = size;
+
+  pthread_mutex_init(&pf->mutex, NULL);
+  pthread_cond_init(&pf->cond, NULL);
+
+  if (pthread_create(&pf->thread, NULL, prefetch_thread, pf))
+  {
+    pthread_cond_destroy(&pf->cond);
+    pthread_mutex_destroy(&pf->mutex);
+    free(pf->buffer);
+    free(pf);
+    return (NULL);
+  }
+
+  return (pf);
+
+#else
+  (void)fd;
+  (void)size;
+
+  return (NULL);
+#endif // HAVE_PTHREAD_H
+}
+
+
+//
+// 'raster_prefetch_read()' - Read raster data that was read ahead.
+//
+// This is a cups_raster_iocb_t callback; it waits until "length" bytes are
+// available or the end of the file is reached.
+//
+
+ssize_t					// O - Bytes read, 0 at end of file
+raster_prefetch_read(
+    void          *ctx,			// I - Prefetch buffer
+    unsigned char *buffer,		// I - Buffer to read into
+    size_t        length)		// I - Number of bytes to read
+{
+#ifdef HAVE_PTHREAD_H
+  raster_prefetch_t	*pf = (raster_prefetch_t *)ctx;
+					// Prefetch buffer
+  size_t		total = 0,	// Bytes read
+			bytes;		// Bytes to copy
+
+
+  pthread_mutex_lock(&pf->mutex);
+
+  while (total < length)
+  {
+    if (pf->count == 0)
+    {
+      if (pf->eof || pf->aborted)
+        break;
+
+      pthread_cond_wait(&pf->cond, &pf->mutex);
+      continue;
+    }
+
+    bytes = length - total;
+    if (bytes > pf->count)
+      bytes = pf->count;
+    if (bytes > pf->size - pf->head)
+      bytes = pf->size - pf->head;
+
+    memcpy(buffer + total, pf->buffer + pf->head, bytes);
+
+    total     += bytes;
+    pf->count -= bytes;
+    pf->head  = (pf->head + bytes) % pf->size;
+
+    pthread_cond_broadcast(&pf->cond);
+  }
+
+  pthread_mutex_unlock(&pf->mutex);
+
+  return ((ssize_t)total);
+
+#else
+  (void)ctx;
+  (void)buffer;
+  (void)length;
+
+  return (-1);
+#endif // HAVE_PTHREAD_H
+}
+
+
+//
+// 'raster_prefetch_stop()' - Stop reading ahead, reads return the end of
+//                            the file.
+//
+// Wakes up a raster_prefetch_read() that waits for the upstream filter,
+// so that a driver thread reading the raster stream can be joined when
+// the job is canceled.  The buffer must still be freed with
+// raster_prefetch_delete().
+//
+
+void
+raster_prefetch_stop(
+    raster_prefetch_t *pf)		// I - Prefetch buffer
+{
+  if (!pf)
+    return;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&pf->mutex);
+  pf->aborted = 1;
+  pthread_cond_broadcast(&pf->cond);
+  pthread_mutex_unlock(&pf->mutex);
+#endif // HAVE_PTHREAD_H
+}
+
+
+#ifdef HAVE_PTHREAD_H
+//
+// 'prefetch_thread()' - Read raster data into the ring buffer.
+//
+// Reads wait until a quarter of the buffer is free, so that the upstream
+// filter is emptied with a few large reads rather than one per line.  A
+// non-blocking file is polled until there is something to read.
+//
+
+static void *				// O - Thread exit status (unused)
+prefetch_thread(void *arg)		// I - Prefetch buffer
+{
+  raster_prefetch_t	*pf = (raster_prefetch_t *)arg;
+					// Prefetch buffer
+  size_t		tail,		// Next byte to fill
+			bytes;		// Bytes to read
+  ssize_t		got;		// Bytes read
+  struct pollfd		pfd;		// File to wait for
+
+
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  pthread_mutex_lock(&pf->mutex);
+
+  while (!pf->aborted)
+  {
+    if (pf->size - pf->count < (pf->size + 3) / 4)
+    {
+      pthread_cond_wait(&pf->cond, &pf->mutex);
+      continue;
+    }
+
+    tail  = (pf->head + pf->count) % pf->size;
+    bytes = pf->size - pf->count;
+    if (bytes > pf->size - tail)
+      bytes = pf->size - tail;
+
+    pthread_mutex_unlock(&pf->mutex);
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    while ((got = read(pf->fd, pf->buffer + tail, bytes)) < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        pfd.fd     = pf->fd;
+        pfd.events = POLLIN;
+
+        poll(&pfd, 1, -1);
+      }
+      else if (errno != EINTR)
+        break;
+    }
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    pthread_mutex_lock(&pf->mutex);
+
+    if (got > 0)
+      pf->count += (size_t)got;
+    else
+    {
+      pf->eof = 1;
+      pthread_cond_broadcast(&pf->cond);
+      break;
+    }
+
+    pthread_cond_broadcast(&pf->cond);
+  }
+
+  pthread_mutex_unlock(&pf->mutex);
+
+  return (NULL);
+}
+#endif // HAVE_PTHREAD_H
+
+
+//
+// 'raster_stats_add()' - Add the time and output of a stage.
+//
+// "start" is the value returned by raster_stats_start() when the stage
+// began and "bytes" is the amount of data the stage produced.  This is
+// safe to call from several threads at once.
+//
+
+void
+raster_stats_add(raster_stats_t *stats,	// I - Statistics or NULL
+                 raster_stage_t stage,	// I - Stage
+		 long long      start,	// I - Start time of stage
+		 size_t         bytes)	// I - Bytes produced
+{
+  if (!stats)
+    return;
+
+  __atomic_fetch_add(stats->page_ns + stage,
+                     raster_stats_start(stats) - start, __ATOMIC_RELAXED);
+  __atomic_fetch_add(stats->page_bytes + stage, (long long)bytes,
+                     __ATOMIC_RELAXED);
+}
+
+
+//
+// 'raster_stats_delete()' - Report the job totals and free statistics.
+//
+
+void
+raster_stats_delete(
+    raster_stats_t *stats)		// I - Statistics or NULL
+{
+  int		i;			// Looping var
+  long long	elapsed;		// Elapsed time for job
+  char		attr[2048],		// ATTR: message
+		*ptr;			// Pointer into message
+
+
+  if (!stats)
+    return;
+
+  if (!stats->driver)
+  {
+    //
+    // Page slots have nothing to report...
+    //
+
+    free(stats);
+    return;
+  }
+
+  elapsed = raster_stats_start(stats) - stats->job_start;
+
+  for (i = 0; i < RASTER_STAGE_MAX; i ++)
+  {
+    stats->job_ns[i]    += stats->page_ns[i];
+    stats->job_bytes[i] += stats->page_bytes[i];
+  }
+
+  stats_log(stats, "job", elapsed, stats->job_ns, stats->job_bytes);
+
+  for (i = 0, ptr = attr, *ptr = '\0'; i < RASTER_STAGE_MAX; i ++)
+  {
+    snprintf(ptr, sizeof(attr) - (size_t)(ptr - attr),
+             " %s-%s-seconds=%.6f %s-%s-bytes=%lld", stats->driver,
+	     stage_names[i], stats->job_ns[i] / 1000000000.0, stats->driver,
+	     stage_names[i], stats->job_bytes[i]);
+    ptr += strlen(ptr);
+  }
+
+  if (stats->logfunc)
+    stats->logfunc(stats->ld, CF_LOGLEVEL_CONTROL, "ATTR:%s", attr);
+
+  if (stats->json)
+  {
+    fputs("\n  ],\n  \"job\": {", stats->json);
+    stats_json(stats, elapsed, stats->job_ns, stats->job_bytes);
+    fputs("}\n}\n", stats->json);
+    fclose(stats->json);
+  }
+
+  free(stats);
+}
+
+
+//
+// 'raster_stats_merge()' - Move the totals of a page slot into the page
+//                          totals.
+//
+
+void
+raster_stats_merge(
+    raster_stats_t *stats,		// I - Statistics or NULL
+    raster_stats_t *slot)		// I - Page slot or NULL
+{
+  int	i;				// Looping var
+
+
+  if (!stats || !slot)
+    return;
+
+  for (i = 0; i < RASTER_STAGE_MAX; i ++)
+  {
+    __atomic_fetch_add(stats->page_ns + i,
+                       __atomic_exchange_n(slot->page_ns + i, 0,
+		                           __ATOMIC_RELAXED),
+		       __ATOMIC_RELAXED);
+    __atomic_fetch_add(stats->page_bytes + i,
+                       __atomic_exchange_n(slot->page_bytes + i, 0,
+		                           __ATOMIC_RELAXED),
+		       __ATOMIC_RELAXED);
+  }
+}
+
+
+//
+// 'raster_stats_new()' - Create statistics for a job if enabled.
+//
+// "spec" is the value of the driver's statistics environment variable:
+// NULL, "" or "0" disable the statistics, "1" logs them with "logfunc"
+// and any other value is the name of a JSON file to write them to as well.
+//
+
+raster_stats_t *			// O - Statistics or NULL if disabled
+raster_stats_new(const char   *driver,	// I - Name of driver
+                 const char   *spec,	// I - Statistics setting
+		 cf_logfunc_t logfunc,	// I - Log function
+		 void         *ld)	// I - Log function data
+{
+  raster_stats_t	*stats;		// Statistics
+
+
+  if (!spec || !*spec || !strcmp(spec, "0"))
+    return (NULL);
+
+  if ((stats = calloc(1, sizeof(raster_stats_t))) == NULL)
+    return (NULL);
+
+  stats->driver     = driver;
+  stats->logfunc    = logfunc;
+  stats->ld         = ld;
+  stats->job_start  = raster_stats_start(stats);
+  stats->page_start = stats->job_start;
+
+  if (strcmp(spec, "1"))
+  {
+    if ((stats->json = fopen(spec, "w")) == NULL)
+    {
+      if (logfunc)
+        logfunc(ld, CF_LOGLEVEL_DEBUG, "Unable to create \"%s\": %s", spec,
+	        strerror(errno));
+    }
+    else
+      fprintf(stats->json, "{\n  \"driver\": \"%s\",\n  \"pages\": [",
+              driver);
+  }
+
+  return (stats);
+}
+
+
+//
+// 'raster_stats_page()' - Report the totals of a page.
+//
+// The page totals are added to the job totals and cleared for the next
+// page.  Other threads may keep adding to the statistics while this runs,
+// so pages rendered at the same time should each use a page slot (see
+// raster_stats_slot()) that is merged right before the page is reported.
+//
+
+void
+raster_stats_page(raster_stats_t *stats)// I - Statistics or NULL
+{
+  int		i;			// Looping var
+  long long	now,			// Current time
+		ns[RASTER_STAGE_MAX],	// Nanoseconds per stage for page
+		bytes[RASTER_STAGE_MAX];// Bytes per stage for page
+  char		what[64];		// Description for log
+
+
+  if (!stats)
+    return;
+
+  now = raster_stats_start(stats);
+
+  for (i = 0; i < RASTER_STAGE_MAX; i ++)
+  {
+    ns[i]    = __atomic_exchange_n(stats->page_ns + i, 0, __ATOMIC_RELAXED);
+    bytes[i] = __atomic_exchange_n(stats->page_bytes + i, 0,
+                                   __ATOMIC_RELAXED);
+  }
+
+  stats->pages ++;
+
+  snprintf(what, sizeof(what), "page %d", stats->pages);
+  stats_log(stats, what, now - stats->page_start, ns, bytes);
+
+  if (stats->json)
+  {
+    fprintf(stats->json, "%s\n    {\"page\": %d, ",
+            stats->pages > 1 ? "," : "", stats->pages);
+    stats_json(stats, now - stats->page_start, ns, bytes);
+    fputc('}', stats->json);
+  }
+
+  for (i = 0; i < RASTER_STAGE_MAX; i ++)
+  {
+    stats->job_ns[i]    += ns[i];
+    stats->job_bytes[i] += bytes[i];
+  }
+
+  stats->page_start = now;
+}
+
+
+//
+// 'raster_stats_slot()' - Create the totals of a page rendered by another
+//                         thread.
+//
+// The stages of the page add to the slot instead of the page totals of
+// "stats"; raster_stats_merge() moves them over when the page is
+// reported.  Free the slot with raster_stats_delete().
+//
+
+raster_stats_t *			// O - Page slot or NULL
+raster_stats_slot(
+    raster_stats_t *stats)		// I - Statistics or NULL
+{
+  if (!stats)
+    return (NULL);
+
+  return ((raster_stats_t *)calloc(1, sizeof(raster_stats_t)));
+}
+
+
+//
+// 'raster_stats_start()' - Get the start time of a stage.
+//
+
+long long				// O - Monotonic time in nanoseconds
+raster_stats_start(
+    raster_stats_t *stats)		// I - Statistics or NULL
+{
+  struct timespec	ts;		// Current time
+
+
+  if (!stats)
+    return (0);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+
+//
+// 'stats_json()' - Write the totals of a page or job as JSON.
+//
+// Only the members are written, the caller supplies the braces.
+//
+
+static void
+stats_json(raster_stats_t  *stats,	// I - Statistics
+           long long       elapsed,	// I - Elapsed time
+	   const long long *ns,		// I - Nanoseconds per stage
+	   const long long *bytes)	// I - Bytes per stage
+{
+  int	i;				// Looping var
+
+
+  fprintf(stats->json, "\"seconds\": %.6f", elapsed / 1000000000.0);
+
+  for (i = 0; i < RASTER_STAGE_MAX; i ++)
+    fprintf(stats->json, ", \"%s\": {\"seconds\": %.6f, \"bytes\": %lld}",
+            stage_names[i], ns[i] / 1000000000.0, bytes[i]);
+}
+
+
+//
+// 'stats_log()' - Log the totals of a page or job.
+//
+
+static void
+stats_log(raster_stats_t  *stats,	// I - Statistics
+          const char      *what,	// I - "page N" or "job"
+          long long       elapsed,	// I - Elapsed time
+	  const long long *ns,		// I - Nanoseconds per stage
+	  const long long *bytes)	// I - Bytes per stage
+{
+  int	i;				// Looping var
+  char	line[1024],			// Per-stage totals
+	*ptr;				// Pointer into totals
+
+
+  if (!stats->logfunc)
+    return;
+
+  for (i = 0, ptr = line, *ptr = '\0'; i < RASTER_STAGE_MAX; i ++)
+  {
+    snprintf(ptr, sizeof(line) - (size_t)(ptr - line), " %s=%.3fs/%lldB",
+             stage_names[i], ns[i] / 1000000000.0, bytes[i]);
+    ptr += strlen(ptr);
+  }
+
+  stats->logfunc(stats->ld, CF_LOGLEVEL_DEBUG, "%s %s took %.3fs:%s",
+                 stats->driver, what, elapsed / 1000000000.0, line);
+}
@@ -0,0 +1,137 @@
+//
+// Common raster driver definitions for cups-filters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _RASTER_COMMON_H_
+#  define _RASTER_COMMON_H_
+
+//
+// Include necessary headers...
+//
+
+#include <cupsfilters/driver.h>
+#include <cupsfilters/log.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+
+//
+// Constants...
+//
+
+#define RASTER_OUT_FLUSH	65536	// Default bytes to collect before
+					// writing
+
+
+//
+// Types...
+//
+
+typedef struct raster_dither_s raster_dither_t;
+					// Threshold dither matrix
+
+typedef struct raster_out_s raster_out_t;
+					// Buffered printer output
+
+typedef struct raster_prefetch_s raster_prefetch_t;
+					// Raster data read ahead
+
+typedef enum raster_stage_e		// Driver stages for statistics
+{
+  RASTER_STAGE_READ,			// Reading raster data
+  RASTER_STAGE_SEPARATE,		// Color separation
+  RASTER_STAGE_DITHER,			// Dithering
+  RASTER_STAGE_PACK,			// Packing and weaving pixels
+  RASTER_STAGE_COMPRESS,		// Compressing graphics
+  RASTER_STAGE_WRITE,			// Writing to the printer
+  RASTER_STAGE_MAX
+} raster_stage_t;
+
+typedef struct raster_stats_s raster_stats_t;
+					// Stage statistics for a job
+
+
+//
+// Functions...
+//
+
+#ifdef __GNUC__
+#  define RASTER_FORMAT(a,b) __attribute__ ((__format__(__printf__, a,b)))
+#else
+#  define RASTER_FORMAT(a,b)
+#endif // __GNUC__
+
+extern int		raster_check_value(const unsigned char *p,
+			                   size_t length, int value);
+extern size_t		raster_count_diff(const unsigned char *p,
+			                  const unsigned char *seed,
+					  size_t length);
+extern size_t		raster_count_diff_rgb(const unsigned char *p,
+			                      const unsigned char *seed,
+					      size_t count);
+extern size_t		raster_count_same(const unsigned char *p,
+			                  const unsigned char *seed,
+					  size_t length);
+extern void		raster_dither_delete(raster_dither_t *d);
+extern unsigned short	*raster_dither_levels(const cf_lut_t *lut);
+extern void		raster_dither_line(const raster_dither_t *d,
+			                   const unsigned short *levels,
+					   const short *input, int step,
+					   unsigned char *pixels, int width,
+					   int y, int plane);
+extern raster_dither_t	*raster_dither_new(const char *name);
+extern void		raster_hash(unsigned long long *hash,
+			            const unsigned char *data,
+				    size_t length);
+extern int		raster_invert_check(unsigned char *dst,
+			                    const unsigned char *src,
+					    size_t length, int value);
+extern void		raster_out_append(raster_out_t *out,
+			                  raster_out_t *src);
+extern int		raster_out_checkpoint(raster_out_t *out);
+extern void		raster_out_delete(raster_out_t *out);
+extern void		raster_out_discard(raster_out_t *out);
+extern unsigned char	*raster_out_dup(const raster_out_t *out,
+			                size_t *length);
+extern int		raster_out_flush(raster_out_t *out);
+extern size_t		raster_out_length(const raster_out_t *out);
+extern raster_out_t	*raster_out_new(int fd, size_t flush_size,
+			               cf_logfunc_t logfunc, void *ld);
+extern void		raster_out_printf(raster_out_t *out,
+			                  const char *format, ...)
+			                  RASTER_FORMAT(2,3);
+extern void		raster_out_putc(raster_out_t *out, int ch);
+extern void		raster_out_puts(raster_out_t *out, const char *s);
+extern void		raster_out_set_stats(raster_out_t *out,
+			                     raster_stats_t *stats);
+extern void		raster_out_write(raster_out_t *out, const void *data,
+			                 size_t length);
+extern int		raster_packbits(unsigned char *dst,
+			                const unsigned char *src, int length,
+					int limit);
+extern const char	*raster_packbits_impl(void);
+extern int		raster_packbits_select(const char *name);
+extern void		raster_prefetch_delete(raster_prefetch_t *pf);
+extern raster_prefetch_t *raster_prefetch_new(int fd, size_t size);
+extern ssize_t		raster_prefetch_read(void *ctx,
+			                     unsigned char *buffer,
+					     size_t length);
+extern void		raster_prefetch_stop(raster_prefetch_t *pf);
+extern void		raster_stats_add(raster_stats_t *stats,
+			                 raster_stage_t stage, long long start,
+					 size_t bytes);
+extern void		raster_stats_delete(raster_stats_t *stats);
+extern void		raster_stats_merge(raster_stats_t *stats,
+			                   raster_stats_t *slot);
+extern raster_stats_t	*raster_stats_new(const char *driver,
+			                  const char *spec,
+					  cf_logfunc_t logfunc, void *ld);
+extern void		raster_stats_page(raster_stats_t *stats);
+extern raster_stats_t	*raster_stats_slot(raster_stats_t *stats);
+extern long long	raster_stats_start(raster_stats_t *stats);
+
+#endif // !_RASTER_COMMON_H_
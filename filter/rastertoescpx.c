@@ -9,15 +9,39 @@
 //
 // Contents:
 //
+//   JobLog()          - Log a message for the job.
 //   Setup()           - Prepare the printer for graphics output.
+//   GetProfile()      - Get the color profile for a page, loading it as
+//                       needed.
+//   FreeProfile()     - Free the separations and tables of a color
+//                       profile.
+//   FreeProfiles()    - Free all cached color profiles at the end of the
+//                       job.
 //   StartPage()       - Start a page of graphics.
 //   EndPage()         - Finish a page of graphics.
 //   Shutdown()        - Shutdown a printer.
-//   CancelJob()       - Cancel the current job...
+//   AddBand()         - Add a band of data to the used heap.
+//   NextBand()        - Remove the first band from the used heap.
+//   FreeBands()       - Free the band slab and arena at the end of the
+//                       job.
 //   CompressData()    - Compress a line of graphics.
 //   OutputBand()      - Output a band of graphics.
+//   TrimData()        - Find the inked columns of a band or line.
+//   SeparateLine()    - Perform the color separation of a line.
+//   DitherPlane()     - Dither a color plane of a line.
+//   WeaveLine()       - Pack, weave and output a line of dithered pixels.
 //   ProcessLine()     - Read graphics from the page stream and output
 //                       as needed.
+//   StartPipeline()   - Start the threaded pipeline for a job.
+//   PipelinePage()    - Hand the next page to the pipeline threads.
+//   PipelineLine()    - Output the next line from the threaded pipeline.
+//   StopPipeline()    - Stop the threaded pipeline at the end of a job.
+//   PipelineWait()    - Wait for the next page in a pipeline thread.
+//   ReadRaster()      - Read raster data from the input file.
+//   ReaderThread()    - Read raster lines into the pipeline.
+//   SeparateThread()  - Color separate lines in the pipeline.
+//   DitherThread()    - Dither color planes of lines in the pipeline.
+//   RasterToESCPX()   - Filter function to print a raster job.
 //   main()            - Main entry and processing of driver.
 //
 
@@ -26,11 +50,27 @@
 //
 
 #include <cupsfilters/driver.h>
+#include <cupsfilters/filter.h>
 #include <ppd/ppd.h>
+#include <ppd/ppd-filter.h>
+#include <config.h>
 #include "escp.h"
-#include <signal.h>
+#include "raster-common.h"
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif // HAVE_PTHREAD_H
+
+
+//
+// Job data, see below...
+//
+
+typedef struct escp_job_str escp_job_t;
 
 
 //
@@ -39,8 +79,7 @@
 
 typedef struct cups_weave_str
 {
-  struct cups_weave_str	*prev,			// Previous band
-			*next;			// Next band
+  struct cups_weave_str	*next;			// Next available band
   int			x, y,			// Column/Line on the page
 			plane,			// Color plane
 			dirty,			// Is this buffer dirty?
@@ -51,21 +90,120 @@ typedef struct cups_weave_str
 
 
 //
-// Globals...
+// Color profile cache data...
+//
+
+#define PROFILE_MAX	4			// Maximum cached color profiles
+
+typedef struct cups_profile_str
+{
+  cups_cspace_t		cspace;			// Color space
+  char			media_type[64],		// Media type
+			resolution[PPD_MAX_NAME];
+						// Resolution
+  cf_rgb_t		*rgb;			// RGB color separation data
+  cf_cmyk_t		*cmyk;			// CMYK color separation data
+  cf_lut_t		*luts[7];		// Lookup tables for dithering
+  raster_dither_t	*dither;		// Threshold matrix or NULL for
+						// error diffusion
+  unsigned short	*levels[7];		// Threshold dither levels
+  int			use;			// Last use of profile
+} cups_profile_t;
+
+
+//
+// Threaded pipeline data...
+//
+// With the pipeline enabled, raster lines pass through a ring of line
+// slots: a reader thread fills a slot with raster data, a separation
+// thread converts it to ink values, one or more dither threads dither
+// the color planes, and the main thread packs, weaves and writes the
+// line.  Each stage processes the lines in page order, so the output
+// is identical to the single-threaded driver.  The threads are started
+// for the first page of a job and wait between pages.
+//
+
+#ifdef HAVE_PTHREAD_H
+#  define PIPELINE_DEPTH	16		// Line slots in the pipeline
+
+enum cups_line_state_e				// Line slot states
+{
+  LINE_FREE,					// Slot can be filled
+  LINE_READ,					// Raster data read
+  LINE_SEPARATED,				// Color separation done
+  LINE_SKIPPED					// Read failed, skip line
+};
+
+typedef struct cups_line_str
+{
+  int			y,			// Line on the page
+			state,			// Slot state
+			blank,			// Is the line blank?
+			dithered;		// Number of planes dithered
+  unsigned char		*pixels,		// Raster pixels
+			*cmyk,			// CMYK buffer
+			*planes[7];		// Dithered output for each plane
+  short			*input;			// Color separation buffer
+} cups_line_t;
+
+typedef struct cups_worker_str
+{
+  escp_job_t		*job;			// Job being printed
+  int			first;			// First plane to dither
+} cups_worker_t;
+
+typedef struct cups_pipeline_str
+{
+  pthread_mutex_t	mutex;			// Mutex for line slots
+  pthread_cond_t	cond;			// Line slot state changes
+  cups_raster_t		*ras;			// Raster stream
+  cups_page_header2_t	*header;		// Current page header
+  int			aborted,		// Stop the pipeline?
+			page,			// Current page, changed to
+						// start the threads on a page
+			num_workers,		// Number of dither threads
+			num_dither,		// Dither threads used for the
+						// current page
+			num_started;		// Number of threads started
+  size_t		pixels_size,		// Allocated sizes of the
+			input_size,		// line slot buffers
+			planes_size,
+			cmyk_size;
+  pthread_t		threads[9];		// Pipeline threads
+  cups_worker_t		workers[7];		// Dither thread arguments
+  cups_line_t		lines[PIPELINE_DEPTH];	// Line slots
+} cups_pipeline_t;
+#endif // HAVE_PTHREAD_H
+
+
+//
+// Job data...
+//
+// Everything the driver needs while printing a job lives in this
+// structure, so several jobs can be run at the same time in one process
+// through the RasterToESCPX() filter function.
 //
 
-cf_rgb_t	*RGB;			// RGB color separation data
-cf_cmyk_t	*CMYK;			// CMYK color separation data
-unsigned char	*PixelBuffer,		// Pixel buffer
+struct escp_job_str
+{
+  cf_rgb_t	*RGB;			// RGB color separation data
+  cf_cmyk_t	*CMYK;			// CMYK color separation data
+  unsigned char	*PixelBuffer,		// Pixel buffer
 		*CMYKBuffer,		// CMYK buffer
 		*OutputBuffers[7],	// Output buffers
 		*DotBuffers[7],		// Dot buffers
 		*CompBuffer;		// Compression buffer
-short		*InputBuffer;		// Color separation buffer
-cups_weave_t	*DotAvailList,		// Available buffers
-		*DotUsedList,		// Used buffers
+  short		*InputBuffer,		// Color separation buffer
+		*BlankInput;		// Ink values of a blank line
+  cups_weave_t	*DotAvailList,		// Available buffers
+		**DotUsedHeap,		// Used buffers, ordered by position
+		*DotBandSlab,		// Band headers for the job
 		*DotBands[128][7];	// Buffers in use
-int		DotBufferSize,		// Size of dot buffers
+  unsigned char	*DotArena;		// Band buffers for the job
+  size_t	DotArenaSize;		// Size of band buffer arena
+  int		DotUsedCount,		// Number of used buffers
+		DotBandAlloc,		// Number of allocated band headers
+		DotBufferSize,		// Size of dot buffers
 		DotRowMax,		// Maximum row number in buffer
 		DotColStep,		// Step for each output column
 		DotRowStep,		// Step for each output line
@@ -74,36 +212,119 @@ int		DotBufferSize,		// Size of dot buffers
 		DotRowOffset[7],	// Offset for each color on print head
 		DotRowCurrent,		// Current row
 		DotSize;		// Dot size (Pro 5000 only)
-int		PrinterPlanes,		// # of color planes
+  int		PrinterPlanes,		// # of color planes
 		BitPlanes,		// # of bit planes per color
 		PrinterTop,		// Top of page
 		PrinterLength;		// Length of page
-cf_lut_t	*DitherLuts[7];		// Lookup tables for dithering
-cf_dither_t	*DitherStates[7];	// Dither state tables
-int		OutputFeed;		// Number of lines to skip
-int		Canceled;		// Is the job canceled?
-cf_logfunc_t logfunc;               // Log function
-void            *ld;                    // Log function data
+  cf_lut_t	*DitherLuts[7];		// Lookup tables for dithering
+  cf_dither_t	*DitherStates[7];	// Dither state tables
+  raster_dither_t *DitherMatrix;	// Threshold matrix, if any
+  unsigned short *DitherLevels[7];	// Threshold levels for dithering
+  const char	*DitherMode;		// Threshold matrix from the
+					// environment
+  int		BlankValue,		// Raster value of blank lines or -1
+		DitherClean[7];		// Dither state has no error left?
+  int		OutputFeed;		// Number of lines to skip
+  raster_out_t	*Output;		// Buffered printer output
+  cups_profile_t Profiles[PROFILE_MAX];	// Cached color profiles
+  int		NumProfiles,		// Number of cached color profiles
+		ProfileUse;		// Profile use counter
+  int		Threads;		// Number of pipeline threads
+  int		Trim;			// Trim blank margins of bands?
+  raster_stats_t *Stats;		// Stage statistics, if any
+#ifdef HAVE_PTHREAD_H
+  int		InputFD;		// Raster input file
+  cups_pipeline_t *Pipeline;		// Threaded pipeline, if any
+#endif // HAVE_PTHREAD_H
+  cf_logfunc_t	logfunc;		// Log function
+  void		*ld;			// Log function data
+  cf_filter_iscanceledfunc_t iscanceled;
+					// Function returning 1 when job
+					// is canceled
+  void		*icd;			// Data for iscanceled()
+};
 
 
 //
-// Prototypes...
+// Globals...
 //
 
-void	Setup(ppd_file_t *);
-void	StartPage(ppd_file_t *, cups_page_header2_t *);
-void	EndPage(ppd_file_t *, cups_page_header2_t *);
-void	Shutdown(ppd_file_t *);
+static int	JobCanceled = 0;	// Set to 1 on SIGTERM
+
+
+//
+// Prototypes...
+//
 
-void	AddBand(cups_weave_t *band);
-void	CancelJob(int sig);
-void	CompressData(ppd_file_t *, const unsigned char *, const int,
-	             int, int, const int, const int, const int,
+int	RasterToESCPX(int, int, int, cf_filter_data_t *, void *);
+
+void	JobLog(escp_job_t *, cf_loglevel_t, const char *, ...)
+	       RASTER_FORMAT(3,4);
+void	Setup(escp_job_t *, ppd_file_t *);
+int	StartPage(escp_job_t *, ppd_file_t *, cups_page_header2_t *);
+void	EndPage(escp_job_t *, ppd_file_t *, cups_page_header2_t *);
+void	Shutdown(escp_job_t *, ppd_file_t *);
+
+cups_profile_t *GetProfile(escp_job_t *, ppd_file_t *,
+			   cups_page_header2_t *, const char *, const char *);
+void	FreeProfile(cups_profile_t *);
+void	FreeProfiles(escp_job_t *);
+
+void	AddBand(escp_job_t *, cups_weave_t *band);
+cups_weave_t *NextBand(escp_job_t *);
+void	FreeBands(escp_job_t *);
+void	CompressData(escp_job_t *, ppd_file_t *, const unsigned char *,
+		     const int, int, int, const int, const int, const int,
 		     const int);
-void	OutputBand(ppd_file_t *, cups_page_header2_t *,
+void	OutputBand(escp_job_t *, ppd_file_t *, cups_page_header2_t *,
 	           cups_weave_t *band);
-void	ProcessLine(ppd_file_t *, cups_raster_t *,
+int	TrimData(escp_job_t *, ppd_file_t *, cups_page_header2_t *,
+		 const unsigned char *, const int, int *, int *, int *);
+void	ProcessLine(escp_job_t *, ppd_file_t *, cups_raster_t *,
 	            cups_page_header2_t *, const int y);
+void	SeparateLine(escp_job_t *, cups_page_header2_t *, unsigned char *,
+		     unsigned char *, short *);
+void	DitherPlane(escp_job_t *, const int, const int, const short *,
+		    unsigned char *);
+void	WeaveLine(escp_job_t *, ppd_file_t *, cups_page_header2_t *,
+		  const int y, unsigned char **);
+#ifdef HAVE_PTHREAD_H
+int	StartPipeline(escp_job_t *, cups_raster_t *);
+int	PipelinePage(escp_job_t *, cups_page_header2_t *);
+int	PipelineLine(escp_job_t *, ppd_file_t *, cups_page_header2_t *,
+		     const int y);
+void	StopPipeline(escp_job_t *);
+int	PipelineWait(escp_job_t *, int *);
+ssize_t	ReadRaster(void *, unsigned char *, size_t);
+void	*ReaderThread(void *);
+void	*SeparateThread(void *);
+void	*DitherThread(void *);
+#endif // HAVE_PTHREAD_H
+
+
+//
+// 'JobLog()' - Log a message for the job.
+//
+
+void
+JobLog(escp_job_t    *job,		// I - Job data
+       cf_loglevel_t level,		// I - Log level
+       const char    *message,		// I - Printf-style message
+       ...)				// I - Additional arguments
+{
+  va_list	ap;			// Argument pointer
+  char		buffer[1024];		// Formatted message
+
+
+  if (!job->logfunc)
+    return;
+
+  va_start(ap, message);
+  vsnprintf(buffer, sizeof(buffer), message, ap);
+  va_end(ap);
+
+  job->logfunc(job->ld, level, "%s", buffer);
+}
 
 
 //
@@ -111,7 +332,8 @@ void	ProcessLine(ppd_file_t *, cups_raster_t *,
 //
 
 void
-Setup(ppd_file_t *ppd)		// I - PPD file
+Setup(escp_job_t *job,			// I - Job data
+      ppd_file_t *ppd)			// I - PPD file
 {
   //
   // Some EPSON printers need an additional command issued at the
@@ -119,31 +341,32 @@ Setup(ppd_file_t *ppd)		// I - PPD file
   //
 
   if (ppd->model_number & ESCP_USB)
-    cfWritePrintData("\000\000\000\033\001@EJL 1284.4\n@EJL     \n\033@", 29);
+    raster_out_write(job->Output,
+                     "\000\000\000\033\001@EJL 1284.4\n@EJL     \n\033@", 29);
 }
 
 
 //
-// 'StartPage()' - Start a page of graphics.
+// 'GetProfile()' - Get the color profile for a page, loading it as needed.
+//
+// Color separations and dither lookup tables only depend on the color
+// space, media type and resolution, so they are kept for the whole job
+// instead of being loaded again for every page.
 //
 
-void
-StartPage(ppd_file_t         *ppd,	// I - PPD file
-          cups_page_header2_t *header)	// I - Page header
+cups_profile_t *			// O - Color profile or NULL on error
+GetProfile(escp_job_t          *job,	// I - Job data
+           ppd_file_t          *ppd,	// I - PPD file
+           cups_page_header2_t *header,	// I - Page header
+           const char          *colormodel,	// I - Color model string
+           const char          *resolution)	// I - Resolution string
 {
-  int		i, y;			// Looping vars
-  int		subrow,			// Current subrow
-		modrow,			// Subrow modulus
+  int		i,			// Looping var
 		plane;			// Current color plane
-  unsigned char	*ptr;			// Pointer into dot buffer
-  int		bands;			// Number of bands to allocate
-  int		units;			// Units for resolution
-  cups_weave_t	*band;			// Current band
-  const char	*colormodel;		// Color model string
-  char		resolution[PPD_MAX_NAME],
-					// Resolution string
-		spec[PPD_MAX_NAME];	// PPD attribute name
+  cups_profile_t *profile;		// Current profile
+  const char	*mode;			// Threshold matrix
   ppd_attr_t	*attr;			// Attribute from PPD file
+  char		spec[PPD_MAX_NAME];	// PPD attribute name
   const float	default_lut[2] =	// Default dithering lookup table
 		{
 		  0.0,
@@ -151,213 +374,411 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 		};
 
 
-  fprintf(stderr, "DEBUG: StartPage...\n");
-  fprintf(stderr, "DEBUG: MediaClass = \"%s\"\n", header->MediaClass);
-  fprintf(stderr, "DEBUG: MediaColor = \"%s\"\n", header->MediaColor);
-  fprintf(stderr, "DEBUG: MediaType = \"%s\"\n", header->MediaType);
-  fprintf(stderr, "DEBUG: OutputType = \"%s\"\n", header->OutputType);
-
-  fprintf(stderr, "DEBUG: AdvanceDistance = %d\n", header->AdvanceDistance);
-  fprintf(stderr, "DEBUG: AdvanceMedia = %d\n", header->AdvanceMedia);
-  fprintf(stderr, "DEBUG: Collate = %d\n", header->Collate);
-  fprintf(stderr, "DEBUG: CutMedia = %d\n", header->CutMedia);
-  fprintf(stderr, "DEBUG: Duplex = %d\n", header->Duplex);
-  fprintf(stderr, "DEBUG: HWResolution = [ %d %d ]\n", header->HWResolution[0],
-          header->HWResolution[1]);
-  fprintf(stderr, "DEBUG: ImagingBoundingBox = [ %d %d %d %d ]\n",
-          header->ImagingBoundingBox[0], header->ImagingBoundingBox[1],
-          header->ImagingBoundingBox[2], header->ImagingBoundingBox[3]);
-  fprintf(stderr, "DEBUG: InsertSheet = %d\n", header->InsertSheet);
-  fprintf(stderr, "DEBUG: Jog = %d\n", header->Jog);
-  fprintf(stderr, "DEBUG: LeadingEdge = %d\n", header->LeadingEdge);
-  fprintf(stderr, "DEBUG: Margins = [ %d %d ]\n", header->Margins[0],
-          header->Margins[1]);
-  fprintf(stderr, "DEBUG: ManualFeed = %d\n", header->ManualFeed);
-  fprintf(stderr, "DEBUG: MediaPosition = %d\n", header->MediaPosition);
-  fprintf(stderr, "DEBUG: MediaWeight = %d\n", header->MediaWeight);
-  fprintf(stderr, "DEBUG: MirrorPrint = %d\n", header->MirrorPrint);
-  fprintf(stderr, "DEBUG: NegativePrint = %d\n", header->NegativePrint);
-  fprintf(stderr, "DEBUG: NumCopies = %d\n", header->NumCopies);
-  fprintf(stderr, "DEBUG: Orientation = %d\n", header->Orientation);
-  fprintf(stderr, "DEBUG: OutputFaceUp = %d\n", header->OutputFaceUp);
-  fprintf(stderr, "DEBUG: PageSize = [ %d %d ]\n", header->PageSize[0],
-          header->PageSize[1]);
-  fprintf(stderr, "DEBUG: Separations = %d\n", header->Separations);
-  fprintf(stderr, "DEBUG: TraySwitch = %d\n", header->TraySwitch);
-  fprintf(stderr, "DEBUG: Tumble = %d\n", header->Tumble);
-  fprintf(stderr, "DEBUG: cupsWidth = %d\n", header->cupsWidth);
-  fprintf(stderr, "DEBUG: cupsHeight = %d\n", header->cupsHeight);
-  fprintf(stderr, "DEBUG: cupsMediaType = %d\n", header->cupsMediaType);
-  fprintf(stderr, "DEBUG: cupsBitsPerColor = %d\n", header->cupsBitsPerColor);
-  fprintf(stderr, "DEBUG: cupsBitsPerPixel = %d\n", header->cupsBitsPerPixel);
-  fprintf(stderr, "DEBUG: cupsBytesPerLine = %d\n", header->cupsBytesPerLine);
-  fprintf(stderr, "DEBUG: cupsColorOrder = %d\n", header->cupsColorOrder);
-  fprintf(stderr, "DEBUG: cupsColorSpace = %d\n", header->cupsColorSpace);
-  fprintf(stderr, "DEBUG: cupsCompression = %d\n", header->cupsCompression);
-  fprintf(stderr, "DEBUG: cupsRowCount = %d\n", header->cupsRowCount);
-  fprintf(stderr, "DEBUG: cupsRowFeed = %d\n", header->cupsRowFeed);
-  fprintf(stderr, "DEBUG: cupsRowStep = %d\n", header->cupsRowStep);
+  //
+  // See if we already have this profile...
+  //
+
+  for (i = 0, profile = job->Profiles; i < job->NumProfiles; i ++, profile ++)
+    if (profile->cspace == header->cupsColorSpace &&
+        !strcmp(profile->media_type, header->MediaType) &&
+	!strcmp(profile->resolution, resolution))
+    {
+      JobLog(job, CF_LOGLEVEL_DEBUG, "Using cached color profile.");
+
+      profile->use = ++ job->ProfileUse;
+      return (profile);
+    }
 
   //
-  // Figure out the color model and spec strings...
+  // No, use a free slot or replace the least recently used profile...
   //
 
-  switch (header->cupsColorSpace)
+  if (job->NumProfiles < PROFILE_MAX)
+    profile = job->Profiles + job->NumProfiles ++;
+  else
   {
-    case CUPS_CSPACE_K :
-        colormodel = "Black";
-	break;
-    case CUPS_CSPACE_W :
-        colormodel = "Gray";
-	break;
-    default :
-    case CUPS_CSPACE_RGB :
-        colormodel = "RGB";
-	break;
-    case CUPS_CSPACE_CMYK :
-        colormodel = "CMYK";
-	break;
-  }
+    for (i = 1, profile = job->Profiles; i < PROFILE_MAX; i ++)
+      if (job->Profiles[i].use < profile->use)
+        profile = job->Profiles + i;
 
-  if (header->HWResolution[0] != header->HWResolution[1])
-    snprintf(resolution, sizeof(resolution), "%dx%ddpi",
-             header->HWResolution[0], header->HWResolution[1]);
-  else
-    snprintf(resolution, sizeof(resolution), "%ddpi",
-             header->HWResolution[0]);
+    FreeProfile(profile);
+  }
 
-  if (!header->MediaType[0])
-    strcpy(header->MediaType, "Plain");
+  profile->cspace = header->cupsColorSpace;
+  profile->use    = ++ job->ProfileUse;
+  snprintf(profile->media_type, sizeof(profile->media_type), "%s",
+           header->MediaType);
+  snprintf(profile->resolution, sizeof(profile->resolution), "%s",
+           resolution);
 
   //
   // Load the appropriate color profiles...
   //
 
-  RGB  = NULL;
-  CMYK = NULL;
-
-  fputs("DEBUG: Attempting to load color profiles using the following values:\n", stderr);
-  fprintf(stderr, "DEBUG: ColorModel = %s\n", colormodel);
-  fprintf(stderr, "DEBUG: MediaType = %s\n", header->MediaType);
-  fprintf(stderr, "DEBUG: Resolution = %s\n", resolution);
+  JobLog(job, CF_LOGLEVEL_DEBUG,
+	 "Attempting to load color profiles using the following values:");
+  JobLog(job, CF_LOGLEVEL_DEBUG, "ColorModel = %s", colormodel);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaType = %s", header->MediaType);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Resolution = %s", resolution);
 
   if (header->cupsColorSpace == CUPS_CSPACE_RGB ||
       header->cupsColorSpace == CUPS_CSPACE_W)
-    RGB = ppdRGBLoad(ppd, colormodel, header->MediaType, resolution,
-		     logfunc, ld);
+    profile->rgb = ppdRGBLoad(ppd, colormodel, header->MediaType, resolution,
+			      job->logfunc, job->ld);
   else
-    RGB = NULL;
+    profile->rgb = NULL;
 
-  CMYK = ppdCMYKLoad(ppd, colormodel, header->MediaType, resolution,
-		     logfunc, ld);
+  profile->cmyk = ppdCMYKLoad(ppd, colormodel, header->MediaType, resolution,
+			      job->logfunc, job->ld);
 
-  if (RGB)
-    fputs("DEBUG: Loaded RGB separation from PPD.\n", stderr);
+  if (profile->rgb)
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Loaded RGB separation from PPD.");
 
-  if (CMYK)
-    fputs("DEBUG: Loaded CMYK separation from PPD.\n", stderr);
+  if (profile->cmyk)
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Loaded CMYK separation from PPD.");
   else
   {
-    fputs("DEBUG: Loading default CMYK separation.\n", stderr);
-    CMYK = cfCMYKNew(4);
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Loading default CMYK separation.");
+    profile->cmyk = cfCMYKNew(4);
   }
 
-  PrinterPlanes = CMYK->num_channels;
-
-  fprintf(stderr, "DEBUG: PrinterPlanes = %d\n", PrinterPlanes);
-
   //
   // Get the dithering parameters...
   //
 
-  switch (PrinterPlanes)
+  switch (profile->cmyk->num_channels)
   {
     case 1 : // K
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
         break;
 
     case 2 : // Kk
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightBlack", logfunc, ld);
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightBlack",
+				      job->logfunc, job->ld);
         break;
 
     case 3 : // CMY
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
         break;
 
     case 4 : // CMYK
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
-        DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
+        profile->luts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
         break;
 
     case 6 : // CcMmYK
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightCyan", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightMagenta", logfunc, ld);
-        DitherLuts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
-        DitherLuts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightCyan",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightMagenta",
+				      job->logfunc, job->ld);
+        profile->luts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
+        profile->luts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
         break;
 
     case 7 : // CcMmYKk
-        DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Cyan", logfunc, ld);
-        DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightCyan", logfunc, ld);
-        DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Magenta", logfunc, ld);
-        DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightMagenta", logfunc, ld);
-        DitherLuts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Yellow", logfunc, ld);
-        DitherLuts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "Black", logfunc, ld);
-        DitherLuts[6] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                            resolution, "LightBlack", logfunc, ld);
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightCyan",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightMagenta",
+				      job->logfunc, job->ld);
+        profile->luts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
+        profile->luts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
+        profile->luts[6] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightBlack",
+				      job->logfunc, job->ld);
         break;
     default : // ERROR
-        fputs("ERROR: Unexpected number of channels\n", stderr);
-        exit(1);
+        JobLog(job, CF_LOGLEVEL_ERROR, "Unexpected number of channels");
+        FreeProfile(profile);
+        return (NULL);
+  }
+
+  for (plane = 0; plane < profile->cmyk->num_channels; plane ++)
+    if (!profile->luts[plane])
+      profile->luts[plane] = cfLutNew(2, default_lut, job->logfunc, job->ld);
+
+  //
+  // Dither with a threshold matrix instead of error diffusion when the
+  // environment or PPD file asks for it; it is faster, but not as good
+  // for photos...
+  //
+
+  if (job->DitherMode)
+    mode = job->DitherMode;
+  else if ((attr = ppdFindColorAttr(ppd, "cupsESCPDither", colormodel,
+				    header->MediaType, resolution, spec,
+				    sizeof(spec), job->logfunc,
+				    job->ld)) != NULL)
+    mode = attr->value;
+  else
+    mode = NULL;
+
+  if ((profile->dither = raster_dither_new(mode)) != NULL)
+  {
+    for (plane = 0; plane < profile->cmyk->num_channels; plane ++)
+      if ((profile->levels[plane] =
+               raster_dither_levels(profile->luts[plane])) == NULL)
+        break;
+
+    if (plane < profile->cmyk->num_channels)
+    {
+      for (plane = 0; plane < profile->cmyk->num_channels; plane ++)
+      {
+        free(profile->levels[plane]);
+	profile->levels[plane] = NULL;
+      }
+
+      raster_dither_delete(profile->dither);
+      profile->dither = NULL;
+    }
+    else
+      JobLog(job, CF_LOGLEVEL_DEBUG, "Using %s threshold dithering.", mode);
+  }
+
+  return (profile);
+}
+
+
+//
+// 'FreeProfile()' - Free the separations and tables of a color profile.
+//
+
+void
+FreeProfile(cups_profile_t *profile)	// I - Color profile
+{
+  int	plane;				// Current color plane
+
+
+  for (plane = 0; plane < 7; plane ++)
+  {
+    if (profile->luts[plane])
+      cfLutDelete(profile->luts[plane]);
+
+    free(profile->levels[plane]);
   }
 
-  for (plane = 0; plane < PrinterPlanes; plane ++)
+  raster_dither_delete(profile->dither);
+
+  if (profile->cmyk)
+    cfCMYKDelete(profile->cmyk);
+
+  if (profile->rgb)
+    cfRGBDelete(profile->rgb);
+
+  memset(profile, 0, sizeof(cups_profile_t));
+}
+
+
+//
+// 'FreeProfiles()' - Free all cached color profiles at the end of the job.
+//
+
+void
+FreeProfiles(escp_job_t *job)		// I - Job data
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < job->NumProfiles; i ++)
+    FreeProfile(job->Profiles + i);
+
+  job->NumProfiles = 0;
+}
+
+
+//
+// 'StartPage()' - Start a page of graphics.
+//
+
+int					// O - 1 on success, 0 on error
+StartPage(escp_job_t          *job,	// I - Job data
+          ppd_file_t          *ppd,	// I - PPD file
+          cups_page_header2_t *header)	// I - Page header
+{
+  int		i, y;			// Looping vars
+  int		subrow,			// Current subrow
+		modrow,			// Subrow modulus
+		plane;			// Current color plane
+  unsigned char	*ptr;			// Pointer into dot buffer
+  int		bands;			// Number of bands to allocate
+  size_t	arena;			// Size of band buffer arena
+  int		units;			// Units for resolution
+  cups_weave_t	*band;			// Current band
+  const char	*colormodel;		// Color model string
+  char		resolution[PPD_MAX_NAME],
+					// Resolution string
+		spec[PPD_MAX_NAME];	// PPD attribute name
+  ppd_attr_t	*attr;			// Attribute from PPD file
+  cups_profile_t *profile;		// Color profile for page
+
+
+  JobLog(job, CF_LOGLEVEL_DEBUG, "StartPage...");
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaClass = \"%s\"", header->MediaClass);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaColor = \"%s\"", header->MediaColor);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaType = \"%s\"", header->MediaType);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "OutputType = \"%s\"", header->OutputType);
+
+  JobLog(job, CF_LOGLEVEL_DEBUG, "AdvanceDistance = %d",
+	 header->AdvanceDistance);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "AdvanceMedia = %d", header->AdvanceMedia);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Collate = %d", header->Collate);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "CutMedia = %d", header->CutMedia);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Duplex = %d", header->Duplex);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "HWResolution = [ %d %d ]",
+         header->HWResolution[0], header->HWResolution[1]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "ImagingBoundingBox = [ %d %d %d %d ]",
+         header->ImagingBoundingBox[0], header->ImagingBoundingBox[1],
+         header->ImagingBoundingBox[2], header->ImagingBoundingBox[3]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "InsertSheet = %d", header->InsertSheet);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Jog = %d", header->Jog);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "LeadingEdge = %d", header->LeadingEdge);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Margins = [ %d %d ]", header->Margins[0],
+         header->Margins[1]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "ManualFeed = %d", header->ManualFeed);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaPosition = %d", header->MediaPosition);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaWeight = %d", header->MediaWeight);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MirrorPrint = %d", header->MirrorPrint);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "NegativePrint = %d", header->NegativePrint);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "NumCopies = %d", header->NumCopies);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Orientation = %d", header->Orientation);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "OutputFaceUp = %d", header->OutputFaceUp);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "PageSize = [ %d %d ]", header->PageSize[0],
+         header->PageSize[1]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Separations = %d", header->Separations);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "TraySwitch = %d", header->TraySwitch);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Tumble = %d", header->Tumble);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsWidth = %d", header->cupsWidth);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsHeight = %d", header->cupsHeight);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsMediaType = %d", header->cupsMediaType);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsBitsPerColor = %d",
+	 header->cupsBitsPerColor);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsBitsPerPixel = %d",
+	 header->cupsBitsPerPixel);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsBytesPerLine = %d",
+	 header->cupsBytesPerLine);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsColorOrder = %d", header->cupsColorOrder);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsColorSpace = %d", header->cupsColorSpace);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsCompression = %d",
+	 header->cupsCompression);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsRowCount = %d", header->cupsRowCount);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsRowFeed = %d", header->cupsRowFeed);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsRowStep = %d", header->cupsRowStep);
+
+  //
+  // Figure out the color model and spec strings...
+  //
+
+  switch (header->cupsColorSpace)
   {
-    DitherStates[plane] = cfDitherNew(header->cupsWidth);
+    case CUPS_CSPACE_K :
+        colormodel = "Black";
+	break;
+    case CUPS_CSPACE_W :
+        colormodel = "Gray";
+	break;
+    default :
+    case CUPS_CSPACE_RGB :
+        colormodel = "RGB";
+	break;
+    case CUPS_CSPACE_CMYK :
+        colormodel = "CMYK";
+	break;
+  }
+
+  if (header->HWResolution[0] != header->HWResolution[1])
+    snprintf(resolution, sizeof(resolution), "%dx%ddpi",
+             header->HWResolution[0], header->HWResolution[1]);
+  else
+    snprintf(resolution, sizeof(resolution), "%ddpi",
+             header->HWResolution[0]);
+
+  if (!header->MediaType[0])
+    strcpy(header->MediaType, "Plain");
+
+  //
+  // Get the color profile for the page, loading it as needed...
+  //
+
+  if ((profile = GetProfile(job, ppd, header, colormodel, resolution)) == NULL)
+    return (0);
 
-    if (!DitherLuts[plane])
-      DitherLuts[plane] = cfLutNew(2, default_lut, logfunc, ld);
+  job->RGB           = profile->rgb;
+  job->CMYK          = profile->cmyk;
+  job->PrinterPlanes = job->CMYK->num_channels;
+
+  JobLog(job, CF_LOGLEVEL_DEBUG, "PrinterPlanes = %d", job->PrinterPlanes);
+
+  //
+  // Reset the dithering state for the page...
+  //
+
+  for (plane = 0; plane < job->PrinterPlanes; plane ++)
+  {
+    job->DitherLuts[plane]   = profile->luts[plane];
+    job->DitherStates[plane] = cfDitherNew(header->cupsWidth);
+    job->DitherClean[plane]  = 1;
+    job->DitherLevels[plane] = profile->levels[plane];
   }
 
-  if (DitherLuts[0][4095].pixel > 1)
-    BitPlanes = 2;
+  job->DitherMatrix = profile->dither;
+
+  if (job->DitherLuts[0][4095].pixel > 1)
+    job->BitPlanes = 2;
   else
-    BitPlanes = 1;
+    job->BitPlanes = 1;
 
   //
   // Initialize the printer...
   //
 
-  printf("\033@");
+  raster_out_printf(job->Output, "\033@");
 
   if (ppd->model_number & ESCP_REMOTE)
   {
@@ -365,13 +786,13 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
     // Go into remote mode...
     //
 
-    cfWritePrintData("\033(R\010\000\000REMOTE1", 13);
+    raster_out_write(job->Output, "\033(R\010\000\000REMOTE1", 13);
 
     //
     // Disable status reporting...
     //
 
-    cfWritePrintData("ST\002\000\000\000", 6);
+    raster_out_write(job->Output, "ST\002\000\000\000", 6);
 
     //
     // Enable borderless printing...
@@ -385,9 +806,9 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 
       i = atoi(attr->value);
 
-      cfWritePrintData("FP\003\000\000", 5);
-      putchar(i & 255);
-      putchar(i >> 8);
+      raster_out_write(job->Output, "FP\003\000\000", 5);
+      raster_out_putc(job->Output, i & 255);
+      raster_out_putc(job->Output, i >> 8);
     }
 
     //
@@ -404,8 +825,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Set feed sequence...
 	//
 
-	cfWritePrintData("SN\003\000\000\000", 6);
-	putchar(atoi(attr->value));
+	raster_out_write(job->Output, "SN\003\000\000\000", 6);
+	raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPSN1", spec)) != NULL && attr->value)
@@ -414,8 +835,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Set platten gap...
 	//
 
-	cfWritePrintData("SN\003\000\000\001", 6);
-	putchar(atoi(attr->value));
+	raster_out_write(job->Output, "SN\003\000\000\001", 6);
+	raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPSN2", spec)) != NULL && attr->value)
@@ -424,8 +845,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Paper feeding/ejecting sequence...
 	//
 
-	cfWritePrintData("SN\003\000\000\002", 6);
-	putchar(atoi(attr->value));
+	raster_out_write(job->Output, "SN\003\000\000\002", 6);
+	raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPSN6", spec)) != NULL && attr->value)
@@ -434,8 +855,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Eject delay...
 	//
 
-        cfWritePrintData("SN\003\000\000\006", 6);
-        putchar(atoi(attr->value));
+        raster_out_write(job->Output, "SN\003\000\000\006", 6);
+        raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPMT", spec)) != NULL && attr->value)
@@ -444,8 +865,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Set media type.
 	//
 
-	cfWritePrintData("MT\003\000\000\000", 6);
-        putchar(atoi(attr->value));
+	raster_out_write(job->Output, "MT\003\000\000\000", 6);
+        raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPPH", spec)) != NULL && attr->value)
@@ -454,8 +875,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Set paper thickness.
 	//
 
-	cfWritePrintData("PH\002\000\000", 5);
-        putchar(atoi(attr->value));
+	raster_out_write(job->Output, "PH\002\000\000", 5);
+        raster_out_putc(job->Output, atoi(attr->value));
       }
     }
 
@@ -469,8 +890,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Paper check.
 	//
 
-	cfWritePrintData("PC\002\000\000", 5);
-        putchar(atoi(attr->value));
+	raster_out_write(job->Output, "PC\002\000\000", 5);
+        raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPPP", spec)) != NULL && attr->value)
@@ -484,9 +905,9 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
         a = b = 0;
         sscanf(attr->value, "%d%d", &a, &b);
 
-	cfWritePrintData("PP\003\000\000", 5);
-        putchar(a);
-        putchar(b);
+	raster_out_write(job->Output, "PP\003\000\000", 5);
+        raster_out_putc(job->Output, a);
+        raster_out_putc(job->Output, b);
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPEX", spec)) != NULL && attr->value)
@@ -495,8 +916,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Set media position.
 	//
 
-	cfWritePrintData("EX\006\000\000\000\000\000\005", 9);
-        putchar(atoi(attr->value));
+	raster_out_write(job->Output, "EX\006\000\000\000\000\000\005", 9);
+        raster_out_putc(job->Output, atoi(attr->value));
       }
     }
 
@@ -506,108 +927,108 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
       // Set media size...
       //
 
-      cfWritePrintData("MS\010\000\000", 5);
-      putchar(atoi(attr->value));
+      raster_out_write(job->Output, "MS\010\000\000", 5);
+      raster_out_putc(job->Output, atoi(attr->value));
 
       switch (header->PageSize[1])
       {
         case 1191 :	// A3
-	    putchar(0x01);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x01);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 1032 :	// B4
-	    putchar(0x02);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x02);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 842 :	// A4
-	    putchar(0x03);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x03);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 595 :	// A4.Transverse
-	    putchar(0x03);
-	    putchar(0x01);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x03);
+	    raster_out_putc(job->Output, 0x01);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 729 :	// B5
-	    putchar(0x04);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x04);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 516 :	// B5.Transverse
-	    putchar(0x04);
-	    putchar(0x01);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x04);
+	    raster_out_putc(job->Output, 0x01);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 1369 :	// Super A3/B
-	    putchar(0x20);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x20);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 792 :	// Letter
-	    putchar(0x08);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x08);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 612 :	// Letter.Transverse
-	    putchar(0x08);
-	    putchar(0x01);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x08);
+	    raster_out_putc(job->Output, 0x01);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 1004 :	// Legal
-	    putchar(0x0a);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x0a);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	case 1224 :	// Tabloid
-	    putchar(0x2d);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
-	    putchar(0x00);
+	    raster_out_putc(job->Output, 0x2d);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
+	    raster_out_putc(job->Output, 0x00);
 	    break;
 	default :	// Custom size
-	    putchar(0xff);
-	    putchar(0xff);
+	    raster_out_putc(job->Output, 0xff);
+	    raster_out_putc(job->Output, 0xff);
 	    i = 360 * header->PageSize[0] / 72;
-	    putchar(i);
-	    putchar(i >> 8);
+	    raster_out_putc(job->Output, i);
+	    raster_out_putc(job->Output, i >> 8);
 	    i = 360 * header->PageSize[1] / 72;
-	    putchar(i);
-	    putchar(i >> 8);
+	    raster_out_putc(job->Output, i);
+	    raster_out_putc(job->Output, i >> 8);
 	    break;
       }
     }
@@ -620,8 +1041,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
       // Enable/disable cutter.
       //
 
-      cfWritePrintData("AC\002\000\000", 5);
-      putchar(atoi(attr->value));
+      raster_out_write(job->Output, "AC\002\000\000", 5);
+      raster_out_putc(job->Output, atoi(attr->value));
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPSN80",
 			      header->MediaType)) != NULL && attr->value)
@@ -630,8 +1051,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Cutting method...
 	//
 
-	cfWritePrintData("SN\003\000\000\200", 6);
-	putchar(atoi(attr->value));
+	raster_out_write(job->Output, "SN\003\000\000\200", 6);
+	raster_out_putc(job->Output, atoi(attr->value));
       }
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPSN81",
@@ -641,8 +1062,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Cutting pressure...
 	//
 
-	cfWritePrintData("SN\003\000\000\201", 6);
-	putchar(atoi(attr->value));
+	raster_out_write(job->Output, "SN\003\000\000\201", 6);
+	raster_out_putc(job->Output, atoi(attr->value));
       }
     }
 
@@ -652,23 +1073,23 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
       // Enable/disable cutter.
       //
 
-      cfWritePrintData("CO\010\000\000\000", 6);
-      putchar(atoi(attr->value));
-      cfWritePrintData("\000\000\000\000\000", 5);
+      raster_out_write(job->Output, "CO\010\000\000\000", 6);
+      raster_out_putc(job->Output, atoi(attr->value));
+      raster_out_write(job->Output, "\000\000\000\000\000", 5);
     }
 
     //
     // Exit remote mode...
     //
 
-    cfWritePrintData("\033\000\000\000", 4);
+    raster_out_write(job->Output, "\033\000\000\000", 4);
   }
 
   //
   // Enter graphics mode...
   //
 
-  cfWritePrintData("\033(G\001\000\001", 6);
+  raster_out_write(job->Output, "\033(G\001\000\001", 6);
 
   //
   // Set the line feed increment...
@@ -679,24 +1100,24 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 
   if (ppd->model_number & ESCP_EXT_UNITS)
   {
-    cfWritePrintData("\033(U\005\000", 5);
-    putchar(units / header->HWResolution[1]);
-    putchar(units / header->HWResolution[1]);
-    putchar(units / header->HWResolution[0]);
-    putchar(units);
-    putchar(units >> 8);
+    raster_out_write(job->Output, "\033(U\005\000", 5);
+    raster_out_putc(job->Output, units / header->HWResolution[1]);
+    raster_out_putc(job->Output, units / header->HWResolution[1]);
+    raster_out_putc(job->Output, units / header->HWResolution[0]);
+    raster_out_putc(job->Output, units);
+    raster_out_putc(job->Output, units >> 8);
   }
   else
   {
-    cfWritePrintData("\033(U\001\000", 5);
-    putchar(3600 / header->HWResolution[1]);
+    raster_out_write(job->Output, "\033(U\001\000", 5);
+    raster_out_putc(job->Output, 3600 / header->HWResolution[1]);
   }
 
   //
   // Set the page length...
   //
 
-  PrinterLength = header->PageSize[1] * header->HWResolution[1] / 72;
+  job->PrinterLength = header->PageSize[1] * header->HWResolution[1] / 72;
 
   if (ppd->model_number & ESCP_PAGE_SIZE)
   {
@@ -704,64 +1125,64 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
     // Set page size (expands bottom margin)...
     //
 
-    cfWritePrintData("\033(S\010\000", 5);
+    raster_out_write(job->Output, "\033(S\010\000", 5);
 
     i = header->PageSize[0] * header->HWResolution[1] / 72;
-    putchar(i);
-    putchar(i >> 8);
-    putchar(i >> 16);
-    putchar(i >> 24);
+    raster_out_putc(job->Output, i);
+    raster_out_putc(job->Output, i >> 8);
+    raster_out_putc(job->Output, i >> 16);
+    raster_out_putc(job->Output, i >> 24);
 
     i = header->PageSize[1] * header->HWResolution[1] / 72;
-    putchar(i);
-    putchar(i >> 8);
-    putchar(i >> 16);
-    putchar(i >> 24);
+    raster_out_putc(job->Output, i);
+    raster_out_putc(job->Output, i >> 8);
+    raster_out_putc(job->Output, i >> 16);
+    raster_out_putc(job->Output, i >> 24);
   }
   else
   {
-    cfWritePrintData("\033(C\002\000", 5);
-    putchar(PrinterLength & 255);
-    putchar(PrinterLength >> 8);
+    raster_out_write(job->Output, "\033(C\002\000", 5);
+    raster_out_putc(job->Output, job->PrinterLength & 255);
+    raster_out_putc(job->Output, job->PrinterLength >> 8);
   }
 
   //
   // Set the top and bottom margins...
   //
 
-  PrinterTop = (int)((ppd->sizes[1].length - ppd->sizes[1].top) *
+  job->PrinterTop = (int)((ppd->sizes[1].length - ppd->sizes[1].top) *
                      header->HWResolution[1] / 72.0);
 
   if (ppd->model_number & ESCP_EXT_MARGINS)
   {
-    cfWritePrintData("\033(c\010\000", 5);
+    raster_out_write(job->Output, "\033(c\010\000", 5);
 
-    putchar(PrinterTop);
-    putchar(PrinterTop >> 8);
-    putchar(PrinterTop >> 16);
-    putchar(PrinterTop >> 24);
+    raster_out_putc(job->Output, job->PrinterTop);
+    raster_out_putc(job->Output, job->PrinterTop >> 8);
+    raster_out_putc(job->Output, job->PrinterTop >> 16);
+    raster_out_putc(job->Output, job->PrinterTop >> 24);
 
-    putchar(PrinterLength);
-    putchar(PrinterLength >> 8);
-    putchar(PrinterLength >> 16);
-    putchar(PrinterLength >> 24);
+    raster_out_putc(job->Output, job->PrinterLength);
+    raster_out_putc(job->Output, job->PrinterLength >> 8);
+    raster_out_putc(job->Output, job->PrinterLength >> 16);
+    raster_out_putc(job->Output, job->PrinterLength >> 24);
   }
   else
   {
-    cfWritePrintData("\033(c\004\000", 5);
+    raster_out_write(job->Output, "\033(c\004\000", 5);
 
-    putchar(PrinterTop & 255);
-    putchar(PrinterTop >> 8);
+    raster_out_putc(job->Output, job->PrinterTop & 255);
+    raster_out_putc(job->Output, job->PrinterTop >> 8);
 
-    putchar(PrinterLength & 255);
-    putchar(PrinterLength >> 8);
+    raster_out_putc(job->Output, job->PrinterLength & 255);
+    raster_out_putc(job->Output, job->PrinterLength >> 8);
   }
 
   //
   // Set the top position...
   //
 
-  cfWritePrintData("\033(V\002\000\000\000", 7);
+  raster_out_write(job->Output, "\033(V\002\000\000\000", 7);
 
   //
   // Enable unidirectional printing depending on the mode...
@@ -769,8 +1190,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 
   if ((attr = ppdFindColorAttr(ppd, "cupsESCPDirection", colormodel,
                            header->MediaType, resolution, spec,
-			   sizeof(spec), logfunc, ld)) != NULL)
-    printf("\033U%c", atoi(attr->value));
+			   sizeof(spec), job->logfunc, job->ld)) != NULL)
+    raster_out_printf(job->Output, "\033U%c", atoi(attr->value));
 
   //
   // Enable/disable microweaving as needed...
@@ -778,8 +1199,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 
   if ((attr = ppdFindColorAttr(ppd, "cupsESCPMicroWeave", colormodel,
                            header->MediaType, resolution, spec,
-			   sizeof(spec), logfunc, ld)) != NULL)
-    printf("\033(i\001%c%c", 0, atoi(attr->value));
+			   sizeof(spec), job->logfunc, job->ld)) != NULL)
+    raster_out_printf(job->Output, "\033(i\001%c%c", 0, atoi(attr->value));
 
   //
   // Set the dot size and print speed as needed...
@@ -787,8 +1208,8 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 
   if ((attr = ppdFindColorAttr(ppd, "cupsESCPDotSize", colormodel,
                            header->MediaType, resolution, spec,
-			   sizeof(spec), logfunc, ld)) != NULL)
-    printf("\033(e\002%c%c%c", 0, 0, atoi(attr->value));
+			   sizeof(spec), job->logfunc, job->ld)) != NULL)
+    raster_out_printf(job->Output, "\033(e\002%c%c%c", 0, 0, atoi(attr->value));
 
   if (ppd->model_number & ESCP_ESCK)
   {
@@ -796,13 +1217,13 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
     // Set the print mode...
     //
 
-    if (PrinterPlanes == 1)
+    if (job->PrinterPlanes == 1)
     {
       //
       // Fast black printing.
       //
 
-      cfWritePrintData("\033(K\002\000\000\001", 7);
+      raster_out_write(job->Output, "\033(K\002\000\000\001", 7);
     }
     else
     {
@@ -810,7 +1231,7 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
       // Color printing.
       //
 
-      cfWritePrintData("\033(K\002\000\000\002", 7);
+      raster_out_write(job->Output, "\033(K\002\000\000\002", 7);
     }
   }
 
@@ -820,54 +1241,55 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 
   if (header->cupsRowCount <= 1)
   {
-    DotRowCount = 1;
-    DotColStep  = 1;
-    DotRowStep  = 1;
-    DotRowFeed  = 1;
+    job->DotRowCount = 1;
+    job->DotColStep  = 1;
+    job->DotRowStep  = 1;
+    job->DotRowFeed  = 1;
   }
   else
   {
-    DotRowCount = header->cupsRowCount;
-    DotRowFeed  = header->cupsRowFeed;
-    DotRowStep  = header->cupsRowStep % 100;
-    DotColStep  = header->cupsRowStep / 100;
+    job->DotRowCount = header->cupsRowCount;
+    job->DotRowFeed  = header->cupsRowFeed;
+    job->DotRowStep  = header->cupsRowStep % 100;
+    job->DotColStep  = header->cupsRowStep / 100;
 
-    if (DotColStep == 0)
-      DotColStep ++;
+    if (job->DotColStep == 0)
+      job->DotColStep ++;
   }
 
   //
   // Setup softweave parameters...
   //
 
-  DotRowCurrent = 0;
-  DotRowMax     = DotRowCount * DotRowStep;
-  DotBufferSize = (header->cupsWidth / DotColStep * BitPlanes + 7) / 8;
+  job->DotRowCurrent = 0;
+  job->DotRowMax     = job->DotRowCount * job->DotRowStep;
+  job->DotBufferSize = (header->cupsWidth / job->DotColStep * job->BitPlanes +
+                        7) / 8;
 
-  fprintf(stderr, "DEBUG: DotBufferSize = %d\n", DotBufferSize);
-  fprintf(stderr, "DEBUG: DotColStep = %d\n", DotColStep);
-  fprintf(stderr, "DEBUG: DotRowMax = %d\n", DotRowMax);
-  fprintf(stderr, "DEBUG: DotRowStep = %d\n", DotRowStep);
-  fprintf(stderr, "DEBUG: DotRowFeed = %d\n", DotRowFeed);
-  fprintf(stderr, "DEBUG: DotRowCount = %d\n", DotRowCount);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "DotBufferSize = %d", job->DotBufferSize);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "DotColStep = %d", job->DotColStep);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "DotRowMax = %d", job->DotRowMax);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "DotRowStep = %d", job->DotRowStep);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "DotRowFeed = %d", job->DotRowFeed);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "DotRowCount = %d", job->DotRowCount);
 
-  DotAvailList  = NULL;
-  DotUsedList   = NULL;
-  DotBuffers[0] = NULL;
+  job->DotAvailList  = NULL;
+  job->DotUsedCount  = 0;
+  job->DotBuffers[0] = NULL;
 
-  fprintf(stderr, "DEBUG: model_number = %x\n", ppd->model_number);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "model_number = %x", ppd->model_number);
 
-  if (DotRowMax > 1)
+  if (job->DotRowMax > 1)
   {
     //
     // Compute offsets for the color jets on the print head...
     //
 
-    bands = DotRowStep * DotColStep * PrinterPlanes * 4;
+    bands = job->DotRowStep * job->DotColStep * job->PrinterPlanes * 4;
 
-    memset(DotRowOffset, 0, sizeof(DotRowOffset));
+    memset(job->DotRowOffset, 0, sizeof(job->DotRowOffset));
 
-    if (PrinterPlanes == 1)
+    if (job->PrinterPlanes == 1)
     {
       //
       // Use full height of print head...
@@ -880,7 +1302,7 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Use custom black head data...
 	//
 
-        sscanf(attr->value, "%d%d", &DotRowCount, &DotRowStep);
+        sscanf(attr->value, "%d%d", &job->DotRowCount, &job->DotRowStep);
       }
     }
     else if (ppd->model_number & ESCP_STAGGER)
@@ -889,7 +1311,7 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
       // Use staggered print head...
       //
 
-      fputs("DEBUG: Offset head detected...\n", stderr);
+      JobLog(job, CF_LOGLEVEL_DEBUG, "Offset head detected...");
 
       if ((attr = ppdFindAttr(ppd, "cupsESCPOffsets", resolution)) != NULL &&
           attr->value)
@@ -898,74 +1320,105 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	// Use only 1/3 of the print head when printing color...
 	//
 
-        sscanf(attr->value, "%d%d%d%d", DotRowOffset + 0,
-	       DotRowOffset + 1, DotRowOffset + 2, DotRowOffset + 3);
+        sscanf(attr->value, "%d%d%d%d", job->DotRowOffset + 0,
+	       job->DotRowOffset + 1, job->DotRowOffset + 2,
+	       job->DotRowOffset + 3);
       }
     }
 
-    for (i = 0; i < PrinterPlanes; i ++)
-      fprintf(stderr, "DEBUG: DotRowOffset[%d] = %d\n", i, DotRowOffset[i]);
+    for (i = 0; i < job->PrinterPlanes; i ++)
+      JobLog(job, CF_LOGLEVEL_DEBUG, "DotRowOffset[%d] = %d", i,
+	     job->DotRowOffset[i]);
 
     //
-    // Allocate bands...
+    // Allocate bands...  The band headers and buffers are kept for the
+    // whole job and only grown when a page needs more of them.  Buffers
+    // are cleared as bands are output, so the arena is all zeros again at
+    // the end of every page.
     //
 
-    for (i = 0; i < bands; i ++)
+    arena = (size_t)bands * job->DotRowCount * job->DotBufferSize;
+
+    if (bands > job->DotBandAlloc)
     {
-      band         = (cups_weave_t *)calloc(1, sizeof(cups_weave_t));
-      band->next   = DotAvailList;
-      DotAvailList = band;
+      free(job->DotBandSlab);
+      free(job->DotUsedHeap);
 
-      band->buffer = calloc(DotRowCount, DotBufferSize);
+      job->DotBandSlab  = calloc(bands, sizeof(cups_weave_t));
+      job->DotUsedHeap  = calloc(bands, sizeof(cups_weave_t *));
+      job->DotBandAlloc = bands;
     }
 
-    if (!DotAvailList)
+    if (arena > job->DotArenaSize)
     {
-      fputs("ERROR: Unable to allocate band list\n", stderr);
-      exit(1);
+      free(job->DotArena);
+
+      job->DotArena     = calloc(1, arena);
+      job->DotArenaSize = arena;
+    }
+
+    if (!job->DotBandSlab || !job->DotUsedHeap || !job->DotArena)
+    {
+      JobLog(job, CF_LOGLEVEL_ERROR, "Unable to allocate band list");
+
+      for (plane = 0; plane < job->PrinterPlanes; plane ++)
+        cfDitherDelete(job->DitherStates[plane]);
+
+      return (0);
+    }
+
+    memset(job->DotBandSlab, 0, bands * sizeof(cups_weave_t));
+
+    for (i = 0, band = job->DotBandSlab, ptr = job->DotArena;
+         i < bands;
+	 i ++, band ++, ptr += job->DotRowCount * job->DotBufferSize)
+    {
+      band->next        = job->DotAvailList;
+      band->buffer      = ptr;
+      job->DotAvailList = band;
     }
 
-    fputs("DEBUG: Pointer list at start of page...\n", stderr);
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Pointer list at start of page...");
 
-    for (band = DotAvailList; band != NULL; band = band->next)
-      fprintf(stderr, "DEBUG: %p\n", (void*)band);
+    for (band = job->DotAvailList; band != NULL; band = band->next)
+      JobLog(job, CF_LOGLEVEL_DEBUG, "%p", (void*)band);
 
-    fputs("DEBUG: ----END----\n", stderr);
+    JobLog(job, CF_LOGLEVEL_DEBUG, "----END----");
 
     //
     // Fill the initial bands...
     //
 
-    modrow = DotColStep * DotRowStep;
+    modrow = job->DotColStep * job->DotRowStep;
 
-    if (DotRowFeed == 0)
+    if (job->DotRowFeed == 0)
     {
       //
       // Automatically compute the optimal feed value...
       //
 
-      DotRowFeed = DotRowCount / DotColStep - DotRowStep;
+      job->DotRowFeed = job->DotRowCount / job->DotColStep - job->DotRowStep;
 
-      while ((((DotRowFeed % 2) == 0) == ((DotRowCount % 2) == 0) ||
-              ((DotRowFeed % 3) == 0) == ((DotRowCount % 3) == 0) ||
-              ((DotRowFeed % 5) == 0) == ((DotRowCount % 5) == 0)) &&
-	     DotRowFeed > 1)
-	DotRowFeed --;
+      while ((((job->DotRowFeed % 2) == 0) == ((job->DotRowCount % 2) == 0) ||
+              ((job->DotRowFeed % 3) == 0) == ((job->DotRowCount % 3) == 0) ||
+              ((job->DotRowFeed % 5) == 0) == ((job->DotRowCount % 5) == 0)) &&
+	     job->DotRowFeed > 1)
+	job->DotRowFeed --;
 
-      if (DotRowFeed < 1)
-	DotRowFeed = 1;
+      if (job->DotRowFeed < 1)
+	job->DotRowFeed = 1;
 
-      fprintf(stderr, "DEBUG: Auto DotRowFeed = %d, modrow=%d...\n",
-              DotRowFeed, modrow);
+      JobLog(job, CF_LOGLEVEL_DEBUG, "Auto DotRowFeed = %d, modrow=%d...",
+             job->DotRowFeed, modrow);
     }
 
-    memset(DotBands, 0, sizeof(DotBands));
+    memset(job->DotBands, 0, sizeof(job->DotBands));
 
-    for (i = modrow, subrow = modrow - 1, y = DotRowFeed;
+    for (i = modrow, subrow = modrow - 1, y = job->DotRowFeed;
 	 i > 0;
-	 i --, y += DotRowFeed)
+	 i --, y += job->DotRowFeed)
     {
-      while (DotBands[subrow][0])
+      while (job->DotBands[subrow][0])
       {
 	//
 	// This subrow is already used, move to another one...
@@ -974,38 +1427,39 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 	subrow = (subrow + 1) % modrow;
       }
 
-      for (plane = 0; plane < PrinterPlanes; plane ++)
+      for (plane = 0; plane < job->PrinterPlanes; plane ++)
       {
 	//
 	// Pull the next available band from the list...
 	//
 
-        band                    = DotAvailList;
-	DotAvailList            = DotAvailList->next;
-	DotBands[subrow][plane] = band;
+        band                         = job->DotAvailList;
+	job->DotAvailList            = job->DotAvailList->next;
+	job->DotBands[subrow][plane] = band;
 
 	//
 	// Start the band in the first few passes, with the number of rows
 	// varying to allow for a nice interleaved pattern...
 	//
 
-        band->x     = subrow / DotRowStep;
-        band->y     = (subrow % DotRowStep) + DotRowOffset[plane];
+        band->x     = subrow / job->DotRowStep;
+        band->y     = (subrow % job->DotRowStep) + job->DotRowOffset[plane];
 	band->plane = plane;
 	band->row   = 0;
-	band->count = DotRowCount - y / DotRowStep;
+	band->count = job->DotRowCount - y / job->DotRowStep;
 
         if (band->count < 1)
 	  band->count = 1;
-	else if (band->count > DotRowCount)
-	  band->count = DotRowCount;
+	else if (band->count > job->DotRowCount)
+	  band->count = job->DotRowCount;
 
-	fprintf(stderr, "DEBUG: DotBands[%d][%d] = %p, x = %d, y = %d, plane = %d, count = %d\n",
-	        subrow, plane, (void*)band, band->x, band->y, band->plane,
-		band->count);
+	JobLog(job, CF_LOGLEVEL_DEBUG,
+	       "DotBands[%d][%d] = %p, x = %d, y = %d, plane = %d, count = %d",
+	       subrow, plane, (void*)band, band->x, band->y, band->plane,
+	       band->count);
       }
 
-      subrow = (subrow + DotRowFeed) % modrow;
+      subrow = (subrow + job->DotRowFeed) % modrow;
     }
   }
   else
@@ -1014,43 +1468,70 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
     // Allocate memory for a single line of graphics...
     //
 
-    ptr = calloc(PrinterPlanes, DotBufferSize);
+    ptr = calloc(job->PrinterPlanes, job->DotBufferSize);
 
-    for (plane = 0; plane < PrinterPlanes; plane ++, ptr += DotBufferSize)
-      DotBuffers[plane] = ptr;
+    for (plane = 0; plane < job->PrinterPlanes;
+         plane ++, ptr += job->DotBufferSize)
+      job->DotBuffers[plane] = ptr;
   }
 
   //
   // Set the output resolution...
   //
 
-  cfWritePrintData("\033(D\004\000", 5);
-  putchar(units);
-  putchar(units >> 8);
-  putchar(units * DotRowStep / header->HWResolution[1]);
-  putchar(units * DotColStep / header->HWResolution[0]);
+  raster_out_write(job->Output, "\033(D\004\000", 5);
+  raster_out_putc(job->Output, units);
+  raster_out_putc(job->Output, units >> 8);
+  raster_out_putc(job->Output,
+		  units * job->DotRowStep / header->HWResolution[1]);
+  raster_out_putc(job->Output,
+		  units * job->DotColStep / header->HWResolution[0]);
 
   //
   // Set the top of form...
   //
 
-  OutputFeed = 0;
+  job->OutputFeed = 0;
 
   //
   // Allocate buffers as needed...
   //
 
-  PixelBuffer      = malloc(header->cupsBytesPerLine);
-  InputBuffer      = malloc(header->cupsWidth * PrinterPlanes * 2);
-  OutputBuffers[0] = malloc(PrinterPlanes * header->cupsWidth);
+  job->PixelBuffer      = malloc(header->cupsBytesPerLine);
+  job->InputBuffer      = malloc(header->cupsWidth * job->PrinterPlanes * 2);
+  job->OutputBuffers[0] = malloc(job->PrinterPlanes * header->cupsWidth);
+
+  for (i = 1; i < job->PrinterPlanes; i ++)
+    job->OutputBuffers[i] = job->OutputBuffers[0] + i * header->cupsWidth;
+
+  if (job->RGB)
+    job->CMYKBuffer = malloc(header->cupsWidth * job->PrinterPlanes);
+
+  job->CompBuffer = malloc(10 * job->DotBufferSize * job->DotRowMax);
+  job->BlankInput = calloc(header->cupsWidth, sizeof(short));
+
+  //
+  // Blank lines can skip color separation and dithering as long as paper
+  // white does not use any ink...
+  //
+
+  if (header->cupsColorSpace == CUPS_CSPACE_K ||
+      header->cupsColorSpace == CUPS_CSPACE_CMYK)
+    job->BlankValue = 0;
+  else
+    job->BlankValue = 255;
+
+  memset(job->PixelBuffer, job->BlankValue, header->cupsBytesPerLine);
+  SeparateLine(job, header, job->PixelBuffer, job->CMYKBuffer,
+	       job->InputBuffer);
 
-  for (i = 1; i < PrinterPlanes; i ++)
-    OutputBuffers[i] = OutputBuffers[0] + i * header->cupsWidth;
+  if (!cfCheckBytes((unsigned char *)job->InputBuffer,
+                    header->cupsWidth * job->PrinterPlanes * 2))
+    job->BlankValue = -1;
 
-  if (RGB)
-    CMYKBuffer = malloc(header->cupsWidth * PrinterPlanes);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "BlankValue = %d", job->BlankValue);
 
-  CompBuffer = malloc(10 * DotBufferSize * DotRowMax);
+  return (1);
 }
 
 
@@ -1059,12 +1540,12 @@ StartPage(ppd_file_t         *ppd,	// I - PPD file
 //
 
 void
-EndPage(ppd_file_t         *ppd,	// I - PPD file
+EndPage(escp_job_t          *job,	// I - Job data
+        ppd_file_t          *ppd,	// I - PPD file
         cups_page_header2_t *header)	// I - Page header
 {
   int		i;			// Looping var
-  cups_weave_t	*band,			// Current band
-		*next;			// Next band in list
+  cups_weave_t	*band;			// Current band
   int		plane;			// Current plane
   int		subrow;			// Current subrow
   int		subrows;		// Number of subrows
@@ -1074,26 +1555,27 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
   // Output the last bands of print data as necessary...
   //
 
-  if (DotRowMax > 1)
+  if (job->DotRowMax > 1)
   {
     //
-    // Move the remaining bands to the used or avail lists...
+    // Move the remaining bands to the used heap or avail list...
     //
 
-    subrows = DotRowStep * DotColStep;
+    subrows = job->DotRowStep * job->DotColStep;
 
     for (subrow = 0; subrow < subrows; subrow ++)
-      for (plane = 0; plane < PrinterPlanes; plane ++)
+      for (plane = 0; plane < job->PrinterPlanes; plane ++)
       {
-        if (DotBands[subrow][plane]->dirty)
+        if (job->DotBands[subrow][plane]->dirty)
 	{
 	  //
-	  // Insert into the used list...
+	  // Insert into the used heap...
 	  //
 
-          DotBands[subrow][plane]->count = DotBands[subrow][plane]->row;
+          job->DotBands[subrow][plane]->count =
+              job->DotBands[subrow][plane]->row;
 
-          AddBand(DotBands[subrow][plane]);
+          AddBand(job, job->DotBands[subrow][plane]);
 	}
 	else
 	{
@@ -1101,89 +1583,65 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
 	  // Nothing here, so move it to the available list...
 	  //
 
-	  DotBands[subrow][plane]->next = DotAvailList;
-	  DotAvailList                  = DotBands[subrow][plane];
+	  job->DotBands[subrow][plane]->next = job->DotAvailList;
+	  job->DotAvailList                  = job->DotBands[subrow][plane];
 	}
 
-	DotBands[subrow][plane] = NULL;
+	job->DotBands[subrow][plane] = NULL;
       }
 
     //
     // Loop until all bands are written...
     //
 
-    fputs("DEBUG: Pointer list at end of page...\n", stderr);
-
-    for (band = DotUsedList; band != NULL; band = band->next)
-      fprintf(stderr, "DEBUG: %p (used)\n", (void*)band);
-    for (band = DotAvailList; band != NULL; band = band->next)
-      fprintf(stderr, "DEBUG: %p (avail)\n", (void*)band);
-
-    fputs("DEBUG: ----END----\n", stderr);
-
-    for (band = DotUsedList; band != NULL; band = next)
-    {
-      next = band->next;
-
-      OutputBand(ppd, header, band);
-
-      fprintf(stderr, "DEBUG: freeing used band %p, prev = %p, next = %p\n",
-              (void*)band, (void*)band->prev, (void*)band->next);
-
-      free(band->buffer);
-      free(band);
-    }
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Pointer list at end of page...");
 
-    //
-    // Free memory for the available bands, if any...
-    //
+    for (i = 0; i < job->DotUsedCount; i ++)
+      JobLog(job, CF_LOGLEVEL_DEBUG, "%p (used)", (void*)job->DotUsedHeap[i]);
+    for (band = job->DotAvailList; band != NULL; band = band->next)
+      JobLog(job, CF_LOGLEVEL_DEBUG, "%p (avail)", (void*)band);
 
-    for (band = DotAvailList; band != NULL; band = next)
-    {
-      next = band->next;
+    JobLog(job, CF_LOGLEVEL_DEBUG, "----END----");
 
-      fprintf(stderr, "DEBUG: freeing avail band %p, prev = %p,  next = %p\n",
-              (void*)band, (void*)band->prev, (void*)band->next);
+    while ((band = NextBand(job)) != NULL)
+      OutputBand(job, ppd, header, band);
 
-      free(band->buffer);
-      free(band);
-    }
+    job->DotAvailList = NULL;
   }
   else
   {
-    free(DotBuffers[0]);
-    DotBuffers[0] = NULL;
+    free(job->DotBuffers[0]);
+    job->DotBuffers[0] = NULL;
   }
 
   //
   // Output a page eject sequence...
   //
 
-  putchar(12);
+  raster_out_putc(job->Output, 12);
 
   //
-  // Free memory for the page...
+  // Send the rest of the page to the printer...
   //
 
-  for (i = 0; i < PrinterPlanes; i ++)
-  {
-    cfDitherDelete(DitherStates[i]);
-    cfLutDelete(DitherLuts[i]);
-  }
+  raster_out_flush(job->Output);
 
-  free(OutputBuffers[0]);
+  //
+  // Free memory for the page...
+  //
 
-  free(PixelBuffer);
-  free(InputBuffer);
-  free(CompBuffer);
+  for (i = 0; i < job->PrinterPlanes; i ++)
+    cfDitherDelete(job->DitherStates[i]);
 
-  cfCMYKDelete(CMYK);
+  free(job->OutputBuffers[0]);
 
-  if (RGB)
-  {
-    cfRGBDelete(RGB);
-    free(CMYKBuffer);
-  }
+  free(job->PixelBuffer);
+  free(job->InputBuffer);
+  free(job->BlankInput);
+  free(job->CompBuffer);
+
+  if (job->RGB)
+    free(job->CMYKBuffer);
 }
 
 
@@ -1192,13 +1650,14 @@ EndPage(ppd_file_t         *ppd,	// I - PPD file
 //
 
 void
-Shutdown(ppd_file_t *ppd)		// I - PPD file
+Shutdown(escp_job_t *job,		// I - Job data
+         ppd_file_t *ppd)		// I - PPD file
 {
   //
   // Reset the printer...
   //
 
-  printf("\033@");
+  raster_out_printf(job->Output, "\033@");
 
   if (ppd->model_number & ESCP_REMOTE)
   {
@@ -1206,94 +1665,131 @@ Shutdown(ppd_file_t *ppd)		// I - PPD file
     // Go into remote mode...
     //
 
-    cfWritePrintData("\033(R\010\000\000REMOTE1", 13);
+    raster_out_write(job->Output, "\033(R\010\000\000REMOTE1", 13);
 
     //
     // LoadXS defaults...
     //
 
-    cfWritePrintData("LD\000\000", 4);
+    raster_out_write(job->Output, "LD\000\000", 4);
 
     //
     // Exit remote mode...
     //
 
-    cfWritePrintData("\033\000\000\000", 4);
+    raster_out_write(job->Output, "\033\000\000\000", 4);
   }
 }
 
 
 //
-// 'AddBand()' - Add a band of data to the used list.
+// 'AddBand()' - Add a band of data to the used heap.
+//
+// The used bands form a binary min-heap ordered by (y, x, plane), which is
+// the order they have to be sent to the printer in.  No two bands share
+// the same position, so the heap order matches the old sorted list.
 //
 
 void
-AddBand(cups_weave_t *band)			// I - Band to add
+AddBand(escp_job_t   *job,		// I - Job data
+        cups_weave_t *band)		// I - Band to add
 {
-  cups_weave_t	*current,			// Current band
-		*prev;				// Previous band
+  int		i,				// Current heap index
+		parent;				// Parent heap index
+  cups_weave_t	*current;			// Parent band
 
 
   if (band->count < 1)
     return;
 
-  for (current = DotUsedList, prev = NULL;
-       current != NULL;
-       prev = current, current = current->next)
-    if (band->y < current->y ||
-        (band->y == current->y && band->x < current->x) ||
-	(band->y == current->y && band->x == current->x &&
-	 band->plane < current->plane))
-      break;
-
-  if (current != NULL)
+  for (i = job->DotUsedCount ++; i > 0; i = parent)
   {
-    //
-    // Insert the band...
-    //
+    parent  = (i - 1) / 2;
+    current = job->DotUsedHeap[parent];
 
-    band->next    = current;
-    band->prev    = prev;
-    current->prev = band;
+    if (current->y < band->y ||
+        (current->y == band->y && current->x < band->x) ||
+	(current->y == band->y && current->x == band->x &&
+	 current->plane < band->plane))
+      break;
 
-    if (prev != NULL)
-      prev->next = band;
-    else
-      DotUsedList = band;
+    job->DotUsedHeap[i] = current;
   }
-  else if (prev != NULL)
-  {
-    //
-    // Append the band to the end...
-    //
 
-    band->prev = prev;
-    prev->next = band;
-    band->next = NULL;
-  }
-  else
+  job->DotUsedHeap[i] = band;
+}
+
+
+//
+// 'NextBand()' - Remove the first band from the used heap.
+//
+
+cups_weave_t *				// O - First band or NULL if none
+NextBand(escp_job_t *job)		// I - Job data
+{
+  int		i,			// Current heap index
+		child;			// Child heap index
+  cups_weave_t	*first,			// First band
+		*last,			// Last band in heap
+		*current,		// Child band
+		*right;			// Right child band
+
+
+  if (job->DotUsedCount < 1)
+    return (NULL);
+
+  first = job->DotUsedHeap[0];
+  last  = job->DotUsedHeap[-- job->DotUsedCount];
+
+  for (i = 0; (child = 2 * i + 1) < job->DotUsedCount; i = child)
   {
-    //
-    // First band in list...
-    // 
+    current = job->DotUsedHeap[child];
+
+    if (child + 1 < job->DotUsedCount)
+    {
+      right = job->DotUsedHeap[child + 1];
+
+      if (right->y < current->y ||
+          (right->y == current->y && right->x < current->x) ||
+	  (right->y == current->y && right->x == current->x &&
+	   right->plane < current->plane))
+      {
+        child ++;
+	current = right;
+      }
+    }
 
-    DotUsedList = band;
-    band->prev  = NULL;
-    band->next  = NULL;
+    if (last->y < current->y ||
+        (last->y == current->y && last->x < current->x) ||
+	(last->y == current->y && last->x == current->x &&
+	 last->plane < current->plane))
+      break;
+
+    job->DotUsedHeap[i] = current;
   }
+
+  job->DotUsedHeap[i] = last;
+
+  return (first);
 }
 
 
 //
-// 'CancelJob()' - Cancel the current job...
+// 'FreeBands()' - Free the band slab and arena at the end of the job.
 //
 
 void
-CancelJob(int sig)			// I - Signal
+FreeBands(escp_job_t *job)		// I - Job data
 {
-  (void)sig;
-
-  Canceled = 1;
+  free(job->DotBandSlab);
+  free(job->DotUsedHeap);
+  free(job->DotArena);
+
+  job->DotBandSlab  = NULL;
+  job->DotUsedHeap  = NULL;
+  job->DotArena     = NULL;
+  job->DotBandAlloc = 0;
+  job->DotArenaSize = 0;
 }
 
 
@@ -1302,23 +1798,23 @@ CancelJob(int sig)			// I - Signal
 //
 
 void
-CompressData(ppd_file_t          *ppd,	// I - PPD file information
+CompressData(escp_job_t          *job,	// I - Job data
+             ppd_file_t          *ppd,	// I - PPD file information
              const unsigned char *line,	// I - Data to compress
-             const int           length,// I - Number of bytes
-	     int                 plane,	// I - Color plane
-	     int                 type,	// I - Type of compression
-	     const int           rows,	// I - Number of lines to write
-	     const int           xstep,	// I - Spacing between columns
-	     const int           ystep,	// I - Spacing between lines
-	     const int           offset)// I - Head offset
+             const int           length,	// I - Number of bytes
+             int                 plane,	// I - Color plane
+             int                 type,	// I - Type of compression
+             const int           rows,	// I - Number of lines to write
+             const int           xstep,	// I - Spacing between columns
+             const int           ystep,	// I - Spacing between lines
+             const int           offset)	// I - Head offset
 {
   register const unsigned char *line_ptr,
 					// Current byte pointer
-        	*line_end,		// End-of-line byte pointer
-        	*start;			// Start of compression sequence
-  register unsigned char *comp_ptr;	// Pointer into compression buffer
+        	*line_end;		// End-of-line byte pointer
   register int  count;			// Count of bytes for output
   register int	bytes;			// Number of bytes per row
+  long long	start;			// Start time of compression
   static int	ctable[7][7] =		// Colors
 		{
 		  {  0,  0,  0,  0,  0,  0,  0 },	// K
@@ -1331,6 +1827,8 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
 		};
 
 
+  start = raster_stats_start(job->Stats);
+
   switch (type)
   {
     case 0 :
@@ -1347,70 +1845,12 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
         // Do TIFF pack-bits encoding...
         //
 
-	line_ptr = (const unsigned char *)line;
-	line_end = (const unsigned char *)line + length;
-	comp_ptr = CompBuffer;
+	count = raster_packbits(job->CompBuffer, line, length, length);
 
-	while (line_ptr < line_end && (comp_ptr - CompBuffer) < length)
+        if (count < length)
 	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	    //
-	    // Single byte on the end...
-	    //
-
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	    //
-	    // Repeated sequence...
-	    //
-
-	    line_ptr ++;
-	    count = 2;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	    //
-	    // Non-repeated sequence...
-	    //
-
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = count - 1;
-
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
-
-        if ((comp_ptr - CompBuffer) < length)
-	{
-          line_ptr = (const unsigned char *)CompBuffer;
-          line_end = (const unsigned char *)comp_ptr;
+          line_ptr = (const unsigned char *)job->CompBuffer;
+          line_end = (const unsigned char *)job->CompBuffer + count;
 	}
 	else
 	{
@@ -1421,21 +1861,24 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
 	break;
   }
 
+  raster_stats_add(job->Stats, RASTER_STAGE_COMPRESS, start,
+                   (size_t)(line_end - line_ptr));
+
   //
   // Position the print head...
   //
 
-  putchar(0x0d);
+  raster_out_putc(job->Output, 0x0d);
 
   if (offset)
   {
-    if (BitPlanes == 1)
-      cfWritePrintData("\033(\\\004\000\240\005", 7);
+    if (job->BitPlanes == 1)
+      raster_out_write(job->Output, "\033(\\\004\000\240\005", 7);
     else
-      printf("\033\\");
+      raster_out_printf(job->Output, "\033\\");
 
-    putchar(offset);
-    putchar(offset >> 8);
+    raster_out_putc(job->Output, offset);
+    raster_out_putc(job->Output, offset >> 8);
   }
 
   //
@@ -1450,14 +1893,14 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
     // Send graphics with ESC i command.
     //
 
-    printf("\033i");
-    putchar(ctable[PrinterPlanes - 1][plane]);
-    putchar((type != 0) ? '1': '0');
-    putchar(BitPlanes);
-    putchar(bytes & 255);
-    putchar(bytes >> 8);
-    putchar(rows & 255);
-    putchar(rows >> 8);
+    raster_out_printf(job->Output, "\033i");
+    raster_out_putc(job->Output, ctable[job->PrinterPlanes - 1][plane]);
+    raster_out_putc(job->Output, (type != 0) ? '1': '0');
+    raster_out_putc(job->Output, job->BitPlanes);
+    raster_out_putc(job->Output, bytes & 255);
+    raster_out_putc(job->Output, bytes >> 8);
+    raster_out_putc(job->Output, rows & 255);
+    raster_out_putc(job->Output, rows >> 8);
   }
   else
   {
@@ -1465,14 +1908,14 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
     // Set the color if necessary...
     //
 
-    if (PrinterPlanes > 1)
+    if (job->PrinterPlanes > 1)
     {
-      plane = ctable[PrinterPlanes - 1][plane];
+      plane = ctable[job->PrinterPlanes - 1][plane];
 
       if (plane & 0x10)
-	printf("\033(r%c%c%c%c", 2, 0, 1, plane & 0x0f);
+	raster_out_printf(job->Output, "\033(r%c%c%c%c", 2, 0, 1, plane & 0x0f);
       else
-	printf("\033r%c", plane);
+	raster_out_printf(job->Output, "\033r%c", plane);
     }
 
     //
@@ -1481,16 +1924,16 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
 
     bytes *= 8;
 
-    printf("\033.");
-    putchar((type != 0) ? '1': '0');
-    putchar(ystep);
-    putchar(xstep);
-    putchar(rows);
-    putchar(bytes & 255);
-    putchar(bytes >> 8);
+    raster_out_printf(job->Output, "\033.");
+    raster_out_putc(job->Output, (type != 0) ? '1': '0');
+    raster_out_putc(job->Output, ystep);
+    raster_out_putc(job->Output, xstep);
+    raster_out_putc(job->Output, rows);
+    raster_out_putc(job->Output, bytes & 255);
+    raster_out_putc(job->Output, bytes >> 8);
   }
 
-  cfWritePrintData(line_ptr, line_end - line_ptr);
+  raster_out_write(job->Output, line_ptr, line_end - line_ptr);
 }
 
 
@@ -1499,167 +1942,350 @@ CompressData(ppd_file_t          *ppd,	// I - PPD file information
 //
 
 void
-OutputBand(ppd_file_t         *ppd,	// I - PPD file
+OutputBand(escp_job_t          *job,	// I - Job data
+           ppd_file_t          *ppd,	// I - PPD file
            cups_page_header2_t *header,	// I - Page header
-           cups_weave_t       *band)	// I - Current band
+           cups_weave_t        *band)	// I - Current band
 {
   int	xstep,				// Spacing between columns
 	ystep;				// Spacing between rows
+  int	row,				// Current row
+	left,				// First inked byte in each row
+	bytes,				// Inked bytes in each row
+	offset;				// Head offset for first inked byte
 
 
   //
   // Interleaved ESC/P2 graphics...
   //
 
-  OutputFeed    = band->y - DotRowCurrent;
-  DotRowCurrent = band->y;
+  job->OutputFeed    = band->y - job->DotRowCurrent;
+  job->DotRowCurrent = band->y;
 
-  fprintf(stderr, "DEBUG: Printing band %p, x = %d, y = %d, plane = %d, count = %d, OutputFeed = %d\n",
-          (void*)band, band->x, band->y, band->plane, band->count, OutputFeed);
+  JobLog(job, CF_LOGLEVEL_DEBUG,
+	 "Printing band %p, x = %d, y = %d, plane = %d, count = %d, "
+	 "OutputFeed = %d",
+	 (void*)band, band->x, band->y, band->plane, band->count,
+	 job->OutputFeed);
 
   //
   // Compute step values...
   //
 
-  xstep = 3600 * DotColStep / header->HWResolution[0];
-  ystep = 3600 * DotRowStep / header->HWResolution[1];
+  xstep = 3600 * job->DotColStep / header->HWResolution[0];
+  ystep = 3600 * job->DotRowStep / header->HWResolution[1];
 
   //
   // Output the band...
   //
 
-  if (OutputFeed > 0)
+  if (job->OutputFeed > 0)
+  {
+    raster_out_write(job->Output, "\033(v\002\000", 5);
+    raster_out_putc(job->Output, job->OutputFeed & 255);
+    raster_out_putc(job->Output, job->OutputFeed >> 8);
+
+    job->OutputFeed = 0;
+  }
+
+  if (TrimData(job, ppd, header, band->buffer, band->count, &left, &bytes,
+               &offset))
   {
-    cfWritePrintData("\033(v\002\000", 5);
-    putchar(OutputFeed & 255);
-    putchar(OutputFeed >> 8);
+    //
+    // Only send the inked columns, moving the rows together in the band
+    // buffer which gets cleared below anyway...
+    //
 
-    OutputFeed = 0;
+    for (row = 0; row < band->count; row ++)
+      memmove(band->buffer + row * bytes,
+              band->buffer + row * job->DotBufferSize + left, bytes);
+
+    offset += band->x;
+  }
+  else
+  {
+    bytes  = job->DotBufferSize;
+    offset = band->x;
   }
 
-  CompressData(ppd, band->buffer, band->count * DotBufferSize, band->plane,
-	       header->cupsCompression, band->count, xstep, ystep, band->x);
+  CompressData(job, ppd, band->buffer, band->count * bytes, band->plane,
+	       header->cupsCompression, band->count, xstep, ystep, offset);
 
   //
   // Clear the band...
   //
 
-  memset(band->buffer, 0, band->count * DotBufferSize);
+  memset(band->buffer, 0, band->count * job->DotBufferSize);
   band->dirty = 0;
 
   //
-  // Flush the output buffers...
+  // Write the output once a band's worth has been collected...
   //
 
-  fflush(stdout);
+  raster_out_checkpoint(job->Output);
 }
 
 
 //
-// 'ProcessLine()' - Read graphics from the page stream and output as needed.
+// 'TrimData()' - Find the inked columns of a band or line.
+//
+// The first inked byte is moved left as needed so that it starts on a
+// whole number of positioning units, keeping every dot exactly where it
+// would have been printed without trimming.
 //
 
-void
-ProcessLine(ppd_file_t         *ppd,	// I - PPD file
-            cups_raster_t      *ras,	// I - Raster stream
-            cups_page_header2_t *header,	// I - Page header
-            const int          y)	// I - Current scanline
+int					// O - 1 if trimmed, 0 to send everything
+TrimData(escp_job_t          *job,	// I - Job data
+         ppd_file_t          *ppd,	// I - PPD file
+         cups_page_header2_t *header,	// I - Page header
+         const unsigned char *buffer,	// I - Packed rows
+         const int           rows,	// I - Number of rows
+         int                 *left,	// O - First inked byte in each row
+         int                 *bytes,	// O - Inked bytes in each row
+         int                 *offset)	// O - Head offset of first inked byte
 {
-  int		plane,			// Current color plane
-		width,			// Width of line
-		subwidth,		// Width of interleaved row
-		subrow,			// Subrow for interleaved output
-		offset,			// Offset to current line
-		pass,			// Pass number
-		xstep,			// X step value
-		ystep;			// Y step value
-  cups_weave_t	*band;			// Current band
+  int			i,		// Looping var
+			row,		// Current row
+			first,		// First inked byte
+			last,		// Last inked byte
+			dots,		// Page dots per byte
+			units;		// Positioning units per inch
+  const unsigned char	*ptr;		// Current row
 
 
+  if (!job->Trim)
+    return (0);
+
   //
-  // Read a row of graphics...
+  // Find the first and last inked bytes over all rows...
   //
 
-  if (!cupsRasterReadPixels(ras, PixelBuffer, header->cupsBytesPerLine))
-    return;
+  first = job->DotBufferSize;
+  last  = -1;
+
+  for (row = 0, ptr = buffer; row < rows; row ++, ptr += job->DotBufferSize)
+  {
+    for (i = 0; i < first && !ptr[i]; i ++);
+    first = i;
+
+    for (i = job->DotBufferSize - 1; i > last && !ptr[i]; i --);
+    last = i;
+  }
+
+  if (last < first)
+    return (0);
 
   //
-  // Perform the color separation...
+  // ESC ( \ positions in 1/1440th inch, ESC \ in the horizontal unit set
+  // with ESC ( U...
   //
 
-  width    = header->cupsWidth;
-  subwidth = header->cupsWidth / DotColStep;
-  xstep    = 3600 / header->HWResolution[0];
-  ystep    = 3600 / header->HWResolution[1];
+  dots = 8 / job->BitPlanes * job->DotColStep;
+
+  if (job->BitPlanes == 1)
+    units = 1440;
+  else if (ppd->model_number & ESCP_EXT_UNITS)
+    units = header->HWResolution[0];
+  else
+    units = 3600 / (3600 / header->HWResolution[1]);
+
+  while (first > 0 && (first * dots * units) % header->HWResolution[0])
+    first --;
+
+  if (first == 0 && last == job->DotBufferSize - 1)
+    return (0);
+
+  *left   = first;
+  *bytes  = last - first + 1;
+  *offset = first * dots * units / header->HWResolution[0];
+
+  return (1);
+}
+
+
+//
+// 'SeparateLine()' - Perform the color separation of a line.
+//
+
+void
+SeparateLine(escp_job_t          *job,	// I - Job data
+             cups_page_header2_t *header,	// I - Page header
+             unsigned char       *pixels,	// I - Raster pixels
+             unsigned char       *cmyk,	// I - CMYK buffer
+             short               *input)	// O - Ink values
+{
+  int		width;			// Width of line
+  long long	start;			// Start time of separation
+
+
+  width = header->cupsWidth;
+  start = raster_stats_start(job->Stats);
 
   switch (header->cupsColorSpace)
   {
     case CUPS_CSPACE_W :
-        if (RGB)
+        if (job->RGB)
 	{
-	  cfRGBDoGray(RGB, PixelBuffer, CMYKBuffer, width);
-	  cfCMYKDoCMYK(CMYK, CMYKBuffer, InputBuffer, width);
+	  cfRGBDoGray(job->RGB, pixels, cmyk, width);
+	  cfCMYKDoCMYK(job->CMYK, cmyk, input, width);
 	}
 	else
-          cfCMYKDoGray(CMYK, PixelBuffer, InputBuffer, width);
+          cfCMYKDoGray(job->CMYK, pixels, input, width);
 	break;
 
     case CUPS_CSPACE_K :
-        cfCMYKDoBlack(CMYK, PixelBuffer, InputBuffer, width);
+        cfCMYKDoBlack(job->CMYK, pixels, input, width);
 	break;
 
     default :
     case CUPS_CSPACE_RGB :
-        if (RGB)
+        if (job->RGB)
 	{
-	  cfRGBDoRGB(RGB, PixelBuffer, CMYKBuffer, width);
-	  cfCMYKDoCMYK(CMYK, CMYKBuffer, InputBuffer, width);
+	  cfRGBDoRGB(job->RGB, pixels, cmyk, width);
+	  cfCMYKDoCMYK(job->CMYK, cmyk, input, width);
 	}
 	else
-          cfCMYKDoRGB(CMYK, PixelBuffer, InputBuffer, width);
+          cfCMYKDoRGB(job->CMYK, pixels, input, width);
 	break;
 
     case CUPS_CSPACE_CMYK :
-        cfCMYKDoCMYK(CMYK, PixelBuffer, InputBuffer, width);
+        cfCMYKDoCMYK(job->CMYK, pixels, input, width);
 	break;
   }
 
-  //
-  // Dither the pixels...
-  //
+  raster_stats_add(job->Stats, RASTER_STAGE_SEPARATE, start,
+                   width * job->PrinterPlanes * sizeof(short));
+}
+
+
+//
+// 'DitherPlane()' - Dither a color plane of a line.
+//
+// Blank lines pass NULL for the ink values.  They are still dithered
+// until the error left over from the last inked line has been used up;
+// after that a line without ink only changes the direction of the
+// dither, so the rest of a blank run is not dithered at all.  Threshold
+// dithering leaves no error, so blank lines are never dithered with it.
+//
 
-  for (plane = 0; plane < PrinterPlanes; plane ++)
+void
+DitherPlane(escp_job_t    *job,		// I - Job data
+            const int     plane,	// I - Color plane
+            const int     y,		// I - Line on the page
+            const short   *input,	// I - Ink values or NULL if blank
+            unsigned char *pixels)	// O - Dithered pixels
+{
+  cf_dither_t	*state = job->DitherStates[plane];
+					// Dither state for plane
+  long long	start;			// Start time of dither
+
+
+  start = raster_stats_start(job->Stats);
+
+  if (job->DitherMatrix)
   {
-    cfDitherLine(DitherStates[plane], DitherLuts[plane], InputBuffer + plane,
-                   PrinterPlanes, OutputBuffers[plane]);
+    if (input)
+      raster_dither_line(job->DitherMatrix, job->DitherLevels[plane], input,
+                         job->PrinterPlanes, pixels, state->width, y, plane);
+    else
+      memset(pixels, 0, state->width);
+  }
+  else if (input)
+  {
+    job->DitherClean[plane] = 0;
+
+    cfDitherLine(state, job->DitherLuts[plane], input, job->PrinterPlanes,
+		 pixels);
+  }
+  else if (job->DitherClean[plane])
+  {
+    state->row ^= 1;
+
+    memset(pixels, 0, state->width);
+  }
+  else
+  {
+    cfDitherLine(state, job->DitherLuts[plane], job->BlankInput, 1, pixels);
+
+    job->DitherClean[plane] = cfCheckBytes((unsigned char *)state->errors,
+                                      2 * (state->width + 4) * sizeof(int));
+  }
+
+  raster_stats_add(job->Stats, RASTER_STAGE_DITHER, start, state->width);
+}
+
+
+//
+// 'WeaveLine()' - Pack, weave and output a line of dithered pixels.
+//
+
+void
+WeaveLine(escp_job_t          *job,	// I - Job data
+          ppd_file_t          *ppd,	// I - PPD file
+          cups_page_header2_t *header,	// I - Page header
+          const int           y,	// I - Current scanline
+          unsigned char       **planes)	// I - Dithered pixels for each plane
+{
+  int		plane,			// Current color plane
+		width,			// Width of line
+		subwidth,		// Width of interleaved row
+		subrow,			// Subrow for interleaved output
+		offset,			// Offset to current line
+		pass,			// Pass number
+		xstep,			// X step value
+		ystep,			// Y step value
+		left,			// First inked byte of line
+		bytes,			// Inked bytes of line
+		head;			// Head offset of inked bytes
+  long long	start;			// Start time of packing
+  cups_weave_t	*band,			// Current band
+		*next;			// Next band to use
+
+
+  width    = header->cupsWidth;
+  subwidth = header->cupsWidth / job->DotColStep;
+  xstep    = 3600 / header->HWResolution[0];
+  ystep    = 3600 / header->HWResolution[1];
 
-    if (DotRowMax == 1)
+  for (plane = 0; plane < job->PrinterPlanes; plane ++)
+  {
+    if (job->DotRowMax == 1)
     {
       //
       // Handle microweaved output...
       //
 
-      if (cfCheckBytes(OutputBuffers[plane], width))
+      if (cfCheckBytes(planes[plane], width))
 	continue;
 
-      if (BitPlanes == 1)
-	cfPackHorizontal(OutputBuffers[plane], DotBuffers[plane],
+      start = raster_stats_start(job->Stats);
+
+      if (job->BitPlanes == 1)
+	cfPackHorizontal(planes[plane], job->DotBuffers[plane],
 	                   width, 0, 1);
       else
-	cfPackHorizontal2(OutputBuffers[plane], DotBuffers[plane],
+	cfPackHorizontal2(planes[plane], job->DotBuffers[plane],
                 	    width, 1);
 
-      if (OutputFeed > 0)
+      raster_stats_add(job->Stats, RASTER_STAGE_PACK, start,
+		       job->DotBufferSize);
+
+      if (job->OutputFeed > 0)
       {
-	cfWritePrintData("\033(v\002\000", 5);
-	putchar(OutputFeed & 255);
-	putchar(OutputFeed >> 8);
-	OutputFeed = 0;
+	raster_out_write(job->Output, "\033(v\002\000", 5);
+	raster_out_putc(job->Output, job->OutputFeed & 255);
+	raster_out_putc(job->Output, job->OutputFeed >> 8);
+	job->OutputFeed = 0;
       }
 
-      CompressData(ppd, DotBuffers[plane], DotBufferSize, plane, 1, 1,
-                   xstep, ystep, 0);
-      fflush(stdout);
+      if (TrimData(job, ppd, header, job->DotBuffers[plane], 1, &left,
+                   &bytes, &head))
+	CompressData(job, ppd, job->DotBuffers[plane] + left, bytes, plane, 1,
+		     1, xstep, ystep, head);
+      else
+	CompressData(job, ppd, job->DotBuffers[plane], job->DotBufferSize,
+		     plane, 1, 1, xstep, ystep, 0);
+      raster_out_checkpoint(job->Output);
     }
     else
     {
@@ -1667,61 +2293,69 @@ ProcessLine(ppd_file_t         *ppd,	// I - PPD file
       // Handle softweaved output...
       //
 
-      for (pass = 0, subrow = y % DotRowStep;
-           pass < DotColStep;
-	   pass ++, subrow += DotRowStep)
+      for (pass = 0, subrow = y % job->DotRowStep;
+           pass < job->DotColStep;
+	   pass ++, subrow += job->DotRowStep)
       {
 	//
 	// See if we need to output the band...
 	//
 
-        band   = DotBands[subrow][plane];
-	offset = band->row * DotBufferSize;
+        band   = job->DotBands[subrow][plane];
+	offset = band->row * job->DotBufferSize;
+	start  = raster_stats_start(job->Stats);
 
-        if (BitPlanes == 1)
-	  cfPackHorizontal(OutputBuffers[plane] + pass,
-	                     band->buffer + offset, subwidth, 0, DotColStep);
+        if (job->BitPlanes == 1)
+	  cfPackHorizontal(planes[plane] + pass,
+			     band->buffer + offset, subwidth, 0,
+			     job->DotColStep);
         else
-	  cfPackHorizontal2(OutputBuffers[plane] + pass,
-	                      band->buffer + offset, subwidth, DotColStep);
+	  cfPackHorizontal2(planes[plane] + pass,
+	                      band->buffer + offset, subwidth, job->DotColStep);
 
         band->row ++;
-	band->dirty |= !cfCheckBytes(band->buffer + offset, DotBufferSize);
+	band->dirty |= !cfCheckBytes(band->buffer + offset, job->DotBufferSize);
+
+	raster_stats_add(job->Stats, RASTER_STAGE_PACK, start,
+			 job->DotBufferSize);
 	if (band->row >= band->count)
 	{
 	  if (band->dirty)
 	  {
 	    //
-	    // Dirty band needs to be added to the used list...
+	    // Dirty band needs to be added to the used heap...
 	    //
 
-	    AddBand(band);
+	    AddBand(job, band);
 
 	    //
 	    // Then find a new band...
 	    //
 
-	    if (DotAvailList == NULL)
+	    if (job->DotAvailList == NULL)
 	    {
-	      OutputBand(ppd, header, DotUsedList);
-
-	      DotBands[subrow][plane] = DotUsedList;
-	      DotUsedList->x          = band->x;
-	      DotUsedList->y          = band->y + band->count * DotRowStep;
-	      DotUsedList->plane      = band->plane;
-	      DotUsedList->row        = 0;
-	      DotUsedList->count      = DotRowCount;
-	      DotUsedList             = DotUsedList->next;
+	      next = NextBand(job);
+
+	      OutputBand(job, ppd, header, next);
+
+	      job->DotBands[subrow][plane] = next;
+	      next->x                      = band->x;
+	      next->y                      = band->y +
+	                                     band->count * job->DotRowStep;
+	      next->plane                  = band->plane;
+	      next->row                    = 0;
+	      next->count                  = job->DotRowCount;
 	    }
 	    else
 	    {
-	      DotBands[subrow][plane] = DotAvailList;
-	      DotAvailList->x         = band->x;
-	      DotAvailList->y         = band->y + band->count * DotRowStep;
-	      DotAvailList->plane     = band->plane;
-	      DotAvailList->row       = 0;
-	      DotAvailList->count     = DotRowCount;
-	      DotAvailList            = DotAvailList->next;
+	      job->DotBands[subrow][plane] = job->DotAvailList;
+	      job->DotAvailList->x         = band->x;
+	      job->DotAvailList->y         = band->y +
+	                                     band->count * job->DotRowStep;
+	      job->DotAvailList->plane     = band->plane;
+	      job->DotAvailList->row       = 0;
+	      job->DotAvailList->count     = job->DotRowCount;
+	      job->DotAvailList            = job->DotAvailList->next;
 	    }
 	  }
 	  else
@@ -1730,137 +2364,810 @@ ProcessLine(ppd_file_t         *ppd,	// I - PPD file
 	    // This band isn't dirty, so reuse it...
 	    //
 
-            fprintf(stderr, "DEBUG: Blank band %p, x = %d, y = %d, plane = %d, count = %d\n",
-	            (void*)band, band->x, band->y, band->plane, band->count);
+	    JobLog(job, CF_LOGLEVEL_DEBUG,
+		   "Blank band %p, x = %d, y = %d, plane = %d, count = %d",
+		   (void*)band, band->x, band->y, band->plane, band->count);
 
-	    band->y     += band->count * DotRowStep;
+	    band->y     += band->count * job->DotRowStep;
 	    band->row   = 0;
-	    band->count = DotRowCount;
+	    band->count = job->DotRowCount;
 	  }
         }
       }
     }
   }
 
-  if (DotRowMax == 1)
-    OutputFeed ++;
+  if (job->DotRowMax == 1)
+    job->OutputFeed ++;
 }
 
 
 //
-// 'main()' - Main entry and processing of driver.
+// 'ProcessLine()' - Read graphics from the page stream and output as needed.
 //
 
-int					// O - Exit status
-main(int  argc,				// I - Number of command-line arguments
-     char *argv[])			// I - Command-line arguments
+void
+ProcessLine(escp_job_t          *job,	// I - Job data
+            ppd_file_t          *ppd,	// I - PPD file
+            cups_raster_t       *ras,	// I - Raster stream
+            cups_page_header2_t *header,	// I - Page header
+            const int           y)	// I - Current scanline
 {
-  int			fd;		// File descriptor
-  int empty = 1;
-  cups_raster_t		*ras;		// Raster stream for printing
-  cups_page_header2_t	header;		// Page header from file
-  int			page;		// Current page
-  int			y;		// Current line
-  ppd_file_t		*ppd;		// PPD file
-  int			num_options;	// Number of options
-  cups_option_t		*options;	// Options
-#if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
-  struct sigaction action;		// Actions for POSIX signals
-#endif // HAVE_SIGACTION && !HAVE_SIGSET
+  int		plane,			// Current color plane
+		blank;			// Is the line blank?
+  long long	start;			// Start time of read
 
 
   //
-  // Log function for the library functions, standard CUPS logging to stderr...
+  // Read a row of graphics...
   //
 
-  logfunc = cfCUPSLogFunc;
-  ld = NULL;
+  start = raster_stats_start(job->Stats);
+
+  if (!cupsRasterReadPixels(ras, job->PixelBuffer, header->cupsBytesPerLine))
+    return;
+
+  raster_stats_add(job->Stats, RASTER_STAGE_READ, start,
+		   header->cupsBytesPerLine);
 
   //
-  // Make sure status messages are not buffered...
+  // Perform the color separation, unless the line is blank...
   //
 
-  setbuf(stderr, NULL);
+  blank = job->BlankValue >= 0 &&
+          raster_check_value(job->PixelBuffer, header->cupsBytesPerLine,
+	                     job->BlankValue);
+
+  if (!blank)
+    SeparateLine(job, header, job->PixelBuffer, job->CMYKBuffer,
+		 job->InputBuffer);
 
   //
-  // Check command-line...
+  // Dither the pixels...
   //
 
-  if (argc < 6 || argc > 7)
+  for (plane = 0; plane < job->PrinterPlanes; plane ++)
+    DitherPlane(job, plane, y, blank ? NULL : job->InputBuffer + plane,
+                job->OutputBuffers[plane]);
+
+  //
+  // Pack, weave and send the line...
+  //
+
+  WeaveLine(job, ppd, header, y, job->OutputBuffers);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+//
+// 'StartPipeline()' - Start the threaded pipeline for a job.
+//
+// The threads are started once and then wait for each page handed to
+// them by PipelinePage().
+//
+
+int					// O - 1 on success, 0 on failure
+StartPipeline(escp_job_t    *job,	// I - Job data
+              cups_raster_t *ras)	// I - Raster stream
+{
+  int		i;			// Looping var
+
+
+  if ((job->Pipeline = calloc(1, sizeof(cups_pipeline_t))) == NULL)
+    return (0);
+
+  job->Pipeline->ras = ras;
+
+  pthread_mutex_init(&job->Pipeline->mutex, NULL);
+  pthread_cond_init(&job->Pipeline->cond, NULL);
+
+  //
+  // One thread each for reading and color separation, the rest dithers
+  // the color planes...
+  //
+
+  job->Pipeline->num_workers = job->Threads - 2;
+
+  if (job->Pipeline->num_workers > 7)
+    job->Pipeline->num_workers = 7;
+  else if (job->Pipeline->num_workers < 1)
+    job->Pipeline->num_workers = 1;
+
+  //
+  // Start the threads...
+  //
+
+  if (pthread_create(job->Pipeline->threads + 0, NULL, ReaderThread, job))
   {
-    fprintf(stderr, "Usage: %s job-id user title copies options [file]\n",
-	    argv[0]);
-    return (1);
+    StopPipeline(job);
+    return (0);
+  }
+
+  job->Pipeline->num_started ++;
+
+  if (pthread_create(job->Pipeline->threads + 1, NULL, SeparateThread, job))
+  {
+    StopPipeline(job);
+    return (0);
+  }
+
+  job->Pipeline->num_started ++;
+
+  for (i = 0; i < job->Pipeline->num_workers; i ++)
+  {
+    job->Pipeline->workers[i].job   = job;
+    job->Pipeline->workers[i].first = i;
+
+    if (pthread_create(job->Pipeline->threads + 2 + i, NULL, DitherThread,
+                       job->Pipeline->workers + i))
+    {
+      StopPipeline(job);
+      return (0);
+    }
+
+    job->Pipeline->num_started ++;
   }
 
-  num_options = cupsParseOptions(argv[5], 0, &options);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Started pipeline with %d dither threads.",
+         job->Pipeline->num_workers);
+
+  return (1);
+}
+
+
+//
+// 'PipelinePage()' - Hand the next page to the pipeline threads.
+//
+// The threads are idle between pages, so the line slots can be resized
+// here for the new page.
+//
+
+int					// O - 1 on success, 0 on failure
+PipelinePage(escp_job_t          *job,	// I - Job data
+             cups_page_header2_t *header)	// I - Page header
+{
+  int		i,			// Looping var
+		plane;			// Current color plane
+  size_t	pixels_size,		// Size of raster pixels
+		input_size,		// Size of color separation buffer
+		planes_size,		// Size of dithered output
+		cmyk_size;		// Size of CMYK buffer
+  cups_line_t	*line;			// Current line slot
+
+
+  pixels_size = header->cupsBytesPerLine;
+  input_size  = (size_t)header->cupsWidth * job->PrinterPlanes * 2;
+  planes_size = (size_t)header->cupsWidth * job->PrinterPlanes;
+  cmyk_size   = job->RGB ? planes_size : 0;
+
+  if (pixels_size > job->Pipeline->pixels_size ||
+      input_size > job->Pipeline->input_size ||
+      planes_size > job->Pipeline->planes_size ||
+      cmyk_size > job->Pipeline->cmyk_size)
+  {
+    //
+    // Grow the line slots; if that fails, all of them are allocated again
+    // for the next page...
+    //
+
+    job->Pipeline->pixels_size = 0;
+    job->Pipeline->input_size  = 0;
+    job->Pipeline->planes_size = 0;
+    job->Pipeline->cmyk_size   = 0;
+
+    for (i = 0, line = job->Pipeline->lines; i < PIPELINE_DEPTH;
+         i ++, line ++)
+    {
+      free(line->pixels);
+      free(line->input);
+      free(line->planes[0]);
+      free(line->cmyk);
+
+      line->pixels    = malloc(pixels_size);
+      line->input     = malloc(input_size);
+      line->planes[0] = malloc(planes_size);
+      line->cmyk      = cmyk_size ? malloc(cmyk_size) : NULL;
+
+      if (!line->pixels || !line->input || !line->planes[0] ||
+          (cmyk_size && !line->cmyk))
+        return (0);
+    }
+
+    job->Pipeline->pixels_size = pixels_size;
+    job->Pipeline->input_size  = input_size;
+    job->Pipeline->planes_size = planes_size;
+    job->Pipeline->cmyk_size   = cmyk_size;
+  }
 
   //
-  // Open the PPD file...
+  // Start the threads on the page...
   //
 
-  ppd = ppdOpenFile(getenv("PPD"));
+  pthread_mutex_lock(&job->Pipeline->mutex);
 
-  if (!ppd)
+  for (i = 0, line = job->Pipeline->lines; i < PIPELINE_DEPTH; i ++, line ++)
   {
-    ppd_status_t	status;		// PPD error
-    int			linenum;	// Line number
+    line->y     = -1;
+    line->state = LINE_FREE;
 
-    fputs("ERROR: The PPD file could not be opened.\n", stderr);
+    for (plane = 1; plane < job->PrinterPlanes; plane ++)
+      line->planes[plane] = line->planes[0] + plane * header->cupsWidth;
+  }
 
-    status = ppdLastError(&linenum);
+  job->Pipeline->header     = header;
+  job->Pipeline->num_dither = job->Pipeline->num_workers;
 
-    fprintf(stderr, "DEBUG: %s on line %d.\n", ppdErrorString(status), linenum);
+  if (job->Pipeline->num_dither > job->PrinterPlanes)
+    job->Pipeline->num_dither = job->PrinterPlanes;
 
-    return (1);
+  job->Pipeline->page ++;
+
+  pthread_cond_broadcast(&job->Pipeline->cond);
+  pthread_mutex_unlock(&job->Pipeline->mutex);
+
+  return (1);
+}
+
+
+//
+// 'PipelineLine()' - Output the next line from the threaded pipeline.
+//
+// Returns 0 when the job is canceled while waiting for the line, e.g.
+// because the reader thread waits for the upstream filter.
+//
+
+int					// O - 1 on success, 0 if canceled
+PipelineLine(escp_job_t          *job,	// I - Job data
+             ppd_file_t          *ppd,	// I - PPD file
+             cups_page_header2_t *header,	// I - Page header
+             const int           y)	// I - Current scanline
+{
+  cups_line_t	*line;			// Line slot
+  struct timespec timeout;		// Time to check for cancel
+
+
+  line = job->Pipeline->lines + y % PIPELINE_DEPTH;
+
+  //
+  // Wait for the line to be dithered, checking every 100ms whether the job
+  // has been canceled...
+  //
+
+  pthread_mutex_lock(&job->Pipeline->mutex);
+
+  while (line->y != y || line->state == LINE_FREE ||
+         (line->state != LINE_SKIPPED && line->dithered < job->PrinterPlanes))
+  {
+    if (job->iscanceled && job->iscanceled(job->icd))
+    {
+      pthread_mutex_unlock(&job->Pipeline->mutex);
+      return (0);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &timeout);
+
+    if ((timeout.tv_nsec += 100000000) >= 1000000000)
+    {
+      timeout.tv_sec ++;
+      timeout.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(&job->Pipeline->cond, &job->Pipeline->mutex,
+                           &timeout);
   }
 
-  ppdMarkDefaults(ppd);
-  ppdMarkOptions(ppd, num_options, options);
+  pthread_mutex_unlock(&job->Pipeline->mutex);
 
   //
-  // Open the page stream...
+  // Pack, weave and send the line...
+  //
+
+  if (line->state != LINE_SKIPPED)
+    WeaveLine(job, ppd, header, y, line->planes);
+
   //
+  // Return the slot to the reader...
+  //
+
+  pthread_mutex_lock(&job->Pipeline->mutex);
+  line->state = LINE_FREE;
+  pthread_cond_broadcast(&job->Pipeline->cond);
+  pthread_mutex_unlock(&job->Pipeline->mutex);
+
+  return (1);
+}
+
+
+//
+// 'StopPipeline()' - Stop the threaded pipeline at the end of a job.
+//
+// Also used when the job is canceled in the middle of a page; the reader
+// thread then stops waiting for raster data (see ReadRaster()).
+//
+
+void
+StopPipeline(escp_job_t *job)		// I - Job data
+{
+  int		i;			// Looping var
+  cups_line_t	*line;			// Current line slot
+
+
+  if (!job->Pipeline)
+    return;
+
+  //
+  // Tell the threads to stop and wait for them...
+  //
+
+  pthread_mutex_lock(&job->Pipeline->mutex);
+  __atomic_store_n(&job->Pipeline->aborted, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&job->Pipeline->cond);
+  pthread_mutex_unlock(&job->Pipeline->mutex);
+
+  for (i = 0; i < job->Pipeline->num_started; i ++)
+    pthread_join(job->Pipeline->threads[i], NULL);
+
+  pthread_cond_destroy(&job->Pipeline->cond);
+  pthread_mutex_destroy(&job->Pipeline->mutex);
+
+  for (i = 0, line = job->Pipeline->lines; i < PIPELINE_DEPTH; i ++, line ++)
+  {
+    free(line->pixels);
+    free(line->input);
+    free(line->planes[0]);
+    free(line->cmyk);
+  }
+
+  free(job->Pipeline);
+  job->Pipeline = NULL;
+}
+
+
+//
+// 'PipelineWait()' - Wait for the next page in a pipeline thread.
+//
+
+int					// O  - 1 for a new page, 0 to stop
+PipelineWait(escp_job_t *job,		// I  - Job data
+             int        *page)		// IO - Last page processed
+{
+  int	aborted;			// Pipeline stopped?
+
+
+  pthread_mutex_lock(&job->Pipeline->mutex);
+
+  while (job->Pipeline->page == *page && !job->Pipeline->aborted)
+    pthread_cond_wait(&job->Pipeline->cond, &job->Pipeline->mutex);
+
+  *page   = job->Pipeline->page;
+  aborted = job->Pipeline->aborted;
+
+  pthread_mutex_unlock(&job->Pipeline->mutex);
+
+  return (!aborted);
+}
+
 
-  if (argc == 7)
+//
+// 'ReadRaster()' - Read raster data from the input file.
+//
+// This is the cups_raster_iocb_t callback used with the pipeline.  Waiting
+// for the upstream filter is given up once the pipeline is stopped, so
+// that a canceled job does not hang while joining the reader thread.
+//
+
+ssize_t					// O - Bytes read, 0 at end of file
+ReadRaster(void          *ctx,		// I - Job data
+           unsigned char *buffer,	// I - Buffer to read into
+	   size_t        length)	// I - Number of bytes to read
+{
+  escp_job_t	*job = (escp_job_t *)ctx;
+					// Job data
+  ssize_t	bytes;			// Bytes read
+  struct pollfd	pfd;			// File to wait for
+
+
+  for (;;)
+  {
+    if (job->Pipeline &&
+        __atomic_load_n(&job->Pipeline->aborted, __ATOMIC_ACQUIRE))
+      return (-1);
+
+    //
+    // Wait up to 100ms for data, then check again whether the pipeline has
+    // been stopped...
+    //
+
+    pfd.fd     = job->InputFD;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, 100) == 0)
+      continue;
+
+    if ((bytes = read(job->InputFD, buffer, length)) >= 0)
+      return (bytes);
+
+    if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+      return (-1);
+  }
+}
+
+
+//
+// 'ReaderThread()' - Read raster lines into the pipeline.
+//
+
+void *					// O - Thread exit status
+ReaderThread(void *arg)			// I - Job data
+{
+  escp_job_t	*job = (escp_job_t *)arg;
+					// Job data
+  cups_page_header2_t *header;		// Page header
+  int		page = 0,		// Current page
+		y,			// Current line
+		aborted,		// Pipeline stopped?
+		state;			// New state for slot
+  long long	start;			// Start time of read
+  cups_line_t	*line;			// Line slot
+
+
+  while (PipelineWait(job, &page))
   {
-    if ((fd = open(argv[6], O_RDONLY)) == -1)
+    header = job->Pipeline->header;
+
+    for (y = 0; y < (int)header->cupsHeight; y ++)
     {
-      perror("ERROR: Unable to open raster file");
-      return (1);
+      line = job->Pipeline->lines + y % PIPELINE_DEPTH;
+
+      //
+      // Wait for the slot to be output...
+      //
+
+      pthread_mutex_lock(&job->Pipeline->mutex);
+
+      while (line->state != LINE_FREE && !job->Pipeline->aborted)
+	pthread_cond_wait(&job->Pipeline->cond, &job->Pipeline->mutex);
+
+      aborted = job->Pipeline->aborted;
+
+      pthread_mutex_unlock(&job->Pipeline->mutex);
+
+      if (aborted)
+	break;
+
+      //
+      // Read a row of graphics...
+      //
+
+      start = raster_stats_start(job->Stats);
+
+      if (cupsRasterReadPixels(job->Pipeline->ras, line->pixels,
+			       header->cupsBytesPerLine))
+      {
+	raster_stats_add(job->Stats, RASTER_STAGE_READ, start,
+			 header->cupsBytesPerLine);
+
+	state       = LINE_READ;
+	line->blank = job->BlankValue >= 0 &&
+		      raster_check_value(line->pixels,
+					 header->cupsBytesPerLine,
+					 job->BlankValue);
+      }
+      else
+	state = LINE_SKIPPED;
+
+      pthread_mutex_lock(&job->Pipeline->mutex);
+      line->y        = y;
+      line->state    = state;
+      line->dithered = 0;
+      pthread_cond_broadcast(&job->Pipeline->cond);
+      pthread_mutex_unlock(&job->Pipeline->mutex);
     }
   }
+
+  return (NULL);
+}
+
+
+//
+// 'SeparateThread()' - Color separate lines in the pipeline.
+//
+
+void *					// O - Thread exit status
+SeparateThread(void *arg)		// I - Job data
+{
+  escp_job_t	*job = (escp_job_t *)arg;
+					// Job data
+  cups_page_header2_t *header;		// Page header
+  int		page = 0,		// Current page
+		y,			// Current line
+		state;			// Slot state
+  cups_line_t	*line;			// Line slot
+
+
+  while (PipelineWait(job, &page))
+  {
+    header = job->Pipeline->header;
+
+    for (y = 0; y < (int)header->cupsHeight; y ++)
+    {
+      line = job->Pipeline->lines + y % PIPELINE_DEPTH;
+
+      pthread_mutex_lock(&job->Pipeline->mutex);
+
+      while ((line->y != y || line->state != LINE_READ) &&
+	     !(line->y == y && line->state == LINE_SKIPPED) &&
+	     !job->Pipeline->aborted)
+	pthread_cond_wait(&job->Pipeline->cond, &job->Pipeline->mutex);
+
+      state = job->Pipeline->aborted ? LINE_FREE : line->state;
+
+      pthread_mutex_unlock(&job->Pipeline->mutex);
+
+      if (state == LINE_FREE)
+	break;
+      else if (state == LINE_SKIPPED)
+	continue;
+
+      if (!line->blank)
+	SeparateLine(job, header, line->pixels, line->cmyk, line->input);
+
+      pthread_mutex_lock(&job->Pipeline->mutex);
+      line->state = LINE_SEPARATED;
+      pthread_cond_broadcast(&job->Pipeline->cond);
+      pthread_mutex_unlock(&job->Pipeline->mutex);
+    }
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'DitherThread()' - Dither color planes of lines in the pipeline.
+//
+// Dither thread N handles the planes N, N + num_dither, ... of every line.
+// Each plane has its own dither state which carries the error from line
+// to line, so the lines of a plane are always dithered in order.  Threads
+// without a plane on a page wait for the next one.
+//
+
+void *					// O - Thread exit status
+DitherThread(void *arg)			// I - Dither thread arguments
+{
+  cups_worker_t	*worker = (cups_worker_t *)arg;
+					// Dither thread arguments
+  escp_job_t	*job = worker->job;	// Job data
+  cups_page_header2_t *header;		// Page header
+  int		page = 0,		// Current page
+		y,			// Current line
+		first,			// First plane for this thread
+		plane,			// Current color plane
+		count,			// Number of planes dithered
+		state;			// Slot state
+  cups_line_t	*line;			// Line slot
+
+
+  first = worker->first;
+
+  while (PipelineWait(job, &page))
+  {
+    if (first >= job->Pipeline->num_dither)
+      continue;
+
+    header = job->Pipeline->header;
+
+    for (y = 0; y < (int)header->cupsHeight; y ++)
+    {
+      line = job->Pipeline->lines + y % PIPELINE_DEPTH;
+
+      pthread_mutex_lock(&job->Pipeline->mutex);
+
+      while ((line->y != y || line->state != LINE_SEPARATED) &&
+	     !(line->y == y && line->state == LINE_SKIPPED) &&
+	     !job->Pipeline->aborted)
+	pthread_cond_wait(&job->Pipeline->cond, &job->Pipeline->mutex);
+
+      state = job->Pipeline->aborted ? LINE_FREE : line->state;
+
+      pthread_mutex_unlock(&job->Pipeline->mutex);
+
+      if (state == LINE_FREE)
+	break;
+      else if (state == LINE_SKIPPED)
+	continue;
+
+      for (plane = first, count = 0;
+	   plane < job->PrinterPlanes;
+	   plane += job->Pipeline->num_dither, count ++)
+	DitherPlane(job, plane, line->y,
+		    line->blank ? NULL : line->input + plane,
+		    line->planes[plane]);
+
+      pthread_mutex_lock(&job->Pipeline->mutex);
+      line->dithered += count;
+      pthread_cond_broadcast(&job->Pipeline->cond);
+      pthread_mutex_unlock(&job->Pipeline->mutex);
+    }
+  }
+
+  return (NULL);
+}
+#endif // HAVE_PTHREAD_H
+
+
+//
+// 'RasterToESCPX()' - Filter function to print a raster job.
+//
+// All job state lives in a private escp_job_t, so several jobs may be
+// printed at once in the same process.
+//
+
+int					// O - Exit status
+RasterToESCPX(int              inputfd,	// I - File descriptor in
+              int              outputfd,	// I - File descriptor out
+	      int              inputseekable,
+					// I - Is input seekable? (unused)
+	      cf_filter_data_t *data,	// I - Job and printer data
+	      void             *parameters)
+					// I - Filter parameters (unused)
+{
+  escp_job_t		*job;		// Job data
+  ppd_filter_data_ext_t	*ext;		// PPD data from the filter chain
+  cf_filter_iscanceledfunc_t iscanceled = data->iscanceledfunc;
+					// Function returning 1 when job
+					// is canceled
+  void			*icd = data->iscanceleddata;
+					// Data for iscanceled()
+  int			empty = 1;	// Is the input empty?
+  int			status = 0;	// Exit status
+  cups_raster_t		*ras;		// Raster stream for printing
+  cups_page_header2_t	header;		// Page header from file
+  int			page;		// Current page
+  int			y;		// Current line
+  ppd_file_t		*ppd;		// PPD file
+  ppd_attr_t		*attr;		// Attribute from PPD file
+  const char		*val;		// Environment variable value
+  int			prefetch_size;	// Kilobytes to read ahead
+  raster_prefetch_t	*prefetch = NULL;
+					// Raster data read ahead, if any
+#ifdef HAVE_PTHREAD_H
+  int			threaded;	// Use the pipeline for the page?
+#endif // HAVE_PTHREAD_H
+
+
+  (void)inputseekable;
+  (void)parameters;
+
+  //
+  // Allocate the job data...
+  //
+
+  if ((job = calloc(1, sizeof(escp_job_t))) == NULL)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR,
+		    "rastertoescpx: Unable to allocate job data.");
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  job->logfunc    = data->logfunc;
+  job->ld         = data->logdata;
+  job->iscanceled = iscanceled;
+  job->icd        = icd;
+
+  //
+  // Get the PPD file, it has already been loaded and marked by the
+  // caller...
+  //
+
+  ext = (ppd_filter_data_ext_t *)cfFilterDataGetExt(data,
+						     PPD_FILTER_DATA_EXT);
+
+  if (!ext || !ext->ppd)
+  {
+    JobLog(job, CF_LOGLEVEL_ERROR, "The PPD file could not be opened.");
+    free(job);
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  ppd = ext->ppd;
+
+  //
+  // See how many threads to use for the raster pipeline; the environment
+  // overrides the PPD file...
+  //
+
+  if ((val = getenv("RASTERTOESCPX_THREADS")) != NULL)
+    job->Threads = atoi(val);
+  else if ((attr = ppdFindAttr(ppd, "cupsESCPThreads", NULL)) != NULL &&
+           attr->value)
+    job->Threads = atoi(attr->value);
   else
-    fd = 0;
+    job->Threads = 0;
 
-  ras = cupsRasterOpen(fd, CUPS_RASTER_READ);
+  //
+  // See whether blank margins may be trimmed from bands; some printers do
+  // not handle the horizontal positioning well...
+  //
+
+  if ((val = getenv("RASTERTOESCPX_TRIM")) != NULL)
+    job->Trim = atoi(val) != 0;
+  else if ((attr = ppdFindAttr(ppd, "cupsESCPTrim", NULL)) != NULL &&
+           attr->value)
+    job->Trim = !strcasecmp(attr->value, "true");
+  else
+    job->Trim = 1;
+
+  //
+  // A threshold matrix ("ordered" or "bluenoise") in the environment is
+  // used for all pages; otherwise the PPD file may choose one for each
+  // color model, media type and resolution...
+  //
+
+  job->DitherMode = getenv("RASTERTOESCPX_DITHER");
 
   //
-  // Register a signal handler to eject the current page if the
-  // job is cancelled.
+  // Collect per-stage timing statistics if requested...
   //
 
-  Canceled = 0;
+  job->Stats = raster_stats_new("rastertoescpx",
+				getenv("RASTERTOESCPX_STATS"), job->logfunc,
+				job->ld);
 
-#ifdef HAVE_SIGSET // Use System V signals over POSIX to avoid bugs
-  sigset(SIGTERM, CancelJob);
-#elif defined(HAVE_SIGACTION)
-  memset(&action, 0, sizeof(action));
+#ifndef HAVE_PTHREAD_H
+  if (job->Threads > 1)
+    JobLog(job, CF_LOGLEVEL_DEBUG,
+	   "Threaded pipeline not supported, using a single thread.");
+#endif // !HAVE_PTHREAD_H
 
-  sigemptyset(&action.sa_mask);
-  action.sa_handler = CancelJob;
-  sigaction(SIGTERM, &action, NULL);
-#else
-  signal(SIGTERM, CancelJob);
-#endif // HAVE_SIGSET
+  //
+  // See how many kilobytes of raster data may be read ahead by a separate
+  // thread; the environment overrides the PPD file...
+  //
+
+  if ((val = getenv("RASTERTOESCPX_PREFETCH")) != NULL)
+    prefetch_size = atoi(val);
+  else if ((attr = ppdFindAttr(ppd, "cupsESCPPrefetch", NULL)) != NULL &&
+           attr->value)
+    prefetch_size = atoi(attr->value);
+  else
+    prefetch_size = 0;
+
+  //
+  // Open the page stream...
+  //
+
+  if (prefetch_size > 0 &&
+      (prefetch = raster_prefetch_new(inputfd,
+                                      (size_t)prefetch_size * 1024)) != NULL)
+    ras = cupsRasterOpenIO(raster_prefetch_read, prefetch, CUPS_RASTER_READ);
+#ifdef HAVE_PTHREAD_H
+  else if (job->Threads > 1)
+  {
+    job->InputFD = inputfd;
+    ras          = cupsRasterOpenIO(ReadRaster, job, CUPS_RASTER_READ);
+  }
+#endif // HAVE_PTHREAD_H
+  else
+    ras = cupsRasterOpen(inputfd, CUPS_RASTER_READ);
 
   //
   // Process pages as needed...
   //
 
-  page = 0;
+  page        = 0;
+  job->Output = raster_out_new(outputfd, RASTER_OUT_FLUSH, job->logfunc,
+                               job->ld);
 
-  while (cupsRasterReadHeader2(ras, &header))
+  if (job->Output)
+    raster_out_set_stats(job->Output, job->Stats);
+
+  while (job->Output && cupsRasterReadHeader2(ras, &header))
   {
     //
     // Write a status message with the page number and number of copies.
@@ -1872,19 +3179,36 @@ main(int  argc,				// I - Number of command-line arguments
       // Initialize the print device...
       //
 
-      Setup(ppd);
+      Setup(job, ppd);
       empty = 0;
     }
 
-    if (Canceled)
+    if (iscanceled && iscanceled(icd))
       break;
 
     page ++;
 
-    fprintf(stderr, "PAGE: %d 1\n", page);
-    fprintf(stderr, "INFO: Starting page %d.\n", page);
+    JobLog(job, CF_LOGLEVEL_CONTROL, "PAGE: %d 1", page);
+    JobLog(job, CF_LOGLEVEL_INFO, "Starting page %d.", page);
 
-    StartPage(ppd, &header);
+    if (!StartPage(job, ppd, &header))
+    {
+      status = 1;
+      break;
+    }
+
+#ifdef HAVE_PTHREAD_H
+    if (page == 1 && job->Threads > 1 && !StartPipeline(job, ras))
+      JobLog(job, CF_LOGLEVEL_DEBUG,
+	     "Unable to start pipeline, using a single thread.");
+
+    threaded = job->Pipeline && PipelinePage(job, &header);
+
+    if (job->Pipeline && !threaded)
+      JobLog(job, CF_LOGLEVEL_DEBUG,
+	     "Unable to allocate pipeline buffers, using a single thread "
+	     "for page %d.", page);
+#endif // HAVE_PTHREAD_H
 
     for (y = 0; y < header.cupsHeight; y ++)
     {
@@ -1892,53 +3216,115 @@ main(int  argc,				// I - Number of command-line arguments
       // Let the user know how far we have progressed...
       //
 
-      if (Canceled)
+      if (iscanceled && iscanceled(icd))
 	break;
 
       if ((y & 127) == 0)
       {
-        fprintf(stderr, "INFO: Printing page %d, %d%% complete.\n",
-		page, 100 * y / header.cupsHeight);
-        fprintf(stderr, "ATTR: job-media-progress=%d\n",
-		100 * y / header.cupsHeight);
+        JobLog(job, CF_LOGLEVEL_INFO, "Printing page %d, %d%% complete.",
+	       page, 100 * y / header.cupsHeight);
+        JobLog(job, CF_LOGLEVEL_CONTROL, "ATTR: job-media-progress=%d",
+	       100 * y / header.cupsHeight);
       }
 
       //
       // Read and write a line of graphics or whitespace...
       //
 
-      ProcessLine(ppd, ras, &header, y);
+#ifdef HAVE_PTHREAD_H
+      if (threaded)
+      {
+        if (!PipelineLine(job, ppd, &header, y))
+	  break;
+      }
+      else
+#endif // HAVE_PTHREAD_H
+      ProcessLine(job, ppd, ras, &header, y);
+    }
+
+#ifdef HAVE_PTHREAD_H
+    if (y < header.cupsHeight)
+    {
+      //
+      // The job was canceled in the middle of the page; stop the pipeline
+      // before ejecting the page, the reader thread may still be waiting
+      // for raster data...
+      //
+
+      raster_prefetch_stop(prefetch);
+      StopPipeline(job);
     }
+#endif // HAVE_PTHREAD_H
 
     //
     // Eject the page...
     //
 
-    fprintf(stderr, "INFO: Finished page %d.\n", page);
+    JobLog(job, CF_LOGLEVEL_INFO, "Finished page %d.", page);
+
+    EndPage(job, ppd, &header);
 
-    EndPage(ppd, &header);
+    raster_stats_page(job->Stats);
 
-    if (Canceled)
+    if (iscanceled && iscanceled(icd))
       break;
   }
 
+#ifdef HAVE_PTHREAD_H
+  StopPipeline(job);
+#endif // HAVE_PTHREAD_H
+
   if (!empty)
-    Shutdown(ppd);
+    Shutdown(job, ppd);
+
+  if (!job->Output || raster_out_flush(job->Output))
+    status = 1;
 
-  cupsFreeOptions(num_options, options);
+  raster_out_delete(job->Output);
+  raster_stats_delete(job->Stats);
+
+  FreeProfiles(job);
+  FreeBands(job);
 
   cupsRasterClose(ras);
+  raster_prefetch_delete(prefetch);
+  close(inputfd);
+  close(outputfd);
 
-  if (fd != 0)
-    close(fd);
-  
-  if (DotBuffers[0] != NULL)
-    free(DotBuffers[0]);
+  if (job->DotBuffers[0] != NULL)
+    free(job->DotBuffers[0]);
 
-  if (empty)
-  {
-    fprintf(stderr, "DEBUG: Input is empty, outputting empty file.\n");
-    return 0;
-  }
-  return (page == 0);
+  if (empty && !status)
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Input is empty, outputting empty file.");
+  else if (page == 0)
+    status = 1;
+
+  free(job);
+
+  return (status);
+}
+
+
+//
+// 'main()' - Main entry and processing of driver.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int	ret;				// Exit status
+
+
+  //
+  // Fire up the RasterToESCPX() filter function; the wrapper parses the
+  // command line, loads and marks the PPD file and handles SIGTERM...
+  //
+
+  ret = ppdFilterCUPSWrapper(argc, argv, RasterToESCPX, NULL, &JobCanceled);
+
+  if (ret)
+    fprintf(stderr, "ERROR: rastertoescpx filter function failed.\n");
+
+  return (ret);
 }
@@ -10,14 +10,36 @@
 //
 // Contents:
 //
-//   StartPage()    - Start a page of graphics.
-//   EndPage()      - Finish a page of graphics.
-//   Shutdown()     - Shutdown a printer.
-//   CancelJob()    - Cancel the current job...
-//   CompressData() - Compress a line of graphics.
-//   OutputLine()   - Output the specified number of lines of graphics.
-//   ReadLine()     - Read graphics from the page stream.
-//   main()         - Main entry and processing of driver.
+//   JobLog()           - Log a message for the job.
+//   CompilePJL()       - Compile the PJL commands for the job.
+//   FreePJL()          - Free the PJL commands at the end of the job.
+//   StartPage()        - Start a page of graphics.
+//   GetProfile()       - Get the color profile for a page, loading it as
+//                        needed.
+//   FreeProfile()      - Free the separations and tables of a color profile.
+//   FreeProfiles()     - Free all cached color profiles at the end of the job.
+//   EndPage()          - Finish a page of graphics.
+//   Shutdown()         - Shutdown a printer.
+//   CompressAdaptive() - Compress a line with the smallest of several
+//                        methods.
+//   CompressData()     - Compress a line of graphics.
+//   TrimLine()         - Narrow the raster to the inked columns of a line.
+//   OutputLine()       - Output the specified number of lines of graphics.
+//   ReadLine()         - Read graphics from the page stream.
+//   ReadPage()         - Read a whole page into memory.
+//   ReplayPage()       - Send the graphics of a cached page again.
+//   CachePage()        - Keep the graphics of a page for identical pages.
+//   FreeCache()        - Free the page cache at the end of the job.
+//   StartPages()       - Start the threads that render pages.
+//   QueuePage()        - Read a page and queue it for the page threads.
+//   RenderPage()       - Render a page that has been read ahead.
+//   RetryPage()        - Render a page whose output did not fit in its slot
+//                        straight to the printer.
+//   PageThread()       - Render queued pages.
+//   WritePages()       - Send rendered pages to the printer in page order.
+//   FinishPages()      - Send the remaining pages and stop the page threads.
+//   RasterToPCLX()     - Filter function to print a raster job.
+//   main()             - Main entry and processing of driver.
 //
 
 //
@@ -25,12 +47,17 @@
 //
 
 #include "pcl-common.h"
+#include "raster-common.h"
 #include <cupsfilters/colormanager.h>
 #include <cupsfilters/driver.h>
 #include <cupsfilters/filter.h>
 #include <ppd/ppd.h>
 #include <ppd/ppd-filter.h>
-#include <signal.h>
+#include <config.h>
+#include <stdarg.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif // HAVE_PTHREAD_H
 
 //
 // Output modes...
@@ -46,29 +73,237 @@ typedef enum
 
 
 //
-// Globals...
+// Compression types besides the PCL compression modes...
+//
+
+#define COMPRESS_ADAPTIVE	-1	// Choose the mode for each row
+#define COMPRESS_SWITCH		5	// Bytes needed to change the mode
+
+
+//
+// Unused bytes per row to accept before the raster is narrowed again, or
+// to add when it is widened...
+//
+
+#define TRIM_SLACK		16
+
+
+//
+// PJL commands...
+//
+// The cupsPJL attributes of the PPD file and the built-in PJL commands
+// are compiled once per job; only their "value" is filled in when they
+// are written.
+//
+
+enum
+{
+  PJL_CMD_JOB,				// @PJL JOB
+  PJL_CMD_START_JOB,			// cupsPJL StartJob
+  PJL_CMD_RENDERMODE,			// @PJL SET RENDERMODE
+  PJL_CMD_COLORSPACE,			// @PJL SET COLORSPACE
+  PJL_CMD_RENDERINTENT,			// @PJL SET RENDERINTENT
+  PJL_CMD_DUPLEX,			// cupsPJL Duplex
+  PJL_CMD_TUMBLE,			// cupsPJL Tumble
+  PJL_CMD_MEDIA_CLASS,			// cupsPJL MediaClass
+  PJL_CMD_MEDIA_COLOR,			// cupsPJL MediaColor
+  PJL_CMD_MEDIA_TYPE,			// cupsPJL MediaType
+  PJL_CMD_OUTPUT_TYPE,			// cupsPJL OutputType
+  PJL_CMD_BOOKLET,			// cupsPJL cupsBooklet
+  PJL_CMD_JOG,				// cupsPJL Jog
+  PJL_CMD_PUNCH,			// cupsPJL cupsPunch
+  PJL_CMD_STAPLE,			// cupsPJL cupsStaple
+  PJL_CMD_RET,				// cupsPJL cupsRET
+  PJL_CMD_TONER_SAVE,			// cupsPJL cupsTonerSave
+  PJL_CMD_PAPERLENGTH,			// @PJL SET PAPERLENGTH
+  PJL_CMD_PAPERWIDTH,			// @PJL SET PAPERWIDTH
+  PJL_CMD_RESOLUTION,			// @PJL SET RESOLUTION
+  PJL_CMD_ENTER_LANGUAGE,		// @PJL ENTER LANGUAGE
+  PJL_CMD_END_JOB,			// cupsPJL EndJob or @PJL EOJ
+  PJL_CMD_MAX
+};
+
+typedef struct pcl_pjl_str		// PJL command
+{
+  const char	*keyword,		// cupsPJL keyword or NULL
+		*format;		// Built-in command or NULL
+} pcl_pjl_t;
+
+
+//
+// Color profile cache data...
+//
+
+#define PROFILE_MAX	4			// Maximum cached color profiles
+
+typedef struct cups_profile_str
+{
+  cups_cspace_t		cspace;			// Color space
+  char			media_type[64],		// Media type
+			resolution[PPD_MAX_NAME];
+						// Resolution
+  cf_rgb_t		*rgb;			// RGB color separation data
+  cf_cmyk_t		*cmyk;			// CMYK color separation data
+  cf_lut_t		*luts[6];		// Lookup tables for dithering
+  raster_dither_t	*dither;		// Threshold matrix or NULL for
+						// error diffusion
+  unsigned short	*levels[6];		// Threshold dither levels
+  int			use;			// Last use of profile
+} cups_profile_t;
+
+
+//
+// Page cache data...
+//
+// Copies that the printer does not make itself and forms send the same
+// page again and again.  The compressed graphics of recent pages are kept
+// with a hash of their raster, so that identical pages are sent without
+// rendering them again.
+//
+
+#define CACHE_MAX	256			// Maximum cached pages
+
+typedef struct pcl_cached_str
+{
+  cups_page_header2_t	header;			// Page header
+  unsigned long long	hash[2];		// Hash of page raster
+  unsigned char		*data;			// Compressed graphics
+  size_t		size;			// Size of compressed graphics
+  int			use;			// Last use of page
+} pcl_cached_t;
+
+typedef struct pcl_cache_str
+{
+  size_t		max_size,		// Maximum size of graphics
+			size;			// Size of cached graphics
+  int			num_pages,		// Number of cached pages
+			use;			// Page use counter
+  pcl_cached_t		pages[CACHE_MAX];	// Cached pages
+} pcl_cache_t;
+
+
+//
+// Job data...
+//
+// Everything the driver needs while printing a job lives in this
+// structure, so several jobs can be run at the same time in one process
+// through the RasterToPCLX() filter function.
 //
 
-cf_rgb_t	*RGB;			// RGB color separation data
-cf_cmyk_t	*CMYK;			// CMYK color separation data
-unsigned char	*PixelBuffer,		// Pixel buffer
+typedef struct pcl_job_str
+{
+  cf_rgb_t	*RGB;			// RGB color separation data
+  cf_cmyk_t	*CMYK;			// CMYK color separation data
+  unsigned char	*PixelBuffer,		// Pixel buffer
+		*PageLines,		// Page raster read ahead, if any
 		*CMYKBuffer,		// CMYK buffer
 		*OutputBuffers[6],	// Output buffers
 		*DotBuffers[6],		// Bit buffers
 		*CompBuffer,		// Compression buffer
-		*SeedBuffer,		// Mode 3 seed buffers
+		*SeedBuffer,		// Mode 3 and 9 seed buffers
 		BlankValue;		// The blank value
-short		*InputBuffer;		// Color separation buffer
-cf_lut_t	*DitherLuts[6];		// Lookup tables for dithering
-cf_dither_t	*DitherStates[6];	// Dither state tables
-int		PrinterPlanes,		// Number of color planes
+  short		*InputBuffer;		// Color separation buffer
+  cf_lut_t	*DitherLuts[6];		// Lookup tables for dithering
+  cf_dither_t	*DitherStates[6];	// Dither state tables
+  raster_dither_t *DitherMatrix;	// Threshold matrix, if any
+  unsigned short *DitherLevels[6];	// Threshold levels for dithering
+  const char	*DitherMode;		// Threshold matrix from the
+					// environment
+  int		PrinterPlanes,		// Number of color planes
 		SeedInvalid,		// Contents of seed buffer invalid?
+		Invert,			// Invert lines as they are read?
+		Adaptive,		// Choose compression for each row?
+		Compression,		// Compression type for the page
+		CompMode,		// Current compression mode
 		DotBits[6],		// Number of bits per color
 		DotBufferSizes[6],	// Size of one row of color dots
 		DotBufferSize,		// Size of complete line
 		OutputFeed,		// Number of lines to skip
-		Page;			// Current page number
-pcl_output_t	OutputMode;		// Output mode - see OUTPUT_ consts
+		PageLine,		// Next line of PageLines
+		Line,			// Next line to dither
+		Page,			// Current page number
+		Threads,		// Number of page threads
+		BufferSize,		// Megabytes the page threads may
+					// buffer
+		Trim,			// Trim blank margins of lines?
+		TrimPage,		// Trim lines on this page?
+		TrimStart,		// Next line starts a new band?
+		TrimLeft,		// First byte sent in each row
+		TrimRight;		// Last byte + 1 sent in each row
+  pcl_output_t	OutputMode;		// Output mode - see OUTPUT_ consts
+  raster_out_t	*Output;		// Buffered printer output
+  raster_stats_t *Stats;		// Stage statistics, if any
+  pcl_cache_t	*Cache;			// Page cache, if any
+  cups_profile_t Profiles[PROFILE_MAX];	// Cached color profiles
+  int		NumProfiles,		// Number of cached color profiles
+		ProfileUse;		// Profile use counter
+  pjl_template_t *PJL[PJL_CMD_MAX];	// Compiled PJL commands
+  cf_logfunc_t	logfunc;		// Log function
+  void		*ld;			// Log function data
+} pcl_job_t;
+
+
+#ifdef HAVE_PTHREAD_H
+//
+// Page thread data...
+//
+// With page threads the main thread reads each page into memory and sets
+// it up with StartPage(), since the PPD functions are not thread-safe.
+// The page threads do the color separation, dithering and compression
+// into per-page output buffers, which are sent to the printer in page
+// order.
+//
+
+#define PAGE_THREADS_MAX	16	// Maximum number of page threads
+
+enum
+{
+  PAGE_FREE,				// Slot is unused
+  PAGE_READY,				// Page is waiting for a thread
+  PAGE_BUSY,				// Page is being rendered
+  PAGE_DONE				// Page output is ready to send
+};
+
+typedef struct pcl_page_str		// Page slot
+{
+  pcl_job_t		*job;		// Job data for the page
+  cups_page_header2_t	header;		// Page header
+  unsigned char		*lines;		// Raster data for the page
+  size_t		size;		// Size of raster data buffer
+  unsigned long long	hash[2];	// Hash of raster data, if cached
+  int			height,		// Number of lines read
+			state,		// Slot state
+			overflow;	// Output did not fit in the slot?
+} pcl_page_t;
+
+typedef struct pcl_pool_str		// Page threads
+{
+  pthread_mutex_t	mutex;		// Mutex for page slots
+  pthread_cond_t	cond;		// Page slot state changes
+  cf_filter_data_t	*data;		// Filter data
+  ppd_file_t		*ppd;		// PPD file
+  pcl_cache_t		*cache;		// Page cache, if any
+  size_t		slot_size;	// Bytes of raster and output per
+					// page slot
+  cf_filter_iscanceledfunc_t iscanceled;// Function returning 1 when job
+					// is canceled
+  void			*icd;		// Data for iscanceled()
+  int			aborted,	// Stop the threads?
+			num_pages,	// Number of page slots and threads
+			num_started,	// Number of threads started
+			written;	// Next page to send
+  pthread_t		threads[PAGE_THREADS_MAX];
+					// Page threads
+  pcl_page_t		pages[PAGE_THREADS_MAX];
+					// Page slots
+} pcl_pool_t;
+#endif // HAVE_PTHREAD_H
+
+
+//
+// Globals...
+//
+
 const int	ColorOrders[7][7] =	// Order of color planes
 		{
 		  { 0, 0, 0, 0, 0, 0, 0 },	// Black
@@ -79,27 +314,167 @@ const int	ColorOrders[7][7] =	// Order of color planes
 		  { 5, 0, 1, 2, 3, 4, 0 },	// KCMYcm
 		  { 5, 0, 1, 2, 3, 4, 6 }	// KCMYcmk
 		};
-int		Canceled;		// Is the job canceled?
-cf_logfunc_t logfunc;               // Log function
-void            *ld;                    // Log function data
+const pcl_pjl_t	PJLCommands[PJL_CMD_MAX] =
+		{			// PJL commands by PJL_CMD_ value
+		  { NULL, "@PJL JOB NAME = \"%t\" DISPLAY = \"%j %u %t\"%n" },
+		  { "StartJob", NULL },
+		  { NULL, "@PJL SET RENDERMODE=%s%n" },
+		  { NULL, "@PJL SET COLORSPACE=%s%n" },
+		  { NULL, "@PJL SET RENDERINTENT=%s%n" },
+		  { "Duplex", NULL },
+		  { "Tumble", NULL },
+		  { "MediaClass", NULL },
+		  { "MediaColor", NULL },
+		  { "MediaType", NULL },
+		  { "OutputType", NULL },
+		  { "cupsBooklet", NULL },
+		  { "Jog", NULL },
+		  { "cupsPunch", NULL },
+		  { "cupsStaple", NULL },
+		  { "cupsRET", NULL },
+		  { "cupsTonerSave", NULL },
+		  { NULL, "@PJL SET PAPERLENGTH=%s%n" },
+		  { NULL, "@PJL SET PAPERWIDTH=%s%n" },
+		  { NULL, "@PJL SET RESOLUTION=%s%n" },
+		  { NULL, "@PJL ENTER LANGUAGE=%s%n" },
+		  { "EndJob", "@PJL EOJ%n" }
+		};
+static int	JobCanceled = 0;	// Set to 1 on SIGTERM
 
 
 //
 // Prototypes...
 //
 
-void	StartPage(cf_filter_data_t *data, ppd_file_t *ppd, cups_page_header2_t *header, int job_id,
-	          const char *user, const char *title, int num_options,
-		  cups_option_t *options);
-void	EndPage(ppd_file_t *ppd, cups_page_header2_t *header);
-void	Shutdown(ppd_file_t *ppd, int job_id, const char *user,
-	         const char *title, int num_options, cups_option_t *options);
+int	RasterToPCLX(int inputfd, int outputfd, int inputseekable,
+		     cf_filter_data_t *data, void *parameters);
+
+void	JobLog(pcl_job_t *job, cf_loglevel_t level, const char *message,
+	       ...) RASTER_FORMAT(3,4);
+void	CompilePJL(pcl_job_t *job, cf_filter_data_t *data, ppd_file_t *ppd);
+void	FreePJL(pcl_job_t *job);
+void	StartPage(pcl_job_t *job, cf_filter_data_t *data, ppd_file_t *ppd,
+		  cups_page_header2_t *header, int job_id, const char *user,
+		  const char *title, int num_options, cups_option_t *options);
+void	EndPage(pcl_job_t *job, ppd_file_t *ppd, cups_page_header2_t *header);
+cups_profile_t *GetProfile(pcl_job_t *job, cf_filter_data_t *data,
+			   ppd_file_t *ppd, cups_page_header2_t *header,
+			   const char *colormodel, const char *resolution);
+void	FreeProfile(cups_profile_t *profile);
+void	FreeProfiles(pcl_job_t *job);
+void	Shutdown(pcl_job_t *job, ppd_file_t *ppd);
+
+unsigned char *CompressAdaptive(pcl_job_t *job, unsigned char *line,
+			       int length, int plane, int *bytes);
+void	CompressData(pcl_job_t *job, unsigned char *line, int length,
+		     int plane, int pend, int type);
+void	TrimLine(pcl_job_t *job, ppd_file_t *ppd,
+		 cups_page_header2_t *header, const unsigned char *buffer,
+		 int rows, int bytes, int *left, int *length);
+void	OutputLine(pcl_job_t *job, ppd_file_t *ppd,
+		   cups_page_header2_t *header);
+int	ReadLine(pcl_job_t *job, cups_raster_t *ras,
+		 cups_page_header2_t *header);
+int	ReadPage(pcl_job_t *job, cups_raster_t *ras,
+		 cups_page_header2_t *header, unsigned char **lines,
+		 size_t *size);
+int	ReplayPage(pcl_cache_t *cache, cups_page_header2_t *header,
+		   const unsigned long long *hash, raster_out_t *out);
+void	CachePage(pcl_cache_t *cache, cups_page_header2_t *header,
+		  const unsigned long long *hash, raster_out_t *body);
+void	FreeCache(pcl_cache_t *cache);
+
+#ifdef HAVE_PTHREAD_H
+pcl_pool_t *StartPages(pcl_job_t *job, cf_filter_data_t *data,
+		       ppd_file_t *ppd);
+void	QueuePage(pcl_job_t *job, pcl_pool_t *pool, cf_filter_data_t *data,
+		  ppd_file_t *ppd, cups_page_header2_t *header,
+		  cups_raster_t *ras);
+void	RenderPage(pcl_pool_t *pool, pcl_page_t *page);
+void	RetryPage(pcl_job_t *job, pcl_pool_t *pool, pcl_page_t *page);
+void	*PageThread(void *arg);
+void	WritePages(pcl_job_t *job, pcl_pool_t *pool, int last);
+void	FinishPages(pcl_job_t *job, pcl_pool_t *pool);
+#endif // HAVE_PTHREAD_H
+
+
+//
+// 'JobLog()' - Log a message for the job.
+//
+
+void
+JobLog(pcl_job_t     *job,		// I - Job data
+       cf_loglevel_t level,		// I - Log level
+       const char    *message,		// I - Printf-style message
+       ...)				// I - Additional arguments
+{
+  va_list	ap;			// Argument pointer
+  char		buffer[1024];		// Formatted message
+
+
+  if (!job->logfunc)
+    return;
+
+  va_start(ap, message);
+  vsnprintf(buffer, sizeof(buffer), message, ap);
+  va_end(ap);
+
+  job->logfunc(job->ld, level, "%s", buffer);
+}
+
+
+//
+// 'CompilePJL()' - Compile the PJL commands for the job.
+//
+// A cupsPJL attribute in the PPD file takes the place of the built-in
+// command; commands the printer does not get stay NULL.
+//
+
+void
+CompilePJL(pcl_job_t        *job,	// I - Job data
+           cf_filter_data_t *data,	// I - Filter data
+           ppd_file_t       *ppd)	// I - PPD file
+{
+  int		i;			// Looping var
+  ppd_attr_t	*attr;			// Attribute from PPD file
+  const char	*format;		// Command string
+
+
+  if (ppd && !(ppd->model_number & PCL_PJL))
+    return;
+
+  for (i = 0; i < PJL_CMD_MAX; i ++)
+  {
+    if (ppd && PJLCommands[i].keyword &&
+        (attr = ppdFindAttr(ppd, "cupsPJL",
+	                    PJLCommands[i].keyword)) != NULL)
+      format = attr->value;
+    else
+      format = PJLCommands[i].format;
+
+    job->PJL[i] = pjl_compile(format, data->job_id, data->job_user,
+                              data->job_title, data->num_options,
+			      data->options);
+  }
+}
+
+
+//
+// 'FreePJL()' - Free the PJL commands at the end of the job.
+//
+
+void
+FreePJL(pcl_job_t *job)			// I - Job data
+{
+  int	i;				// Looping var
 
-void	CancelJob(int sig);
-void	CompressData(unsigned char *line, int length, int plane, int pend,
-	             int type);
-void	OutputLine(ppd_file_t *ppd, cups_page_header2_t *header);
-int	ReadLine(cups_raster_t *ras, cups_page_header2_t *header);
+
+  for (i = 0; i < PJL_CMD_MAX; i ++)
+  {
+    pjl_free(job->PJL[i]);
+    job->PJL[i] = NULL;
+  }
+}
 
 
 //
@@ -107,20 +482,21 @@ int	ReadLine(cups_raster_t *ras, cups_page_header2_t *header);
 //
 
 void
-StartPage(cf_filter_data_t      *data,	// I - filter data
-	  ppd_file_t         *ppd,	// I - PPD file
+StartPage(pcl_job_t           *job,	// I - Job data
+          cf_filter_data_t    *data,	// I - filter data
+          ppd_file_t          *ppd,	// I - PPD file
           cups_page_header2_t *header,	// I - Page header
-	  int                job_id,	// I - Job ID
-	  const char         *user,	// I - User printing job
-	  const char         *title,	// I - Title of job
-	  int                num_options,
+          int                 job_id,	// I - Job ID
+          const char          *user,	// I - User printing job
+          const char          *title,	// I - Title of job
+          int                 num_options,
 					// I - Number of command-line options
-	  cups_option_t      *options)	// I - Command-line options
+          cups_option_t       *options)	// I - Command-line options
 {
   int		i;			// Temporary/looping var
   int		plane;			// Current plane
-  int		cm_disabled;	// Device Color Inhibited
   char		s[255];			// Temporary value
+  char		*jcl;			// JCL commands from PPD
   const char	*colormodel;		// Color model string
   char		resolution[PPD_MAX_NAME],
 					// Resolution string
@@ -130,60 +506,60 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
   const int	*order;			// Order to use
   int		xorigin,		// X origin of page
 		yorigin;		// Y origin of page
-  static const float default_lut[2] =	// Default dithering lookup table
-		{
-		  0.0,
-		  1.0
-		};
-  cf_cm_calibration_t cm_calibrate;	// Color calibration mode
+  cups_profile_t *profile;		// Color profile for page
 
   //
   // Debug info...
   //
 
-  fprintf(stderr, "DEBUG: StartPage...\n");
-  fprintf(stderr, "DEBUG: MediaClass = \"%s\"\n", header->MediaClass);
-  fprintf(stderr, "DEBUG: MediaColor = \"%s\"\n", header->MediaColor);
-  fprintf(stderr, "DEBUG: MediaType = \"%s\"\n", header->MediaType);
-  fprintf(stderr, "DEBUG: OutputType = \"%s\"\n", header->OutputType);
-
-  fprintf(stderr, "DEBUG: AdvanceDistance = %d\n", header->AdvanceDistance);
-  fprintf(stderr, "DEBUG: AdvanceMedia = %d\n", header->AdvanceMedia);
-  fprintf(stderr, "DEBUG: Collate = %d\n", header->Collate);
-  fprintf(stderr, "DEBUG: CutMedia = %d\n", header->CutMedia);
-  fprintf(stderr, "DEBUG: Duplex = %d\n", header->Duplex);
-  fprintf(stderr, "DEBUG: HWResolution = [ %d %d ]\n", header->HWResolution[0],
-          header->HWResolution[1]);
-  fprintf(stderr, "DEBUG: ImagingBoundingBox = [ %d %d %d %d ]\n",
-          header->ImagingBoundingBox[0], header->ImagingBoundingBox[1],
-          header->ImagingBoundingBox[2], header->ImagingBoundingBox[3]);
-  fprintf(stderr, "DEBUG: InsertSheet = %d\n", header->InsertSheet);
-  fprintf(stderr, "DEBUG: Jog = %d\n", header->Jog);
-  fprintf(stderr, "DEBUG: LeadingEdge = %d\n", header->LeadingEdge);
-  fprintf(stderr, "DEBUG: Margins = [ %d %d ]\n", header->Margins[0],
-          header->Margins[1]);
-  fprintf(stderr, "DEBUG: ManualFeed = %d\n", header->ManualFeed);
-  fprintf(stderr, "DEBUG: MediaPosition = %d\n", header->MediaPosition);
-  fprintf(stderr, "DEBUG: MediaWeight = %d\n", header->MediaWeight);
-  fprintf(stderr, "DEBUG: MirrorPrint = %d\n", header->MirrorPrint);
-  fprintf(stderr, "DEBUG: NegativePrint = %d\n", header->NegativePrint);
-  fprintf(stderr, "DEBUG: NumCopies = %d\n", header->NumCopies);
-  fprintf(stderr, "DEBUG: Orientation = %d\n", header->Orientation);
-  fprintf(stderr, "DEBUG: OutputFaceUp = %d\n", header->OutputFaceUp);
-  fprintf(stderr, "DEBUG: PageSize = [ %d %d ]\n", header->PageSize[0],
-          header->PageSize[1]);
-  fprintf(stderr, "DEBUG: Separations = %d\n", header->Separations);
-  fprintf(stderr, "DEBUG: TraySwitch = %d\n", header->TraySwitch);
-  fprintf(stderr, "DEBUG: Tumble = %d\n", header->Tumble);
-  fprintf(stderr, "DEBUG: cupsWidth = %d\n", header->cupsWidth);
-  fprintf(stderr, "DEBUG: cupsHeight = %d\n", header->cupsHeight);
-  fprintf(stderr, "DEBUG: cupsMediaType = %d\n", header->cupsMediaType);
-  fprintf(stderr, "DEBUG: cupsBitsPerColor = %d\n", header->cupsBitsPerColor);
-  fprintf(stderr, "DEBUG: cupsBitsPerPixel = %d\n", header->cupsBitsPerPixel);
-  fprintf(stderr, "DEBUG: cupsBytesPerLine = %d\n", header->cupsBytesPerLine);
-  fprintf(stderr, "DEBUG: cupsColorOrder = %d\n", header->cupsColorOrder);
-  fprintf(stderr, "DEBUG: cupsColorSpace = %d\n", header->cupsColorSpace);
-  fprintf(stderr, "DEBUG: cupsCompression = %d\n", header->cupsCompression);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "StartPage...");
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaClass = \"%s\"", header->MediaClass);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaColor = \"%s\"", header->MediaColor);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaType = \"%s\"", header->MediaType);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "OutputType = \"%s\"", header->OutputType);
+
+  JobLog(job, CF_LOGLEVEL_DEBUG, "AdvanceDistance = %d",
+	 header->AdvanceDistance);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "AdvanceMedia = %d", header->AdvanceMedia);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Collate = %d", header->Collate);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "CutMedia = %d", header->CutMedia);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Duplex = %d", header->Duplex);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "HWResolution = [ %d %d ]",
+         header->HWResolution[0], header->HWResolution[1]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "ImagingBoundingBox = [ %d %d %d %d ]",
+         header->ImagingBoundingBox[0], header->ImagingBoundingBox[1],
+         header->ImagingBoundingBox[2], header->ImagingBoundingBox[3]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "InsertSheet = %d", header->InsertSheet);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Jog = %d", header->Jog);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "LeadingEdge = %d", header->LeadingEdge);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Margins = [ %d %d ]", header->Margins[0],
+         header->Margins[1]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "ManualFeed = %d", header->ManualFeed);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaPosition = %d", header->MediaPosition);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaWeight = %d", header->MediaWeight);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MirrorPrint = %d", header->MirrorPrint);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "NegativePrint = %d", header->NegativePrint);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "NumCopies = %d", header->NumCopies);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Orientation = %d", header->Orientation);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "OutputFaceUp = %d", header->OutputFaceUp);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "PageSize = [ %d %d ]", header->PageSize[0],
+         header->PageSize[1]);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Separations = %d", header->Separations);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "TraySwitch = %d", header->TraySwitch);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Tumble = %d", header->Tumble);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsWidth = %d", header->cupsWidth);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsHeight = %d", header->cupsHeight);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsMediaType = %d", header->cupsMediaType);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsBitsPerColor = %d",
+	 header->cupsBitsPerColor);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsBitsPerPixel = %d",
+	 header->cupsBitsPerPixel);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsBytesPerLine = %d",
+	 header->cupsBytesPerLine);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsColorOrder = %d", header->cupsColorOrder);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsColorSpace = %d", header->cupsColorSpace);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "cupsCompression = %d",
+	 header->cupsCompression);
 
 #ifdef __APPLE__
   //
@@ -202,11 +578,11 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     header->Tumble = CUPS_TRUE;
   }
 
-  fprintf(stderr, "DEBUG: num_options=%d\n", num_options);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "num_options=%d", num_options);
 
   for (i = 0; i < num_options; i ++)
-    fprintf(stderr, "DEBUG: options[%d]=[\"%s\" \"%s\"]\n", i,
-            options[i].name, options[i].value);
+    JobLog(job, CF_LOGLEVEL_DEBUG, "options[%d]=[\"%s\" \"%s\"]", i,
+           options[i].name, options[i].value);
 #endif // __APPLE__
 
   //
@@ -233,8 +609,6 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
 	break;
   }  
 
-  cm_disabled = 0;
-
   if (header->HWResolution[0] != header->HWResolution[1])
     snprintf(resolution, sizeof(resolution), "%dx%ddpi",
              header->HWResolution[0], header->HWResolution[1]);
@@ -249,7 +623,7 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
   // Get the dithering parameters...
   //
 
-  BlankValue = 0x00;
+  job->BlankValue = 0x00;
 
   if (header->cupsBitsPerColor == 1)
   {
@@ -260,35 +634,35 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     switch (header->cupsColorSpace)
     {
       case CUPS_CSPACE_K :
-          OutputMode    = OUTPUT_BITMAP;
-	  PrinterPlanes = 1;
+          job->OutputMode    = OUTPUT_BITMAP;
+	  job->PrinterPlanes = 1;
 	  break;
       case CUPS_CSPACE_W :
-          OutputMode    = OUTPUT_INVERBIT;
-	  PrinterPlanes = 1;
+          job->OutputMode    = OUTPUT_INVERBIT;
+	  job->PrinterPlanes = 1;
 	  break;
       default :
       case CUPS_CSPACE_RGB :
-          OutputMode    = OUTPUT_INVERBIT;
-	  PrinterPlanes = 3;
+          job->OutputMode    = OUTPUT_INVERBIT;
+	  job->PrinterPlanes = 3;
 	  break;
       case CUPS_CSPACE_CMY :
-          OutputMode    = OUTPUT_BITMAP;
-	  PrinterPlanes = 3;
+          job->OutputMode    = OUTPUT_BITMAP;
+	  job->PrinterPlanes = 3;
 	  break;
       case CUPS_CSPACE_CMYK :
-          OutputMode    = OUTPUT_BITMAP;
-	  PrinterPlanes = 4;
+          job->OutputMode    = OUTPUT_BITMAP;
+	  job->PrinterPlanes = 4;
 	  break;
     }
 
-    if (OutputMode == OUTPUT_INVERBIT)
-      BlankValue = 0xff;
+    if (job->OutputMode == OUTPUT_INVERBIT)
+      job->BlankValue = 0xff;
 
-    DotBufferSize = header->cupsBytesPerLine;
+    job->DotBufferSize = header->cupsBytesPerLine;
 
-    memset(DitherLuts, 0, sizeof(DitherLuts));
-    memset(DitherStates, 0, sizeof(DitherStates));
+    memset(job->DitherLuts, 0, sizeof(job->DitherLuts));
+    memset(job->DitherStates, 0, sizeof(job->DitherStates));
   }
   else if (header->cupsColorSpace == CUPS_CSPACE_RGB &&
            (!ppd || (ppd->model_number & PCL_RASTER_RGB24)))
@@ -297,15 +671,15 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     // Use 24-bit RGB output mode...
     //
 
-    OutputMode    = OUTPUT_RGB;
-    PrinterPlanes = 3;
-    DotBufferSize = header->cupsBytesPerLine;
+    job->OutputMode    = OUTPUT_RGB;
+    job->PrinterPlanes = 3;
+    job->DotBufferSize = header->cupsBytesPerLine;
 
     if (header->cupsCompression == 10)
-      BlankValue = 0xff;
+      job->BlankValue = 0xff;
 
-    memset(DitherLuts, 0, sizeof(DitherLuts));
-    memset(DitherStates, 0, sizeof(DitherStates));
+    memset(job->DitherLuts, 0, sizeof(job->DitherLuts));
+    memset(job->DitherStates, 0, sizeof(job->DitherStates));
   }
   else if ((header->cupsColorSpace == CUPS_CSPACE_K ||
             header->cupsColorSpace == CUPS_CSPACE_W) &&
@@ -316,15 +690,15 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     // Use 24-bit RGB output mode for grayscale/black output...
     //
 
-    OutputMode    = OUTPUT_RGB;
-    PrinterPlanes = 1;
-    DotBufferSize = header->cupsBytesPerLine;
+    job->OutputMode    = OUTPUT_RGB;
+    job->PrinterPlanes = 1;
+    job->DotBufferSize = header->cupsBytesPerLine;
 
     if (header->cupsColorSpace == CUPS_CSPACE_W)
-      BlankValue = 0xff;
+      job->BlankValue = 0xff;
 
-    memset(DitherLuts, 0, sizeof(DitherLuts));
-    memset(DitherStates, 0, sizeof(DitherStates));
+    memset(job->DitherLuts, 0, sizeof(job->DitherLuts));
+    memset(job->DitherStates, 0, sizeof(job->DitherStates));
   }
   else
   {
@@ -332,127 +706,40 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     // Use dithered output mode...
     //
 
-    OutputMode = OUTPUT_DITHERED;
+    job->OutputMode = OUTPUT_DITHERED;
 
     //
-    // Load the appropriate color profiles...
+    // Get the color profile for the page, loading it as needed...
     //
 
-    RGB  = NULL;
-    CMYK = NULL;
-
-    fputs("DEBUG: Attempting to load color profiles using the following values:\n",
-	  stderr);
-    fprintf(stderr, "DEBUG: ColorModel = %s\n", colormodel);
-    fprintf(stderr, "DEBUG: MediaType = %s\n", header->MediaType);
-    fprintf(stderr, "DEBUG: Resolution = %s\n", resolution);
-
-    // support the "cm-calibration" option
-    cm_calibrate = cfCmGetCupsColorCalibrateMode(data);
-
-    if (cm_calibrate == CF_CM_CALIBRATION_ENABLED)
-      cm_disabled = 1;
-    else
-      cm_disabled = cfCmIsPrinterCmDisabled(data);
-
-    if (ppd && !cm_disabled)
-    {
-      if (header->cupsColorSpace == CUPS_CSPACE_RGB ||
-	  header->cupsColorSpace == CUPS_CSPACE_W)
-	RGB = ppdRGBLoad(ppd, colormodel, header->MediaType, resolution,
-			  logfunc, ld);
-
-      CMYK = ppdCMYKLoad(ppd, colormodel, header->MediaType, resolution,
-			  logfunc, ld);
-    }
-
-    if (RGB)
-      fputs("DEBUG: Loaded RGB separation from PPD.\n", stderr);
-
-    if (CMYK)
-      fputs("DEBUG: Loaded CMYK separation from PPD.\n", stderr);
-    else
-    {
-      if (header->cupsColorSpace == CUPS_CSPACE_KCMY ||
-	  header->cupsColorSpace == CUPS_CSPACE_CMYK)
-	PrinterPlanes = 4;
-      else if (header->cupsColorSpace == CUPS_CSPACE_CMY)
-	PrinterPlanes = 3;
-      else
-	PrinterPlanes = 1;
-      //fputs("DEBUG: Loading default K separation.\n", stderr);
-      fprintf(stderr, "DEBUG: Color Space: %d; Color Planes %d\n",
-	      header->cupsColorSpace, PrinterPlanes);
-      CMYK = cfCMYKNew(PrinterPlanes);
-    }
+    profile = GetProfile(job, data, ppd, header, colormodel, resolution);
 
-    PrinterPlanes = CMYK->num_channels;
+    job->RGB           = profile->rgb;
+    job->CMYK          = profile->cmyk;
+    job->PrinterPlanes = job->CMYK->num_channels;
 
     //
-    // Use dithered mode...
+    // Reset the dithering state for the page...
     //
 
-    switch (PrinterPlanes)
-    {
-      case 1 : // K
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Black", logfunc, ld);
-          break;
-
-      case 3 : // CMY
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Cyan", logfunc, ld);
-          DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Magenta", logfunc, ld);
-          DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Yellow", logfunc, ld);
-          break;
-
-      case 4 : // CMYK
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Cyan", logfunc, ld);
-          DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Magenta", logfunc, ld);
-          DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Yellow", logfunc, ld);
-          DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Black", logfunc, ld);
-          break;
-
-      case 6 : // CcMmYK
-          DitherLuts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Cyan", logfunc, ld);
-          DitherLuts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "LightCyan", logfunc, ld);
-          DitherLuts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Magenta", logfunc, ld);
-          DitherLuts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "LightMagenta", logfunc, ld);
-          DitherLuts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Yellow", logfunc, ld);
-          DitherLuts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
-	                              resolution, "Black", logfunc, ld);
-          break;
-    }
-
-    for (plane = 0; plane < PrinterPlanes; plane ++)
+    for (plane = 0; plane < job->PrinterPlanes; plane ++)
     {
-      if (!DitherLuts[plane])
-        DitherLuts[plane] = cfLutNew(2, default_lut, logfunc, ld);
+      job->DitherLuts[plane] = profile->luts[plane];
 
-      if (DitherLuts[plane][4095].pixel > 1)
-	DotBits[plane] = 2;
+      if (job->DitherLuts[plane][4095].pixel > 1)
+	job->DotBits[plane] = 2;
       else
-	DotBits[plane] = 1;
+	job->DotBits[plane] = 1;
 
-      DitherStates[plane] = cfDitherNew(header->cupsWidth);
-
-      if (!DitherLuts[plane])
-	DitherLuts[plane] = cfLutNew(2, default_lut, logfunc, ld);
+      job->DitherStates[plane] = cfDitherNew(header->cupsWidth);
+      job->DitherLevels[plane] = profile->levels[plane];
     }
+
+    job->DitherMatrix = profile->dither;
+    job->Line         = 0;
   }
 
-  fprintf(stderr, "DEBUG: PrinterPlanes = %d\n", PrinterPlanes);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "PrinterPlanes = %d", job->PrinterPlanes);
 
   //
   // Initialize the printer...
@@ -460,155 +747,133 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
 
   if (ppd && ((attr = ppdFindAttr(ppd, "cupsInitialNulls", NULL)) != NULL))
     for (i = atoi(attr->value); i > 0; i --)
-      putchar(0);
+      raster_out_putc(job->Output, 0);
 
-  if (Page == 1 && (!ppd || ppd->model_number & PCL_PJL))
+  if (job->Page == 1 && (!ppd || ppd->model_number & PCL_PJL))
   {
-    pjl_escape();
+    pjl_escape(job->Output);
 
     //
     // PJL job setup...
     //
 
-    pjl_set_job(job_id, user, title);
-
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "StartJob")) != NULL))
-      pjl_write(attr->value, NULL, job_id, user, title, num_options,
-                options);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_JOB], NULL);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_START_JOB], NULL);
 
     snprintf(spec, sizeof(spec), "RENDERMODE.%s", colormodel);
     if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", spec)) != NULL))
-      printf("@PJL SET RENDERMODE=%s\r\n", attr->value);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_RENDERMODE], attr->value);
 
     snprintf(spec, sizeof(spec), "COLORSPACE.%s", colormodel);
     if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", spec)) != NULL))
-      printf("@PJL SET COLORSPACE=%s\r\n", attr->value);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_COLORSPACE], attr->value);
     if (!ppd)
-      printf("@PJL SET COLORSPACE=%s\r\n", colormodel);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_COLORSPACE], colormodel);
 
     snprintf(spec, sizeof(spec), "RENDERINTENT.%s", colormodel);
     if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", spec)) != NULL))
-      printf("@PJL SET RENDERINTENT=%s\r\n", attr->value);
-
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "Duplex")) != NULL))
-    {
-      sprintf(s, "%d", header->Duplex);
-      pjl_write(attr->value, s, job_id, user, title, num_options, options);
-    }
-
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "Tumble")) != NULL))
-    {
-      sprintf(s, "%d", header->Tumble);
-      pjl_write(attr->value, s, job_id, user, title, num_options, options);
-    }
-
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "MediaClass")) != NULL))
-      pjl_write(attr->value, header->MediaClass, job_id, user, title,
-                num_options, options);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_RENDERINTENT], attr->value);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "MediaColor")) != NULL))
-      pjl_write(attr->value, header->MediaColor, job_id, user, title,
-                num_options, options);
+    snprintf(s, sizeof(s), "%d", header->Duplex);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_DUPLEX], s);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "MediaType")) != NULL))
-      pjl_write(attr->value, header->MediaType, job_id, user, title,
-                num_options, options);
+    snprintf(s, sizeof(s), "%d", header->Tumble);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_TUMBLE], s);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "OutputType")) != NULL))
-      pjl_write(attr->value, header->OutputType, job_id, user, title,
-                num_options, options);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_MEDIA_CLASS],
+               header->MediaClass);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_MEDIA_COLOR],
+               header->MediaColor);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_MEDIA_TYPE], header->MediaType);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_OUTPUT_TYPE],
+               header->OutputType);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "cupsBooklet")) != NULL &&
-		(choice = ppdFindMarkedChoice(ppd, "cupsBooklet")) != NULL))
-      pjl_write(attr->value, choice->choice, job_id, user, title,
-                num_options, options);
+    if (ppd && (choice = ppdFindMarkedChoice(ppd, "cupsBooklet")) != NULL)
+      pjl_expand(job->Output, job->PJL[PJL_CMD_BOOKLET], choice->choice);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "Jog")) != NULL))
-    {
-      sprintf(s, "%d", header->Jog);
-      pjl_write(attr->value, s, job_id, user, title, num_options, options);
-    }
+    snprintf(s, sizeof(s), "%d", header->Jog);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_JOG], s);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "cupsPunch")) != NULL &&
-		(choice = ppdFindMarkedChoice(ppd, "cupsPunch")) != NULL))
-      pjl_write(attr->value, choice->choice, job_id, user, title,
-                num_options, options);
+    if (ppd && (choice = ppdFindMarkedChoice(ppd, "cupsPunch")) != NULL)
+      pjl_expand(job->Output, job->PJL[PJL_CMD_PUNCH], choice->choice);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "cupsStaple")) != NULL &&
-		(choice = ppdFindMarkedChoice(ppd, "cupsStaple")) != NULL))
-      pjl_write(attr->value, choice->choice, job_id, user, title,
-                num_options, options);
+    if (ppd && (choice = ppdFindMarkedChoice(ppd, "cupsStaple")) != NULL)
+      pjl_expand(job->Output, job->PJL[PJL_CMD_STAPLE], choice->choice);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "cupsRET")) != NULL &&
-		(choice = ppdFindMarkedChoice(ppd, "cupsRET")) != NULL))
-      pjl_write(attr->value, choice->choice, job_id, user, title,
-                num_options, options);
+    if (ppd && (choice = ppdFindMarkedChoice(ppd, "cupsRET")) != NULL)
+      pjl_expand(job->Output, job->PJL[PJL_CMD_RET], choice->choice);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "cupsTonerSave")) != NULL &&
-		(choice = ppdFindMarkedChoice(ppd, "cupsTonerSave")) != NULL))
-      pjl_write(attr->value, choice->choice, job_id, user, title,
-                num_options, options);
+    if (ppd && (choice = ppdFindMarkedChoice(ppd, "cupsTonerSave")) != NULL)
+      pjl_expand(job->Output, job->PJL[PJL_CMD_TONER_SAVE], choice->choice);
 
     if (!ppd || ppd->model_number & PCL_PJL_PAPERWIDTH)
     {
-      printf("@PJL SET PAPERLENGTH=%d\r\n", header->PageSize[1] * 10);
-      printf("@PJL SET PAPERWIDTH=%d\r\n", header->PageSize[0] * 10);
+      snprintf(s, sizeof(s), "%d", header->PageSize[1] * 10);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_PAPERLENGTH], s);
+      snprintf(s, sizeof(s), "%d", header->PageSize[0] * 10);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_PAPERWIDTH], s);
     }
 
     if (!ppd || ppd->model_number & PCL_PJL_RESOLUTION)
-      printf("@PJL SET RESOLUTION=%d\r\n", header->HWResolution[0]);
+    {
+      snprintf(s, sizeof(s), "%d", header->HWResolution[0]);
+      pjl_expand(job->Output, job->PJL[PJL_CMD_RESOLUTION], s);
+    }
 
-    if (ppd)
-      ppdEmit(ppd, stdout, PPD_ORDER_JCL);
+    if (ppd && (jcl = ppdEmitString(ppd, PPD_ORDER_JCL, 0.0)) != NULL)
+    {
+      raster_out_puts(job->Output, jcl);
+      free(jcl);
+    }
     if (ppd && ppd->model_number & PCL_PJL_HPGL2)
-      pjl_enter_language("HPGL2");
+      pjl_expand(job->Output, job->PJL[PJL_CMD_ENTER_LANGUAGE], "HPGL2");
     else if (ppd && ppd->model_number & PCL_PJL_PCL3GUI)
-      pjl_enter_language("PCL3GUI");
+      pjl_expand(job->Output, job->PJL[PJL_CMD_ENTER_LANGUAGE], "PCL3GUI");
     else
-      pjl_enter_language("PCL");
+      pjl_expand(job->Output, job->PJL[PJL_CMD_ENTER_LANGUAGE], "PCL");
   }
 
-  if (Page == 1)
+  if (job->Page == 1)
   {
-    pcl_reset();
+    pcl_reset(job->Output);
   }
 
   if (ppd && ppd->model_number & PCL_PJL_HPGL2)
   {
-    if (Page == 1)
+    if (job->Page == 1)
     {
       //
       // HP-GL/2 initialization...
       //
 
-      printf("IN;");
-      printf("MG\"%d %s %s\";", job_id, user, title);
+      raster_out_printf(job->Output, "IN;");
+      raster_out_printf(job->Output, "MG\"%d %s %s\";", job_id, user, title);
     }
 
     //
     // Set media size, position, type, etc...
     //
 
-    printf("BP5,0;");
-    printf("PS%.0f,%.0f;",
+    raster_out_printf(job->Output, "BP5,0;");
+    raster_out_printf(job->Output, "PS%.0f,%.0f;",
 	   header->cupsHeight * 1016.0 / header->HWResolution[1],
 	   header->cupsWidth * 1016.0 / header->HWResolution[0]);
-    printf("PU;");
-    printf("PA0,0");
+    raster_out_printf(job->Output, "PU;");
+    raster_out_printf(job->Output, "PA0,0");
 
-    printf("MT%d;", header->cupsMediaType);
+    raster_out_printf(job->Output, "MT%d;", header->cupsMediaType);
 
     if (header->CutMedia == CUPS_CUT_PAGE)
-      printf("EC;");
+      raster_out_printf(job->Output, "EC;");
     else
-      printf("EC0;");
+      raster_out_printf(job->Output, "EC0;");
 
     //
     // Set graphics mode...
     //
 
-    pcl_set_pcl_mode(0);
-    pcl_set_negative_motion();
+    pcl_set_pcl_mode(job->Output, 0);
+    pcl_set_negative_motion(job->Output);
   }
   else
   {
@@ -616,31 +881,32 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     // Set media size, position, type, etc...
     //
 
-    if (!header->Duplex || (Page & 1))
+    if (!header->Duplex || (job->Page & 1))
     {
-      pcl_set_media_size(ppd, header->PageSize[0], header->PageSize[1]);
+      pcl_set_media_size(job->Output, ppd, header->PageSize[0],
+	                 header->PageSize[1]);
 
       if (header->MediaPosition)
-        pcl_set_media_source(header->MediaPosition);
+        pcl_set_media_source(job->Output, header->MediaPosition);
 
-      pcl_set_media_type(header->cupsMediaType);
+      pcl_set_media_type(job->Output, header->cupsMediaType);
 
       if (!ppd || ppdFindAttr(ppd, "cupsPJL", "Duplex") == NULL)
-        pcl_set_duplex(header->Duplex, header->Tumble);
+        pcl_set_duplex(job->Output, header->Duplex, header->Tumble);
 
       //
       // Set the number of copies...
       //
 
       if (!ppd || !ppd->manual_copies)
-	pcl_set_copies(header->NumCopies);
+	pcl_set_copies(job->Output, header->NumCopies);
 
       //
       // Set the output order/bin...
       //
 
       if ((!ppd || ppdFindAttr(ppd, "cupsPJL", "Jog") == NULL) && header->Jog)
-        printf("\033&l%dG", header->Jog);
+        raster_out_printf(job->Output, "\033&l%dG", header->Jog);
     }
     else
     {
@@ -648,7 +914,7 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
       // Print on the back side...
       //
 
-      printf("\033&a2G");
+      raster_out_printf(job->Output, "\033&a2G");
     }
 
     if (header->Duplex && (ppd && (ppd->model_number & PCL_RASTER_CRD)))
@@ -657,29 +923,30 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
       // Reload the media...
       //
 
-      pcl_set_media_source(-2);
+      pcl_set_media_source(job->Output, -2);
     }
 
     //
     // Set the units for cursor positioning and go to the top of the form.
     //
 
-    printf("\033&u%dD", header->HWResolution[0]);
-    printf("\033*p0Y\033*p0X");
+    raster_out_printf(job->Output, "\033&u%dD", header->HWResolution[0]);
+    raster_out_printf(job->Output, "\033*p0Y\033*p0X");
   }
 
   if (ppd && ((attr = ppdFindColorAttr(ppd, "cupsPCLQuality", colormodel,
 				   header->MediaType, resolution, spec,
-				   sizeof(spec), logfunc, ld)) != NULL))
+				   sizeof(spec), job->logfunc,
+				   job->ld)) != NULL))
   {
     //
     // Set the print quality...
     //
 
     if (ppd && (ppd->model_number & PCL_PJL_HPGL2))
-      printf("QM%d", atoi(attr->value));
+      raster_out_printf(job->Output, "QM%d", atoi(attr->value));
     else
-      printf("\033*o%dM", atoi(attr->value));
+      raster_out_printf(job->Output, "\033*o%dM", atoi(attr->value));
   }
 
   //
@@ -692,7 +959,7 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     // Use configure raster data command...
     //
 
-    if (OutputMode == OUTPUT_RGB)
+    if (job->OutputMode == OUTPUT_RGB)
     {
       //
       // Send 12-byte configure raster data command with horizontal and
@@ -701,26 +968,29 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
 
       if (ppd && ((attr = ppdFindColorAttr(ppd, "cupsPCLCRDMode", colormodel,
 				       header->MediaType, resolution, spec,
-				       sizeof(spec), logfunc, ld)) != NULL))
+				       sizeof(spec), job->logfunc,
+				       job->ld)) != NULL))
         i = atoi(attr->value);
       else
         i = 31;
 
-      printf("\033*g12W");
-      putchar(6);			// Format 6
-      putchar(i);			// Set pen mode
-      putchar(0x00);			// Number components
-      putchar(0x01);			// (1 for RGB)
-
-      putchar(header->HWResolution[0] >> 8);
-      putchar(header->HWResolution[0]);
-      putchar(header->HWResolution[1] >> 8);
-      putchar(header->HWResolution[1]);
-
-      putchar(header->cupsCompression);	// Compression mode 3 or 10
-      putchar(0x01);			// Portrait orientation
-      putchar(0x20);			// Bits per pixel (32 = RGB)
-      putchar(0x01);			// Planes per pixel (1 = chunky RGB)
+      raster_out_printf(job->Output, "\033*g12W");
+      raster_out_putc(job->Output, 6);	// Format 6
+      raster_out_putc(job->Output, i);	// Set pen mode
+      raster_out_putc(job->Output, 0x00);	// Number components
+      raster_out_putc(job->Output, 0x01);	// (1 for RGB)
+
+      raster_out_putc(job->Output, header->HWResolution[0] >> 8);
+      raster_out_putc(job->Output, header->HWResolution[0]);
+      raster_out_putc(job->Output, header->HWResolution[1] >> 8);
+      raster_out_putc(job->Output, header->HWResolution[1]);
+
+      raster_out_putc(job->Output, header->cupsCompression);
+					// Compression mode 3 or 10
+      raster_out_putc(job->Output, 0x01);	// Portrait orientation
+      raster_out_putc(job->Output, 0x20);	// Bits per pixel (32 = RGB)
+      raster_out_putc(job->Output, 0x01);	// Planes per pixel
+						// (1 = chunky RGB)
     }
     else
     {
@@ -729,36 +999,36 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
       // vertical resolutions as well as a color count...
       //
 
-      printf("\033*g%dW", PrinterPlanes * 6 + 2);
-      putchar(2);			// Format 2
-      putchar(PrinterPlanes);		// Output planes
+      raster_out_printf(job->Output, "\033*g%dW", job->PrinterPlanes * 6 + 2);
+      raster_out_putc(job->Output, 2);	// Format 2
+      raster_out_putc(job->Output, job->PrinterPlanes);	// Output planes
 
-      order = ColorOrders[PrinterPlanes - 1];
+      order = ColorOrders[job->PrinterPlanes - 1];
 
-      for (i = 0; i < PrinterPlanes; i ++)
+      for (i = 0; i < job->PrinterPlanes; i ++)
       {
         plane = order[i];
 
-	putchar(header->HWResolution[0] >> 8);
-	putchar(header->HWResolution[0]);
-	putchar(header->HWResolution[1] >> 8);
-	putchar(header->HWResolution[1]);
-	putchar(0);
-	putchar(1 << DotBits[plane]);
+	raster_out_putc(job->Output, header->HWResolution[0] >> 8);
+	raster_out_putc(job->Output, header->HWResolution[0]);
+	raster_out_putc(job->Output, header->HWResolution[1] >> 8);
+	raster_out_putc(job->Output, header->HWResolution[1]);
+	raster_out_putc(job->Output, 0);
+	raster_out_putc(job->Output, 1 << job->DotBits[plane]);
       }
     }
   }
   else if ((!ppd || (ppd->model_number & PCL_RASTER_CID)) &&
-	   OutputMode == OUTPUT_RGB)
+	   job->OutputMode == OUTPUT_RGB)
   {
     //
     // Use configure image data command...
     //
 
-    pcl_set_simple_resolution(header->HWResolution[0]);
+    pcl_set_simple_resolution(job->Output, header->HWResolution[0]);
 					// Set output resolution
 
-    cfWritePrintData("\033*v6W\2\3\0\10\10\10", 11);
+    raster_out_write(job->Output, "\033*v6W\2\3\0\10\10\10", 11);
 					// 24-bit sRGB
   }
   else
@@ -767,13 +1037,13 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
     // Use simple raster commands...
     //
 
-    pcl_set_simple_resolution(header->HWResolution[0]);
+    pcl_set_simple_resolution(job->Output, header->HWResolution[0]);
 					// Set output resolution
 
-    if (PrinterPlanes == 3)
-      pcl_set_simple_cmy();
-    else if (PrinterPlanes == 4)
-      pcl_set_simple_kcmy();
+    if (job->PrinterPlanes == 3)
+      pcl_set_simple_cmy(job->Output);
+    else if (job->PrinterPlanes == 4)
+      pcl_set_simple_kcmy(job->Output);
   }
 
   if (ppd && ((attr = ppdFindAttr(ppd, "cupsPCLOrigin", "X")) != NULL))
@@ -786,420 +1056,644 @@ StartPage(cf_filter_data_t      *data,	// I - filter data
   else
     yorigin = 120;
 
-  printf("\033&a%dH\033&a%dV", xorigin, yorigin);
-  printf("\033*r%dS", header->cupsWidth);
-  printf("\033*r%dT", header->cupsHeight);
-  printf("\033*r1A");
+  raster_out_printf(job->Output, "\033&a%dH\033&a%dV", xorigin, yorigin);
+  raster_out_printf(job->Output, "\033*r%dS", header->cupsWidth);
+  raster_out_printf(job->Output, "\033*r%dT", header->cupsHeight);
+  raster_out_printf(job->Output, "\033*r1A");
 
   if (header->cupsCompression && header->cupsCompression != 10)
-    printf("\033*b%dM", header->cupsCompression);
+    raster_out_printf(job->Output, "\033*b%dM", header->cupsCompression);
+
+  //
+  // Modes 1 to 3 may be switched for each row when adaptive compression
+  // is enabled...
+  //
+
+  if (job->Adaptive && header->cupsCompression >= 1 &&
+      header->cupsCompression <= 3)
+    job->Compression = COMPRESS_ADAPTIVE;
+  else
+    job->Compression = header->cupsCompression;
+
+  job->CompMode = header->cupsCompression;
+
+  job->OutputFeed = 0;
+
+  //
+  // White-is-one bitmaps and grayscale are inverted while looking for
+  // blank lines...
+  //
 
-  OutputFeed = 0;
+  job->Invert = job->OutputMode == OUTPUT_INVERBIT ||
+                (job->OutputMode == OUTPUT_RGB && job->PrinterPlanes == 1 &&
+		 !job->BlankValue);
+
+  //
+  // Blank margins are only trimmed from planar bitmap data, where the
+  // cursor can be moved in PCL units of one pixel...
+  //
+
+  job->TrimPage  = job->Trim && job->OutputMode != OUTPUT_RGB &&
+                   header->cupsCompression != 10 &&
+		   !(ppd && (ppd->model_number & PCL_PJL_HPGL2));
+  job->TrimStart = 1;
+  job->TrimLeft  = 0;
+
+  if (job->OutputMode == OUTPUT_DITHERED)
+    job->TrimRight = (header->cupsWidth + 7) / 8;
+  else
+    job->TrimRight = header->cupsBytesPerLine / job->PrinterPlanes;
 
   //
   // Allocate memory for the page...
   //
 
-  PixelBuffer = malloc(header->cupsBytesPerLine);
+  job->PixelBuffer = malloc(header->cupsBytesPerLine);
 
-  if (OutputMode == OUTPUT_DITHERED)
+  if (job->OutputMode == OUTPUT_DITHERED)
   {
-    InputBuffer      = malloc(header->cupsWidth * PrinterPlanes * 2);
-    OutputBuffers[0] = malloc(PrinterPlanes * header->cupsWidth);
+    job->InputBuffer      = malloc(header->cupsWidth * job->PrinterPlanes * 2);
+    job->OutputBuffers[0] = malloc(job->PrinterPlanes * header->cupsWidth);
 
-    for (i = 1; i < PrinterPlanes; i ++)
-      OutputBuffers[i] = OutputBuffers[0] + i * header->cupsWidth;
+    for (i = 1; i < job->PrinterPlanes; i ++)
+      job->OutputBuffers[i] = job->OutputBuffers[0] + i * header->cupsWidth;
 
-    if (RGB)
-      CMYKBuffer = malloc(header->cupsWidth * PrinterPlanes);
+    if (job->RGB)
+      job->CMYKBuffer = malloc(header->cupsWidth * job->PrinterPlanes);
 
-    for (plane = 0, DotBufferSize = 0; plane < PrinterPlanes; plane ++)
+    for (plane = 0, job->DotBufferSize = 0; plane < job->PrinterPlanes;
+         plane ++)
     {
-      DotBufferSizes[plane] = (header->cupsWidth + 7) / 8 * DotBits[plane];
-      DotBufferSize         += DotBufferSizes[plane];
+      job->DotBufferSizes[plane] = (header->cupsWidth + 7) / 8 *
+                                   job->DotBits[plane];
+      job->DotBufferSize         += job->DotBufferSizes[plane];
     }
 
-    DotBuffers[0] = malloc(DotBufferSize);
-    for (plane = 1; plane < PrinterPlanes; plane ++)
-      DotBuffers[plane] = DotBuffers[plane - 1] + DotBufferSizes[plane - 1];
+    job->DotBuffers[0] = malloc(job->DotBufferSize);
+    for (plane = 1; plane < job->PrinterPlanes; plane ++)
+      job->DotBuffers[plane] = job->DotBuffers[plane - 1] +
+                               job->DotBufferSizes[plane - 1];
   }
 
   if (header->cupsCompression)
-    CompBuffer = malloc(DotBufferSize * 4);
+    job->CompBuffer = malloc(job->DotBufferSize * 4);
 
-  if (header->cupsCompression >= 3)
-    SeedBuffer = malloc(DotBufferSize);
+  if (header->cupsCompression >= 3 ||
+      job->Compression == COMPRESS_ADAPTIVE)
+    job->SeedBuffer = malloc(job->DotBufferSize);
 
-  SeedInvalid = 1;
+  job->SeedInvalid = 1;
 
-  fprintf(stderr, "BlankValue=%d\n", BlankValue);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "BlankValue=%d", job->BlankValue);
 }
 
 
 //
-// 'EndPage()' - Finish a page of graphics.
+// 'GetProfile()' - Get the color profile for a page, loading it as needed.
 //
 
-void
-EndPage(ppd_file_t         *ppd,	// I - PPD file
-        cups_page_header2_t *header)	// I - Page header
+cups_profile_t *			// O - Color profile
+GetProfile(pcl_job_t           *job,	// I - Job data
+           cf_filter_data_t    *data,	// I - Filter data
+           ppd_file_t          *ppd,	// I - PPD file
+           cups_page_header2_t *header,	// I - Page header
+           const char          *colormodel,
+					// I - Color model string
+           const char          *resolution)
+					// I - Resolution string
 {
-  int	plane;				// Current plane
+  int		i,			// Looping var
+		plane,			// Current plane
+		planes;			// Number of color planes
+  int		cm_disabled;		// Device Color Inhibited
+  cups_profile_t *profile;		// Current profile
+  const char	*mode;			// Threshold matrix
+  ppd_attr_t	*attr;			// Attribute from PPD file
+  char		spec[PPD_MAX_NAME];	// PPD attribute name
+  static const float default_lut[2] =	// Default dithering lookup table
+		{
+		  0.0,
+		  1.0
+		};
+  cf_cm_calibration_t cm_calibrate;	// Color calibration mode
 
 
   //
-  // End graphics mode...
+  // See if we already have this profile...
   //
 
-  if (ppd && (ppd->model_number & PCL_RASTER_END_COLOR))
-    printf("\033*rC");			// End color GFX
-  else
-    printf("\033*r0B");			// End B&W GFX
+  for (i = 0, profile = job->Profiles; i < job->NumProfiles; i ++, profile ++)
+    if (profile->cspace == header->cupsColorSpace &&
+        !strcmp(profile->media_type, header->MediaType) &&
+	!strcmp(profile->resolution, resolution))
+    {
+      JobLog(job, CF_LOGLEVEL_DEBUG, "Using cached color profile.");
+
+      profile->use = ++ job->ProfileUse;
+      return (profile);
+    }
 
   //
-  // Output a page eject sequence...
+  // No, use a free slot or replace the least recently used profile...
   //
 
-  if (ppd && (ppd->model_number & PCL_PJL_HPGL2))
+  if (job->NumProfiles < PROFILE_MAX)
+    profile = job->Profiles + job->NumProfiles ++;
+  else
   {
-     pcl_set_hpgl_mode(0);		// Back to HP-GL/2 mode
-     printf("PG;");			// Eject the current page
+    for (i = 1, profile = job->Profiles; i < PROFILE_MAX; i ++)
+      if (job->Profiles[i].use < profile->use)
+        profile = job->Profiles + i;
+
+    FreeProfile(profile);
   }
-  else if (!(header->Duplex && (Page & 1)))
-    printf("\014");			// Eject current page
+
+  profile->cspace = header->cupsColorSpace;
+  profile->use    = ++ job->ProfileUse;
+  snprintf(profile->media_type, sizeof(profile->media_type), "%s",
+           header->MediaType);
+  snprintf(profile->resolution, sizeof(profile->resolution), "%s",
+           resolution);
 
   //
-  // Free memory for the page...
+  // Load the appropriate color profiles...
   //
 
-  free(PixelBuffer);
+  JobLog(job, CF_LOGLEVEL_DEBUG,
+	 "Attempting to load color profiles using the following values:");
+  JobLog(job, CF_LOGLEVEL_DEBUG, "ColorModel = %s", colormodel);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "MediaType = %s", header->MediaType);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Resolution = %s", resolution);
+
+  // support the "cm-calibration" option
+  cm_calibrate = cfCmGetCupsColorCalibrateMode(data);
+
+  if (cm_calibrate == CF_CM_CALIBRATION_ENABLED)
+    cm_disabled = 1;
+  else
+    cm_disabled = cfCmIsPrinterCmDisabled(data);
+
+  if (ppd && !cm_disabled)
+  {
+    if (header->cupsColorSpace == CUPS_CSPACE_RGB ||
+	header->cupsColorSpace == CUPS_CSPACE_W)
+      profile->rgb = ppdRGBLoad(ppd, colormodel, header->MediaType,
+				resolution, job->logfunc, job->ld);
+
+    profile->cmyk = ppdCMYKLoad(ppd, colormodel, header->MediaType,
+				resolution, job->logfunc, job->ld);
+  }
+
+  if (profile->rgb)
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Loaded RGB separation from PPD.");
 
-  if (OutputMode == OUTPUT_DITHERED)
+  if (profile->cmyk)
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Loaded CMYK separation from PPD.");
+  else
   {
-    for (plane = 0; plane < PrinterPlanes; plane ++)
-    {
-      cfDitherDelete(DitherStates[plane]);
-      cfLutDelete(DitherLuts[plane]);
-    }
+    if (header->cupsColorSpace == CUPS_CSPACE_KCMY ||
+	header->cupsColorSpace == CUPS_CSPACE_CMYK)
+      planes = 4;
+    else if (header->cupsColorSpace == CUPS_CSPACE_CMY)
+      planes = 3;
+    else
+      planes = 1;
+    //JobLog(job, CF_LOGLEVEL_DEBUG, "Loading default K separation.");
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Color Space: %d; Color Planes %d",
+	   header->cupsColorSpace, planes);
+    profile->cmyk = cfCMYKNew(planes);
+  }
+
+  planes = profile->cmyk->num_channels;
+
+  //
+  // Load the dithering lookup tables...
+  //
+
+  switch (planes)
+  {
+    case 1 : // K
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
+        break;
+
+    case 3 : // CMY
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
+        break;
+
+    case 4 : // CMYK
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
+        profile->luts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
+        break;
+
+    case 6 : // CcMmYK
+        profile->luts[0] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Cyan",
+				      job->logfunc, job->ld);
+        profile->luts[1] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightCyan",
+				      job->logfunc, job->ld);
+        profile->luts[2] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Magenta",
+				      job->logfunc, job->ld);
+        profile->luts[3] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "LightMagenta",
+				      job->logfunc, job->ld);
+        profile->luts[4] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Yellow",
+				      job->logfunc, job->ld);
+        profile->luts[5] = ppdLutLoad(ppd, colormodel, header->MediaType,
+				      resolution, "Black",
+				      job->logfunc, job->ld);
+        break;
+  }
 
-    free(DotBuffers[0]);
-    free(InputBuffer);
-    free(OutputBuffers[0]);
+  for (plane = 0; plane < planes; plane ++)
+    if (!profile->luts[plane])
+      profile->luts[plane] = cfLutNew(2, default_lut, job->logfunc, job->ld);
 
-    cfCMYKDelete(CMYK);
+  //
+  // Dither with a threshold matrix instead of error diffusion when the
+  // environment or PPD file asks for it; it is faster, but not as good
+  // for photos...
+  //
+
+  if (job->DitherMode)
+    mode = job->DitherMode;
+  else if (ppd && (attr = ppdFindColorAttr(ppd, "cupsPCLDither", colormodel,
+					   header->MediaType, resolution,
+					   spec, sizeof(spec), job->logfunc,
+					   job->ld)) != NULL)
+    mode = attr->value;
+  else
+    mode = NULL;
 
-    if (RGB)
+  if ((profile->dither = raster_dither_new(mode)) != NULL)
+  {
+    for (plane = 0; plane < planes; plane ++)
+      if ((profile->levels[plane] =
+               raster_dither_levels(profile->luts[plane])) == NULL)
+        break;
+
+    if (plane < planes)
     {
-      cfRGBDelete(RGB);
-      free(CMYKBuffer);
+      for (plane = 0; plane < planes; plane ++)
+      {
+        free(profile->levels[plane]);
+	profile->levels[plane] = NULL;
+      }
+
+      raster_dither_delete(profile->dither);
+      profile->dither = NULL;
     }
+    else
+      JobLog(job, CF_LOGLEVEL_DEBUG, "Using %s threshold dithering.", mode);
   }
 
-  if (header->cupsCompression)
-    free(CompBuffer);
-
-  if (header->cupsCompression >= 3)
-    free(SeedBuffer);
+  return (profile);
 }
 
 
 //
-// 'Shutdown()' - Shutdown a printer.
+// 'FreeProfile()' - Free the separations and tables of a color profile.
 //
 
 void
-Shutdown(ppd_file_t         *ppd,	// I - PPD file
-	 int                job_id,	// I - Job ID
-	 const char         *user,	// I - User printing job
-	 const char         *title,	// I - Title of job
-	 int                num_options,// I - Number of command-line options
-	 cups_option_t      *options)	// I - Command-line options
+FreeProfile(cups_profile_t *profile)	// I - Color profile
 {
-  ppd_attr_t	*attr;			// Attribute from PPD file
+  int	plane;				// Current plane
 
 
-  if (ppd && ((attr = ppdFindAttr(ppd, "cupsPCL", "EndJob")) != NULL))
+  for (plane = 0; plane < 6; plane ++)
   {
-    //
-    // Tell the printer how many pages were in the job...
-    //
+    if (profile->luts[plane])
+      cfLutDelete(profile->luts[plane]);
 
-    putchar(0x1b);
-    printf(attr->value, Page);
+    free(profile->levels[plane]);
   }
-  else
-  {
-    //
-    // Return the printer to the default state...
-    //
 
-    pcl_reset();
-  }
+  raster_dither_delete(profile->dither);
 
-  if (!ppd || (ppd->model_number & PCL_PJL))
-  {
-    pjl_escape();
+  if (profile->cmyk)
+    cfCMYKDelete(profile->cmyk);
 
-    if (ppd && ((attr = ppdFindAttr(ppd, "cupsPJL", "EndJob")) != NULL))
-      pjl_write(attr->value, NULL, job_id, user, title, num_options,
-                options);
-    else
-      printf("@PJL EOJ\r\n");
+  if (profile->rgb)
+    cfRGBDelete(profile->rgb);
 
-    pjl_escape();
-  }
+  memset(profile, 0, sizeof(cups_profile_t));
 }
 
 
 //
-// 'CancelJob()' - Cancel the current job...
+// 'FreeProfiles()' - Free all cached color profiles at the end of the job.
 //
 
 void
-CancelJob(int sig)			// I - Signal
+FreeProfiles(pcl_job_t *job)		// I - Job data
 {
-  (void)sig;
+  int	i;				// Looping var
+
+
+  for (i = 0; i < job->NumProfiles; i ++)
+    FreeProfile(job->Profiles + i);
 
-  Canceled = 1;
+  job->NumProfiles = 0;
 }
 
 
 //
-// 'CompressData()' - Compress a line of graphics.
+// 'EndPage()' - Finish a page of graphics.
 //
 
 void
-CompressData(unsigned char *line,	// I - Data to compress
-             int           length,	// I - Number of bytes
-	     int           plane,	// I - Color plane
-	     int           pend,	// I - End character for data
-	     int           type)	// I - Type of compression
+EndPage(pcl_job_t           *job,	// I - Job data
+        ppd_file_t          *ppd,	// I - PPD file
+        cups_page_header2_t *header)	// I - Page header
 {
-  unsigned char	*line_ptr,		// Current byte pointer
-        	*line_end,		// End-of-line byte pointer
-        	*comp_ptr,		// Pointer into compression buffer
-        	*start,			// Start of compression sequence
-		*seed;			// Seed buffer pointer
-  int           count,			// Count of bytes for output
-		offset,			// Offset of bytes for output
-		temp;			// Temporary count
-  int		r, g, b;		// RGB deltas for mode 10 compression
+  int	plane;				// Current plane
 
 
-  switch (type)
-  {
-    default :
-        //
-        // Do no compression; with a mode-0 only printer, we can compress blank
-        // lines...
-        //
+  //
+  // End graphics mode...
+  //
 
-	line_ptr = line;
+  if (ppd && (ppd->model_number & PCL_RASTER_END_COLOR))
+    raster_out_printf(job->Output, "\033*rC");	// End color GFX
+  else
+    raster_out_printf(job->Output, "\033*r0B");	// End B&W GFX
 
-        if (cfCheckBytes(line, length))
-          line_end = line;		// Blank line
-        else
-	  line_end = line + length;	// Non-blank line
-	break;
+  //
+  // Output a page eject sequence...
+  //
 
-    case 1 :
-        //
-        // Do run-length encoding...
-        //
+  if (ppd && (ppd->model_number & PCL_PJL_HPGL2))
+  {
+     pcl_set_hpgl_mode(job->Output, 0);		// Back to HP-GL/2 mode
+     raster_out_printf(job->Output, "PG;");	// Eject the current page
+  }
+  else if (!(header->Duplex && (job->Page & 1)))
+    raster_out_printf(job->Output, "\014");	// Eject current page
 
-	line_end = line + length;
-	for (line_ptr = line, comp_ptr = CompBuffer;
-	     line_ptr < line_end;
-	     comp_ptr += 2, line_ptr += count)
-	{
-	  for (count = 1;
-               (line_ptr + count) < line_end &&
-	           line_ptr[0] == line_ptr[count] &&
-        	   count < 256;
-               count ++);
-
-	  comp_ptr[0] = count - 1;
-	  comp_ptr[1] = line_ptr[0];
-	}
+  //
+  // Send the rest of the page to the printer...
+  //
 
-        line_ptr = CompBuffer;
-        line_end = comp_ptr;
-	break;
+  raster_out_flush(job->Output);
 
-    case 2 :
-        //
-        // Do TIFF pack-bits encoding...
-        //
+  //
+  // Free memory for the page...
+  //
 
-	line_ptr = line;
-	line_end = line + length;
-	comp_ptr = CompBuffer;
+  free(job->PixelBuffer);
 
-	while (line_ptr < line_end)
-	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	    //
-	    // Single byte on the end...
-	    //
+  if (job->OutputMode == OUTPUT_DITHERED)
+  {
+    for (plane = 0; plane < job->PrinterPlanes; plane ++)
+      cfDitherDelete(job->DitherStates[plane]);
 
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	    // 
-	    // Repeated sequence...
-	    //
+    free(job->DotBuffers[0]);
+    free(job->InputBuffer);
+    free(job->OutputBuffers[0]);
 
-	    line_ptr ++;
-	    count = 2;
+    if (job->RGB)
+      free(job->CMYKBuffer);
+  }
 
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
+  if (header->cupsCompression)
+    free(job->CompBuffer);
 
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	    //
-	    // Non-repeated sequence...
-	    //
+  if (job->SeedBuffer)
+  {
+    free(job->SeedBuffer);
+    job->SeedBuffer = NULL;
+  }
+}
 
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
 
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
+//
+// 'Shutdown()' - Shutdown a printer.
+//
 
-	    *comp_ptr++ = count - 1;
+void
+Shutdown(pcl_job_t  *job,		// I - Job data
+         ppd_file_t *ppd)		// I - PPD file
+{
+  ppd_attr_t	*attr;			// Attribute from PPD file
 
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
 
-        line_ptr = CompBuffer;
-        line_end = comp_ptr;
-	break;
+  if (ppd && ((attr = ppdFindAttr(ppd, "cupsPCL", "EndJob")) != NULL))
+  {
+    //
+    // Tell the printer how many pages were in the job...
+    //
 
-    case 3 :
-        //
-        // Do delta-row compression...
-        //
+    raster_out_putc(job->Output, 0x1b);
+    raster_out_printf(job->Output, attr->value, job->Page);
+  }
+  else
+  {
+    //
+    // Return the printer to the default state...
+    //
 
-	line_ptr = line;
-	line_end = line + length;
+    pcl_reset(job->Output);
+  }
 
-	comp_ptr = CompBuffer;
-	seed     = SeedBuffer + plane * length;
+  if (!ppd || (ppd->model_number & PCL_PJL))
+  {
+    pjl_escape(job->Output);
+    pjl_expand(job->Output, job->PJL[PJL_CMD_END_JOB], NULL);
+    pjl_escape(job->Output);
+  }
+}
 
-	while (line_ptr < line_end)
-        {
-	  //
-          // Find the next non-matching sequence...
-	  //
 
-          start = line_ptr;
+//
+// 'CompressAdaptive()' - Compress a line with the smallest of several
+//                        methods.
+//
+// The line is encoded with TIFF PackBits (mode 2) and, if the seed row is
+// valid, delta-row compression (mode 3); the raw line (mode 0) is used if
+// neither helps.  The printer uses the previous row of a plane as seed in
+// every mode, so the seed buffer is updated for every row.  Changing the
+// mode costs an escape sequence, so the current mode is kept unless the
+// new one saves more than that.
+//
 
-	  if (SeedInvalid)
-	  {
-	    //
-	    // The seed buffer is invalid, so do the next 8 bytes, max...
-	    //
+unsigned char *				// O - Data to send
+CompressAdaptive(pcl_job_t     *job,	// I - Job data
+                 unsigned char *line,	// I - Data to compress
+                 int           length,	// I - Number of bytes
+                 int           plane,	// I - Color plane
+                 int           *bytes)	// O - Number of bytes to send
+{
+  unsigned char	*data[4],		// Encoded line for each mode
+		*seed;			// Seed row for the plane
+  int		sizes[4],		// Encoded size for each mode, or -1
+		mode;			// Mode to use
 
-	    offset = 0;
 
-	    if ((count = line_end - line_ptr) > 8)
-	      count = 8;
+  seed = job->SeedBuffer + plane * length;
 
-	    line_ptr += count;
-	  }
-	  else
-	  {
-	    //
-	    // The seed buffer is valid, so compare against it...
-	    //
+  data[0]  = line;
+  sizes[0] = length;
+  data[1]  = NULL;
+  sizes[1] = -1;
+  data[2]  = job->CompBuffer;
+  sizes[2] = raster_packbits(data[2], line, length, 0);
+  data[3]  = job->CompBuffer + 2 * length;
 
-            while (*line_ptr == *seed &&
-                   line_ptr < line_end)
-            {
-              line_ptr ++;
-              seed ++;
-            }
+  if (job->SeedInvalid)
+    sizes[3] = -1;
+  else
+    sizes[3] = pcl_compress_delta(data[3], line, seed, length);
 
-            if (line_ptr == line_end)
-              break;
+  memcpy(seed, line, length);
 
-            offset = line_ptr - start;
+  //
+  // Pick the smallest encoding, but stay in the current mode unless the
+  // switch pays for itself...
+  //
 
-	    //
-            // Find up to 8 non-matching bytes...
-	    //
+  mode = sizes[2] < sizes[0] ? 2 : 0;
 
-            start = line_ptr;
-            count = 0;
-            while (*line_ptr != *seed &&
-                   line_ptr < line_end &&
-                   count < 8)
-            {
-              line_ptr ++;
-              seed ++;
-              count ++;
-            }
-	  }
+  if (sizes[3] >= 0 && sizes[3] < sizes[mode])
+    mode = 3;
 
-	  //
-          // Place mode 3 compression data in the buffer; see HP manuals
-          // for details...
-	  //
+  if (mode != job->CompMode && sizes[job->CompMode] >= 0 &&
+      sizes[job->CompMode] - sizes[mode] <= COMPRESS_SWITCH)
+    mode = job->CompMode;
 
-          if (offset >= 31)
-          {
-	    //
-            // Output multi-byte offset...
-	    //
+  if (mode != job->CompMode)
+  {
+    raster_out_printf(job->Output, "\033*b%dM", mode);
+    job->CompMode = mode;
+  }
 
-            *comp_ptr++ = ((count - 1) << 5) | 31;
+  *bytes = sizes[mode];
 
-            offset -= 31;
-            while (offset >= 255)
-            {
-              *comp_ptr++ = 255;
-              offset    -= 255;
-            }
+  return (data[mode]);
+}
 
-            *comp_ptr++ = offset;
-          }
-          else
-          {
-	    //
-            // Output single-byte offset...
-	    //
 
-            *comp_ptr++ = ((count - 1) << 5) | offset;
-          }
+//
+// 'CompressData()' - Compress a line of graphics.
+//
 
-          memcpy(comp_ptr, start, count);
-          comp_ptr += count;
-        }
+void
+CompressData(pcl_job_t     *job,	// I - Job data
+             unsigned char *line,	// I - Data to compress
+             int           length,	// I - Number of bytes
+             int           plane,	// I - Color plane
+             int           pend,	// I - End character for data
+             int           type)	// I - Type of compression
+{
+  unsigned char	*line_ptr,		// Current byte pointer
+        	*line_end,		// End-of-line byte pointer
+        	*comp_ptr,		// Pointer into compression buffer
+        	*start,			// Start of compression sequence
+		*seed;			// Seed buffer pointer
+  int           count,			// Count of bytes for output
+		offset,			// Offset of bytes for output
+		temp;			// Temporary count
+  int		r, g, b;		// RGB deltas for mode 10 compression
+  long long	stats_start;		// Start time of compression
 
-	line_ptr = CompBuffer;
-	line_end = comp_ptr;
 
-        memcpy(SeedBuffer + plane * length, line, length);
+  stats_start = raster_stats_start(job->Stats);
+
+  switch (type)
+  {
+    case COMPRESS_ADAPTIVE :
+        //
+        // Send the smallest encoding of the line...
+        //
+
+        line_ptr = CompressAdaptive(job, line, length, plane, &count);
+	line_end = line_ptr + count;
+	break;
+
+    default :
+        //
+        // Do no compression; with a mode-0 only printer, we can compress blank
+        // lines...
+        //
+
+	line_ptr = line;
+
+        if (cfCheckBytes(line, length))
+          line_end = line;		// Blank line
+        else
+	  line_end = line + length;	// Non-blank line
+	break;
+
+    case 1 :
+        //
+        // Do run-length encoding...
+        //
+
+        line_ptr = job->CompBuffer;
+	line_end = job->CompBuffer + pcl_compress_rle(job->CompBuffer, line,
+						      length);
+	break;
+
+    case 2 :
+        //
+        // Do TIFF pack-bits encoding...
+        //
+
+        line_ptr = job->CompBuffer;
+	line_end = job->CompBuffer + raster_packbits(job->CompBuffer, line,
+						     length, 0);
+	break;
+
+    case 3 :
+        //
+        // Do delta-row compression...
+        //
+
+	line_ptr = job->CompBuffer;
+	line_end = job->CompBuffer +
+	           pcl_compress_delta(job->CompBuffer, line,
+		                      job->SeedInvalid ? NULL :
+				          job->SeedBuffer + plane * length,
+				      length);
+
+        memcpy(job->SeedBuffer + plane * length, line, length);
+	break;
+
+    case 9 :
+        //
+        // Do compressed replacement delta-row compression...
+        //
+
+	line_ptr = job->CompBuffer;
+	line_end = job->CompBuffer +
+	           pcl_compress_delta_rle(job->CompBuffer, line,
+		                          job->SeedInvalid ? NULL :
+					      job->SeedBuffer + plane * length,
+					  length);
+
+        memcpy(job->SeedBuffer + plane * length, line, length);
 	break;
 
     case 10 :
@@ -1210,10 +1704,21 @@ CompressData(unsigned char *line,	// I - Data to compress
 	line_ptr = line;
 	line_end = line + length;
 
-	comp_ptr = CompBuffer;
-	seed     = SeedBuffer;
+	comp_ptr = job->CompBuffer;
+	seed     = job->SeedBuffer;
+
+	if (job->SeedInvalid)
+	{
+	  //
+	  // The printer's seed row is not known, so make every byte of ours
+	  // differ by 128; this sends the whole line as new pixels...
+	  //
+
+	  for (count = 0; count < length; count ++)
+	    seed[count] = line[count] ^ 0x80;
+	}
 
-        if (PrinterPlanes == 1)
+        if (job->PrinterPlanes == 1)
 	{
 	  //
 	  // Do grayscale compression to RGB...
@@ -1225,38 +1730,29 @@ CompressData(unsigned char *line,	// I - Data to compress
             // Find the next non-matching sequence...
 	    //
 
-            start = line_ptr;
-            while (line_ptr < line_end &&
-	           *line_ptr == *seed)
-            {
-              line_ptr ++;
-              seed ++;
-            }
+            offset   = (int)raster_count_same(line_ptr, seed,
+	                                      (size_t)(line_end - line_ptr));
+            line_ptr += offset;
+            seed     += offset;
 
             if (line_ptr == line_end)
               break;
 
-            offset = line_ptr - start;
-
 	    //
             // Find non-matching grayscale pixels...
 	    //
 
-            start = line_ptr;
-            while (line_ptr < line_end &&
-	           *line_ptr != *seed)
-            {
-              line_ptr ++;
-              seed ++;
-            }
-
-            count = line_ptr - start;
+            start    = line_ptr;
+            count    = (int)raster_count_diff(line_ptr, seed,
+	                                      (size_t)(line_end - line_ptr));
+            line_ptr += count;
+            seed     += count;
 
 #if 0
-            fprintf(stderr,
-		    "DEBUG: offset=%d, count=%d, comp_ptr=%p(%d of %d)...\n",
-	            offset, count, comp_ptr, comp_ptr - CompBuffer,
-		    BytesPerLine * 5);
+	    JobLog(job, CF_LOGLEVEL_DEBUG,
+		   "offset=%d, count=%d, comp_ptr=%p(%d of %d)...",
+		   offset, count, comp_ptr, comp_ptr - job->CompBuffer,
+		   BytesPerLine * 5);
 #endif // 0
 
 	    //
@@ -1393,36 +1889,25 @@ CompressData(unsigned char *line,	// I - Data to compress
             // Find the next non-matching sequence...
 	    //
 
-            start = line_ptr;
-            while (line_ptr[0] == seed[0] &&
-                   line_ptr[1] == seed[1] &&
-                   line_ptr[2] == seed[2] &&
-                   (line_ptr + 2) < line_end)
-            {
-              line_ptr += 3;
-              seed += 3;
-            }
+            offset   = (int)raster_count_same(line_ptr, seed,
+	                                      (size_t)(line_end - line_ptr)) /
+	               3;
+            line_ptr += 3 * offset;
+            seed     += 3 * offset;
 
             if (line_ptr == line_end)
               break;
 
-            offset = (line_ptr - start) / 3;
-
 	    //
             // Find non-matching RGB tuples...
 	    //
 
-            start = line_ptr;
-            while ((line_ptr[0] != seed[0] ||
-                    line_ptr[1] != seed[1] ||
-                    line_ptr[2] != seed[2]) &&
-                   (line_ptr + 2) < line_end)
-            {
-              line_ptr += 3;
-              seed += 3;
-            }
-
-            count = (line_ptr - start) / 3;
+            start    = line_ptr;
+            count    = (int)raster_count_diff_rgb(line_ptr, seed,
+	                                          (size_t)(line_end -
+						           line_ptr) / 3);
+            line_ptr += 3 * count;
+            seed     += 3 * count;
 
 	    //
 	    // Place mode 10 compression data in the buffer; each sequence
@@ -1545,19 +2030,153 @@ CompressData(unsigned char *line,	// I - Data to compress
           }
         }
 
-	line_ptr = CompBuffer;
+	line_ptr = job->CompBuffer;
 	line_end = comp_ptr;
 
-        memcpy(SeedBuffer, line, length);
+        memcpy(job->SeedBuffer, line, length);
 	break;
   }
 
+  raster_stats_add(job->Stats, RASTER_STAGE_COMPRESS, stats_start,
+                   (size_t)(line_end - line_ptr));
+
   //
   // Set the length of the data and write a raster plane...
   //
 
-  printf("\033*b%d%c", (int)(line_end - line_ptr), pend);
-  cfWritePrintData(line_ptr, line_end - line_ptr);
+  raster_out_printf(job->Output, "\033*b%d%c", (int)(line_end - line_ptr),
+		    pend);
+  raster_out_write(job->Output, line_ptr, line_end - line_ptr);
+}
+
+
+//
+// 'TrimLine()' - Narrow the raster to the inked columns of a line.
+//
+// Non-blank lines are sent in bands.  The first line of a band picks the
+// columns that are sent and the following lines only widen them, since
+// every change ends raster graphics and starts it again without a seed
+// row.  The cursor is moved relative to the current left raster margin,
+// which is where the cursor is left when raster graphics end.
+//
+
+void
+TrimLine(pcl_job_t           *job,	// I - Job data
+         ppd_file_t          *ppd,	// I - PPD file
+         cups_page_header2_t *header,	// I - Page header
+         const unsigned char *buffer,	// I - Packed rows
+         int                 rows,	// I - Number of rows
+         int                 bytes,	// I - Bytes in each row
+         int                 *left,	// O - First byte to send
+         int                 *length)	// O - Bytes to send from each row
+{
+  int			i,		// Looping var
+			row,		// Current row
+			first,		// First inked byte
+			last,		// Last inked byte
+			right,		// Last byte + 1 to send
+			pad,		// Extra bytes when widening
+			width;		// Width of raster in pixels
+  const unsigned char	*ptr;		// Current row
+
+
+  if (job->TrimPage)
+  {
+    //
+    // Find the first and last inked bytes over all rows...
+    //
+
+    first = bytes;
+    last  = -1;
+
+    for (row = 0, ptr = buffer; row < rows; row ++, ptr += bytes)
+    {
+      for (i = 0; i < first && !ptr[i]; i ++);
+      first = i;
+
+      for (i = bytes - 1; i > last && !ptr[i]; i --);
+      last = i;
+    }
+
+    //
+    // Pick the columns to send; lines without any dots after dithering
+    // fit in any raster...
+    //
+
+    if (last < first)
+    {
+      first = job->TrimLeft;
+      right = job->TrimRight;
+    }
+    else if (job->TrimStart)
+    {
+      right = last + 1;
+
+      if (first >= job->TrimLeft && right <= job->TrimRight &&
+          first - job->TrimLeft + job->TrimRight - right <= TRIM_SLACK)
+      {
+        first = job->TrimLeft;
+	right = job->TrimRight;
+      }
+    }
+    else
+    {
+      //
+      // Widen the raster as needed; rows sent relative to a seed row
+      // start over with a whole row after each change, so leave them
+      // some room to grow...
+      //
+
+      right = last + 1;
+      pad   = job->Compression >= 3 ||
+              job->Compression == COMPRESS_ADAPTIVE ? TRIM_SLACK : 0;
+
+      if (first >= job->TrimLeft)
+        first = job->TrimLeft;
+      else if ((first -= pad) < 0)
+        first = 0;
+
+      if (right <= job->TrimRight)
+        right = job->TrimRight;
+      else if ((right += pad) > bytes)
+        right = bytes;
+    }
+
+    if (first != job->TrimLeft || right != job->TrimRight)
+    {
+      //
+      // End raster graphics, move to the new left margin and start again
+      // with the new width...
+      //
+
+      if (ppd && (ppd->model_number & PCL_RASTER_END_COLOR))
+	raster_out_printf(job->Output, "\033*rC");
+      else
+	raster_out_printf(job->Output, "\033*r0B");
+
+      if (first != job->TrimLeft)
+        raster_out_printf(job->Output, "\033*p%+dX",
+	                  (first - job->TrimLeft) * 8);
+
+      width = right * 8;
+      if (width > (int)header->cupsWidth)
+        width = header->cupsWidth;
+
+      raster_out_printf(job->Output, "\033*r%dS\033*r1A", width - first * 8);
+
+      if (job->CompMode)
+        raster_out_printf(job->Output, "\033*b%dM", job->CompMode);
+
+      job->TrimLeft    = first;
+      job->TrimRight   = right;
+      job->SeedInvalid = 1;
+    }
+
+    job->TrimStart = 0;
+  }
+
+  *left   = job->TrimLeft;
+  *length = job->TrimRight - job->TrimLeft;
 }
 
 
@@ -1566,34 +2185,40 @@ CompressData(unsigned char *line,	// I - Data to compress
 //
 
 void
-OutputLine(ppd_file_t         *ppd,	// I - PPD file
+OutputLine(pcl_job_t           *job,	// I - Job data
+           ppd_file_t          *ppd,	// I - PPD file
            cups_page_header2_t *header)	// I - Page header
 {
   int			i, j;		// Looping vars
   int			plane;		// Current plane
   unsigned char		bit;		// Current bit
   int			bytes;		// Number of bytes/plane
+  int			left,		// First byte to send
+			length;		// Number of bytes to send
   int			width;		// Width of line in pixels
   const int		*order;		// Order to use
   unsigned char		*ptr;		// Pointer into buffer
+  long long		start;		// Start time of packing
 
 
   //
   // Output whitespace as needed...
   //
 
-  if (OutputFeed > 0)
+  if (job->OutputFeed > 0)
   {
-    if (header->cupsCompression < 3)
+    job->TrimStart = 1;
+
+    if (job->Compression >= 0 && job->Compression < 3)
     {
       //
       // Send blank raster lines...
       //
 
-      while (OutputFeed > 0)
+      while (job->OutputFeed > 0)
       {
-	printf("\033*b0W");
-	OutputFeed --;
+	raster_out_printf(job->Output, "\033*b0W");
+	job->OutputFeed --;
       }
     }
     else
@@ -1602,9 +2227,9 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
       // Send Y offset command and invalidate the seed buffer...
       //
 
-      printf("\033*b%dY", OutputFeed);
-      OutputFeed  = 0;
-      SeedInvalid = 1;
+      raster_out_printf(job->Output, "\033*b%dY", job->OutputFeed);
+      job->OutputFeed  = 0;
+      job->SeedInvalid = 1;
     }
   }
 
@@ -1612,82 +2237,87 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
   // Write bitmap data as needed...
   //
 
-  switch (OutputMode)
+  switch (job->OutputMode)
   {
     case OUTPUT_BITMAP :		// Send 1-bit bitmap data...
-	order = ColorOrders[PrinterPlanes - 1];
-	bytes = header->cupsBytesPerLine / PrinterPlanes;
+	order = ColorOrders[job->PrinterPlanes - 1];
+	bytes = header->cupsBytesPerLine / job->PrinterPlanes;
+
+	TrimLine(job, ppd, header, job->PixelBuffer, job->PrinterPlanes,
+	         bytes, &left, &length);
 
-	for (i = 0; i < PrinterPlanes; i ++)
+	for (i = 0; i < job->PrinterPlanes; i ++)
 	{
 	  plane = order[i];
 
-	  CompressData(PixelBuffer + i * bytes, bytes, plane,
-	               (i < (PrinterPlanes - 1)) ? 'V' : 'W',
-		       header->cupsCompression);
+	  CompressData(job, job->PixelBuffer + i * bytes + left, length,
+	               plane, (i < (job->PrinterPlanes - 1)) ? 'V' : 'W',
+		       job->Compression);
         }
         break;
 
     case OUTPUT_INVERBIT :		// Send inverted 1-bit bitmap data...
-	order = ColorOrders[PrinterPlanes - 1];
-	bytes = header->cupsBytesPerLine / PrinterPlanes;
+	order = ColorOrders[job->PrinterPlanes - 1];
+	bytes = header->cupsBytesPerLine / job->PrinterPlanes;
 
-        for (i = header->cupsBytesPerLine, ptr = PixelBuffer;
-	     i > 0;
-	     i --, ptr ++)
-	  *ptr = ~*ptr;
+	TrimLine(job, ppd, header, job->PixelBuffer, job->PrinterPlanes,
+	         bytes, &left, &length);
 
-	for (i = 0; i < PrinterPlanes; i ++)
+	for (i = 0; i < job->PrinterPlanes; i ++)
 	{
 	  plane = order[i];
 
-	  CompressData(PixelBuffer + i * bytes, bytes, plane,
-	               (i < (PrinterPlanes - 1)) ? 'V' : 'W',
-		       header->cupsCompression);
+	  CompressData(job, job->PixelBuffer + i * bytes + left, length,
+	               plane, (i < (job->PrinterPlanes - 1)) ? 'V' : 'W',
+		       job->Compression);
         }
         break;
 
     case OUTPUT_RGB :			// Send 24-bit RGB data...
-        if (PrinterPlanes == 1 && !BlankValue)
-	{
-	  //
-	  // Invert black to grayscale...
-	  //
+	CompressData(job, job->PixelBuffer, header->cupsBytesPerLine, 0, 'W',
+	             job->Compression);
+        break;
 
-          for (i = header->cupsBytesPerLine, ptr = PixelBuffer;
-	       i > 0;
-	       i --, ptr ++)
-	    *ptr = ~*ptr;
-	}
+    default :
+	order = ColorOrders[job->PrinterPlanes - 1];
+	width = header->cupsWidth;
+	bytes = (width + 7) / 8;
 
 	//
-	// Compress the output...
+	// Pack each bit of each plane into its own row...
 	//
 
-	CompressData(PixelBuffer, header->cupsBytesPerLine, 0, 'W',
-	             header->cupsCompression);
-        break;
+	start = raster_stats_start(job->Stats);
 
-    default :
-	order = ColorOrders[PrinterPlanes - 1];
-	width = header->cupsWidth;
+	for (plane = 0; plane < job->PrinterPlanes; plane ++)
+	{
+	  for (bit = 1, ptr = job->DotBuffers[plane];
+	       bit <= job->DotBits[plane];
+	       bit <<= 1, ptr += bytes)
+	    cfPackHorizontalBit(job->OutputBuffers[plane], ptr, width, 0, bit);
+	}
+
+	raster_stats_add(job->Stats, RASTER_STAGE_PACK, start,
+	                 job->DotBufferSize);
+
+	//
+	// Then compress the rows in the printer's plane order...
+	//
+
+	TrimLine(job, ppd, header, job->DotBuffers[0],
+	         job->DotBufferSize / bytes, bytes, &left, &length);
 
-	for (i = 0, j = 0; i < PrinterPlanes; i ++)
+	for (i = 0, j = 0; i < job->PrinterPlanes; i ++)
 	{
 	  plane = order[i];
-	  bytes = DotBufferSizes[plane] / DotBits[plane];
 
-	  for (bit = 1, ptr = DotBuffers[plane];
-	       bit <= DotBits[plane];
+	  for (bit = 1, ptr = job->DotBuffers[plane];
+	       bit <= job->DotBits[plane];
 	       bit <<= 1, ptr += bytes, j ++)
-	  {
-	    cfPackHorizontalBit(OutputBuffers[plane], DotBuffers[plane],
-	                          width, 0, bit);
-            CompressData(ptr, bytes, j,
-	                 i == (PrinterPlanes - 1) &&
-			     bit == DotBits[plane] ? 'W' : 'V',
-			 header->cupsCompression);
-          }
+            CompressData(job, ptr + left, length, j,
+	                 i == (job->PrinterPlanes - 1) &&
+			     bit == job->DotBits[plane] ? 'W' : 'V',
+			 job->Compression);
 	}
 	break;
   }
@@ -1696,7 +2326,13 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
   // The seed buffer, if any, now should contain valid data...
   //
 
-  SeedInvalid = 0;
+  job->SeedInvalid = 0;
+
+  //
+  // Write the output once enough lines have been collected...
+  //
+
+  raster_out_checkpoint(job->Output);
 }
 
 
@@ -1705,31 +2341,64 @@ OutputLine(ppd_file_t         *ppd,	// I - PPD file
 //
 
 int					// O - Number of lines (0 if blank)
-ReadLine(cups_raster_t      *ras,	// I - Raster stream
+ReadLine(pcl_job_t           *job,	// I - Job data
+         cups_raster_t       *ras,	// I - Raster stream
          cups_page_header2_t *header)	// I - Page header
 {
-  int	plane,				// Current color plane
-	width;				// Width of line
+  int		plane,			// Current color plane
+		width,			// Width of line
+		y;			// Line on the page
+  const unsigned char *line;		// Line that was read
+  long long	start;			// Start time of stage
 
 
   //
-  // Read raster data...
+  // Read raster data, or use the next line of a page that was read
+  // ahead...
   //
 
-  cupsRasterReadPixels(ras, PixelBuffer, header->cupsBytesPerLine);
+  y = job->Line ++;
+
+  if (job->PageLines)
+  {
+    line = job->PageLines + (size_t)job->PageLine * header->cupsBytesPerLine;
+    job->PageLine ++;
+  }
+  else
+  {
+    start = raster_stats_start(job->Stats);
+
+    cupsRasterReadPixels(ras, job->PixelBuffer, header->cupsBytesPerLine);
+
+    raster_stats_add(job->Stats, RASTER_STAGE_READ, start,
+		     header->cupsBytesPerLine);
+
+    line = job->PixelBuffer;
+  }
 
   //
-  // See if it is blank; if so, return right away...
+  // See if it is blank; if so, return right away.  Lines that need to be
+  // inverted are inverted in the same pass, and lines that were read ahead
+  // are only copied when they are not blank...
   //
 
-  if (cfCheckValue(PixelBuffer, header->cupsBytesPerLine, BlankValue))
+  if (job->Invert)
+  {
+    if (raster_invert_check(job->PixelBuffer, line, header->cupsBytesPerLine,
+                            job->BlankValue))
+      return (0);
+  }
+  else if (raster_check_value(line, header->cupsBytesPerLine,
+                              job->BlankValue))
     return (0);
+  else if (line != job->PixelBuffer)
+    memcpy(job->PixelBuffer, line, header->cupsBytesPerLine);
 
   //
   // If we aren't dithering, return immediately...
   //
 
-  if (OutputMode != OUTPUT_DITHERED)
+  if (job->OutputMode != OUTPUT_DITHERED)
     return (1);
 
   //
@@ -1737,54 +2406,69 @@ ReadLine(cups_raster_t      *ras,	// I - Raster stream
   //
 
   width = header->cupsWidth;
+  start = raster_stats_start(job->Stats);
 
   switch (header->cupsColorSpace)
   {
     case CUPS_CSPACE_W :
-        if (RGB)
+        if (job->RGB)
 	{
-	  cfRGBDoGray(RGB, PixelBuffer, CMYKBuffer, width);
+	  cfRGBDoGray(job->RGB, job->PixelBuffer, job->CMYKBuffer, width);
 
-	  if (RGB->num_channels == 1)
-	    cfCMYKDoBlack(CMYK, CMYKBuffer, InputBuffer, width);
+	  if (job->RGB->num_channels == 1)
+	    cfCMYKDoBlack(job->CMYK, job->CMYKBuffer, job->InputBuffer, width);
 	  else
-	    cfCMYKDoCMYK(CMYK, CMYKBuffer, InputBuffer, width);
+	    cfCMYKDoCMYK(job->CMYK, job->CMYKBuffer, job->InputBuffer, width);
 	}
 	else
-          cfCMYKDoGray(CMYK, PixelBuffer, InputBuffer, width);
+          cfCMYKDoGray(job->CMYK, job->PixelBuffer, job->InputBuffer, width);
 	break;
 
     case CUPS_CSPACE_K :
-        cfCMYKDoBlack(CMYK, PixelBuffer, InputBuffer, width);
+        cfCMYKDoBlack(job->CMYK, job->PixelBuffer, job->InputBuffer, width);
 	break;
 
     default :
     case CUPS_CSPACE_RGB :
-        if (RGB)
+        if (job->RGB)
 	{
-	  cfRGBDoRGB(RGB, PixelBuffer, CMYKBuffer, width);
+	  cfRGBDoRGB(job->RGB, job->PixelBuffer, job->CMYKBuffer, width);
 
-	  if (RGB->num_channels == 1)
-	    cfCMYKDoBlack(CMYK, CMYKBuffer, InputBuffer, width);
+	  if (job->RGB->num_channels == 1)
+	    cfCMYKDoBlack(job->CMYK, job->CMYKBuffer, job->InputBuffer, width);
 	  else
-	    cfCMYKDoCMYK(CMYK, CMYKBuffer, InputBuffer, width);
+	    cfCMYKDoCMYK(job->CMYK, job->CMYKBuffer, job->InputBuffer, width);
 	}
 	else
-          cfCMYKDoRGB(CMYK, PixelBuffer, InputBuffer, width);
+          cfCMYKDoRGB(job->CMYK, job->PixelBuffer, job->InputBuffer, width);
 	break;
 
     case CUPS_CSPACE_CMYK :
-        cfCMYKDoCMYK(CMYK, PixelBuffer, InputBuffer, width);
+        cfCMYKDoCMYK(job->CMYK, job->PixelBuffer, job->InputBuffer, width);
 	break;
   }
 
+  raster_stats_add(job->Stats, RASTER_STAGE_SEPARATE, start,
+                   width * job->PrinterPlanes * sizeof(short));
+
   //
   // Dither the pixels...
   //
 
-  for (plane = 0; plane < PrinterPlanes; plane ++)
-    cfDitherLine(DitherStates[plane], DitherLuts[plane], InputBuffer + plane,
-                   PrinterPlanes, OutputBuffers[plane]);
+  start = raster_stats_start(job->Stats);
+
+  for (plane = 0; plane < job->PrinterPlanes; plane ++)
+    if (job->DitherMatrix)
+      raster_dither_line(job->DitherMatrix, job->DitherLevels[plane],
+                         job->InputBuffer + plane, job->PrinterPlanes,
+			 job->OutputBuffers[plane], width, y, plane);
+    else
+      cfDitherLine(job->DitherStates[plane], job->DitherLuts[plane],
+		   job->InputBuffer + plane, job->PrinterPlanes,
+		   job->OutputBuffers[plane]);
+
+  raster_stats_add(job->Stats, RASTER_STAGE_DITHER, start,
+		   width * job->PrinterPlanes);
 
   //
   // Return 1 to indicate that we have non-blank output...
@@ -1795,126 +2479,933 @@ ReadLine(cups_raster_t      *ras,	// I - Raster stream
 
 
 //
-// 'main()' - Main entry and processing of driver.
+// 'ReadPage()' - Read a whole page into memory.
 //
 
-int					// O - Exit status
-main(int  argc,				// I - Number of command-line arguments
-     char *argv[])			// I - Command-line arguments
+int					// O - 1 on success, 0 if out of memory
+ReadPage(pcl_job_t           *job,	// I  - Job data
+         cups_raster_t       *ras,	// I  - Raster stream
+         cups_page_header2_t *header,	// I  - Page header
+	 unsigned char       **lines,	// IO - Page buffer
+	 size_t              *size)	// IO - Size of page buffer
 {
-  int			fd;		// File descriptor
-  int empty = 1;
-  cups_raster_t		*ras;		// Raster stream for printing
-  cups_page_header2_t	header;		// Page header from file
-  int			y;		// Current line
-  ppd_file_t		*ppd;		// PPD file
-  int			job_id;		// Job ID
-  int			num_options;	// Number of options
-  cups_option_t		*options;	// Options
-#if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
-  struct sigaction action;		// Actions for POSIX signals
-#endif // HAVE_SIGACTION && !HAVE_SIGSET
+  int		y;			// Current line
+  size_t	length;			// Size of page raster
+  long long	start;			// Start time of read
+
+
+  length = (size_t)header->cupsBytesPerLine * header->cupsHeight;
+
+  if (length > *size)
+  {
+    free(*lines);
+
+    if ((*lines = malloc(length)) == NULL)
+    {
+      *size = 0;
+      return (0);
+    }
+
+    *size = length;
+  }
+
+  start = raster_stats_start(job->Stats);
+
+  for (y = 0; y < (int)header->cupsHeight; y ++)
+    cupsRasterReadPixels(ras, *lines + (size_t)y * header->cupsBytesPerLine,
+                         header->cupsBytesPerLine);
+
+  raster_stats_add(job->Stats, RASTER_STAGE_READ, start, length);
+
+  return (1);
+}
+
+
+//
+// 'ReplayPage()' - Send the graphics of a cached page again.
+//
+
+int					// O - 1 if sent, 0 if not cached
+ReplayPage(pcl_cache_t              *cache,
+					// I - Page cache
+           cups_page_header2_t      *header,
+					// I - Page header
+           const unsigned long long *hash,
+					// I - Hash of page raster
+	   raster_out_t             *out)
+					// I - Output buffer
+{
+  int		i;			// Looping var
+  pcl_cached_t	*page;			// Current cached page
+
+
+  for (i = cache->num_pages, page = cache->pages; i > 0; i --, page ++)
+    if (page->hash[0] == hash[0] && page->hash[1] == hash[1] &&
+        !memcmp(&page->header, header, sizeof(cups_page_header2_t)))
+    {
+      page->use = ++ cache->use;
+
+      raster_out_write(out, page->data, page->size);
+
+      return (1);
+    }
+
+  return (0);
+}
+
+
+//
+// 'CachePage()' - Keep the graphics of a page for identical pages.
+//
+// The least recently used pages are dropped to make room.  Pages with more
+// graphics than fit in the cache are not kept.
+//
+
+void
+CachePage(pcl_cache_t              *cache,
+					// I - Page cache
+          cups_page_header2_t      *header,
+					// I - Page header
+          const unsigned long long *hash,
+					// I - Hash of page raster
+	  raster_out_t             *body)
+					// I - Graphics of page
+{
+  int		i;			// Looping var
+  unsigned char	*data;			// Copy of graphics
+  size_t	size;			// Size of graphics
+  pcl_cached_t	*page,			// Cached page
+		*temp;			// Current cached page
+
+
+  if ((data = raster_out_dup(body, &size)) == NULL)
+    return;
+
+  if (size > cache->max_size)
+  {
+    free(data);
+    return;
+  }
+
+  while (cache->num_pages >= CACHE_MAX ||
+         (cache->num_pages > 0 && cache->size + size > cache->max_size))
+  {
+    for (i = cache->num_pages - 1, page = cache->pages,
+             temp = cache->pages + 1;
+         i > 0;
+	 i --, temp ++)
+      if (temp->use < page->use)
+        page = temp;
+
+    cache->size -= page->size;
+    free(page->data);
+
+    *page = cache->pages[-- cache->num_pages];
+  }
+
+  page = cache->pages + cache->num_pages ++;
+
+  page->header  = *header;
+  page->hash[0] = hash[0];
+  page->hash[1] = hash[1];
+  page->data    = data;
+  page->size    = size;
+  page->use     = ++ cache->use;
+
+  cache->size += size;
+}
+
+
+//
+// 'FreeCache()' - Free the page cache at the end of the job.
+//
+
+void
+FreeCache(pcl_cache_t *cache)		// I - Page cache
+{
+  int		i;			// Looping var
+
+
+  if (!cache)
+    return;
+
+  for (i = 0; i < cache->num_pages; i ++)
+    free(cache->pages[i].data);
+
+  free(cache);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+//
+// 'StartPages()' - Start the threads that render pages.
+//
+
+pcl_pool_t *				// O - Page threads or NULL on failure
+StartPages(pcl_job_t        *job,	// I - Job data
+           cf_filter_data_t *data,	// I - Filter data
+           ppd_file_t       *ppd)	// I - PPD file
+{
+  int		i;			// Looping var
+  pcl_pool_t	*pool;			// Page threads
+  pcl_job_t	*page_job;		// Job data for a page slot
+
+
+  if ((pool = calloc(1, sizeof(pcl_pool_t))) == NULL)
+    return (NULL);
 
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  pool->data       = data;
+  pool->ppd        = ppd;
+  pool->cache      = job->Cache;
+  pool->iscanceled = data->iscanceledfunc;
+  pool->icd        = data->iscanceleddata;
+  pool->written    = 1;
+
+  if ((pool->num_pages = job->Threads) > PAGE_THREADS_MAX)
+    pool->num_pages = PAGE_THREADS_MAX;
 
   //
-  // Log function for the library functions, standard CUPS logging to stderr...
+  // The buffer limit of the job is shared evenly by the page slots...
   //
 
-  logfunc = cfCUPSLogFunc;
-  ld = NULL;
+  if (job->BufferSize > 0)
+    pool->slot_size = (size_t)job->BufferSize * 1024 * 1024 /
+                      (size_t)pool->num_pages;
 
   //
-  // Make sure status messages are not buffered...
+  // Each page slot has its own job data with a memory output buffer,
+  // stage statistics and color profile cache; the compiled PJL commands
+  // are shared...
   //
 
-  setbuf(stderr, NULL);
+  for (i = 0; i < pool->num_pages; i ++)
+  {
+    if ((page_job = calloc(1, sizeof(pcl_job_t))) == NULL)
+    {
+      FinishPages(job, pool);
+      return (NULL);
+    }
+
+    pool->pages[i].job = page_job;
+
+    page_job->Adaptive   = job->Adaptive;
+    page_job->Trim       = job->Trim;
+    page_job->DitherMode = job->DitherMode;
+    page_job->Output     = raster_out_new(-1, 0, job->logfunc, job->ld);
+    page_job->Stats      = raster_stats_slot(job->Stats);
+    page_job->logfunc    = job->logfunc;
+    page_job->ld         = job->ld;
+
+    memcpy(page_job->PJL, job->PJL, sizeof(page_job->PJL));
+
+    if (!page_job->Output || (job->Stats && !page_job->Stats))
+    {
+      FinishPages(job, pool);
+      return (NULL);
+    }
+  }
 
   //
-  // Check command-line...
+  // Start the threads...
   //
 
-  cf_filter_data_t temp;
-  cf_filter_data_t *data = &temp;
-  data->printer = getenv("PRINTER");
-  data->logdata = NULL;
-  data->logfunc = cfCUPSLogFunc;
-  if (argc < 6 || argc > 7)
+  for (i = 0; i < pool->num_pages; i ++)
   {
-    fprintf(stderr, "Usage: %s job-id user title copies options [file]\n",
-	    "rastertopclx");
-    return (1);
+    if (pthread_create(pool->threads + i, NULL, PageThread, pool))
+    {
+      FinishPages(job, pool);
+      return (NULL);
+    }
+
+    pool->num_started ++;
   }
 
-  num_options = cupsParseOptions(argv[5], 0, &options);
+  JobLog(job, CF_LOGLEVEL_DEBUG, "Started %d page threads.",
+         pool->num_pages);
+
+  return (pool);
+}
+
+
+//
+// 'QueuePage()' - Read a page and queue it for the page threads.
+//
+// The page uses the next slot once the page that used it before has been
+// sent.  If the page raster does not fit in the slot's share of the buffer
+// limit or there is not enough memory to read it ahead, the earlier pages
+// are sent and the page is rendered in this thread straight to the
+// printer instead.
+//
+
+void
+QueuePage(pcl_job_t           *job,	// I - Job data
+          pcl_pool_t          *pool,	// I - Page threads
+          cf_filter_data_t    *data,	// I - Filter data
+          ppd_file_t          *ppd,	// I - PPD file
+          cups_page_header2_t *header,	// I - Page header
+          cups_raster_t       *ras)	// I - Raster stream
+{
+  int		y;			// Current line
+  size_t	size;			// Size of page raster
+  int		replayed;		// Was the page sent from the cache?
+  pcl_page_t	*page;			// Page slot
+  pcl_job_t	*page_job;		// Job data for the page
+  raster_out_t	*output = NULL;		// Output buffer of the slot
+  long long	start;			// Start time of read
+
+
+  page     = pool->pages + (job->Page - 1) % pool->num_pages;
+  page_job = page->job;
 
   //
-  // Open the PPD file...
+  // Send finished pages until the slot is free...
   //
 
-  ppd = ppdOpenFile(getenv("PPD"));
+  WritePages(job, pool, job->Page - pool->num_pages);
 
-  if (ppd)
+  //
+  // Get a buffer for the page raster...
+  //
+
+  size = (size_t)header->cupsBytesPerLine * header->cupsHeight;
+
+  if (size > pool->slot_size || size > page->size)
   {
-    ppdMarkDefaults(ppd);
-    ppdMarkOptions(ppd, num_options, options);
+    free(page->lines);
+
+    if (size <= pool->slot_size && (page->lines = malloc(size)) != NULL)
+      page->size = size;
+    else
+    {
+      page->lines = NULL;
+      page->size  = 0;
+    }
   }
-  else
+
+  if (!page->lines)
   {
-    ppd_status_t	status;		// PPD error
-    int			linenum;	// Line number
+    //
+    // Send the earlier pages and render this one straight to the
+    // printer...
+    //
 
-    fputs("DEBUG: The PPD file could not be opened.\n", stderr);
+    JobLog(job, CF_LOGLEVEL_DEBUG,
+	   "Unable to read page %d ahead, rendering it in order.", job->Page);
 
-    status = ppdLastError(&linenum);
+    WritePages(job, pool, job->Page - 1);
 
-    fprintf(stderr, "DEBUG: %s on line %d.\n", ppdErrorString(status), linenum);
+    output           = page_job->Output;
+    page_job->Output = job->Output;
   }
 
   //
-  // Open the page stream...
+  // Start the page...
+  //
+
+  page->header   = *header;
+  page->overflow = 0;
+  page_job->Page = job->Page;
+
+  StartPage(page_job, data, ppd, &page->header, data->job_id,
+	    data->job_user, data->job_title, data->num_options,
+	    data->options);
+
+  page_job->PageLines = page->lines;
+  page_job->PageLine  = 0;
+
+  //
+  // Read the page...
   //
 
-  if (argc == 7)
+  for (y = 0; y < (int)header->cupsHeight; y ++)
   {
-    if ((fd = open(argv[6], O_RDONLY)) == -1)
+    //
+    // Let the user know how far we have progressed...
+    //
+
+    if (pool->iscanceled && pool->iscanceled(pool->icd))
+      break;
+
+    if ((y & 127) == 0)
     {
-      perror("ERROR: Unable to open raster file");
-      return (1);
+      JobLog(job, CF_LOGLEVEL_INFO, "Printing page %d, %d%% complete.",
+	     job->Page, 100 * y / header->cupsHeight);
+      JobLog(job, CF_LOGLEVEL_CONTROL, "ATTR: job-media-progress=%d",
+	     100 * y / header->cupsHeight);
+    }
+
+    if (page->lines)
+    {
+      start = raster_stats_start(page_job->Stats);
+
+      cupsRasterReadPixels(ras,
+                           page->lines +
+			       (size_t)y * header->cupsBytesPerLine,
+			   header->cupsBytesPerLine);
+
+      raster_stats_add(page_job->Stats, RASTER_STAGE_READ, start,
+		       header->cupsBytesPerLine);
+    }
+    else if (ReadLine(page_job, ras, &page->header))
+      OutputLine(page_job, ppd, &page->header);
+    else
+      page_job->OutputFeed ++;
+  }
+
+  page->height = y;
+
+  //
+  // Send the graphics of an identical page that was printed before...
+  //
+
+  replayed = 0;
+
+  if (page->lines && pool->cache && y == (int)header->cupsHeight)
+  {
+    page->hash[0] = page->hash[1] = 0;
+    raster_hash(page->hash, page->lines, size);
+
+    pthread_mutex_lock(&pool->mutex);
+    replayed = ReplayPage(pool->cache, &page->header, page->hash,
+                          page_job->Output);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (replayed)
+      JobLog(job, CF_LOGLEVEL_DEBUG,
+             "Page %d is the same as an earlier page.", job->Page);
+  }
+
+  //
+  // Hand the page to the threads, or finish it here...
+  //
+
+  if (!page->lines || replayed)
+    EndPage(page_job, ppd, &page->header);
+
+  if (output)
+    page_job->Output = output;
+
+  pthread_mutex_lock(&pool->mutex);
+  page->state = page->lines && !replayed ? PAGE_READY : PAGE_DONE;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+
+//
+// 'RenderPage()' - Render a page that has been read ahead.
+//
+// The output of the page may use what is left of the slot's share of the
+// buffer limit after the raster.  If it needs more, or memory runs out,
+// rendering stops and RetryPage() renders the page again when it is its
+// turn to be sent.
+//
+
+void
+RenderPage(pcl_pool_t *pool,		// I - Page threads
+           pcl_page_t *page)		// I - Page slot
+{
+  int		y;			// Current line
+  pcl_job_t	*page_job = page->job;	// Job data for the page
+  raster_out_t	*output = NULL,		// Page output with cache
+		*body;			// Graphics of page
+  size_t	max_output;		// Room for output in the slot
+
+
+  max_output = pool->slot_size - page->size;
+
+  //
+  // Collect the graphics separately when they go in the cache...
+  //
+
+  if (pool->cache && page->height == (int)page->header.cupsHeight &&
+      (body = raster_out_new(-1, 0, page_job->logfunc,
+                             page_job->ld)) != NULL)
+  {
+    output           = page_job->Output;
+    page_job->Output = body;
+  }
+
+  for (y = 0; y < page->height; y ++)
+  {
+    if (pool->iscanceled && pool->iscanceled(pool->icd))
+      break;
+
+    if (output &&
+        raster_out_length(page_job->Output) > pool->cache->max_size)
+    {
+      //
+      // Too big for the cache, stop collecting the graphics...
+      //
+
+      body             = page_job->Output;
+      page_job->Output = output;
+      output           = NULL;
+
+      raster_out_append(page_job->Output, body);
+      raster_out_delete(body);
+    }
+
+    if (raster_out_length(page_job->Output) +
+            (output ? raster_out_length(output) : 0) > max_output ||
+        raster_out_flush(page_job->Output) ||
+        (output && raster_out_flush(output)))
+    {
+      page->overflow = 1;
+      break;
+    }
+
+    if (ReadLine(page_job, NULL, &page->header))
+      OutputLine(page_job, pool->ppd, &page->header);
+    else
+      page_job->OutputFeed ++;
+  }
+
+  if (output)
+  {
+    body             = page_job->Output;
+    page_job->Output = output;
+
+    if (y == page->height && !page->overflow)
+    {
+      pthread_mutex_lock(&pool->mutex);
+      CachePage(pool->cache, &page->header, page->hash, body);
+      pthread_mutex_unlock(&pool->mutex);
+    }
+
+    raster_out_append(output, body);
+    raster_out_delete(body);
+  }
+
+  EndPage(page_job, pool->ppd, &page->header);
+}
+
+
+//
+// 'RetryPage()' - Render a page whose output did not fit in its slot
+//                 straight to the printer.
+//
+
+void
+RetryPage(pcl_job_t  *job,		// I - Job data
+          pcl_pool_t *pool,		// I - Page threads
+          pcl_page_t *page)		// I - Page slot
+{
+  int			y;		// Current line
+  pcl_job_t		*page_job = page->job;
+					// Job data for the page
+  raster_out_t		*output = page_job->Output;
+					// Output buffer of the slot
+  cf_filter_data_t	*data = pool->data;
+					// Filter data
+
+
+  JobLog(job, CF_LOGLEVEL_DEBUG,
+         "Output of page %d does not fit in the page buffers, rendering it "
+	 "in order.", page_job->Page);
+
+  raster_out_discard(output);
+
+  page_job->Output = job->Output;
+
+  StartPage(page_job, data, pool->ppd, &page->header, data->job_id,
+	    data->job_user, data->job_title, data->num_options,
+	    data->options);
+
+  page_job->PageLines = page->lines;
+  page_job->PageLine  = 0;
+
+  for (y = 0; y < page->height; y ++)
+  {
+    if (pool->iscanceled && pool->iscanceled(pool->icd))
+      break;
+
+    if (ReadLine(page_job, NULL, &page->header))
+      OutputLine(page_job, pool->ppd, &page->header);
+    else
+      page_job->OutputFeed ++;
+  }
+
+  EndPage(page_job, pool->ppd, &page->header);
+
+  page_job->Output = output;
+}
+
+
+//
+// 'PageThread()' - Render queued pages.
+//
+
+void *					// O - Thread exit status (unused)
+PageThread(void *arg)			// I - Page threads
+{
+  int		i;			// Looping var
+  pcl_pool_t	*pool = (pcl_pool_t *)arg;
+					// Page threads
+  pcl_page_t	*page,			// Page to render
+		*temp;			// Current page slot
+
+
+  pthread_mutex_lock(&pool->mutex);
+
+  for (;;)
+  {
+    //
+    // Render the oldest page that is waiting...
+    //
+
+    for (i = 0, page = NULL, temp = pool->pages; i < pool->num_pages;
+         i ++, temp ++)
+      if (temp->state == PAGE_READY &&
+          (!page || temp->job->Page < page->job->Page))
+	page = temp;
+
+    if (page)
+    {
+      page->state = PAGE_BUSY;
+      pthread_mutex_unlock(&pool->mutex);
+
+      RenderPage(pool, page);
+
+      pthread_mutex_lock(&pool->mutex);
+      page->state = PAGE_DONE;
+      pthread_cond_broadcast(&pool->cond);
     }
+    else if (pool->aborted)
+      break;
+    else
+      pthread_cond_wait(&pool->cond, &pool->mutex);
   }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'WritePages()' - Send rendered pages to the printer in page order.
+//
+// Pages that are done are sent right away; this waits for the pages up to
+// and including "last" to be sent.
+//
+
+void
+WritePages(pcl_job_t  *job,		// I - Job data
+           pcl_pool_t *pool,		// I - Page threads
+           int        last)		// I - Last page that must be sent
+{
+  pcl_page_t	*page;			// Next page to send
+
+
+  pthread_mutex_lock(&pool->mutex);
+
+  while (pool->written <= job->Page)
+  {
+    page = pool->pages + (pool->written - 1) % pool->num_pages;
+
+    if (page->state == PAGE_DONE)
+    {
+      pthread_mutex_unlock(&pool->mutex);
+
+      if (page->overflow)
+        RetryPage(job, pool, page);
+      else
+        raster_out_append(job->Output, page->job->Output);
+
+      raster_out_flush(job->Output);
+
+      JobLog(job, CF_LOGLEVEL_INFO, "Finished page %d.", pool->written);
+
+      raster_stats_merge(job->Stats, page->job->Stats);
+      raster_stats_page(job->Stats);
+
+      pthread_mutex_lock(&pool->mutex);
+      page->state = PAGE_FREE;
+      pool->written ++;
+    }
+    else if (pool->written <= last)
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+    else
+      break;
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+
+//
+// 'FinishPages()' - Send the remaining pages and stop the page threads.
+//
+
+void
+FinishPages(pcl_job_t  *job,		// I - Job data
+            pcl_pool_t *pool)		// I - Page threads
+{
+  int		i;			// Looping var
+  pcl_page_t	*page;			// Current page slot
+
+
+  if (pool->num_started == pool->num_pages)
+    WritePages(job, pool, job->Page);
+
+  //
+  // Tell the threads to stop and wait for them...
+  //
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->aborted = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < pool->num_started; i ++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->mutex);
+
+  //
+  // Free the page slots...
+  //
+
+  for (i = 0, page = pool->pages; i < pool->num_pages; i ++, page ++)
+  {
+    if (page->job)
+    {
+      raster_out_delete(page->job->Output);
+      raster_stats_delete(page->job->Stats);
+      FreeProfiles(page->job);
+      free(page->job);
+    }
+
+    free(page->lines);
+  }
+
+  free(pool);
+}
+#endif // HAVE_PTHREAD_H
+
+
+//
+// 'RasterToPCLX()' - Filter function to print a raster job.
+//
+// All job state lives in a private pcl_job_t, so several jobs may be
+// printed at once in the same process.
+//
+
+int					// O - Exit status
+RasterToPCLX(int              inputfd,	// I - File descriptor in
+             int              outputfd,	// I - File descriptor out
+	     int              inputseekable,
+					// I - Is input seekable? (unused)
+	     cf_filter_data_t *data,	// I - Job and printer data
+	     void             *parameters)
+					// I - Filter parameters (unused)
+{
+  pcl_job_t		*job;		// Job data
+  ppd_filter_data_ext_t	*ext;		// PPD data from the filter chain
+  cf_filter_iscanceledfunc_t iscanceled = data->iscanceledfunc;
+					// Function returning 1 when job
+					// is canceled
+  void			*icd = data->iscanceleddata;
+					// Data for iscanceled()
+  int			empty = 1;	// Is the input empty?
+  int			status = 0;	// Exit status
+  cups_raster_t		*ras;		// Raster stream for printing
+  cups_page_header2_t	header;		// Page header from file
+  int			y;		// Current line
+  ppd_file_t		*ppd;		// PPD file
+  ppd_attr_t		*attr;		// Attribute from PPD file
+  const char		*val;		// Environment variable value
+  int			cache_size;	// Size of page cache in megabytes
+  int			replayed;	// Was the page sent from the cache?
+  int			prefetch_size;	// Kilobytes to read ahead
+  raster_prefetch_t	*prefetch = NULL;
+					// Raster data read ahead, if any
+  unsigned char		*lines = NULL;	// Page raster for the cache
+  size_t		lines_size = 0;	// Size of page raster buffer
+  unsigned long long	hash[2];	// Hash of page raster
+  raster_out_t		*output = NULL,	// Printer output with cache
+			*body;		// Graphics of page
+#ifdef HAVE_PTHREAD_H
+  pcl_pool_t		*pool = NULL;	// Page threads, if any
+#endif // HAVE_PTHREAD_H
+
+
+  (void)inputseekable;
+  (void)parameters;
+
+  //
+  // Allocate the job data...
+  //
+
+  if ((job = calloc(1, sizeof(pcl_job_t))) == NULL)
+  {
+    if (data->logfunc)
+      data->logfunc(data->logdata, CF_LOGLEVEL_ERROR,
+		    "rastertopclx: Unable to allocate job data.");
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  job->logfunc = data->logfunc;
+  job->ld      = data->logdata;
+
+  //
+  // Get the PPD file, if any; it has already been loaded and marked by the
+  // caller...
+  //
+
+  ext = (ppd_filter_data_ext_t *)cfFilterDataGetExt(data,
+						     PPD_FILTER_DATA_EXT);
+
+  if (ext && ext->ppd)
+    ppd = ext->ppd;
   else
-    fd = 0;
+  {
+    ppd = NULL;
 
-  ras = cupsRasterOpen(fd, CUPS_RASTER_READ);
+    JobLog(job, CF_LOGLEVEL_DEBUG, "The PPD file could not be opened.");
+  }
 
   //
-  // Register a signal handler to eject the current page if the
-  // job is cancelled.
+  // See whether the compression mode may be chosen for each row; the
+  // environment overrides the PPD file...
   //
 
-  Canceled = 0;
+  if ((val = getenv("RASTERTOPCLX_ADAPTIVE")) != NULL)
+    job->Adaptive = atoi(val) != 0;
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLAdaptive", NULL)) != NULL &&
+           attr->value)
+    job->Adaptive = !strcasecmp(attr->value, "true");
+  else
+    job->Adaptive = 0;
 
-#ifdef HAVE_SIGSET // Use System V signals over POSIX to avoid bugs
-  sigset(SIGTERM, CancelJob);
-#elif defined(HAVE_SIGACTION)
-  memset(&action, 0, sizeof(action));
+  //
+  // See whether the blank margins of lines may be trimmed; older PCL 3
+  // printers mishandle horizontal moves in raster mode, so this is off
+  // unless the PPD file or environment asks for it...
+  //
 
-  sigemptyset(&action.sa_mask);
-  action.sa_handler = CancelJob;
-  sigaction(SIGTERM, &action, NULL);
-#else
-  signal(SIGTERM, CancelJob);
-#endif // HAVE_SIGSET
+  if ((val = getenv("RASTERTOPCLX_TRIM")) != NULL)
+    job->Trim = atoi(val) != 0;
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLTrim", NULL)) != NULL &&
+           attr->value)
+    job->Trim = !strcasecmp(attr->value, "true");
+  else
+    job->Trim = 0;
 
   //
-  // Process pages as needed...
+  // A threshold matrix ("ordered" or "bluenoise") in the environment is
+  // used for all pages; otherwise the PPD file may choose one for each
+  // color model, media type and resolution...
   //
 
-  job_id = atoi(argv[1]);
+  job->DitherMode = getenv("RASTERTOPCLX_DITHER");
+
+  //
+  // See how many pages may be rendered at the same time; the environment
+  // overrides the PPD file...
+  //
+
+  if ((val = getenv("RASTERTOPCLX_THREADS")) != NULL)
+    job->Threads = atoi(val);
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLThreads", NULL)) != NULL &&
+           attr->value)
+    job->Threads = atoi(attr->value);
+  else
+    job->Threads = 0;
+
+  //
+  // See how many megabytes of page rasters and output the page threads may
+  // buffer; pages that do not fit are rendered in order.  The environment
+  // overrides the PPD file...
+  //
+
+  if ((val = getenv("RASTERTOPCLX_BUFFER")) != NULL)
+    job->BufferSize = atoi(val);
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLBuffer", NULL)) != NULL &&
+           attr->value)
+    job->BufferSize = atoi(attr->value);
+  else
+    job->BufferSize = 256;
+
+  //
+  // See how many megabytes of compressed pages may be kept to send
+  // identical pages again; the environment overrides the PPD file...
+  //
+
+  if ((val = getenv("RASTERTOPCLX_CACHE")) != NULL)
+    cache_size = atoi(val);
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLCache", NULL)) != NULL &&
+           attr->value)
+    cache_size = atoi(attr->value);
+  else
+    cache_size = 0;
+
+  if (cache_size > 0 && (job->Cache = calloc(1, sizeof(pcl_cache_t))) != NULL)
+    job->Cache->max_size = (size_t)cache_size * 1024 * 1024;
+
+  //
+  // See how many kilobytes of raster data may be read ahead by a separate
+  // thread; the environment overrides the PPD file...
+  //
+
+  if ((val = getenv("RASTERTOPCLX_PREFETCH")) != NULL)
+    prefetch_size = atoi(val);
+  else if (ppd && (attr = ppdFindAttr(ppd, "cupsPCLPrefetch", NULL)) != NULL &&
+           attr->value)
+    prefetch_size = atoi(attr->value);
+  else
+    prefetch_size = 0;
+
+  //
+  // Open the page stream...
+  //
+
+  if (prefetch_size > 0 &&
+      (prefetch = raster_prefetch_new(inputfd,
+                                      (size_t)prefetch_size * 1024)) != NULL)
+    ras = cupsRasterOpenIO(raster_prefetch_read, prefetch, CUPS_RASTER_READ);
+  else
+    ras = cupsRasterOpen(inputfd, CUPS_RASTER_READ);
+
+  //
+  // Compile the PJL commands for the job...
+  //
+
+  CompilePJL(job, data, ppd);
+
+  //
+  // Process pages as needed...
+  //
 
-  Page = 0;
+  job->Page   = 0;
+  job->Output = raster_out_new(outputfd, RASTER_OUT_FLUSH, job->logfunc,
+                               job->ld);
+  job->Stats  = raster_stats_new("rastertopclx",
+				 getenv("RASTERTOPCLX_STATS"), job->logfunc,
+				 job->ld);
+
+  if (job->Output)
+    raster_out_set_stats(job->Output, job->Stats);
+
+#ifdef HAVE_PTHREAD_H
+  if (job->Output && job->Threads > 1 &&
+      (pool = StartPages(job, data, ppd)) == NULL)
+    JobLog(job, CF_LOGLEVEL_DEBUG,
+	   "Unable to start page threads, using a single thread.");
+#else
+  if (job->Threads > 1)
+    JobLog(job, CF_LOGLEVEL_DEBUG,
+	   "Page threads not supported, using a single thread.");
+#endif // HAVE_PTHREAD_H
 
-  while (cupsRasterReadHeader2(ras, &header))
+  while (job->Output && cupsRasterReadHeader2(ras, &header))
   {
     //
     // Write a status message with the page number and number of copies.
@@ -1923,70 +3414,189 @@ main(int  argc,				// I - Number of command-line arguments
     if (empty)
       empty = 0;
 
-    if (Canceled)
+    if (iscanceled && iscanceled(icd))
       break;
 
-    Page ++;
+    job->Page ++;
+
+    JobLog(job, CF_LOGLEVEL_CONTROL, "PAGE: %d %d", job->Page,
+	   header.NumCopies);
+    JobLog(job, CF_LOGLEVEL_INFO, "Starting page %d.", job->Page);
+
+#ifdef HAVE_PTHREAD_H
+    if (pool)
+    {
+      //
+      // Read the page and let the page threads render it...
+      //
 
-    fprintf(stderr, "PAGE: %d %d\n", Page, header.NumCopies);
-    fprintf(stderr, "INFO: Starting page %d.\n", Page);
+      QueuePage(job, pool, data, ppd, &header, ras);
 
-    StartPage(data, ppd, &header, atoi(argv[1]), argv[2], argv[3],
-              num_options, options);
+      if (iscanceled && iscanceled(icd))
+	break;
 
-    for (y = 0; y < (int)header.cupsHeight; y ++)
+      continue;
+    }
+#endif // HAVE_PTHREAD_H
+
+    StartPage(job, data, ppd, &header, data->job_id, data->job_user,
+	      data->job_title, data->num_options, data->options);
+
+    //
+    // With the page cache, read the page first and send the graphics of an
+    // identical page that was printed before, or collect the graphics of
+    // this one...
+    //
+
+    replayed = 0;
+
+    if (job->Cache && ReadPage(job, ras, &header, &lines, &lines_size))
+    {
+      job->PageLines = lines;
+      job->PageLine  = 0;
+
+      hash[0] = hash[1] = 0;
+      raster_hash(hash, lines,
+                  (size_t)header.cupsBytesPerLine * header.cupsHeight);
+
+      if ((replayed = ReplayPage(job->Cache, &header, hash,
+                                 job->Output)) != 0)
+        JobLog(job, CF_LOGLEVEL_DEBUG,
+	       "Page %d is the same as an earlier page.", job->Page);
+      else if ((body = raster_out_new(-1, 0, job->logfunc,
+                                      job->ld)) != NULL)
+      {
+        output      = job->Output;
+        job->Output = body;
+      }
+    }
+
+    for (y = 0; !replayed && y < (int)header.cupsHeight; y ++)
     {
       //
       // Let the user know how far we have progressed...
       //
 
-      if (Canceled)
+      if (iscanceled && iscanceled(icd))
 	break;
 
       if ((y & 127) == 0)
       {
-        fprintf(stderr, "INFO: Printing page %d, %d%% complete.\n",
-		Page, 100 * y / header.cupsHeight);
-        fprintf(stderr, "ATTR: job-media-progress=%d\n",
-		100 * y / header.cupsHeight);
+        JobLog(job, CF_LOGLEVEL_INFO, "Printing page %d, %d%% complete.",
+	       job->Page, 100 * y / header.cupsHeight);
+        JobLog(job, CF_LOGLEVEL_CONTROL, "ATTR: job-media-progress=%d",
+	       100 * y / header.cupsHeight);
+      }
+
+      if (output && raster_out_length(job->Output) > job->Cache->max_size)
+      {
+        //
+        // Too big for the cache, stop collecting the graphics...
+        //
+
+        body        = job->Output;
+        job->Output = output;
+        output      = NULL;
+
+        raster_out_append(job->Output, body);
+        raster_out_delete(body);
       }
 
       //
       // Read and write a line of graphics or whitespace...
       //
 
-      if (ReadLine(ras, &header))
-        OutputLine(ppd, &header);
+      if (ReadLine(job, ras, &header))
+        OutputLine(job, ppd, &header);
       else
-        OutputFeed ++;
+        job->OutputFeed ++;
     }
 
+    if (output)
+    {
+      body        = job->Output;
+      job->Output = output;
+      output      = NULL;
+
+      if (y == (int)header.cupsHeight)
+        CachePage(job->Cache, &header, hash, body);
+
+      raster_out_append(job->Output, body);
+      raster_out_delete(body);
+      raster_out_checkpoint(job->Output);
+    }
+
+    job->PageLines = NULL;
+
     //
     // Eject the page...
     //
 
-    fprintf(stderr, "INFO: Finished page %d.\n", Page);
+    JobLog(job, CF_LOGLEVEL_INFO, "Finished page %d.", job->Page);
+
+    EndPage(job, ppd, &header);
 
-    EndPage(ppd, &header);
+    raster_stats_page(job->Stats);
 
-    if (Canceled)
+    if (iscanceled && iscanceled(icd))
       break;
   }
 
+#ifdef HAVE_PTHREAD_H
+  if (pool)
+    FinishPages(job, pool);
+#endif // HAVE_PTHREAD_H
+
   if (!empty)
-    Shutdown(ppd, job_id, argv[2], argv[3], num_options, options);
+    Shutdown(job, ppd);
+
+  if (!job->Output || raster_out_flush(job->Output))
+    status = 1;
+
+  raster_out_delete(job->Output);
+  raster_stats_delete(job->Stats);
 
-  cupsFreeOptions(num_options, options);
+  FreeProfiles(job);
+  FreePJL(job);
+  FreeCache(job->Cache);
+  free(lines);
 
   cupsRasterClose(ras);
+  raster_prefetch_delete(prefetch);
+  close(inputfd);
+  close(outputfd);
 
-  if (fd != 0)
-    close(fd);
+  if (empty && !status)
+    JobLog(job, CF_LOGLEVEL_DEBUG, "Input is empty, outputting empty file.");
+  else if (job->Page == 0)
+    status = 1;
 
-  if (empty)
-  {
-    fprintf(stderr, "DEBUG: Input is empty, outputting empty file.\n");
-    return 0;
-  }
-  return (Page == 0);
+  free(job);
+
+  return (status);
+}
+
+
+//
+// 'main()' - Main entry and processing of driver.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int	ret;				// Exit status
+
+
+  //
+  // Fire up the RasterToPCLX() filter function; the wrapper parses the
+  // command line, loads and marks the PPD file and handles SIGTERM...
+  //
+
+  ret = ppdFilterCUPSWrapper(argc, argv, RasterToPCLX, NULL, &JobCanceled);
+
+  if (ret)
+    fprintf(stderr, "ERROR: rastertopclx filter function failed.\n");
+
+  return (ret);
 }
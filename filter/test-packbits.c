@@ -0,0 +1,373 @@
+//
+// PackBits encoder test and benchmark program for cups-filters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./test-packbits [iterations]
+//
+// Checks every PackBits kernel supported by the CPU against the original
+// byte-at-a-time encoder of the ESC/P and PCL drivers and then reports the
+// throughput of each kernel in MB/s on dithered, blank and photographic
+// line data.
+//
+// Contents:
+//
+//   main()           - Main entry.
+//   fill_line()      - Fill a line with test data.
+//   reference_pack() - Original byte-at-a-time PackBits encoder.
+//   timer_get()      - Get the current time in seconds.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "raster-common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+//
+// Constants...
+//
+
+#define LINE_LENGTH	1440		// Bytes per line (A4 at 1440dpi, 1-bit)
+#define LINE_COUNT	64		// Number of distinct lines per data set
+
+enum
+{
+  DATA_DITHERED,			// Error-diffused halftone data
+  DATA_BLANK,				// Blank (white) data
+  DATA_PHOTO,				// Smooth 8-bit photographic data
+  DATA_RANDOM,				// Mixed runs and literals of any length
+  DATA_MAX
+};
+
+
+//
+// Local globals...
+//
+
+static const char * const data_names[DATA_MAX] =
+{
+  "dithered",
+  "blank",
+  "photo",
+  "random"
+};
+static const char * const kernels[] =
+{
+  "scalar",
+  "sse2",
+  "avx2",
+  "neon"
+};
+
+
+//
+// Local functions...
+//
+
+static void	fill_line(unsigned char *line, int length, int type);
+static int	reference_pack(unsigned char *dst, const unsigned char *src,
+		               int length, int limit);
+static double	timer_get(void);
+
+
+//
+// 'main()' - Main entry.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		i, j, k,		// Looping vars
+		type,			// Data type
+		length,			// Length of line
+		limit,			// Output limit
+		iterations,		// Number of benchmark iterations
+		status = 0;		// Exit status
+  int		ref_bytes,		// Bytes from reference encoder
+		bytes;			// Bytes from kernel
+  unsigned char	*lines[DATA_MAX],	// Test data
+		ref[2 * LINE_LENGTH + 2],
+					// Reference output
+		out[2 * LINE_LENGTH + 2];
+					// Kernel output
+  double	start,			// Start time
+		secs;			// Elapsed time
+
+
+  iterations = argc > 1 ? atoi(argv[1]) : 2000;
+  if (iterations < 1)
+    iterations = 1;
+
+  srand(1);
+
+  for (type = 0; type < DATA_MAX; type ++)
+  {
+    lines[type] = malloc(LINE_LENGTH * LINE_COUNT);
+
+    for (j = 0; j < LINE_COUNT; j ++)
+      fill_line(lines[type] + j * LINE_LENGTH, LINE_LENGTH, type);
+  }
+
+  //
+  // Check that every kernel produces the same output as the original
+  // encoder, with and without an output limit and for all line lengths...
+  //
+
+  for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k ++)
+  {
+    if (raster_packbits_select(kernels[k]))
+      continue;
+
+    for (type = 0; type < DATA_MAX; type ++)
+      for (j = 0; j < LINE_COUNT; j ++)
+        for (length = 0; length <= LINE_LENGTH; length += j + 1)
+	  for (limit = 0; limit <= length; limit += length ? length : 1)
+	  {
+	    ref_bytes = reference_pack(ref, lines[type] + j * LINE_LENGTH,
+	                               length, limit);
+	    bytes     = raster_packbits(out, lines[type] + j * LINE_LENGTH,
+	                                length, limit);
+
+	    if (bytes != ref_bytes || memcmp(ref, out, bytes))
+	    {
+	      printf("FAIL: %s kernel, %s line %d, length %d, limit %d\n",
+	             kernels[k], data_names[type], j, length, limit);
+	      status = 1;
+	    }
+	  }
+  }
+
+  if (status)
+    return (status);
+
+  puts("PASS: all kernels match the reference encoder");
+
+  //
+  // Benchmark the kernels...
+  //
+
+  printf("%-10s", "kernel");
+  for (type = 0; type <= DATA_PHOTO; type ++)
+    printf(" %12s", data_names[type]);
+  putchar('\n');
+
+  for (k = -1; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k ++)
+  {
+    if (k >= 0 && raster_packbits_select(kernels[k]))
+      continue;
+
+    printf("%-10s", k < 0 ? "reference" : kernels[k]);
+
+    for (type = 0; type <= DATA_PHOTO; type ++)
+    {
+      start = timer_get();
+
+      for (i = 0; i < iterations; i ++)
+        for (j = 0; j < LINE_COUNT; j ++)
+	{
+	  if (k < 0)
+	    reference_pack(out, lines[type] + j * LINE_LENGTH, LINE_LENGTH, 0);
+	  else
+	    raster_packbits(out, lines[type] + j * LINE_LENGTH, LINE_LENGTH,
+	                    0);
+	}
+
+      secs = timer_get() - start;
+
+      printf(" %7.1f MB/s", (double)iterations * LINE_COUNT * LINE_LENGTH /
+                            (secs > 0.0 ? secs : 1e-9) / 1048576.0);
+    }
+
+    putchar('\n');
+  }
+
+  raster_packbits_select(NULL);
+  printf("Selected kernel: %s\n", raster_packbits_impl());
+
+  for (type = 0; type < DATA_MAX; type ++)
+    free(lines[type]);
+
+  return (0);
+}
+
+
+//
+// 'fill_line()' - Fill a line with test data.
+//
+
+static void
+fill_line(unsigned char *line,		// I - Line buffer
+          int           length,		// I - Length of line
+	  int           type)		// I - Data type
+{
+  int	i, j,				// Looping vars
+	count,				// Run length
+	value,				// Current value
+	error;				// Diffusion error
+
+
+  switch (type)
+  {
+    case DATA_DITHERED :
+        //
+	// 1-bit error diffusion of a slowly varying 25-75% tone...
+	//
+
+        memset(line, 0, length);
+
+        for (i = 0, error = 0, value = 64 + rand() % 128; i < length * 8; i ++)
+	{
+	  if ((i & 63) == 0)
+	    value = 64 + (value + rand() % 9 - 4 + 128) % 128;
+
+	  error += value + rand() % 32 - 16;
+	  if (error >= 128)
+	  {
+	    line[i / 8] |= 0x80 >> (i & 7);
+	    error -= 255;
+	  }
+	}
+	break;
+
+    case DATA_BLANK :
+        memset(line, 0, length);
+	break;
+
+    case DATA_PHOTO :
+        //
+	// Smooth gradient with sensor noise and flat highlight areas...
+	//
+
+        for (i = 0, value = rand() % 256; i < length; i ++)
+	{
+	  if ((i % 300) < 100)
+	    line[i] = 255;
+	  else
+	  {
+	    value += rand() % 3 - 1;
+	    if (value < 0)
+	      value = 0;
+	    else if (value > 255)
+	      value = 255;
+
+	    line[i] = value + ((rand() & 7) == 0);
+	  }
+	}
+	break;
+
+    default :
+        //
+	// Random mix of runs and literals of all lengths...
+	//
+
+        for (i = 0; i < length; i += count)
+	{
+	  count = 1 + rand() % 300;
+	  if (count > length - i)
+	    count = length - i;
+
+	  if (rand() & 1)
+	    memset(line + i, rand() & 255, count);
+	  else
+	    for (j = 0; j < count; j ++)
+	      line[i + j] = rand() & 3;
+	}
+	break;
+  }
+}
+
+
+//
+// 'reference_pack()' - Original byte-at-a-time PackBits encoder.
+//
+
+static int				// O - Number of bytes written
+reference_pack(unsigned char       *dst,// I - Output buffer
+               const unsigned char *src,// I - Input data
+	       int                 length,
+					// I - Number of input bytes
+	       int                 limit)
+					// I - Stop after this many bytes or 0
+{
+  const unsigned char	*line_ptr,	// Current byte pointer
+			*line_end,	// End-of-line byte pointer
+			*start;		// Start of compression sequence
+  unsigned char		*comp_ptr;	// Pointer into compression buffer
+  int			count;		// Count of bytes for output
+
+
+  line_ptr = src;
+  line_end = src + length;
+  comp_ptr = dst;
+
+  while (line_ptr < line_end && (limit <= 0 || (comp_ptr - dst) < limit))
+  {
+    if ((line_ptr + 1) >= line_end)
+    {
+      *comp_ptr++ = 0x00;
+      *comp_ptr++ = *line_ptr++;
+    }
+    else if (line_ptr[0] == line_ptr[1])
+    {
+      line_ptr ++;
+      count = 2;
+
+      while (line_ptr < (line_end - 1) &&
+	     line_ptr[0] == line_ptr[1] &&
+	     count < 127)
+      {
+	line_ptr ++;
+	count ++;
+      }
+
+      *comp_ptr++ = 257 - count;
+      *comp_ptr++ = *line_ptr++;
+    }
+    else
+    {
+      start    = line_ptr;
+      line_ptr ++;
+      count    = 1;
+
+      while (line_ptr < (line_end - 1) &&
+	     line_ptr[0] != line_ptr[1] &&
+	     count < 127)
+      {
+	line_ptr ++;
+	count ++;
+      }
+
+      *comp_ptr++ = count - 1;
+
+      memcpy(comp_ptr, start, count);
+      comp_ptr += count;
+    }
+  }
+
+  return ((int)(comp_ptr - dst));
+}
+
+
+//
+// 'timer_get()' - Get the current time in seconds.
+//
+
+static double				// O - Time in seconds
+timer_get(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
@@ -0,0 +1,521 @@
+//
+// PCL raster compression test program for cups-filters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./test-pcl
+//
+// Compresses lines of dithered, blank, photographic and random data with
+// the PCL raster compression modes 1, 2, 3 and 9 used by rastertopclx,
+// decodes the result the way a printer does and checks that the original
+// line comes back.  Delta-row modes are checked against the previous line,
+// a lightly changed copy of the line and an unknown (garbage) seed row.
+//
+// Contents:
+//
+//   main()             - Main entry.
+//   decode_delta()     - Decode a mode 3 line.
+//   decode_delta_rle() - Decode a mode 9 line.
+//   decode_packbits()  - Decode a mode 2 line.
+//   decode_rle()       - Decode a mode 1 line.
+//   fill_line()        - Fill a line with test data.
+//   get_extended()     - Get a mode 3 or 9 offset or count extension.
+//
+
+//
+// Include necessary headers...
+//
+
+#include "pcl-common.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+//
+// Constants...
+//
+
+#define LINE_LENGTH	1440		// Maximum bytes per line
+#define LINE_COUNT	64		// Number of lines per data set
+
+enum
+{
+  DATA_DITHERED,			// Error-diffused halftone data
+  DATA_BLANK,				// Blank (white) data
+  DATA_PHOTO,				// Smooth 8-bit photographic data
+  DATA_RANDOM,				// Mixed runs and literals of any length
+  DATA_MAX
+};
+
+enum
+{
+  SEED_PREVIOUS,			// Previous line of the data set
+  SEED_CHANGED,				// Copy of the line with a few changes
+  SEED_INVALID,				// Unknown seed row
+  SEED_MAX
+};
+
+
+//
+// Local globals...
+//
+
+static const char * const data_names[DATA_MAX] =
+{
+  "dithered",
+  "blank",
+  "photo",
+  "random"
+};
+static const char * const seed_names[SEED_MAX] =
+{
+  "previous",
+  "changed",
+  "invalid"
+};
+
+
+//
+// Local functions...
+//
+
+static int	decode_delta(unsigned char *line, const unsigned char *data,
+		             int bytes, int length);
+static int	decode_delta_rle(unsigned char *line,
+		                 const unsigned char *data, int bytes,
+				 int length);
+static int	decode_packbits(unsigned char *line,
+		                const unsigned char *data, int bytes,
+				int length);
+static int	decode_rle(unsigned char *line, const unsigned char *data,
+		           int bytes, int length);
+static void	fill_line(unsigned char *line, int length, int type);
+static const unsigned char *get_extended(const unsigned char *data,
+			                 const unsigned char *end,
+					 int *value);
+
+
+//
+// 'main()' - Main entry.
+//
+
+int					// O - Exit status
+main(void)
+{
+  int		i, j,			// Looping vars
+		type,			// Data type
+		seed_type,		// Seed row type
+		length,			// Length of line
+		bytes,			// Bytes of compressed data
+		status = 0;		// Exit status
+  long		totals[4];		// Total bytes for modes 1, 2, 3 and 9
+  unsigned char	*lines[DATA_MAX],	// Test data
+		*line,			// Current line
+		seed[LINE_LENGTH],	// Seed row
+		printer[LINE_LENGTH],	// Printer's copy of the seed row
+		comp[4 * LINE_LENGTH];	// Compressed data
+  const unsigned char *seed_ptr;	// Seed row or NULL
+
+
+  srand(1);
+
+  for (type = 0; type < DATA_MAX; type ++)
+  {
+    lines[type] = malloc(LINE_LENGTH * LINE_COUNT);
+
+    for (j = 0; j < LINE_COUNT; j ++)
+      fill_line(lines[type] + j * LINE_LENGTH, LINE_LENGTH, type);
+  }
+
+  memset(totals, 0, sizeof(totals));
+
+  for (type = 0; type < DATA_MAX; type ++)
+    for (j = 0; j < LINE_COUNT; j ++)
+      for (length = 0; length <= LINE_LENGTH; length += j + 1)
+      {
+        line = lines[type] + j * LINE_LENGTH;
+
+	//
+	// Modes 1 and 2 don't use a seed row...
+	//
+
+	bytes = pcl_compress_rle(comp, line, length);
+	totals[0] += bytes;
+
+	if (decode_rle(printer, comp, bytes, length) ||
+	    memcmp(printer, line, length))
+	{
+	  printf("FAIL: mode 1, %s line %d, length %d\n", data_names[type], j,
+	         length);
+	  status = 1;
+	}
+
+	bytes = raster_packbits(comp, line, length, 0);
+	totals[1] += bytes;
+
+	if (decode_packbits(printer, comp, bytes, length) ||
+	    memcmp(printer, line, length))
+	{
+	  printf("FAIL: mode 2, %s line %d, length %d\n", data_names[type], j,
+	         length);
+	  status = 1;
+	}
+
+	//
+	// Modes 3 and 9 replace the bytes that differ from the seed row...
+	//
+
+	for (seed_type = 0; seed_type < SEED_MAX; seed_type ++)
+	{
+	  switch (seed_type)
+	  {
+	    case SEED_PREVIOUS :
+	        memcpy(seed, lines[type] + ((j + LINE_COUNT - 1) % LINE_COUNT) *
+		                               LINE_LENGTH, length);
+		break;
+
+	    case SEED_CHANGED :
+	        memcpy(seed, line, length);
+		for (i = 0; i < length / 16; i ++)
+		  seed[rand() % length] ^= 1 << (rand() % 8);
+		break;
+
+	    default :
+	        for (i = 0; i < length; i ++)
+		  seed[i] = rand();
+		break;
+	  }
+
+          seed_ptr = seed_type == SEED_INVALID ? NULL : seed;
+
+	  memcpy(printer, seed, length);
+	  bytes = pcl_compress_delta(comp, line, seed_ptr, length);
+	  if (seed_type == SEED_PREVIOUS)
+	    totals[2] += bytes;
+
+	  if (decode_delta(printer, comp, bytes, length) ||
+	      memcmp(printer, line, length))
+	  {
+	    printf("FAIL: mode 3, %s line %d, length %d, %s seed\n",
+	           data_names[type], j, length, seed_names[seed_type]);
+	    status = 1;
+	  }
+
+	  memcpy(printer, seed, length);
+	  bytes = pcl_compress_delta_rle(comp, line, seed_ptr, length);
+	  if (seed_type == SEED_PREVIOUS)
+	    totals[3] += bytes;
+
+	  if (bytes > length + length / 8 + 8)
+	  {
+	    printf("FAIL: mode 9, %s line %d, length %d, %s seed: %d bytes "
+	           "is too long\n", data_names[type], j, length,
+		   seed_names[seed_type], bytes);
+	    status = 1;
+	  }
+
+	  if (decode_delta_rle(printer, comp, bytes, length) ||
+	      memcmp(printer, line, length))
+	  {
+	    printf("FAIL: mode 9, %s line %d, length %d, %s seed\n",
+	           data_names[type], j, length, seed_names[seed_type]);
+	    status = 1;
+	  }
+	}
+      }
+
+  for (type = 0; type < DATA_MAX; type ++)
+    free(lines[type]);
+
+  if (status)
+    return (status);
+
+  puts("PASS: all compression modes decode to the original lines");
+  printf("Total bytes: mode 1 %ld, mode 2 %ld, mode 3 %ld, mode 9 %ld\n",
+         totals[0], totals[1], totals[2], totals[3]);
+
+  return (0);
+}
+
+
+//
+// 'decode_delta()' - Decode a mode 3 line.
+//
+
+static int				// O - 0 on success, -1 on error
+decode_delta(
+    unsigned char       *line,		// IO - Seed row/decoded line
+    const unsigned char *data,		// I  - Compressed data
+    int                 bytes,		// I  - Number of bytes of data
+    int                 length)		// I  - Number of bytes in line
+{
+  const unsigned char	*end = data + bytes;
+					// End of data
+  int			pos = 0,	// Position in line
+			offset,		// Offset of replacement
+			count;		// Number of replacement bytes
+
+
+  while (data < end)
+  {
+    count  = (*data >> 5) + 1;
+    offset = *data++ & 31;
+
+    if (offset == 31 && (data = get_extended(data, end, &offset)) == NULL)
+      return (-1);
+
+    pos += offset;
+
+    if (pos + count > length || data + count > end)
+      return (-1);
+
+    memcpy(line + pos, data, count);
+    data += count;
+    pos  += count;
+  }
+
+  return (0);
+}
+
+
+//
+// 'decode_delta_rle()' - Decode a mode 9 line.
+//
+
+static int				// O - 0 on success, -1 on error
+decode_delta_rle(
+    unsigned char       *line,		// IO - Seed row/decoded line
+    const unsigned char *data,		// I  - Compressed data
+    int                 bytes,		// I  - Number of bytes of data
+    int                 length)		// I  - Number of bytes in line
+{
+  const unsigned char	*end = data + bytes;
+					// End of data
+  int			pos = 0,	// Position in line
+			cmd,		// Command byte
+			offset,		// Offset of replacement
+			count,		// Number of replacement bytes
+			value;		// Repeated byte
+
+
+  while (data < end)
+  {
+    cmd = *data++;
+
+    if (cmd & 0x80)
+    {
+      //
+      // Run of equal bytes...
+      //
+
+      offset = (cmd >> 5) & 3;
+      count  = cmd & 31;
+
+      if (offset == 3 && (data = get_extended(data, end, &offset)) == NULL)
+        return (-1);
+
+      if (data >= end)
+        return (-1);
+
+      value = *data++;
+
+      if (count == 31 && (data = get_extended(data, end, &count)) == NULL)
+        return (-1);
+
+      count += 2;
+      pos   += offset;
+
+      if (pos + count > length)
+        return (-1);
+
+      memset(line + pos, value, count);
+    }
+    else
+    {
+      //
+      // Literal bytes...
+      //
+
+      offset = (cmd >> 3) & 15;
+      count  = cmd & 7;
+
+      if (offset == 15 && (data = get_extended(data, end, &offset)) == NULL)
+        return (-1);
+
+      if (count == 7 && (data = get_extended(data, end, &count)) == NULL)
+        return (-1);
+
+      count ++;
+      pos += offset;
+
+      if (pos + count > length || data + count > end)
+        return (-1);
+
+      memcpy(line + pos, data, count);
+      data += count;
+    }
+
+    pos += count;
+  }
+
+  return (0);
+}
+
+
+//
+// 'decode_packbits()' - Decode a mode 2 line.
+//
+
+static int				// O - 0 on success, -1 on error
+decode_packbits(
+    unsigned char       *line,		// O - Decoded line
+    const unsigned char *data,		// I - Compressed data
+    int                 bytes,		// I - Number of bytes of data
+    int                 length)		// I - Number of bytes in line
+{
+  const unsigned char	*end = data + bytes;
+					// End of data
+  int			pos = 0,	// Position in line
+			count;		// Number of bytes
+
+
+  while (data < end)
+  {
+    count = *data++;
+
+    if (count < 128)
+    {
+      count ++;
+
+      if (pos + count > length || data + count > end)
+        return (-1);
+
+      memcpy(line + pos, data, count);
+      data += count;
+    }
+    else if (count > 128)
+    {
+      count = 257 - count;
+
+      if (pos + count > length || data >= end)
+        return (-1);
+
+      memset(line + pos, *data++, count);
+    }
+    else
+      count = 0;
+
+    pos += count;
+  }
+
+  return (pos == length ? 0 : -1);
+}
+
+
+//
+// 'decode_rle()' - Decode a mode 1 line.
+//
+
+static int				// O - 0 on success, -1 on error
+decode_rle(
+    unsigned char       *line,		// O - Decoded line
+    const unsigned char *data,		// I - Compressed data
+    int                 bytes,		// I - Number of bytes of data
+    int                 length)		// I - Number of bytes in line
+{
+  int	pos = 0,			// Position in line
+	count;				// Number of bytes
+
+
+  if (bytes & 1)
+    return (-1);
+
+  for (; bytes > 0; bytes -= 2, data += 2, pos += count)
+  {
+    count = data[0] + 1;
+
+    if (pos + count > length)
+      return (-1);
+
+    memset(line + pos, data[1], count);
+  }
+
+  return (pos == length ? 0 : -1);
+}
+
+
+//
+// 'fill_line()' - Fill a line with test data.
+//
+
+static void
+fill_line(unsigned char *line,		// I - Line buffer
+          int           length,		// I - Number of bytes
+	  int           type)		// I - Type of data
+{
+  int	i,				// Looping var
+	count,				// Run length
+	value;				// Run value
+
+
+  switch (type)
+  {
+    case DATA_DITHERED :
+        for (i = 0; i < length; i ++)
+	  line[i] = (rand() & 1) ? rand() : 0;
+	break;
+
+    case DATA_BLANK :
+        memset(line, 0, length);
+	break;
+
+    case DATA_PHOTO :
+        value = rand() & 255;
+        for (i = 0; i < length; i ++)
+	{
+	  value  += (rand() % 5) - 2;
+	  line[i] = value;
+	}
+	break;
+
+    default :
+        for (i = 0; i < length; i += count)
+	{
+	  count = 1 + rand() % 300;
+	  if (count > length - i)
+	    count = length - i;
+
+	  if (rand() & 1)
+	    memset(line + i, rand(), count);
+	  else
+	    for (value = 0; value < count; value ++)
+	      line[i + value] = rand();
+	}
+	break;
+  }
+}
+
+
+//
+// 'get_extended()' - Get a mode 3 or 9 offset or count extension.
+//
+
+static const unsigned char *		// O - Next byte or NULL on error
+get_extended(const unsigned char *data,	// I  - Compressed data
+             const unsigned char *end,	// I  - End of data
+	     int                 *value)// IO - Offset or count
+{
+  do
+  {
+    if (data >= end)
+      return (NULL);
+
+    *value += *data;
+  }
+  while (*data++ == 255);
+
+  return (data);
+}
@@ -0,0 +1,767 @@
+//
+// Raster driver benchmark program for cups-filters.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./test-raster [-d filter-dir] [-k] [-n iterations] [-o corpus-dir]
+//                 [-p WIDTHxHEIGHT] [-v] ppd-file [... ppd-file]
+//
+// Writes a corpus of deterministic CUPS raster streams (K, W, RGB and
+// CMYK at 1, 8 and 16 bits per color, 300 to 2880 dpi, with text-like,
+// photo-like and mostly blank pages) and runs every stream through the
+// raster driver of each PPD file, which must use "rastertoescpx" or
+// "rastertopclx".  For every run the program reports pages per second,
+// MB/s of printer output, the peak RSS of the driver and a hash of the
+// output, so optimizations can be checked byte-for-byte against the
+// previous output of the drivers.
+//
+// Contents:
+//
+//   main()         - Main entry.
+//   bench_run()    - Run a driver on a raster file and measure it.
+//   fill_line()    - Fill a line of a test page.
+//   get_driver()   - Get the raster driver of a PPD file.
+//   rand_next()    - Return the next pseudo-random number.
+//   timer_get()    - Get the current time in seconds.
+//   write_raster() - Write a test raster file.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <cups/raster.h>
+#include <ppd/ppd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+
+//
+// Constants...
+//
+
+#define PAGE_COUNT	2		// Pages per raster file
+
+enum
+{
+  CONTENT_TEXT,				// Lines of "glyphs"
+  CONTENT_PHOTO,			// Smooth gradients with noise
+  CONTENT_BLANK				// Mostly paper white
+};
+
+
+//
+// Types...
+//
+
+typedef struct bench_case_s		// Raster test case
+{
+  const char	*name;			// Name of case
+  cups_cspace_t	cspace;			// Color space
+  int		bits,			// Bits per color
+		xres,			// Horizontal resolution
+		yres,			// Vertical resolution
+		content,		// Page content
+		row_count,		// cupsRowCount for softweave
+		row_feed,		// cupsRowFeed for softweave
+		row_step;		// cupsRowStep for softweave
+} bench_case_t;
+
+typedef struct bench_result_s		// Result of a driver run
+{
+  int		status;			// Exit status of driver
+  double	secs;			// Elapsed time
+  long		rss;			// Peak RSS in kilobytes
+  size_t	bytes;			// Bytes of output
+  unsigned long long hash;		// FNV-1a hash of output
+} bench_result_t;
+
+
+//
+// Local globals...
+//
+
+static const bench_case_t cases[] =	// Raster test cases
+{
+  { "k1-300-text",         CUPS_CSPACE_K,    1,  300,  300, CONTENT_TEXT,
+    0, 0, 0 },
+  { "w1-600-text",         CUPS_CSPACE_W,    1,  600,  600, CONTENT_TEXT,
+    0, 0, 0 },
+  { "w8-360-photo",        CUPS_CSPACE_W,    8,  360,  360, CONTENT_PHOTO,
+    0, 0, 0 },
+  { "k8-720-blank",        CUPS_CSPACE_K,    8,  720,  720, CONTENT_BLANK,
+    0, 0, 0 },
+  { "rgb8-300-photo",      CUPS_CSPACE_RGB,  8,  300,  300, CONTENT_PHOTO,
+    0, 0, 0 },
+  { "rgb8-720-text",       CUPS_CSPACE_RGB,  8,  720,  720, CONTENT_TEXT,
+    0, 0, 0 },
+  { "rgb8-720-soft-photo", CUPS_CSPACE_RGB,  8,  720,  720, CONTENT_PHOTO,
+    32, 0, 4 },
+  { "rgb8-1440x720-blank", CUPS_CSPACE_RGB,  8, 1440,  720, CONTENT_BLANK,
+    0, 0, 0 },
+  { "rgb16-600-photo",     CUPS_CSPACE_RGB, 16,  600,  600, CONTENT_PHOTO,
+    0, 0, 0 },
+  { "cmyk1-600-text",      CUPS_CSPACE_CMYK, 1,  600,  600, CONTENT_TEXT,
+    0, 0, 0 },
+  { "cmyk8-720-photo",     CUPS_CSPACE_CMYK, 8,  720,  720, CONTENT_PHOTO,
+    0, 0, 0 },
+  { "cmyk16-360-blank",    CUPS_CSPACE_CMYK, 16, 360,  360, CONTENT_BLANK,
+    0, 0, 0 },
+  { "k8-2880x720-text",    CUPS_CSPACE_K,    8, 2880,  720, CONTENT_TEXT,
+    0, 0, 0 }
+};
+static unsigned	rand_state;		// Pseudo-random number state
+
+
+//
+// Local functions...
+//
+
+static int	bench_run(const char *driver, const char *ppdfile,
+		          const char *filename, int verbose,
+			  bench_result_t *result);
+static void	fill_line(const bench_case_t *bc, cups_page_header2_t *header,
+		          int page, int y, unsigned char *line);
+static const char *get_driver(const char *ppdfile);
+static unsigned	rand_next(void);
+static double	timer_get(void);
+static int	write_raster(const bench_case_t *bc, const char *filename,
+		             float width, float length);
+
+
+//
+// 'main()' - Main entry.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int		i, j, k;		// Looping vars
+  const char	*opt,			// Current option
+		*filterdir = ".",	// Directory containing the drivers
+		*corpusdir = NULL,	// Directory for the raster files
+		*driver;		// Driver for PPD file
+  char		tempdir[] = "/tmp/test-rasterXXXXXX",
+					// Temporary corpus directory
+		driverpath[1024],	// Path to driver
+		filename[1024];		// Raster file
+  int		iterations = 1,		// Number of runs for each case
+		keep = 0,		// Keep the corpus files?
+		verbose = 0,		// Show driver messages?
+		num_ppds = 0,		// Number of PPD files
+		status = 0;		// Exit status
+  char		**ppds;			// PPD files
+  float		width = 8.5,		// Page width in inches
+		length = 3.0;		// Page length in inches
+  bench_result_t result,		// Result of current run
+		best;			// Best result for case
+
+
+  if ((ppds = calloc((size_t)argc, sizeof(char *))) == NULL)
+    return (1);
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (argv[i][0] == '-')
+    {
+      for (opt = argv[i] + 1; *opt; opt ++)
+      {
+        switch (*opt)
+	{
+	  case 'd' :			// -d filter-dir
+	      if (++ i >= argc)
+	        goto usage;
+	      filterdir = argv[i];
+	      break;
+
+	  case 'k' :			// -k (keep corpus)
+	      keep = 1;
+	      break;
+
+	  case 'n' :			// -n iterations
+	      if (++ i >= argc)
+	        goto usage;
+	      if ((iterations = atoi(argv[i])) < 1)
+	        iterations = 1;
+	      break;
+
+	  case 'o' :			// -o corpus-dir
+	      if (++ i >= argc)
+	        goto usage;
+	      corpusdir = argv[i];
+	      keep      = 1;
+	      break;
+
+	  case 'p' :			// -p WIDTHxHEIGHT
+	      if (++ i >= argc ||
+	          sscanf(argv[i], "%fx%f", &width, &length) != 2 ||
+		  width <= 0.0 || length <= 0.0)
+	        goto usage;
+	      break;
+
+	  case 'v' :			// -v (verbose)
+	      verbose = 1;
+	      break;
+
+	  default :
+	      goto usage;
+	}
+      }
+    }
+    else
+      ppds[num_ppds ++] = argv[i];
+  }
+
+  if (num_ppds == 0)
+    goto usage;
+
+  //
+  // Write the corpus...
+  //
+
+  if (!corpusdir)
+  {
+    if ((corpusdir = mkdtemp(tempdir)) == NULL)
+    {
+      perror("test-raster: Unable to create corpus directory");
+      return (1);
+    }
+  }
+  else if (mkdir(corpusdir, 0777) && errno != EEXIST)
+  {
+    perror("test-raster: Unable to create corpus directory");
+    return (1);
+  }
+
+  for (j = 0; j < (int)(sizeof(cases) / sizeof(cases[0])); j ++)
+  {
+    snprintf(filename, sizeof(filename), "%s/%s.ras", corpusdir,
+             cases[j].name);
+
+    if (write_raster(cases + j, filename, width, length))
+      return (1);
+  }
+
+  //
+  // Run every case through the driver of each PPD file...
+  //
+
+  printf("%-24s %-20s %8s %9s %9s %s\n", "PPD", "Case", "Pages/s",
+         "Out MB/s", "Peak RSS", "Hash");
+
+  for (i = 0; i < num_ppds; i ++)
+  {
+    if ((driver = get_driver(ppds[i])) == NULL)
+    {
+      fprintf(stderr, "test-raster: Skipping \"%s\", it does not use "
+                      "rastertoescpx or rastertopclx.\n", ppds[i]);
+      continue;
+    }
+
+    snprintf(driverpath, sizeof(driverpath), "%s/%s", filterdir, driver);
+
+    for (j = 0; j < (int)(sizeof(cases) / sizeof(cases[0])); j ++)
+    {
+      snprintf(filename, sizeof(filename), "%s/%s.ras", corpusdir,
+               cases[j].name);
+
+      memset(&best, 0, sizeof(best));
+
+      for (k = 0; k < iterations; k ++)
+      {
+        if (bench_run(driverpath, ppds[i], filename, verbose, &result))
+	  return (1);
+
+        if (k == 0 || result.secs < best.secs)
+	  best = result;
+      }
+
+      printf("%-24s %-20s ", strrchr(ppds[i], '/') ?
+                                 strrchr(ppds[i], '/') + 1 : ppds[i],
+	     cases[j].name);
+
+      if (best.status)
+      {
+        printf("FAILED with status %d\n", best.status);
+	status = 1;
+      }
+      else
+        printf("%8.2f %9.2f %8ldK %016llx\n",
+	       PAGE_COUNT / (best.secs > 0.0 ? best.secs : 1e-9),
+	       best.bytes / (best.secs > 0.0 ? best.secs : 1e-9) / 1048576.0,
+	       best.rss, best.hash);
+    }
+  }
+
+  //
+  // Clean up...
+  //
+
+  if (!keep)
+  {
+    for (j = 0; j < (int)(sizeof(cases) / sizeof(cases[0])); j ++)
+    {
+      snprintf(filename, sizeof(filename), "%s/%s.ras", corpusdir,
+               cases[j].name);
+      unlink(filename);
+    }
+
+    rmdir(corpusdir);
+  }
+
+  free(ppds);
+
+  return (status);
+
+  //
+  // Show program usage...
+  //
+
+  usage:
+
+  puts("Usage: ./test-raster [-d filter-dir] [-k] [-n iterations] "
+       "[-o corpus-dir]");
+  puts("                     [-p WIDTHxHEIGHT] [-v] ppd-file [... ppd-file]");
+
+  return (1);
+}
+
+
+//
+// 'bench_run()' - Run a driver on a raster file and measure it.
+//
+
+static int				// O - 0 on success, -1 on error
+bench_run(const char     *driver,	// I - Driver to run
+          const char     *ppdfile,	// I - PPD file
+          const char     *filename,	// I - Raster file
+	  int            verbose,	// I - Show driver messages?
+	  bench_result_t *result)	// O - Result of run
+{
+  int			fds[2],		// Pipe for driver output
+			fd,		// /dev/null
+			wstatus;	// Status of driver
+  pid_t			pid;		// Driver process
+  ssize_t		bytes;		// Bytes read
+  unsigned char		buffer[65536],	// Output buffer
+			*ptr;		// Pointer into buffer
+  struct rusage		usage;		// Resource usage of driver
+  double		start;		// Start time
+
+
+  memset(result, 0, sizeof(bench_result_t));
+  result->hash = 0xcbf29ce484222325ULL;
+
+  if (pipe(fds))
+  {
+    perror("test-raster: Unable to create pipe");
+    return (-1);
+  }
+
+  start = timer_get();
+
+  if ((pid = fork()) == 0)
+  {
+    //
+    // Child comes here, run the driver with its output going to the pipe...
+    //
+
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+
+    if (!verbose && (fd = open("/dev/null", O_WRONLY)) >= 0)
+    {
+      dup2(fd, 2);
+      close(fd);
+    }
+
+    setenv("PPD", ppdfile, 1);
+
+    execl(driver, driver, "1", "bench", "bench", "1", "", filename,
+          (char *)NULL);
+
+    perror(driver);
+    _exit(127);
+  }
+  else if (pid < 0)
+  {
+    perror("test-raster: Unable to run driver");
+    close(fds[0]);
+    close(fds[1]);
+    return (-1);
+  }
+
+  //
+  // Hash the output of the driver...
+  //
+
+  close(fds[1]);
+
+  while ((bytes = read(fds[0], buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    result->bytes += (size_t)bytes;
+
+    for (ptr = buffer; bytes > 0; bytes --, ptr ++)
+      result->hash = (result->hash ^ *ptr) * 0x100000001b3ULL;
+  }
+
+  close(fds[0]);
+
+  while (wait4(pid, &wstatus, 0, &usage) < 0)
+    if (errno != EINTR)
+    {
+      perror("test-raster: Unable to wait for driver");
+      return (-1);
+    }
+
+  result->secs = timer_get() - start;
+  result->rss  = usage.ru_maxrss;
+
+  if (WIFEXITED(wstatus))
+    result->status = WEXITSTATUS(wstatus);
+  else
+    result->status = 128 + WTERMSIG(wstatus);
+
+  return (0);
+}
+
+
+//
+// 'fill_line()' - Fill a line of a test page.
+//
+// Pixels are computed as RGB light values from 0 (no light) to 65535
+// (paper white) and then stored in the color space of the page.
+//
+
+static void
+fill_line(const bench_case_t  *bc,	// I - Test case
+          cups_page_header2_t *header,	// I - Page header
+	  int                 page,	// I - Page number
+	  int                 y,	// I - Line on page
+	  unsigned char       *line)	// O - Line data
+{
+  int		x,			// Current column
+		c,			// Current color
+		num_colors,		// Number of colors
+		rgb[3],			// RGB light values
+		ink[4],			// Color values for pixel
+		cell,			// Size of glyph cells
+		inked,			// Is the current area inked?
+		noise;			// Photo noise
+  unsigned	bandbytes;		// Bytes per band for banded data
+
+
+  num_colors = header->cupsColorSpace == CUPS_CSPACE_RGB ? 3 :
+               header->cupsColorSpace == CUPS_CSPACE_CMYK ? 4 : 1;
+  bandbytes  = header->cupsBytesPerLine / num_colors;
+  cell       = header->HWResolution[1] / 12;
+
+  memset(line, 0, header->cupsBytesPerLine);
+
+  for (x = 0; x < (int)header->cupsWidth; x ++)
+  {
+    //
+    // Compute the light values for the pixel...
+    //
+
+    switch (bc->content)
+    {
+      case CONTENT_TEXT :
+          //
+	  // Lines of "glyphs" with a 1/6" line pitch, every fourth cell of
+	  // a line is a space...
+	  //
+
+          inked = (y % (2 * cell)) < cell &&
+	          ((x / cell + y / (2 * cell) + page) % 4) != 3 &&
+		  ((x * 7 / cell + (y * 5 / cell) * 3) % 5) < 2;
+	  rgb[0] = rgb[1] = rgb[2] = inked ? 0 : 65535;
+
+	  if (inked && (x / (cell * 40)) % 3 == 1)
+	    rgb[2] = 65535;			// Some colored text
+	  break;
+
+      case CONTENT_PHOTO :
+          //
+	  // Smooth gradients with sensor noise...
+	  //
+
+          noise  = (int)(rand_next() % 2048) - 1024;
+	  rgb[0] = (int)(65535LL * x / header->cupsWidth) + noise;
+	  rgb[1] = (int)(65535LL * y / header->cupsHeight) + noise;
+	  rgb[2] = 65535 - (rgb[0] + rgb[1]) / 2 + page * 4096;
+	  break;
+
+      default :
+          //
+	  // A few lines of text at the top and a small picture, the rest is
+	  // paper white...
+	  //
+
+          if (y < 6 * cell && (y % (2 * cell)) < cell &&
+	      ((x * 7 / cell + (y * 5 / cell) * 3) % 5) < 2 &&
+	      x < (int)header->cupsWidth / 2)
+	    rgb[0] = rgb[1] = rgb[2] = 0;
+	  else if (y > (int)header->cupsHeight / 2 &&
+	           y < (int)header->cupsHeight / 2 + 8 * cell &&
+		   x > (int)header->cupsWidth / 2 &&
+		   x < (int)header->cupsWidth / 2 + 16 * cell)
+	  {
+	    rgb[0] = 32768 + 16 * (x % 1024);
+	    rgb[1] = 16384 + 32 * (y % 1024);
+	    rgb[2] = 49152;
+	  }
+	  else
+	    rgb[0] = rgb[1] = rgb[2] = 65535;
+	  break;
+    }
+
+    for (c = 0; c < 3; c ++)
+      if (rgb[c] < 0)
+        rgb[c] = 0;
+      else if (rgb[c] > 65535)
+        rgb[c] = 65535;
+
+    //
+    // Convert to the page color space...
+    //
+
+    switch (header->cupsColorSpace)
+    {
+      case CUPS_CSPACE_W :
+          ink[0] = (rgb[0] * 31 + rgb[1] * 61 + rgb[2] * 8) / 100;
+	  break;
+
+      case CUPS_CSPACE_K :
+          ink[0] = 65535 - (rgb[0] * 31 + rgb[1] * 61 + rgb[2] * 8) / 100;
+	  break;
+
+      case CUPS_CSPACE_RGB :
+          ink[0] = rgb[0];
+	  ink[1] = rgb[1];
+	  ink[2] = rgb[2];
+	  break;
+
+      default :
+          ink[0] = 65535 - rgb[0];
+	  ink[1] = 65535 - rgb[1];
+	  ink[2] = 65535 - rgb[2];
+	  ink[3] = ink[0] < ink[1] ? ink[0] : ink[1];
+	  if (ink[2] < ink[3])
+	    ink[3] = ink[2];
+	  ink[0] -= ink[3];
+	  ink[1] -= ink[3];
+	  ink[2] -= ink[3];
+	  break;
+    }
+
+    //
+    // Store the pixel; 1-bit color data is banded, everything else is
+    // chunky...
+    //
+
+    for (c = 0; c < num_colors; c ++)
+    {
+      switch (bc->bits)
+      {
+        case 1 :
+	    if (ink[c] >= 32768)
+	      line[c * bandbytes + x / 8] |= 0x80 >> (x & 7);
+	    break;
+
+	case 8 :
+	    line[x * num_colors + c] = (unsigned char)(ink[c] >> 8);
+	    break;
+
+	default :
+	    ((unsigned short *)line)[x * num_colors + c] =
+	        (unsigned short)ink[c];
+	    break;
+      }
+    }
+  }
+}
+
+
+//
+// 'get_driver()' - Get the raster driver of a PPD file.
+//
+
+static const char *			// O - Driver name or NULL
+get_driver(const char *ppdfile)		// I - PPD file
+{
+  int		i;			// Looping var
+  ppd_file_t	*ppd;			// PPD file
+  const char	*driver = NULL;		// Driver name
+
+
+  if ((ppd = ppdOpenFile(ppdfile)) == NULL)
+    return (NULL);
+
+  for (i = 0; i < ppd->num_filters; i ++)
+    if (!strncmp(ppd->filters[i], "application/vnd.cups-raster ", 28))
+    {
+      if (strstr(ppd->filters[i], "rastertoescpx"))
+        driver = "rastertoescpx";
+      else if (strstr(ppd->filters[i], "rastertopclx"))
+        driver = "rastertopclx";
+    }
+
+  ppdClose(ppd);
+
+  return (driver);
+}
+
+
+//
+// 'rand_next()' - Return the next pseudo-random number.
+//
+// This is a 32-bit xorshift generator, so the corpus is the same on every
+// system.
+//
+
+static unsigned				// O - Next number
+rand_next(void)
+{
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+
+  return (rand_state);
+}
+
+
+//
+// 'timer_get()' - Get the current time in seconds.
+//
+
+static double				// O - Time in seconds
+timer_get(void)
+{
+  struct timespec	ts;		// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'write_raster()' - Write a test raster file.
+//
+
+static int				// O - 0 on success, -1 on error
+write_raster(const bench_case_t *bc,	// I - Test case
+             const char         *filename,
+					// I - File to write
+	     float              width,	// I - Page width in inches
+	     float              length)	// I - Page length in inches
+{
+  int			fd,		// Raster file
+			page,		// Current page
+			y;		// Current line
+  cups_raster_t		*ras;		// Raster stream
+  cups_page_header2_t	header;		// Page header
+  unsigned char		*line;		// Line buffer
+  int			num_colors;	// Number of colors
+
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+  {
+    perror(filename);
+    return (-1);
+  }
+
+  ras = cupsRasterOpen(fd, CUPS_RASTER_WRITE);
+
+  num_colors = bc->cspace == CUPS_CSPACE_RGB ? 3 :
+               bc->cspace == CUPS_CSPACE_CMYK ? 4 : 1;
+
+  memset(&header, 0, sizeof(header));
+
+  strcpy(header.MediaClass, "PwgRaster");
+  strcpy(header.MediaType, "Plain");
+  strcpy(header.OutputType, "Normal");
+
+  header.HWResolution[0]  = (unsigned)bc->xres;
+  header.HWResolution[1]  = (unsigned)bc->yres;
+  header.PageSize[0]      = (unsigned)(width * 72.0);
+  header.PageSize[1]      = (unsigned)(length * 72.0);
+  header.cupsPageSize[0]  = width * 72.0f;
+  header.cupsPageSize[1]  = length * 72.0f;
+  header.ImagingBoundingBox[2] = header.PageSize[0];
+  header.ImagingBoundingBox[3] = header.PageSize[1];
+  header.NumCopies        = 1;
+  header.cupsWidth        = (unsigned)(width * bc->xres);
+  header.cupsHeight       = (unsigned)(length * bc->yres);
+  header.cupsMediaType    = 0;
+  header.cupsBitsPerColor = (unsigned)bc->bits;
+  header.cupsColorSpace   = bc->cspace;
+  header.cupsNumColors    = (unsigned)num_colors;
+  header.cupsRowCount     = (unsigned)bc->row_count;
+  header.cupsRowFeed      = (unsigned)bc->row_feed;
+  header.cupsRowStep      = (unsigned)bc->row_step;
+
+  if (bc->bits == 1)
+  {
+    header.cupsColorOrder   = num_colors > 1 ? CUPS_ORDER_BANDED :
+                                               CUPS_ORDER_CHUNKED;
+    header.cupsBitsPerPixel = 1;
+    header.cupsBytesPerLine = (unsigned)num_colors *
+                              ((header.cupsWidth + 7) / 8);
+  }
+  else
+  {
+    header.cupsColorOrder   = CUPS_ORDER_CHUNKED;
+    header.cupsBitsPerPixel = (unsigned)(bc->bits * num_colors);
+    header.cupsBytesPerLine = header.cupsWidth * header.cupsBitsPerPixel / 8;
+  }
+
+  if ((line = malloc(header.cupsBytesPerLine)) == NULL)
+  {
+    cupsRasterClose(ras);
+    close(fd);
+    return (-1);
+  }
+
+  rand_state = 2463534242U;
+
+  for (page = 0; page < PAGE_COUNT; page ++)
+  {
+    cupsRasterWriteHeader2(ras, &header);
+
+    for (y = 0; y < (int)header.cupsHeight; y ++)
+    {
+      fill_line(bc, &header, page, y, line);
+      cupsRasterWritePixels(ras, line, header.cupsBytesPerLine);
+    }
+  }
+
+  free(line);
+  cupsRasterClose(ras);
+  close(fd);
+
+  return (0);
+}